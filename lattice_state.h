@@ -0,0 +1,141 @@
+// Reader for the layout state LatticeWM publishes in shared memory.
+//
+// The window manager keeps a fixed-layout copy of its state (focused window, tiled leaves
+// with their rectangles and titles) in the named file mapping LATTICE_STATE_MAPPING_NAME.
+// Bars, overlays and monitoring tools can include this header and read that copy directly
+// instead of asking the window manager over the command pipe on every refresh.
+//
+// Updates go through a sequence lock. The writer makes the sequence odd, writes the state and
+// makes it even again; it never waits for readers. A reader copies the state out and keeps the
+// copy only if the sequence was even and unchanged around it, so a read that overlapped an
+// update is detected and retried instead of returning a mix of two layouts.
+//
+//     LatticeStateReader reader;
+//     LatticeState* state = new LatticeState;
+//     if (reader.Open() && reader.Read(*state)) { ... }
+#pragma once
+
+#include <windows.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#define LATTICE_STATE_MAPPING_NAME "Local\\LatticeWMState"
+
+const uint32_t LATTICE_STATE_MAGIC = 0x534D574C; // "LWMS"
+const uint32_t LATTICE_STATE_VERSION = 1;        // Bumped whenever the layout below changes
+const uint32_t LATTICE_STATE_MAX_LEAVES = 256;
+const uint32_t LATTICE_STATE_TITLE_BYTES = 96;
+
+// Flags of a published leaf
+const uint32_t LATTICE_LEAF_FOCUSED = 1;
+const uint32_t LATTICE_LEAF_FULLSCREEN = 2;
+const uint32_t LATTICE_LEAF_PLACEHOLDER = 4; // Saved-layout slot still waiting for its window
+
+// Values of LatticeState::mode
+const uint32_t LATTICE_MODE_DEFAULT = 0;
+const uint32_t LATTICE_MODE_RESIZE = 1;
+
+// Structure describing one tiled leaf, in layout order
+struct LatticeStateLeaf {
+    uint64_t hwnd;
+    int32_t left;
+    int32_t top;
+    int32_t right;
+    int32_t bottom;
+    uint32_t flags;
+    uint32_t reserved;
+    char title[LATTICE_STATE_TITLE_BYTES]; // UTF-8, cut at a character boundary, always terminated
+};
+
+// Structure holding one published version of the state
+struct LatticeState {
+    uint64_t generation;  // Increases with every update
+    uint32_t workspace;   // Always 1 for now; LatticeWM manages a single workspace
+    uint32_t mode;
+    uint64_t focusedHwnd; // Zero when no managed window has focus
+    uint32_t leafCount;   // Leaves filled in below
+    uint32_t totalLeaves; // Leaves in the layout; more than leafCount if the list was cut short
+    LatticeStateLeaf leaves[LATTICE_STATE_MAX_LEAVES];
+};
+
+// Structure of the whole shared region
+struct LatticeStateRegion {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    std::atomic<uint32_t> sequence; // Odd while an update is being written
+    LatticeState state;
+};
+
+static_assert(sizeof(LatticeStateLeaf) == 128, "LatticeStateLeaf is part of the shared layout");
+static_assert(offsetof(LatticeStateRegion, state) == 16, "LatticeStateRegion is part of the shared layout");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "The sequence must be usable across processes");
+
+// Function to copy a consistent version of the state out of a region. Only the filled-in
+// leaves are copied. A reader that finds an update under way yields, since the writer may
+// have been preempted in the middle of it. Returns false if every attempt overlapped an
+// update. The number of attempts that had to be thrown away is added to *retries when given.
+inline bool LatticeReadState(const LatticeStateRegion* region, LatticeState& out,
+                             int maxAttempts = 64, size_t* retries = nullptr) {
+    for (int attempt = 0; attempt < maxAttempts; ++attempt) {
+        uint32_t before = region->sequence.load(std::memory_order_acquire);
+        if ((before & 1) == 0) {
+            std::memcpy(&out, &region->state, offsetof(LatticeState, leaves));
+            uint32_t count = out.leafCount < LATTICE_STATE_MAX_LEAVES ? out.leafCount : LATTICE_STATE_MAX_LEAVES;
+            std::memcpy(out.leaves, region->state.leaves, count * sizeof(LatticeStateLeaf));
+
+            // The copy must be complete before the sequence is checked again
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (region->sequence.load(std::memory_order_relaxed) == before) {
+                out.leafCount = count;
+                return true;
+            }
+        }
+        if (retries) ++*retries;
+        std::this_thread::yield();
+    }
+    return false;
+}
+
+// Read-only view of the region published by a running window manager
+struct LatticeStateReader {
+    HANDLE mapping = nullptr;
+    const LatticeStateRegion* region = nullptr;
+
+    LatticeStateReader() = default;
+    LatticeStateReader(const LatticeStateReader&) = delete;
+    LatticeStateReader& operator=(const LatticeStateReader&) = delete;
+    ~LatticeStateReader() { Close(); }
+
+    // Function to map the region. Fails if LatticeWM is not running or publishes an
+    // incompatible layout.
+    bool Open() {
+        Close();
+        mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, LATTICE_STATE_MAPPING_NAME);
+        if (!mapping) return false;
+
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(LatticeStateRegion));
+        region = static_cast<const LatticeStateRegion*>(view);
+        if (!region || region->magic != LATTICE_STATE_MAGIC || region->version != LATTICE_STATE_VERSION ||
+            region->size != sizeof(LatticeStateRegion)) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close() {
+        if (region) UnmapViewOfFile(region);
+        if (mapping) CloseHandle(mapping);
+        region = nullptr;
+        mapping = nullptr;
+    }
+
+    // Function to copy the current state out; see LatticeReadState
+    bool Read(LatticeState& out, size_t* retries = nullptr) const {
+        return region && LatticeReadState(region, out, 64, retries);
+    }
+};
@@ -1,3 +1,4 @@
+#include <winsock2.h>
 #include <windows.h>
 #include <vector>
 #include <iostream>
@@ -5,11 +6,39 @@
 #include <functional>
 #include <algorithm>
 #include <queue>
-#include <mutex>
+#include <deque>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
 #include <shellscalingapi.h>
 #include <winuser.h>
+#include <sddl.h>
 #pragma comment(lib, "Shcore.lib")
+#pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Advapi32.lib")
+#include "lattice_state.h"
+
+// SSE2 is used for the window switcher's title search where the target guarantees it
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LATTICE_SSE2 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
 
 // Define MOD key (can be changed to MOD_CONTROL, MOD_WIN, etc.)
 const UINT MOD_KEY = MOD_ALT;
@@ -25,6 +54,24 @@ HWND g_hOverlay = NULL;
 COLORREF g_BorderColor = RGB(0, 255, 0);
 int g_BorderThickness = 5;
 
+// Windows whose title contains one of these float instead of being tiled
+const char* const FLOATING_TITLE_RULES[] = { "Save As", "Open File", "Picture-in-Picture", "Properties" };
+
+// Gaps in pixels between tiled windows (inner) and along the screen edges (outer), as in
+// i3-gaps. Can be set on the command line with --gaps <inner> <outer>.
+int g_InnerGap = 0;
+int g_OuterGap = 0;
+
+// Height in pixels of the built-in status bar, reserved at the top of the screen when the bar
+// is enabled with --bar "<status command>"
+const int BAR_HEIGHT = 24;
+bool g_BarEnabled = false;
+
+// When set, every call through the window-system boundary (the Ws* functions below) is
+// answered from the simulated window set instead of Win32. Used by the benchmark suite and
+// by trace replay so layout code can run against synthetic window handles.
+bool g_StubWindowSystem = false;
+
 // Forward declarations
 LRESULT CALLBACK OverlayWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
 
@@ -36,6 +83,15 @@ enum class SplitType {
     HORIZONTAL  // Split into rows (top/bottom)
 };
 
+// Split ratios are fixed-point fractions of RATIO_SCALE. Resize steps are whole units, so a
+// step followed by the opposite step always restores the exact ratio, and the 20%/80%
+// limits lie on the step grid from an even split.
+const int RATIO_SCALE = 10000;
+const int RATIO_HALF = RATIO_SCALE / 2;
+const int RATIO_STEP = RATIO_SCALE / 50;    // One resize-mode key press (2%)
+const int RATIO_MIN = RATIO_SCALE / 5;      // 20%
+const int RATIO_MAX = RATIO_SCALE * 4 / 5;  // 80%
+
 // Enumeration for navigation directions
 enum class Direction {
     UP,
@@ -44,21 +100,150 @@ enum class Direction {
     RIGHT
 };
 
-// Structure to hold window information for fullscreen toggling
+// Structure to hold the state kept for a managed window. Layout leaves refer to it by HWND;
+// whether a window is fullscreen is g_FullscreenLeaf's to say.
 struct WindowInfo {
     HWND hwnd;
-    RECT savedRect;            // Saved original position and size for fullscreen toggle
-    LONG savedStyle;           // Saved original style for fullscreen toggle
-    bool isFullscreen = false; // Track fullscreen state
+    RECT savedRect;                // Position and size before the window was managed, restored when it floats
+    LONG savedStyle;               // Style before the window was managed, restored when it floats
+    RECT fullscreenSavedRect = {}; // Position and size before the window went fullscreen
+    LONG fullscreenSavedStyle = 0; // Style before the window went fullscreen
+};
+
+// Upper bound used for sizes that have no maximum
+const int UNBOUNDED_SIZE = 1 << 28;
+
+// Size limits of a window (or a subtree) along one axis. A window with an increment only
+// accepts sizes of the form base + k * increment, like a terminal with fixed cell sizes.
+struct AxisConstraint {
+    int minSize = 0;
+    int maxSize = UNBOUNDED_SIZE;
+    int increment = 1;
+    int base = 0;
+    int snappedFrom = 0;     // Last size the window snapped down from, before the increment is known
+    int snappedTo = 0;       // ... and the size it snapped to
+};
+
+// Structure holding the size limits of a window or subtree
+struct SizeConstraints {
+    AxisConstraint width;
+    AxisConstraint height;
+};
+
+// Immutable copy of a layout node, published for readers on other threads. Unchanged
+// subtrees are shared between consecutive snapshot versions.
+struct SnapshotNode {
+    bool isSplit;
+    SplitType splitType;
+    int splitRatio;
+    HWND hwnd;
+    RECT windowRect;
+    bool isFullscreen;
+    size_t leafCount; // Number of windows in this subtree
+    std::shared_ptr<const SnapshotNode> firstChild;
+    std::shared_ptr<const SnapshotNode> secondChild;
+};
+
+// Registry of objects reached through generation-checked handles. Values live in a dense
+// array, so iterating them is a plain array walk; each handle names a stable slot that records
+// where its value is and how many times the slot was reused. A handle resolves only while its
+// slot still has the generation it was issued with, so one kept past an erase fails to resolve,
+// in O(1), instead of dangling. Pointers returned by Resolve are only good until the next
+// Insert or Erase.
+template <typename T>
+struct SlotMap {
+    struct Handle {
+        uint32_t index = 0; // Slot 0 is never used, so a default handle is null
+        uint32_t generation = 0;
+
+        explicit operator bool() const { return index != 0; }
+        bool operator==(const Handle& other) const { return index == other.index && generation == other.generation; }
+        bool operator!=(const Handle& other) const { return !(*this == other); }
+    };
+
+    struct Slot {
+        uint32_t generation = 0;
+        uint32_t dense = 0;    // Position of the value while the slot is in use
+        uint32_t nextFree = 0; // Next slot in the free list while it is not
+    };
+
+    std::vector<Slot> slots = std::vector<Slot>(1);
+    std::vector<T> values;
+    std::vector<uint32_t> denseToSlot;
+    uint32_t freeHead = 0;
+
+    Handle Insert(T value) {
+        uint32_t index = freeHead;
+        if (index != 0) {
+            freeHead = slots[index].nextFree;
+        } else {
+            index = static_cast<uint32_t>(slots.size());
+            slots.emplace_back();
+        }
+        slots[index].dense = static_cast<uint32_t>(values.size());
+        values.push_back(std::move(value));
+        denseToSlot.push_back(index);
+        return Handle{ index, slots[index].generation };
+    }
+
+    T* Resolve(Handle handle) {
+        if (handle.index == 0 || handle.index >= slots.size()) return nullptr;
+        const Slot& slot = slots[handle.index];
+        return slot.generation == handle.generation ? &values[slot.dense] : nullptr;
+    }
+
+    bool Erase(Handle handle) {
+        if (!Resolve(handle)) return false;
+        Slot& slot = slots[handle.index];
+
+        // Move the last value into the hole so the values stay dense
+        uint32_t last = static_cast<uint32_t>(values.size() - 1);
+        if (slot.dense != last) {
+            values[slot.dense] = std::move(values[last]);
+            denseToSlot[slot.dense] = denseToSlot[last];
+            slots[denseToSlot[slot.dense]].dense = slot.dense;
+        }
+        values.pop_back();
+        denseToSlot.pop_back();
+
+        ++slot.generation; // Every outstanding handle to the slot is now stale
+        slot.nextFree = freeHead;
+        freeHead = handle.index;
+        return true;
+    }
+
+    void Clear() {
+        while (!values.empty()) Erase(Handle{ denseToSlot.back(), slots[denseToSlot.back()].generation });
+    }
+
+    size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+    typename std::vector<T>::iterator begin() { return values.begin(); }
+    typename std::vector<T>::iterator end() { return values.end(); }
 };
 
+// Every live layout node, so global state can refer to nodes by handle. A node registers
+// itself on construction and is erased on destruction, which makes handles to it stale.
+struct LayoutNode;
+using NodeHandle = SlotMap<LayoutNode*>::Handle;
+SlotMap<LayoutNode*> g_NodeRegistry;
+
+// Function to get the node a handle refers to, or nullptr if it was destroyed
+LayoutNode* ResolveNode(NodeHandle handle) {
+    LayoutNode** node = g_NodeRegistry.Resolve(handle);
+    return node ? *node : nullptr;
+}
+
+// Depth recorded for a subtree without a leaf that holds a window
+const int NO_WINDOW_LEAF = 1 << 30;
+
 // Structure to represent each node in the layout tree
 struct LayoutNode {
     bool isSplit; // Indicates whether this node is a split or a leaf (window)
 
     // Split details (valid only if isSplit is true)
     SplitType splitType;
-    float splitRatio; // e.g., 0.5 for equal split
+    int splitRatio; // Fraction of RATIO_SCALE, e.g. RATIO_HALF for an equal split
 
     // Child nodes (valid only if isSplit is true)
     std::unique_ptr<LayoutNode> firstChild;
@@ -67,26 +252,55 @@ struct LayoutNode {
     // Parent node pointer (useful for traversal)
     LayoutNode* parent;
 
-    // Window information (valid only if isSplit is false)
-    WindowInfo windowInfo;
+    // Window held by a leaf (nullptr for splits and placeholders); its state is in managedWindows
+    HWND hwnd;
 
     // Rectangle representing window position and size
     RECT windowRect;
 
+    // Size limits of this subtree (for a leaf, those of its window), refreshed by ApplyLayout
+    SizeConstraints subtreeConstraints;
+
+    // Focus history of a split: whether the second child held focus more recently than the first
+    bool focusSecond;
+
+    // Leaves below this node, and how far below it the shallowest leaf holding a window is
+    // (NO_WINDOW_LEAF if none does), so layout policies find where a window goes without
+    // walking the tree. A change only marks the counts above it stale, up to the first node
+    // already marked; GetLeafCount and GetWindowLeafDepth recompute them when they are read.
+    // A stale node's ancestors are always stale too.
+    mutable int leafCount;
+    mutable int windowLeafDepth;
+    mutable bool countsStale;
+
+    // Snapshot of this subtree as last published; reset whenever the subtree changes
+    std::shared_ptr<const SnapshotNode> snapshot;
+
+    // This node's entry in g_NodeRegistry
+    NodeHandle handle;
+
     // Constructors
     // For leaf nodes
     LayoutNode(HWND window)
-        : isSplit(false), splitType(SplitType::VERTICAL), splitRatio(0.5f),
+        : isSplit(false), splitType(SplitType::VERTICAL), splitRatio(RATIO_HALF),
           firstChild(nullptr), secondChild(nullptr), parent(nullptr),
-          windowInfo{ window, RECT{}, 0, false }, windowRect{ 0,0,0,0 } {}
+          hwnd(window), windowRect{ 0,0,0,0 }, focusSecond(false),
+          leafCount(1), windowLeafDepth(window ? 0 : NO_WINDOW_LEAF), countsStale(false),
+          handle(g_NodeRegistry.Insert(this)) {}
 
     // For split nodes
-    LayoutNode(SplitType type, float ratio,
+    LayoutNode(SplitType type, int ratio,
         std::unique_ptr<LayoutNode> first,
         std::unique_ptr<LayoutNode> second)
         : isSplit(true), splitType(type), splitRatio(ratio),
           firstChild(std::move(first)), secondChild(std::move(second)),
-          parent(nullptr), windowInfo{ nullptr, RECT{}, 0, false }, windowRect{ 0,0,0,0 } {}
+          parent(nullptr), hwnd(nullptr), windowRect{ 0,0,0,0 }, focusSecond(false),
+          leafCount(firstChild->leafCount + secondChild->leafCount),
+          windowLeafDepth((std::min)(NO_WINDOW_LEAF, 1 + (std::min)(firstChild->windowLeafDepth, secondChild->windowLeafDepth))),
+          countsStale(firstChild->countsStale || secondChild->countsStale),
+          handle(g_NodeRegistry.Insert(this)) {}
+
+    ~LayoutNode() { g_NodeRegistry.Erase(handle); }
 };
 
 // Structure to hold queue items with node and its depth
@@ -98,1148 +312,9029 @@ struct QueueItem {
 // Global root of the layout tree
 std::unique_ptr<LayoutNode> root;
 
-// Vector to store all managed windows
-std::vector<WindowInfo> managedWindows;
-
-// Mutex for thread safety
-std::mutex layoutMutex;
-
-// Hotkey and resize mode variables
-bool isResizeMode = false;
-LayoutNode* activeNodeForResize = nullptr;
-HHOOK hKeyboardHook = NULL;
+// Registry of managed windows, one record per window, found by HWND or by handle in O(1).
+// Iterating it visits every managed window; once windows have closed the order is arbitrary.
+using WindowHandle = SlotMap<WindowInfo>::Handle;
+struct WindowRegistry {
+    SlotMap<WindowInfo> records;
+    std::unordered_map<HWND, WindowHandle> byHwnd;
+
+    WindowHandle Insert(const WindowInfo& info) {
+        auto existing = byHwnd.find(info.hwnd);
+        if (existing != byHwnd.end()) {
+            *records.Resolve(existing->second) = info;
+            return existing->second;
+        }
+        WindowHandle handle = records.Insert(info);
+        byHwnd.emplace(info.hwnd, handle);
+        return handle;
+    }
 
-// Queue to manage pending splits awaiting window assignments
-std::queue<LayoutNode*> pendingSplits;
+    WindowHandle Find(HWND hwnd) const {
+        auto it = byHwnd.find(hwnd);
+        return it == byHwnd.end() ? WindowHandle() : it->second;
+    }
 
-// Function Prototypes
-bool MoveWindowNormalized(HWND hwnd, int x, int y, int width, int height);
-BOOL CALLBACK EnumWindowsCallback(HWND hwnd, LPARAM lParam);
-void InitializeLayout(HWND firstWindow);
-void AddWindowBreadthFirst(HWND newWindow, float splitRatio = 0.5f);
-void ApplyLayout(LayoutNode* node, RECT area);
-void TileWindows(const RECT& screenRect);
-void SetWindowFullscreen(LayoutNode* node, const RECT& monitorRect);
-LayoutNode* FindLayoutNode(LayoutNode* node, HWND hwnd);
-void CollectLeafNodes(LayoutNode* node, std::vector<LayoutNode*>& leaves);
-bool SwapWindowHandles(LayoutNode* nodeA, LayoutNode* nodeB);
-void FocusWindow(LayoutNode* node);
-bool RegisterHotKeys();
-void UnregisterHotKeys();
-LayoutNode* FindAdjacent(LayoutNode* current, Direction dir);
-void Navigate(Direction dir);
-bool MoveWindowInDirection(Direction dir);
-bool AddNewSplit(LayoutNode* currentNode, Direction dir);
-SplitType GetSplitTypeFromDirection(Direction dir);
-void AdjustSplitRatio(LayoutNode* node, float deltaRatio);
-LRESULT CALLBACK LowLevelKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam);
-void PrintLayout(LayoutNode* node, int depth = 0);
-void ChangeSplitOrientation(SplitType newSplitType);
-void CALLBACK WinEventProc(
-    HWINEVENTHOOK hWinEventHook,
-    DWORD event,
-    HWND hwnd,
-    LONG idObject,
-    LONG idChild,
-    DWORD dwEventThread,
-    DWORD dwmsEventTime
-);
+    WindowInfo* Resolve(WindowHandle handle) { return records.Resolve(handle); }
+    WindowInfo* Get(HWND hwnd) { return Resolve(Find(hwnd)); }
 
-// Helper function to retrieve window title
-std::string GetWindowTitle(HWND hwnd) {
-    // First, try ANSI version
-    char titleA[512];
-    int lengthA = GetWindowTextA(hwnd, titleA, sizeof(titleA));
-    if (lengthA > 0) {
-        return std::string(titleA);
+    bool Erase(HWND hwnd) {
+        auto it = byHwnd.find(hwnd);
+        if (it == byHwnd.end()) return false;
+        records.Erase(it->second);
+        byHwnd.erase(it);
+        return true;
     }
 
-    // If ANSI fails, try Unicode
-    wchar_t titleW[512];
-    int lengthW = GetWindowTextW(hwnd, titleW, sizeof(titleW)/sizeof(wchar_t));
-    if (lengthW > 0) {
-        // Convert wchar_t to std::string (UTF-8)
-        int size_needed = WideCharToMultiByte(CP_UTF8, 0, titleW, lengthW, NULL, 0, NULL, NULL);
-        std::string title(size_needed, 0);
-        WideCharToMultiByte(CP_UTF8, 0, titleW, lengthW, &title[0], size_needed, NULL, NULL);
-        return title;
+    void Clear() {
+        records.Clear();
+        byHwnd.clear();
     }
 
-    return ""; // No title found
-}
+    size_t size() const { return records.size(); }
+    bool empty() const { return records.empty(); }
+    std::vector<WindowInfo>::iterator begin() { return records.begin(); }
+    std::vector<WindowInfo>::iterator end() { return records.end(); }
+};
 
-// Function to normalize and move windows for more consistent tiling behavior
-bool MoveWindowNormalized(HWND hwnd, int x, int y, int width, int height) {
-    if (!hwnd) return false;
+// All managed windows, tiled and floating
+WindowRegistry managedWindows;
 
-    // Validate the window handle
-    if (!IsWindow(hwnd)) {
-        std::cerr << "MoveWindowNormalized: Invalid HWND.\n";
-        return false;
+// Compact membership set of managed window handles (open addressing, linear probing).
+// The WinEvent pre-filter consults it for every event on the desktop, so lookups touch a
+// single flat array and never allocate; only Insert can grow the table.
+struct HwndSet {
+    std::vector<uint64_t> slots = std::vector<uint64_t>(64, 0); // 0 marks an empty slot
+    size_t count = 0;
+
+    size_t SlotFor(uint64_t key) const {
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & (slots.size() - 1);
     }
 
-    // Retrieve original style
-    LONG originalStyle = GetWindowLong(hwnd, GWL_STYLE);
-    if (originalStyle == 0 && GetLastError() != 0) {
-        std::cerr << "MoveWindowNormalized: Failed to get window style for HWND=0x" 
-                  << std::hex << hwnd << std::dec << ". Error: " << GetLastError() << "\n";
+    bool Contains(HWND hwnd) const {
+        uint64_t key = reinterpret_cast<uintptr_t>(hwnd);
+        if (key == 0) return false;
+        for (size_t i = SlotFor(key); slots[i] != 0; i = (i + 1) & (slots.size() - 1)) {
+            if (slots[i] == key) return true;
+        }
         return false;
     }
 
-    // Ensure window is restored (not minimized or maximized)
-    ShowWindow(hwnd, SW_RESTORE);
+    void Insert(HWND hwnd) {
+        uint64_t key = reinterpret_cast<uintptr_t>(hwnd);
+        if (key == 0 || Contains(hwnd)) return;
 
-    // Remove WS_CAPTION and WS_THICKFRAME to make the window borderless
-    LONG newStyle = originalStyle & ~(WS_CAPTION | WS_THICKFRAME);
-    if (!SetWindowLong(hwnd, GWL_STYLE, newStyle)) {
-        std::cerr << "MoveWindowNormalized: Failed to set window style for HWND=0x" 
-                  << std::hex << hwnd << std::dec << ". Error: " << GetLastError() << "\n";
-        return false;
+        // Keep the load factor at or below one half so probe runs stay short
+        if ((count + 1) * 2 > slots.size()) {
+            std::vector<uint64_t> old(slots.size() * 2, 0);
+            old.swap(slots);
+            for (uint64_t existing : old) {
+                if (existing != 0) Place(existing);
+            }
+        }
+        Place(key);
+        ++count;
     }
 
-    // Apply the style change
-    if (!SetWindowPos(hwnd, nullptr, 0, 0, 0, 0, 
-        SWP_FRAMECHANGED | SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER)) {
-        std::cerr << "MoveWindowNormalized: Failed to update window style for HWND=0x" 
-                  << std::hex << hwnd << std::dec << ". Error: " << GetLastError() << "\n";
-        return false;
+    void Erase(HWND hwnd) {
+        uint64_t key = reinterpret_cast<uintptr_t>(hwnd);
+        if (key == 0) return;
+        const size_t mask = slots.size() - 1;
+        size_t i = SlotFor(key);
+        while (slots[i] != key) {
+            if (slots[i] == 0) return;
+            i = (i + 1) & mask;
+        }
+
+        // Backward-shift the rest of the probe run so no tombstones are needed
+        for (size_t j = (i + 1) & mask; slots[j] != 0; j = (j + 1) & mask) {
+            size_t home = SlotFor(slots[j]);
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i] = 0;
+        --count;
     }
 
-    // Move the window to the specified position and size
-    BOOL success = SetWindowPos(hwnd, HWND_TOP, x, y, width, height, 
-        SWP_NOZORDER | SWP_SHOWWINDOW);
-    if (!success) {
-        std::cerr << "MoveWindowNormalized: Failed to move HWND=0x" 
-                  << std::hex << hwnd << std::dec << ". Error: " << GetLastError() << "\n";
+    void Clear() {
+        std::fill(slots.begin(), slots.end(), 0);
+        count = 0;
     }
 
-    return success != FALSE;
-}
+private:
+    void Place(uint64_t key) {
+        size_t i = SlotFor(key);
+        while (slots[i] != 0) i = (i + 1) & (slots.size() - 1);
+        slots[i] = key;
+    }
+};
 
+// Handles currently in managedWindows, kept in step with it
+HwndSet g_ManagedWindowSet;
 
-// Callback to collect visible windows that will be managed
-BOOL CALLBACK EnumWindowsCallback(HWND hwnd, LPARAM lParam) {
-    auto windows = reinterpret_cast<std::vector<WindowInfo>*>(lParam);
+// Structure for a window in the floating layer. Floating windows are managed but never part
+// of the layout tree, so they keep their own geometry and relayout never touches them.
+struct FloatingWindow {
+    HWND hwnd;
+    RECT rect; // Geometry when it entered the layer
+};
 
-    if (!IsWindowVisible(hwnd)) return TRUE;                   // Skip invisible windows
-    if (GetWindowTextLengthA(hwnd) == 0) return TRUE;          // Skip untitled windows
-    LONG exStyle = GetWindowLong(hwnd, GWL_EXSTYLE);
+// Floating layer in z-order, bottom to top. Always stacked above the tiled windows.
+std::vector<FloatingWindow> g_FloatingWindows;
+
+// WinEvent pre-filter counters over the whole run, for --replay. The metrics export the same
+// counts as WINEVENTS_RECEIVED and WINEVENTS_FILTERED.
+uint64_t g_WinEventsAccepted = 0;
+uint64_t g_WinEventsRejected = 0;
+
+// Runtime metrics, exported in Prometheus text format. Counters are kept per thread: a thread
+// claims a shard the first time it counts and is then its only writer, so an update is a
+// relaxed load and store, with no lock, no read-modify-write and no allocation. A scrape adds
+// the shards up. Gauges are set by the thread that owns what they measure.
+enum class Metric : int {
+    WINEVENTS_RECEIVED,
+    WINEVENTS_FILTERED,
+    LAYOUT_MESSAGES_POSTED,
+    LAYOUT_MESSAGES_HANDLED,
+    HOTKEYS,
+    COMMANDS,
+    RETILES,
+    WINDOW_MOVES,
+    OS_CALLS,
+    GEOMETRY_TIMEOUTS,
+    GROUPS_REBALANCED,
+    BACKGROUND_SLICES_CUT,
+    COUNT
+};
 
-    if (exStyle & WS_EX_TOOLWINDOW) return TRUE;               // Skip tool windows
-    LONG style = GetWindowLong(hwnd, GWL_STYLE);
-    if ((style & WS_POPUP) || (style & WS_CHILD)) return TRUE; // Skip popups or child windows
+enum class Gauge : int {
+    MANAGED_WINDOWS,
+    FLOATING_WINDOWS,
+    UNDO_JOURNAL_OPS,
+    RETIRED_SNAPSHOTS,
+    QUARANTINED_WINDOWS,
+    COUNT
+};
 
-    RECT rect;
-    if (!GetWindowRect(hwnd, &rect)) {
-        std::cerr << "EnumWindowsCallback: Failed to retrieve RECT for HWND 0x" 
-                  << std::hex << hwnd << std::dec << ". Error: " << GetLastError() << "\n";
-        return TRUE;
-    }
+// Structure naming a metric for the exposition format
+struct MetricInfo {
+    const char* name;
+    const char* help;
+};
 
-    if (rect.left == rect.right || rect.top == rect.bottom) return TRUE; // Skip windows with no area
+const MetricInfo METRIC_INFO[] = {
+    { "lattice_winevents_received_total", "WinEvents delivered by the hooks." },
+    { "lattice_winevents_filtered_total", "WinEvents dropped by the pre-filter." },
+    { "lattice_layout_messages_posted_total", "Messages posted to the layout thread." },
+    { "lattice_layout_messages_handled_total", "Posted messages the layout thread has handled." },
+    { "lattice_hotkeys_total", "Hotkeys handled." },
+    { "lattice_commands_total", "Commands received through the command pipe or the switcher." },
+    { "lattice_retiles_total", "Relayouts of the tiled windows." },
+    { "lattice_window_moves_total", "Windows moved or resized." },
+    { "lattice_os_calls_total", "Window-system calls made by the layout code." },
+    { "lattice_geometry_timeouts_total", "Geometry commits that ran past the timeout." },
+    { "lattice_groups_rebalanced_total", "Runs of same-orientation splits rebuilt to limit their depth." },
+    { "lattice_background_slices_cut_total", "Slices of background layout work ended early for user input." },
+};
 
-    // Retrieve window title
-    std::string title = GetWindowTitle(hwnd);
-    if (title.empty()) return TRUE; // Skip windows without titles
+const MetricInfo GAUGE_INFO[] = {
+    { "lattice_managed_windows", "Windows being managed, tiled or floating." },
+    { "lattice_floating_windows", "Windows in the floating layer." },
+    { "lattice_undo_journal_ops", "Layout changes that can be undone." },
+    { "lattice_retired_snapshots", "Replaced layout snapshots waiting for readers to finish." },
+    { "lattice_quarantined_windows", "Windows skipped by geometry commits until they answer again." },
+};
 
-    // Initialize WindowInfo and add to managedWindows
-    WindowInfo winInfo;
-    winInfo.hwnd = hwnd;
-    winInfo.savedRect = rect; // Initially set to current rect
-    winInfo.savedStyle = style;
-    windows->push_back(winInfo);
+static_assert(sizeof(METRIC_INFO) / sizeof(METRIC_INFO[0]) == static_cast<size_t>(Metric::COUNT), "Every metric needs a name");
+static_assert(sizeof(GAUGE_INFO) / sizeof(GAUGE_INFO[0]) == static_cast<size_t>(Gauge::COUNT), "Every gauge needs a name");
 
-    // Debug: Print added window with title
-    std::cout << "EnumWindowsCallback: Managed window added: HWND=0x" 
-              << std::hex << hwnd << std::dec << ", Title=\"" << title << "\"\n";
+struct alignas(64) MetricShard {
+    std::atomic<uint64_t> values[static_cast<int>(Metric::COUNT)];
+    std::atomic<bool> inUse{ false };
+};
 
-    return TRUE;
-}
+const int MAX_METRIC_SHARDS = 32;
+MetricShard g_MetricShards[MAX_METRIC_SHARDS];
+MetricShard g_SharedMetricShard; // For threads that found every shard taken; updated atomically
+std::atomic<int64_t> g_MetricGauges[static_cast<int>(Gauge::COUNT)];
 
-// Function to initialize the layout with the first window
-void InitializeLayout(HWND firstWindow) {
-    root = std::make_unique<LayoutNode>(firstWindow);
+// Shard owned by the current thread. It is handed back when the thread exits and keeps its
+// counts, so the next thread to claim it carries on from them.
+struct MetricShardRegistration {
+    MetricShard* shard = nullptr;
+
+    ~MetricShardRegistration() {
+        if (shard && shard != &g_SharedMetricShard) shard->inUse.store(false, std::memory_order_release);
+    }
+
+    MetricShard* Acquire() {
+        for (MetricShard& candidate : g_MetricShards) {
+            bool expected = false;
+            if (candidate.inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                return shard = &candidate;
+            }
+        }
+        return shard = &g_SharedMetricShard;
+    }
+};
+thread_local MetricShardRegistration t_MetricShard;
+
+// Function to add to a counter. Safe to call from any thread.
+inline void CountMetric(Metric metric, uint64_t amount = 1) {
+    MetricShard* shard = t_MetricShard.shard ? t_MetricShard.shard : t_MetricShard.Acquire();
+    std::atomic<uint64_t>& value = shard->values[static_cast<int>(metric)];
+    if (shard == &g_SharedMetricShard) {
+        value.fetch_add(amount, std::memory_order_relaxed);
+    }
+    else {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
 }
 
-// Function to add a new window using breadth-first split strategy with depth tracking
-void AddWindowBreadthFirst(HWND newWindow, float splitRatio) {
-    if (!root) {
-        // If root is not initialized, initialize with the new window
-        root = std::make_unique<LayoutNode>(newWindow);
-        return;
+// Function to read a counter's total across all threads
+uint64_t ReadMetric(Metric metric) {
+    int index = static_cast<int>(metric);
+    uint64_t total = g_SharedMetricShard.values[index].load(std::memory_order_relaxed);
+    for (const MetricShard& shard : g_MetricShards) {
+        total += shard.values[index].load(std::memory_order_relaxed);
     }
+    return total;
+}
 
-    // Use a queue to perform breadth-first traversal with depth tracking
-    std::queue<QueueItem> nodeQueue;
-    nodeQueue.push(QueueItem{ root.get(), 0 }); // Root node at depth 0
+void SetGauge(Gauge gauge, int64_t value) {
+    g_MetricGauges[static_cast<int>(gauge)].store(value, std::memory_order_relaxed);
+}
 
-    while (!nodeQueue.empty()) {
-        QueueItem currentItem = nodeQueue.front();
-        nodeQueue.pop();
+// Messages handled by the layout thread. The thread that runs the message loop in main is
+// the sole owner of the layout tree: hotkeys, WinEvent hooks, the resize-mode keyboard hook
+// and any other input source post one of these (or WM_HOTKEY) instead of touching the tree,
+// so layout code never needs a lock.
+enum LayoutMessage : UINT {
+    WM_LAYOUT_WINEVENT = WM_APP + 1, // wParam: event, lParam: HWND
+    WM_LAYOUT_RESIZE_KEY,            // wParam: virtual-key code, lParam: shift pressed
+    WM_LAYOUT_HOTKEY,                // wParam: hotkey ID, for sources other than RegisterHotKey
+    WM_LAYOUT_STATUS,                // lParam: new std::vector<StatusBlock>, owned by the receiver
+    WM_LAYOUT_COMMAND,               // lParam: new std::string, wParam: new std::promise<std::string> for
+                                     // the reply or 0, both owned by the receiver
+    WM_LAYOUT_GEOMETRY               // Geometry commits finished; see DrainGeometryResults
+};
 
-        LayoutNode* current = currentItem.node;
-        int depth = currentItem.depth;
+// Thread ID of the layout thread, the target of PostLayoutMessage
+DWORD g_LayoutThreadId = 0;
+
+// Priority lanes of the layout thread. Everything waiting in the thread's queue is sorted into
+// a lane before any of it is handled. User input (hotkeys, resize-mode keys, commands and
+// foreground changes) always goes first; background reconciliation (window appearing and
+// closing, geometry results, status updates) runs in bounded slices, and the queue is checked
+// for input between its messages. Each lane keeps arrival order.
+struct LayoutLanes {
+    std::deque<MSG> input;
+    std::deque<MSG> background;
+};
+LayoutLanes g_LayoutLanes;
 
-        if (!current->isSplit) {
-            // Split this leaf node
-            current->isSplit = true;
+// Bounds of one slice of background messages
+const size_t BACKGROUND_SLICE_MESSAGES = 32;
+const long long BACKGROUND_SLICE_US = 4000;
 
-            // Determine split type based on depth
-            SplitType splitType = (depth % 2 == 0) ? SplitType::HORIZONTAL : SplitType::VERTICAL;
-            current->splitType = splitType;
-            current->splitRatio = splitRatio;
+// Hotkey and resize mode variables. The resized leaf is held by handle, so a window closing
+// while in resize mode leaves a stale handle rather than a dangling pointer.
+bool isResizeMode = false;
+NodeHandle activeNodeForResize;
+HHOOK hKeyboardHook = NULL;
 
-            // Create child nodes
-            current->firstChild = std::make_unique<LayoutNode>(current->windowInfo.hwnd);
-            current->firstChild->parent = current;
-            current->secondChild = std::make_unique<LayoutNode>(newWindow);
-            current->secondChild->parent = current;
+// Focus model, kept up to date from EVENT_SYSTEM_FOREGROUND and from our own focus changes so
+// commands start from a handle instead of looking up the foreground window in the tree.
+// Focus on an unmanaged window leaves the managed focus where it was, as in i3.
+HWND g_ForegroundWindow = nullptr;   // Latest foreground window, managed or not
+HWND g_FocusedWindow = nullptr;      // Latest focused managed window, tiled or floating
+NodeHandle g_FocusedLeaf;            // Latest focused tiled leaf
+
+// The fullscreen leaf of the layout tree, if any. The tree covers one screen, so one slot is
+// enough. While it resolves, tiled changes only mark the layout as pending; the covered
+// windows are laid out once when fullscreen ends. Destroying the leaf ends fullscreen.
+NodeHandle g_FullscreenLeaf;
+bool g_TilingDeferred = false;
+size_t g_DeferredRetileCount = 0;
+
+// Structure describing one window of the simulated window set
+struct SimulatedWindow {
+    std::string title;
+    LONG style = 0;
+    LONG exStyle = 0;
+    RECT rect = { 0, 0, 0, 0 };
+    bool visible = true;
+    HWND owner = nullptr;
+    std::string className;
+    std::string processName;
+    DWORD processId = 0;
+    SizeConstraints limits; // Sizes the simulated application accepts
+    int stallMs = 0;        // How long the application takes to answer a sent message
+};
 
-            // Clear the window handle in the split node
-            current->windowInfo.hwnd = nullptr;
+// Simulated window set used while g_StubWindowSystem is set. Geometry workers reach it from
+// their own threads, so while the pool runs every access takes g_SimulatedWindowsMutex.
+std::unordered_map<HWND, SimulatedWindow> g_SimulatedWindows;
+std::mutex g_SimulatedWindowsMutex;
+std::atomic<bool> g_GeometryPoolRunning{ false }; // Set while geometry workers are running
+HWND g_SimulatedForeground = nullptr;
+RECT g_SimulatedScreen = { 0, 0, 3840, 2160 };
+
+// Counters for layout work, reported by trace replay
+size_t g_RetileCount = 0;
+size_t g_WindowMoveCount = 0;
+size_t g_RefusedMoveCount = 0; // Moves where the window did not take the requested size
+std::atomic<size_t> g_WindowSystemCalls{ 0 }; // Calls made through the Ws* boundary below
+
+// Size limits learned from how each managed window responded to earlier moves. Keyed by
+// window rather than leaf so they follow a window when it is swapped or moved.
+std::unordered_map<HWND, SizeConstraints> g_WindowSizeConstraints;
+
+// Set when a move taught us new limits, so the layout is worth solving again
+bool g_SizeConstraintsChanged = false;
+
+// What has last been applied to a tiled window, so MoveWindowNormalized only makes the calls
+// that change something. Created by the first move; after that the Ws* setters keep it in
+// step with every change we make, and the WinEvents for changes the user makes drop it.
+struct AppliedWindowState {
+    LONG style = 0;            // Last style written, valid once hasStyle is set
+    bool hasStyle = false;
+    bool frameStale = false;   // Style written but the frame not yet recalculated
+    bool restored = false;     // SW_RESTORE issued and not undone since
+    bool placed = false;
+    RECT rect = { 0, 0, 0, 0 }; // Last position and size requested, valid once placed is set
+};
+std::unordered_map<HWND, AppliedWindowState> g_AppliedWindowState;
+
+// Cached properties of a window. Strings point into the intern pool below. Reading them
+// never sends a message to the window's process; they are refreshed from the WinEvents that
+// report changes (NAMECHANGE for the title, SHOW for everything) and by our own style writes.
+struct WindowProperties {
+    const std::string* title = nullptr;
+    const std::string* className = nullptr;
+    const std::string* processName = nullptr;
+    DWORD processId = 0;
+    LONG style = 0;
+    LONG exStyle = 0;
+};
 
-            // Enqueue child nodes with incremented depth
-            nodeQueue.push(QueueItem{ current->firstChild.get(), depth + 1 });
-            nodeQueue.push(QueueItem{ current->secondChild.get(), depth + 1 });
+// Parts of WindowProperties that can be refreshed separately
+enum WindowPropertyFields : unsigned {
+    PROPERTY_TITLE = 1,
+    PROPERTY_STYLES = 2,
+    PROPERTY_IDENTITY = 4, // Class and process, which never change for a window
+    PROPERTY_ALL = PROPERTY_TITLE | PROPERTY_STYLES | PROPERTY_IDENTITY
+};
 
-            return; // Window added successfully
-        }
-        else {
-            // If it's a split node, enqueue its children with incremented depth
-            if (current->firstChild) {
-                nodeQueue.push(QueueItem{ current->firstChild.get(), depth + 1 });
-            }
-            if (current->secondChild) {
-                nodeQueue.push(QueueItem{ current->secondChild.get(), depth + 1 });
-            }
-        }
-    }
-}
+std::unordered_map<HWND, WindowProperties> g_WindowPropertyCache;
 
-// Function to determine the split type based on direction
-SplitType GetSplitTypeFromDirection(Direction dir) {
-    switch (dir) {
-        case Direction::LEFT:
-        case Direction::RIGHT:
-            return SplitType::VERTICAL;
-        case Direction::UP:
-        case Direction::DOWN:
-            return SplitType::HORIZONTAL;
-        default:
-            return SplitType::VERTICAL; // Default fallback
-    }
-}
+// Interned UTF-8 strings used by the cache, with the number of cache fields using each.
+// Many windows share a class or process name, and a string is freed with its last user.
+std::unordered_map<std::string, size_t> g_InternedStrings;
 
-// Function to apply the layout by traversing the tree
-void ApplyLayout(LayoutNode* node, RECT area) {
+// Number of times properties were read from a window rather than from the cache
+size_t g_WindowPropertyFetches = 0;
+
+// Published layout snapshots. The layout thread publishes an immutable version of the tree
+// after each committed change; other threads (status bars, IPC, debug dumps) read it through
+// a LayoutSnapshotGuard without ever blocking the layout thread. Old versions are reclaimed
+// with epoch-based reclamation once no reader can still see them.
+struct LayoutSnapshot {
+    uint64_t version;
+    std::shared_ptr<const SnapshotNode> root;
+};
+
+// Per-reader epoch announcement. Zero means the reader is outside any snapshot.
+struct alignas(64) SnapshotReaderSlot {
+    std::atomic<uint64_t> epoch{ 0 };
+    std::atomic<bool> inUse{ false };
+};
+
+// Structure pairing a replaced snapshot with the epoch at which it was retired
+struct RetiredSnapshot {
+    LayoutSnapshot* snapshot;
+    uint64_t retireEpoch;
+};
+
+const int MAX_SNAPSHOT_READERS = 64;
+SnapshotReaderSlot g_SnapshotReaders[MAX_SNAPSHOT_READERS];
+std::atomic<LayoutSnapshot*> g_PublishedSnapshot{ nullptr };
+std::atomic<uint64_t> g_SnapshotEpoch{ 1 };
+
+// Layout-thread-only publishing state
+std::vector<RetiredSnapshot> g_RetiredSnapshots;
+bool g_LayoutSnapshotDirty = true;
+uint64_t g_LayoutVersion = 0;
+size_t g_SnapshotNodesBuilt = 0;
+
+// Function to record that a node changed, invalidating the cached snapshots of it and its
+// ancestors. Every mutation of the tree must call this so the next publish picks it up.
+void MarkLayoutChanged(LayoutNode* node) {
+    g_LayoutSnapshotDirty = true;
     if (!node) return;
 
-    if (!node->isSplit) {
-        // This is a leaf node; move the window to the specified area
-        if (node->windowInfo.hwnd != nullptr) {
-            if (MoveWindowNormalized(node->windowInfo.hwnd, area.left, area.top,
-                area.right - area.left, area.bottom - area.top)) {
-                node->windowRect = area; // Store the window's position
-            }
-        }
-        return;
+    // The node itself may be freshly inserted, but past it a node without a cached snapshot
+    // has no cached ancestors either
+    node->snapshot.reset();
+    node = node->parent;
+    while (node && node->snapshot) {
+        node->snapshot.reset();
+        node = node->parent;
     }
+}
 
-    // Calculate the split
-    if (node->splitType == SplitType::VERTICAL) {
-        int splitPos = area.left + static_cast<int>((area.right - area.left) * node->splitRatio);
-        RECT firstArea = { area.left, area.top, splitPos, area.bottom };
-        RECT secondArea = { splitPos, area.top, area.right, area.bottom };
-        ApplyLayout(node->firstChild.get(), firstArea);
-        ApplyLayout(node->secondChild.get(), secondArea);
+// Function to build the snapshot of a subtree, reusing the cached snapshots of unchanged nodes
+std::shared_ptr<const SnapshotNode> BuildSnapshotNode(LayoutNode* node) {
+    if (!node) return nullptr;
+    if (node->snapshot) return node->snapshot;
+
+    auto copy = std::make_shared<SnapshotNode>();
+    copy->isSplit = node->isSplit;
+    copy->splitType = node->splitType;
+    copy->splitRatio = node->splitRatio;
+    copy->hwnd = node->hwnd;
+    copy->windowRect = node->windowRect;
+    copy->isFullscreen = (node->handle == g_FullscreenLeaf);
+    if (node->isSplit) {
+        copy->firstChild = BuildSnapshotNode(node->firstChild.get());
+        copy->secondChild = BuildSnapshotNode(node->secondChild.get());
+        copy->leafCount = (copy->firstChild ? copy->firstChild->leafCount : 0) +
+                          (copy->secondChild ? copy->secondChild->leafCount : 0);
     }
-    else { // SplitType::HORIZONTAL
-        int splitPos = area.top + static_cast<int>((area.bottom - area.top) * node->splitRatio);
-        RECT firstArea = { area.left, area.top, area.right, splitPos };
-        RECT secondArea = { area.left, splitPos, area.right, area.bottom };
-        ApplyLayout(node->firstChild.get(), firstArea);
-        ApplyLayout(node->secondChild.get(), secondArea);
+    else {
+        copy->leafCount = node->hwnd ? 1 : 0;
     }
+
+    ++g_SnapshotNodesBuilt;
+    node->snapshot = copy;
+    return copy;
 }
 
-// Function to tile all windows based on the layout tree
-void TileWindows(const RECT& screenRect) {
-    if (root) {
-        ApplyLayout(root.get(), screenRect);
-        std::cout << "TileWindows: Windows tiled successfully.\n";
+// Function to free retired snapshots that no active reader can still be looking at
+void ReclaimRetiredSnapshots(bool force = false) {
+    uint64_t oldestActive = UINT64_MAX;
+    for (const SnapshotReaderSlot& slot : g_SnapshotReaders) {
+        uint64_t epoch = slot.epoch.load(std::memory_order_seq_cst);
+        if (epoch != 0) oldestActive = (std::min)(oldestActive, epoch);
     }
-    else {
-        std::cerr << "TileWindows: Layout root is null. No windows to tile.\n";
+
+    auto reclaimable = [&](const RetiredSnapshot& retired) {
+        return force || retired.retireEpoch <= oldestActive;
+    };
+    for (const RetiredSnapshot& retired : g_RetiredSnapshots) {
+        if (reclaimable(retired)) delete retired.snapshot;
     }
+    g_RetiredSnapshots.erase(std::remove_if(g_RetiredSnapshots.begin(), g_RetiredSnapshots.end(), reclaimable),
+                             g_RetiredSnapshots.end());
 }
 
-// Toggle Overlay Function
-void ToggleOverlayWindow(HWND overlayHwnd) {
-    if (overlayHwnd && IsWindow(overlayHwnd)) {
-        if (IsWindowVisible(overlayHwnd)) {
-            ShowWindow(overlayHwnd, SW_HIDE);
-            std::cout << "Overlay window hidden.\n";
-        } else {
-            ShowWindow(overlayHwnd, SW_SHOW);
-            std::cout << "Overlay window shown.\n";
-        }
-    } else {
-        std::cerr << "Invalid overlay window handle.\n";
+// Function to publish the current tree as a new snapshot version, if anything changed.
+// Runs on the layout thread after each committed change.
+void PublishLayoutSnapshot() {
+    if (!g_LayoutSnapshotDirty) return;
+    g_LayoutSnapshotDirty = false;
+
+    LayoutSnapshot* snapshot = new LayoutSnapshot{ ++g_LayoutVersion, BuildSnapshotNode(root.get()) };
+    LayoutSnapshot* previous = g_PublishedSnapshot.exchange(snapshot, std::memory_order_seq_cst);
+
+    // Readers announcing the new epoch are guaranteed to load the new snapshot, so the
+    // previous one only has to outlive readers announcing an older epoch
+    uint64_t retireEpoch = g_SnapshotEpoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    if (previous) {
+        g_RetiredSnapshots.push_back(RetiredSnapshot{ previous, retireEpoch });
     }
+    ReclaimRetiredSnapshots();
 }
 
-// Function to toggle fullscreen for a window
-void SetWindowFullscreen(LayoutNode* node, const RECT& monitorRect) {
-    if (!node || node->windowInfo.hwnd == nullptr) return;
+// Function to withdraw and free every snapshot. Only valid once no readers remain.
+void ClearLayoutSnapshots() {
+    LayoutSnapshot* previous = g_PublishedSnapshot.exchange(nullptr, std::memory_order_seq_cst);
+    if (previous) {
+        g_RetiredSnapshots.push_back(RetiredSnapshot{ previous, 0 });
+    }
+    ReclaimRetiredSnapshots(true);
+    g_LayoutSnapshotDirty = true;
+}
 
-    WindowInfo& windowInfo = node->windowInfo;
+// Reader slot owned by the current thread, released when the thread exits
+struct SnapshotReaderRegistration {
+    int slot = -1;
 
-    if (!windowInfo.isFullscreen) {
-        ToggleOverlayWindow(g_hOverlay);
-        // Save current window state
-        windowInfo.savedStyle = GetWindowLong(node->windowInfo.hwnd, GWL_STYLE);
-        if (!GetWindowRect(node->windowInfo.hwnd, &windowInfo.savedRect)) {
-            std::cerr << "SetWindowFullscreen: Failed to get window rect for HWND=0x" 
-                      << std::hex << node->windowInfo.hwnd << std::dec 
-                      << ". Error: " << GetLastError() << "\n";
-            return;
+    ~SnapshotReaderRegistration() {
+        if (slot >= 0) {
+            g_SnapshotReaders[slot].epoch.store(0, std::memory_order_release);
+            g_SnapshotReaders[slot].inUse.store(false, std::memory_order_release);
         }
+    }
 
-        // Remove borders, title bar, etc.
-        SetWindowLong(node->windowInfo.hwnd, GWL_STYLE, windowInfo.savedStyle & ~(WS_CAPTION | WS_THICKFRAME | WS_MINIMIZE | WS_MAXIMIZE | WS_SYSMENU));
-
-        // Resize and reposition to cover the entire screen
-        MoveWindowNormalized(node->windowInfo.hwnd,
-            monitorRect.left,
-            monitorRect.top,
-            monitorRect.right - monitorRect.left,
-            monitorRect.bottom - monitorRect.top);
+    bool Acquire() {
+        if (slot >= 0) return true;
+        for (int i = 0; i < MAX_SNAPSHOT_READERS; ++i) {
+            bool expected = false;
+            if (g_SnapshotReaders[i].inUse.compare_exchange_strong(expected, true)) {
+                slot = i;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+thread_local SnapshotReaderRegistration t_SnapshotReader;
+
+// RAII guard pinning the published snapshot for the current thread. Readers never block and
+// never take locks; the snapshot stays valid until the guard is destroyed. Guards must not be
+// nested on one thread. Get() returns nullptr if nothing is published yet or all reader slots
+// are taken.
+struct LayoutSnapshotGuard {
+    const LayoutSnapshot* snapshot = nullptr;
+    SnapshotReaderSlot* slot = nullptr;
+
+    LayoutSnapshotGuard() {
+        if (!t_SnapshotReader.Acquire()) return;
+        slot = &g_SnapshotReaders[t_SnapshotReader.slot];
+        slot->epoch.store(g_SnapshotEpoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        snapshot = g_PublishedSnapshot.load(std::memory_order_seq_cst);
     }
-    else {
-        ToggleOverlayWindow(g_hOverlay);
-        // Restore original window style
-        SetWindowLong(node->windowInfo.hwnd, GWL_STYLE, windowInfo.savedStyle);
-        SetWindowPos(node->windowInfo.hwnd, nullptr, 0, 0, 0, 0, SWP_FRAMECHANGED | SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER);
 
-        // Restore original window size and position
-        MoveWindowNormalized(node->windowInfo.hwnd,
-            windowInfo.savedRect.left,
-            windowInfo.savedRect.top,
-            windowInfo.savedRect.right - windowInfo.savedRect.left,
-            windowInfo.savedRect.bottom - windowInfo.savedRect.top);
+    ~LayoutSnapshotGuard() {
+        if (slot) slot->epoch.store(0, std::memory_order_release);
     }
 
-    // Toggle the fullscreen flag
-    windowInfo.isFullscreen = !windowInfo.isFullscreen;
+    LayoutSnapshotGuard(const LayoutSnapshotGuard&) = delete;
+    LayoutSnapshotGuard& operator=(const LayoutSnapshotGuard&) = delete;
 
-    // Force redraw
-    ShowWindow(node->windowInfo.hwnd, SW_SHOW);
-}
+    const LayoutSnapshot* Get() const { return snapshot; }
+};
 
-// Function to find a LayoutNode given an HWND
-LayoutNode* FindLayoutNode(LayoutNode* node, HWND hwnd) {
-    if (!node) return nullptr;
-    if (!node->isSplit && node->windowInfo.hwnd == hwnd) return node;
+// Function to print a snapshot subtree. Safe to call from any thread while holding a guard.
+void PrintLayoutSnapshot(std::ostream& out, const SnapshotNode* node, int depth = 0) {
+    if (!node) return;
+    for (int i = 0; i < depth; ++i) out << "  ";
     if (node->isSplit) {
-        LayoutNode* found = FindLayoutNode(node->firstChild.get(), hwnd);
-        if (found) return found;
-        return FindLayoutNode(node->secondChild.get(), hwnd);
+        out << "Split: " << (node->splitType == SplitType::VERTICAL ? "Vertical" : "Horizontal")
+            << ", Ratio: " << static_cast<double>(node->splitRatio) / RATIO_SCALE << "\n";
+        PrintLayoutSnapshot(out, node->firstChild.get(), depth + 1);
+        PrintLayoutSnapshot(out, node->secondChild.get(), depth + 1);
+    }
+    else {
+        out << "Window: HWND=0x" << std::hex << node->hwnd << std::dec
+            << ", Rect=(" << node->windowRect.left << "," << node->windowRect.top << ","
+            << node->windowRect.right << "," << node->windowRect.bottom << ")"
+            << (node->isFullscreen ? ", Fullscreen" : "") << "\n";
     }
-    return nullptr;
 }
 
-// Function to collect all leaf nodes
-void CollectLeafNodes(LayoutNode* node, std::vector<LayoutNode*>& leaves) {
-    if (!node) return;
-    if (!node->isSplit && node->windowInfo.hwnd != nullptr) {
-        leaves.push_back(node);
-        return;
+// Position of a node in the layout tree: the first/second child steps taken from the root,
+// packed one bit per level (1 = second child). The first 64 levels are stored inline.
+struct NodePath {
+    uint32_t depth = 0;
+    uint64_t inlineBits = 0;
+    std::vector<uint64_t> extraBits;
+
+    bool Step(uint32_t level) const {
+        uint64_t word = (level < 64) ? inlineBits : extraBits[level / 64 - 1];
+        return (word >> (level % 64)) & 1;
     }
-    if (node->isSplit) {
-        CollectLeafNodes(node->firstChild.get(), leaves);
-        CollectLeafNodes(node->secondChild.get(), leaves);
+
+    void Push(bool second) {
+        if (depth >= 64 && depth % 64 == 0) extraBits.push_back(0);
+        if (second) {
+            uint64_t& word = (depth < 64) ? inlineBits : extraBits[depth / 64 - 1];
+            word |= uint64_t(1) << (depth % 64);
+        }
+        ++depth;
     }
-}
 
-// Function to check if any window is in fullscreen mode
-bool IsAnyWindowFullscreen() {
-    if (!root) return false; // No layout initialized
+    size_t HeapBytes() const { return extraBits.capacity() * sizeof(uint64_t); }
+};
 
-    std::vector<LayoutNode*> leaves;
-    CollectLeafNodes(root.get(), leaves); // Collect all leaf nodes (windows)
+// Kinds of journaled tree mutations. SPLIT and REMOVAL are each other's inverse: undoing a
+// SPLIT collapses the split and leaves a REMOVAL behind for redo, and vice versa.
+enum class JournalDeltaType : uint8_t {
+    SPLIT,       // path: split holding the window's leaf; undo collapses it
+    REMOVAL,     // path: node that took the collapsed split's place; undo re-splits it
+    SWAP,        // path, otherPath: the two leaves whose windows were exchanged
+    ORIENTATION, // path: split node; splitType: orientation to restore
+    RATIO        // path: split node; ratio: ratio to restore
+};
 
-    for (const auto& node : leaves) {
-        if (node->windowInfo.isFullscreen) {
-            return true; // At least one window is in fullscreen
-        }
-    }
+// Structure holding one inverse delta. Applying it restores the previous state and turns it
+// into the delta that re-applies the change.
+struct JournalDelta {
+    JournalDeltaType type;
+    SplitType splitType = SplitType::VERTICAL;
+    bool windowIsFirst = false; // SPLIT/REMOVAL: the window's leaf is the first child
+    int ratio = RATIO_HALF;
+    HWND hwnd = nullptr;        // SPLIT/REMOVAL: window whose leaf is collapsed or re-created
+    NodePath path;
+    NodePath otherPath;
+
+    size_t HeapBytes() const { return path.HeapBytes() + otherPath.HeapBytes(); }
+};
 
-    return false; // No windows are in fullscreen
-}
+// Where a journaled operation came from
+enum class JournalOrigin {
+    LIFECYCLE,  // Windows appearing or disappearing; not undoable
+    USER,       // Hotkey commands
+    RESIZE      // Resize-mode keys; consecutive steps on one split coalesce
+};
 
-// Function to swap two window handles
-bool SwapWindowHandles(LayoutNode* nodeA, LayoutNode* nodeB) {
-    if (!nodeA || !nodeB) return false;
-    if (nodeA->windowInfo.hwnd == nullptr || nodeB->windowInfo.hwnd == nullptr) return false;
+// Structure grouping the deltas of one committed layout operation
+struct JournalOperation {
+    JournalOrigin origin;
+    std::vector<JournalDelta> deltas;
 
-    std::swap(nodeA->windowInfo.hwnd, nodeB->windowInfo.hwnd);
+    size_t MemoryBytes() const {
+        size_t bytes = sizeof(JournalOperation) + deltas.capacity() * sizeof(JournalDelta);
+        for (const JournalDelta& delta : deltas) bytes += delta.HeapBytes();
+        return bytes;
+    }
+};
 
-    std::cout << "SwapWindowHandles: Swapped window handles between HWND 0x" 
-              << std::hex << nodeA->windowInfo.hwnd << " and HWND 0x" 
-              << nodeB->windowInfo.hwnd << std::dec << ".\n";
+// Undo and redo stacks (back = most recent) plus the operation being recorded
+const size_t MAX_JOURNAL_OPERATIONS = 128;
+std::deque<JournalOperation> g_UndoJournal;
+std::deque<JournalOperation> g_RedoJournal;
+JournalOperation g_PendingJournalOp;
+bool g_JournalRecording = false;
+
+// Function to compute the path of a node from the root
+NodePath GetNodePath(LayoutNode* node) {
+    std::vector<bool> steps;
+    for (LayoutNode* current = node; current && current->parent; current = current->parent) {
+        steps.push_back(current->parent->secondChild.get() == current);
+    }
+    NodePath path;
+    for (auto it = steps.rbegin(); it != steps.rend(); ++it) {
+        path.Push(*it);
+    }
+    return path;
+}
 
-    // Reapply the layout to update window positions
-    HDC hdcScreen = GetDC(nullptr);
-    RECT screenRect;
-    screenRect.left = 0;
-    screenRect.top = 0;
-    screenRect.right = GetDeviceCaps(hdcScreen, HORZRES);
-    screenRect.bottom = GetDeviceCaps(hdcScreen, VERTRES);
-    ReleaseDC(nullptr, hdcScreen);
+// Function to find the node at a path, or nullptr if the tree has no such node
+LayoutNode* ResolveNodePath(const NodePath& path) {
+    LayoutNode* node = root.get();
+    for (uint32_t level = 0; node && level < path.depth; ++level) {
+        if (!node->isSplit) return nullptr;
+        node = path.Step(level) ? node->secondChild.get() : node->firstChild.get();
+    }
+    return node;
+}
 
-    TileWindows(screenRect);
+// Function to rewrite a stored path after a non-journaled structural change at changeAt.
+// A SPLIT there pushes the old content one level down on side movedSide; a REMOVAL pulls the
+// kept side (movedSide) up one level and deletes the other. Returns false if the path
+// pointed into deleted structure.
+bool RemapNodePath(NodePath& path, const NodePath& changeAt, JournalDeltaType change, bool movedSide) {
+    if (path.depth < changeAt.depth) return true;
+    for (uint32_t level = 0; level < changeAt.depth; ++level) {
+        if (path.Step(level) != changeAt.Step(level)) return true; // Not inside the change
+    }
 
+    NodePath remapped;
+    for (uint32_t level = 0; level < changeAt.depth; ++level) remapped.Push(path.Step(level));
+    uint32_t rest = changeAt.depth;
+    if (change == JournalDeltaType::SPLIT) {
+        remapped.Push(movedSide);
+    }
+    else {
+        // The collapsed split itself and everything on the removed side are gone
+        if (path.depth == changeAt.depth || path.Step(changeAt.depth) != movedSide) return false;
+        ++rest;
+    }
+    for (uint32_t level = rest; level < path.depth; ++level) remapped.Push(path.Step(level));
+    path = std::move(remapped);
     return true;
 }
 
-void CreateOverlayWindow(HWND targetHwnd) {
-    if (g_hOverlay != NULL) return; // Overlay already exists
-
-    // Register window class
-    const char CLASS_NAME[] = "OverlayWindowClass"; // Use narrow string
+// Function to keep stored history valid across a structural change that is not undoable.
+// Operations that refer to deleted structure are dropped together with everything older.
+void RemapJournal(std::deque<JournalOperation>& journal, const JournalDelta& change) {
+    // The surviving content sits opposite the window's leaf in both cases
+    bool movedSide = change.windowIsFirst;
+    for (size_t i = journal.size(); i-- > 0;) {
+        bool valid = true;
+        for (JournalDelta& delta : journal[i].deltas) {
+            valid &= RemapNodePath(delta.path, change.path, change.type, movedSide);
+            if (delta.type == JournalDeltaType::SWAP) {
+                valid &= RemapNodePath(delta.otherPath, change.path, change.type, movedSide);
+            }
+        }
+        if (!valid) {
+            journal.erase(journal.begin(), journal.begin() + i + 1);
+            return;
+        }
+    }
+}
 
-    WNDCLASSA wc = { }; // Use WNDCLASSA for ANSI
-    wc.lpfnWndProc   = OverlayWndProc;
-    wc.hInstance     = GetModuleHandle(NULL);
-    wc.lpszClassName = CLASS_NAME;
-    wc.hCursor       = LoadCursor(NULL, IDC_ARROW);
+// Function to check whether a tree mutation would be recorded or remap stored history. When
+// it would not, its delta is not built, as computing the path costs the depth of the tree.
+bool JournalNeedsDelta() {
+    return (g_JournalRecording && g_PendingJournalOp.origin != JournalOrigin::LIFECYCLE) ||
+           !g_UndoJournal.empty() || !g_RedoJournal.empty();
+}
 
-    if (!RegisterClassA(&wc)) { // Use RegisterClassA
-        std::cerr << "Failed to register window class.\n";
+// Function to record a tree mutation. Inside a user operation it becomes part of that
+// operation's inverse; otherwise stored history is remapped around it.
+void RecordJournalDelta(JournalDelta delta) {
+    if (g_JournalRecording && g_PendingJournalOp.origin != JournalOrigin::LIFECYCLE) {
+        g_PendingJournalOp.deltas.push_back(std::move(delta));
         return;
     }
+    if (delta.type == JournalDeltaType::SPLIT || delta.type == JournalDeltaType::REMOVAL) {
+        RemapJournal(g_UndoJournal, delta);
+        RemapJournal(g_RedoJournal, delta);
+    }
+}
 
-    // Get target window position and size
-    RECT rect;
-    GetWindowRect(targetHwnd, &rect);
+// Function to drop all undo and redo history
+void ClearJournal() {
+    g_UndoJournal.clear();
+    g_RedoJournal.clear();
+}
 
-    // Create the overlay window
-    g_hOverlay = CreateWindowExA( // Use CreateWindowExA
-        WS_EX_LAYERED | WS_EX_TRANSPARENT | WS_EX_TOPMOST,
-        CLASS_NAME,
-        NULL,
-        WS_POPUP,
-        rect.left, rect.top,
-        rect.right - rect.left, rect.bottom - rect.top,
-        NULL,
-        NULL,
-        GetModuleHandle(NULL),
-        NULL
-    );
+// Function to start recording the deltas of one layout operation
+void BeginJournalOperation(JournalOrigin origin) {
+    g_PendingJournalOp.origin = origin;
+    g_PendingJournalOp.deltas.clear();
+    g_JournalRecording = true;
+}
 
-    if (!g_hOverlay) {
-        std::cerr << "Failed to create overlay window.\n";
-        return;
+// Function to finish the current operation and push it onto the undo journal
+void CommitJournalOperation() {
+    g_JournalRecording = false;
+    if (g_PendingJournalOp.deltas.empty()) return;
+
+    JournalOperation op;
+    op.origin = g_PendingJournalOp.origin;
+    op.deltas.swap(g_PendingJournalOp.deltas);
+    op.deltas.shrink_to_fit();
+    g_RedoJournal.clear();
+
+    // A run of resize steps on the same split is undone as one operation, so keep only the
+    // oldest ratio
+    if (op.origin == JournalOrigin::RESIZE && !g_UndoJournal.empty()) {
+        const JournalOperation& last = g_UndoJournal.back();
+        if (last.origin == JournalOrigin::RESIZE && last.deltas.size() == 1 && op.deltas.size() == 1 &&
+            last.deltas[0].type == JournalDeltaType::RATIO && op.deltas[0].type == JournalDeltaType::RATIO &&
+            ResolveNodePath(last.deltas[0].path) == ResolveNodePath(op.deltas[0].path)) {
+            return;
+        }
     }
 
-    // Make the window transparent
-    // Make pure blue (RGB 0, 0, 255) transparent
-SetLayeredWindowAttributes(g_hOverlay, RGB(255, 255, 255), 0, LWA_COLORKEY);
+    g_UndoJournal.push_back(std::move(op));
+    if (g_UndoJournal.size() > MAX_JOURNAL_OPERATIONS) {
+        g_UndoJournal.pop_front();
+    }
+}
 
+// Function Prototypes
+bool MoveWindowNormalized(HWND hwnd, int x, int y, int width, int height);
+void DropPendingGeometry(HWND hwnd);
+BOOL CALLBACK EnumWindowsCallback(HWND hwnd, LPARAM lParam);
+void InitializeLayout(HWND firstWindow);
+void BuildInitialLayout(const RECT& screenRect);
+void PublishSharedState();
+void UpdateLayoutGauges();
+std::string FormatMetrics();
+void AddWindowBreadthFirst(HWND newWindow, int splitRatio = RATIO_HALF);
+void AddWindowToLayout(HWND newWindow, int splitRatio = RATIO_HALF);
+void ClearPlaceholders();
+bool SwallowIntoPlaceholder(HWND hwnd);
+void ApplyLayout(LayoutNode* node, RECT area);
+void TileWindows(const RECT& screenRect);
+void SetWindowFullscreen(LayoutNode* node, const RECT& monitorRect);
+LayoutNode* FindLayoutNode(LayoutNode* node, HWND hwnd);
+void CollectLeafNodes(LayoutNode* node, std::vector<LayoutNode*>& leaves);
+bool RemoveWindowFromLayout(HWND hwnd);
+bool SwapWindowHandles(LayoutNode* nodeA, LayoutNode* nodeB);
+void FocusWindow(LayoutNode* node);
+bool RegisterHotKeys();
+void UnregisterHotKeys();
+LayoutNode* FindAdjacent(LayoutNode* current, Direction dir);
+void Navigate(Direction dir);
+bool MoveWindowInDirection(Direction dir);
+bool MoveLeafInContainers(LayoutNode* currentNode, Direction dir);
+bool SwapWithAdjacent(LayoutNode* currentNode, Direction dir);
+bool AddNewSplit(LayoutNode* currentNode, Direction dir);
+SplitType GetSplitTypeFromDirection(Direction dir);
+const char* GetDirectionName(Direction dir);
+void AdjustSplitRatio(LayoutNode* node, int deltaRatio);
+LRESULT CALLBACK LowLevelKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam);
+void PrintLayout(LayoutNode* node, int depth = 0);
+void ChangeSplitOrientation(SplitType newSplitType);
+void CALLBACK WinEventProc(
+    HWINEVENTHOOK hWinEventHook,
+    DWORD event,
+    HWND hwnd,
+    LONG idObject,
+    LONG idChild,
+    DWORD dwEventThread,
+    DWORD dwmsEventTime
+);
+void HandleWindowEvent(DWORD event, HWND hwnd);
+void HandleHotkey(WPARAM hotkeyId);
+void HandleResizeKey(DWORD vkCode, bool isShiftPressed);
+bool PostLayoutMessage(UINT message, WPARAM wParam, LPARAM lParam);
+bool DispatchLayoutMessage(const MSG& msg, bool publish = true);
+
+// Window-system boundary. Layout and event-handling code calls these instead of Win32
+// directly, so the same paths can run against the simulated window set.
+inline void CountWindowSystemCall() {
+    ++g_WindowSystemCalls;
+    CountMetric(Metric::OS_CALLS);
+}
 
-    ShowWindow(g_hOverlay, SW_SHOW);
+// Function to lock the simulated window set, if geometry workers may be reaching it too
+std::unique_lock<std::mutex> LockSimulatedWindows() {
+    if (!g_GeometryPoolRunning.load(std::memory_order_relaxed)) return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(g_SimulatedWindowsMutex);
 }
 
-void UpdateOverlayWindow(HWND targetHwnd) {
-    if (g_hOverlay == NULL) return;
+// Function to make the caller wait as long as a simulated application takes to answer
+void StallSimulatedWindow(HWND hwnd) {
+    int stallMs = 0;
+    {
+        auto lock = LockSimulatedWindows();
+        auto it = g_SimulatedWindows.find(hwnd);
+        if (it != g_SimulatedWindows.end()) stallMs = it->second.stallMs;
+    }
+    if (stallMs > 0) std::this_thread::sleep_for(std::chrono::milliseconds(stallMs));
+}
 
-    // Get target window position and size
-    RECT rect;
-    GetWindowRect(targetHwnd, &rect);
+bool WsIsWindow(HWND hwnd) {
+    CountWindowSystemCall();
+    if (g_StubWindowSystem) {
+        auto lock = LockSimulatedWindows();
+        return g_SimulatedWindows.count(hwnd) != 0;
+    }
+    return IsWindow(hwnd) != FALSE;
+}
 
-    // Move and resize the overlay window to match the target window
-    SetWindowPos(g_hOverlay, HWND_TOPMOST, rect.left, rect.top, 
-                 rect.right - rect.left, rect.bottom - rect.top, SWP_NOACTIVATE);
+bool WsIsWindowVisible(HWND hwnd) {
+    CountWindowSystemCall();
+    if (g_StubWindowSystem) {
+        auto lock = LockSimulatedWindows();
+        auto it = g_SimulatedWindows.find(hwnd);
+        return it != g_SimulatedWindows.end() && it->second.visible;
+    }
+    return IsWindowVisible(hwnd) != FALSE;
 }
 
-void DestroyOverlayWindow() {
-    if (g_hOverlay != NULL) {
-        DestroyWindow(g_hOverlay);
-        g_hOverlay = NULL;
+LONG WsGetWindowLong(HWND hwnd, int index) {
+    CountWindowSystemCall();
+    if (g_StubWindowSystem) {
+        auto lock = LockSimulatedWindows();
+        auto it = g_SimulatedWindows.find(hwnd);
+        if (it == g_SimulatedWindows.end()) return 0;
+        return index == GWL_EXSTYLE ? it->second.exStyle : it->second.style;
     }
+    return GetWindowLong(hwnd, index);
 }
 
-LRESULT CALLBACK OverlayWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
-    switch (msg) {
-    case WM_PAINT: {
-        PAINTSTRUCT ps;
-        HDC hdc = BeginPaint(hwnd, &ps);
+bool WsGetWindowRect(HWND hwnd, RECT* rect) {
+    CountWindowSystemCall();
+    if (g_StubWindowSystem) {
+        auto lock = LockSimulatedWindows();
+        auto it = g_SimulatedWindows.find(hwnd);
+        if (it == g_SimulatedWindows.end()) return false;
+        *rect = it->second.rect;
+        return true;
+    }
+    return GetWindowRect(hwnd, rect) != FALSE;
+}
 
-        // Create a pen for the border
-        HPEN hPen = CreatePen(PS_SOLID, g_BorderThickness, g_BorderColor);
-        HPEN hOldPen = (HPEN)SelectObject(hdc, hPen);
+// Function to bring a size within an axis's limits, snapping down onto its increment grid
+// without going below the minimum
+int FitSizeToConstraint(int size, const AxisConstraint& limit) {
+    size = (std::max)(limit.minSize, (std::min)(size, limit.maxSize));
+    if (size == limit.snappedFrom) {
+        return limit.snappedTo; // The window already showed what it makes of this size
+    }
+    if (limit.increment > 1) {
+        int offset = (size - limit.base) % limit.increment;
+        if (offset < 0) offset += limit.increment;
+        if (size - offset >= limit.minSize) size -= offset;
+    }
+    return size;
+}
 
-        // Get client area
-        RECT rect;
-        GetClientRect(hwnd, &rect);
+// The Raw* setters make the call and nothing else. Each of them sends the window a message
+// and waits for its application to answer, so they are the calls a hung window blocks. They
+// touch no layout state, which lets geometry workers make them from their own threads; the
+// Ws* setters below add the bookkeeping the layout thread keeps.
+LONG RawSetWindowLong(HWND hwnd, int index, LONG value) {
+    if (g_StubWindowSystem) {
+        StallSimulatedWindow(hwnd);
+        auto lock = LockSimulatedWindows();
+        auto it = g_SimulatedWindows.find(hwnd);
+        if (it == g_SimulatedWindows.end()) return 0;
+        LONG& field = (index == GWL_EXSTYLE) ? it->second.exStyle : it->second.style;
+        LONG previous = field;
+        field = value;
+        // Mirror Win32, where a zero return is only an error if the previous value was non-zero
+        return previous ? previous : 1;
+    }
+    return SetWindowLong(hwnd, index, value);
+}
 
-        // Draw the border
-        for (int i = 0; i < g_BorderThickness; ++i) {
-            Rectangle(hdc, rect.left + i, rect.top + i, rect.right - i, rect.bottom - i);
+bool RawSetWindowPos(HWND hwnd, HWND insertAfter, int x, int y, int width, int height, UINT flags) {
+    if (g_StubWindowSystem) {
+        StallSimulatedWindow(hwnd);
+        auto lock = LockSimulatedWindows();
+        auto it = g_SimulatedWindows.find(hwnd);
+        if (it == g_SimulatedWindows.end()) return false;
+        RECT& rect = it->second.rect;
+        if (!(flags & SWP_NOMOVE)) {
+            rect.right += x - rect.left;
+            rect.bottom += y - rect.top;
+            rect.left = x;
+            rect.top = y;
         }
-
-        // Cleanup
-        SelectObject(hdc, hOldPen);
-        DeleteObject(hPen);
-        EndPaint(hwnd, &ps);
-        return 0;
-    }
-    case WM_DESTROY:
-        PostQuitMessage(0);
-        return 0;
+        if (!(flags & SWP_NOSIZE)) {
+            // The simulated application adjusts the size the way a real one would
+            rect.right = rect.left + FitSizeToConstraint(width, it->second.limits.width);
+            rect.bottom = rect.top + FitSizeToConstraint(height, it->second.limits.height);
+        }
+        if (flags & SWP_SHOWWINDOW) it->second.visible = true;
+        return true;
     }
-    return DefWindowProc(hwnd, msg, wParam, lParam);
+    return SetWindowPos(hwnd, insertAfter, x, y, width, height, flags) != FALSE;
 }
 
-void FocusWindow(LayoutNode* node) {
-    if (!node || node->windowInfo.hwnd == nullptr) return;
-
-    HWND hwnd = node->windowInfo.hwnd;
+bool RawShowWindow(HWND hwnd, int command) {
+    if (g_StubWindowSystem) {
+        StallSimulatedWindow(hwnd);
+        auto lock = LockSimulatedWindows();
+        auto it = g_SimulatedWindows.find(hwnd);
+        if (it == g_SimulatedWindows.end()) return false;
+        bool wasVisible = it->second.visible;
+        it->second.visible = (command != SW_HIDE);
+        return wasVisible;
+    }
+    return ShowWindow(hwnd, command) != FALSE;
+}
 
-    std::string title = GetWindowTitle(hwnd);
-    std::cout << "FocusWindow: Focusing window: " << title << " (HWND=0x" 
-              << std::hex << reinterpret_cast<uintptr_t>(hwnd) << std::dec << ")\n";
+// Function to check whether a window's application answers messages within a timeout
+bool RawProbeWindow(HWND hwnd, int timeoutMs) {
+    if (g_StubWindowSystem) {
+        int stallMs = -1;
+        {
+            auto lock = LockSimulatedWindows();
+            auto it = g_SimulatedWindows.find(hwnd);
+            if (it != g_SimulatedWindows.end()) stallMs = it->second.stallMs;
+        }
+        if (stallMs < 0) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds((std::min)(stallMs, timeoutMs)));
+        return stallMs <= timeoutMs;
+    }
+    DWORD_PTR result = 0;
+    return SendMessageTimeoutA(hwnd, WM_NULL, 0, 0, SMTO_ABORTIFHUNG | SMTO_BLOCK,
+                               static_cast<UINT>(timeoutMs), &result) != 0;
+}
 
-    ShowWindow(hwnd, SW_RESTORE);
-    SetWindowPos(hwnd, HWND_TOP, 0, 0, 0, 0, 
-                SWP_NOMOVE | SWP_NOSIZE | SWP_SHOWWINDOW);
-    SetForegroundWindow(hwnd);
+// Function to keep the property cache in step with our own style changes
+void UpdateCachedStyle(HWND hwnd, int index, LONG value) {
+    auto cached = g_WindowPropertyCache.find(hwnd);
+    if (cached != g_WindowPropertyCache.end()) {
+        (index == GWL_EXSTYLE ? cached->second.exStyle : cached->second.style) = value;
+    }
+}
 
-    // Create and update the overlay window
-    CreateOverlayWindow(hwnd);
-    UpdateOverlayWindow(hwnd);
+LONG WsSetWindowLong(HWND hwnd, int index, LONG value) {
+    CountWindowSystemCall();
+    UpdateCachedStyle(hwnd, index, value);
+    if (index == GWL_STYLE) DropPendingGeometry(hwnd);
 
-    // Optionally, handle window move/resize events to update the overlay
-    // This requires additional implementation, such as setting up a hook or a timer
+    auto applied = g_AppliedWindowState.find(hwnd);
+    if (applied != g_AppliedWindowState.end() && index == GWL_STYLE) {
+        applied->second.style = value;
+        applied->second.hasStyle = true;
+        applied->second.frameStale = true;
+    }
+    return RawSetWindowLong(hwnd, index, value);
 }
 
-// Function to register hotkeys
-bool RegisterHotKeys() {
-    bool success = true;
+bool WsSetWindowPos(HWND hwnd, HWND insertAfter, int x, int y, int width, int height, UINT flags) {
+    CountWindowSystemCall();
+    if ((flags & (SWP_NOMOVE | SWP_NOSIZE)) != (SWP_NOMOVE | SWP_NOSIZE)) DropPendingGeometry(hwnd);
 
-    // Lambda that attempts hotkey registration and reports failures
-    auto register_hotkey = [&](int id, UINT modifiers, UINT vk, const char* description) -> bool {
-        if (!RegisterHotKey(nullptr, id, modifiers, vk)) {
-            std::cerr << "RegisterHotKeys: Failed to register hotkey ID " << id 
-                      << " (" << description << "). Error: " << GetLastError() << "\n";
-            return false;
+    auto applied = g_AppliedWindowState.find(hwnd);
+    if (applied != g_AppliedWindowState.end()) {
+        if (flags & SWP_FRAMECHANGED) applied->second.frameStale = false;
+        if (!(flags & (SWP_NOMOVE | SWP_NOSIZE))) {
+            applied->second.placed = true;
+            applied->second.rect = RECT{ x, y, x + width, y + height };
         }
-        return true;
-    };
+        else if ((flags & (SWP_NOMOVE | SWP_NOSIZE)) != (SWP_NOMOVE | SWP_NOSIZE)) {
+            applied->second.placed = false; // Only half of the rectangle is known now
+        }
+    }
+    return RawSetWindowPos(hwnd, insertAfter, x, y, width, height, flags);
+}
 
-    // Register navigation and focus hotkeys
-    success &= register_hotkey(1, MOD_KEY, VK_LEFT, "Focus Left");
-    success &= register_hotkey(2, MOD_KEY, VK_RIGHT, "Focus Right");
-    success &= register_hotkey(6, MOD_KEY, VK_UP, "Focus Up");
-    success &= register_hotkey(7, MOD_KEY, VK_DOWN, "Focus Down");
+bool WsShowWindow(HWND hwnd, int command) {
+    CountWindowSystemCall();
 
-    // Register move hotkeys
-    success &= register_hotkey(11, MOD_KEY | MOD_SHIFT, VK_UP, "Move Up");
-    success &= register_hotkey(12, MOD_KEY | MOD_SHIFT, VK_DOWN, "Move Down");
-    success &= register_hotkey(13, MOD_KEY | MOD_SHIFT, VK_LEFT, "Move Left");
-    success &= register_hotkey(14, MOD_KEY | MOD_SHIFT, VK_RIGHT, "Move Right");
+    // SW_SHOW leaves a minimized or maximized window as it is; anything else but SW_RESTORE
+    // may leave it in a state the next move has to undo
+    auto applied = g_AppliedWindowState.find(hwnd);
+    if (applied != g_AppliedWindowState.end() && command != SW_SHOW) {
+        applied->second.restored = (command == SW_RESTORE);
+    }
+    return RawShowWindow(hwnd, command);
+}
 
-    // Register Close Current Window hotkey
-    success &= register_hotkey(15, MOD_KEY | MOD_SHIFT, 'Q', "Close Current Window");
+HWND WsGetWindowOwner(HWND hwnd) {
+    CountWindowSystemCall();
+    if (g_StubWindowSystem) {
+        auto lock = LockSimulatedWindows();
+        auto it = g_SimulatedWindows.find(hwnd);
+        return it != g_SimulatedWindows.end() ? it->second.owner : nullptr;
+    }
+    return GetWindow(hwnd, GW_OWNER);
+}
 
-    // Register fullscreen toggle hotkey
-    success &= register_hotkey(3, MOD_KEY, 'F', "Toggle Fullscreen");
+HWND WsGetForegroundWindow() {
+    CountWindowSystemCall();
+    if (g_StubWindowSystem) {
+        auto lock = LockSimulatedWindows();
+        return g_SimulatedForeground;
+    }
+    return GetForegroundWindow();
+}
 
-    // Register resize mode toggle hotkey
-    success &= register_hotkey(10, MOD_KEY, 'R', "Toggle Resize Mode");
+// Function to make a window the foreground window. Activating it waits for its application,
+// so it is a Raw* call like the setters above.
+bool RawSetForegroundWindow(HWND hwnd) {
+    if (g_StubWindowSystem) {
+        StallSimulatedWindow(hwnd);
+        auto lock = LockSimulatedWindows();
+        g_SimulatedForeground = hwnd;
+        return true;
+    }
+    return SetForegroundWindow(hwnd) != FALSE;
+}
 
-    // **Register Split Orientation Toggle Hotkeys**
-    success &= register_hotkey(16, MOD_KEY, 'V', "Toggle to Vertical Split");
-    success &= register_hotkey(17, MOD_KEY, 'H', "Toggle to Horizontal Split");
+bool WsSetForegroundWindow(HWND hwnd) {
+    CountWindowSystemCall();
+    return RawSetForegroundWindow(hwnd);
+}
 
-    // **Register hotkey to open new terminal
-    success &= register_hotkey(18, MOD_KEY, VK_RETURN, "Open New Terminal Window");
+// Function to learn one axis's limits from the size a window took when asked for another
+bool LearnAxisConstraint(AxisConstraint& limit, int requested, int actual) {
+    AxisConstraint before = limit;
 
-    return success;
+    if (actual > requested) {
+        // Refused to shrink: the size it kept is its minimum
+        limit.minSize = (std::max)(limit.minSize, actual);
+    }
+    else if (actual < requested && requested - actual <= 32) {
+        // A small shortfall is a snap onto a size grid. Two different snapped sizes give the
+        // increment as the gcd of their differences.
+        if (limit.snappedTo != 0 && limit.snappedTo != actual) {
+            int step = (std::abs)(actual - limit.snappedTo);
+            int increment = (limit.increment > 1) ? limit.increment : step;
+            while (step != 0) {
+                int rest = increment % step;
+                increment = step;
+                step = rest;
+            }
+            if (increment > 1) {
+                limit.increment = increment;
+                limit.base = actual % increment;
+            }
+        }
+        limit.snappedFrom = requested;
+        limit.snappedTo = actual;
+    }
+    else if (actual < requested) {
+        // Refused to grow: the size it kept is its maximum
+        limit.maxSize = (std::min)(limit.maxSize, (std::max)(actual, limit.minSize));
+    }
+    else if (limit.increment > 1 && (actual - limit.base) % limit.increment != 0) {
+        // Took a size off the inferred grid, so the grid was wrong
+        limit.increment = 1;
+        limit.base = 0;
+    }
+
+    return before.minSize != limit.minSize || before.maxSize != limit.maxSize ||
+           before.increment != limit.increment || before.base != limit.base ||
+           before.snappedFrom != limit.snappedFrom;
 }
 
-// Function to unregister all hotkeys
-void UnregisterHotKeys() {
-    for (int id = 1; id <= 18; ++id) {
-        UnregisterHotKey(nullptr, id);
+// Function to record the limits implied by a window taking a different size than requested
+void LearnSizeConstraints(HWND hwnd, int requestedWidth, int requestedHeight, const RECT& actual) {
+    int actualWidth = actual.right - actual.left;
+    int actualHeight = actual.bottom - actual.top;
+    if (actualWidth == requestedWidth && actualHeight == requestedHeight) {
+        // Only a window with an inferred grid has anything to re-check
+        auto it = g_WindowSizeConstraints.find(hwnd);
+        if (it == g_WindowSizeConstraints.end()) return;
+        bool changed = LearnAxisConstraint(it->second.width, requestedWidth, actualWidth);
+        changed |= LearnAxisConstraint(it->second.height, requestedHeight, actualHeight);
+        g_SizeConstraintsChanged |= changed;
+        return;
+    }
+
+    ++g_RefusedMoveCount;
+    SizeConstraints& limits = g_WindowSizeConstraints[hwnd];
+    bool changed = LearnAxisConstraint(limits.width, requestedWidth, actualWidth);
+    changed |= LearnAxisConstraint(limits.height, requestedHeight, actualHeight);
+    if (changed) {
+        g_SizeConstraintsChanged = true;
+        std::cout << "LearnSizeConstraints: HWND=0x" << std::hex << hwnd << std::dec
+                  << " width " << limits.width.minSize << ".." << limits.width.maxSize
+                  << " step " << limits.width.increment
+                  << ", height " << limits.height.minSize << ".." << limits.height.maxSize
+                  << " step " << limits.height.increment << "\n";
     }
-    std::cout << "UnregisterHotKeys: All hotkeys unregistered.\n";
+}
+
+// Function to compare two rectangles
+bool EqualRects(const RECT& a, const RECT& b) {
+    return a.left == b.left && a.top == b.top && a.right == b.right && a.bottom == b.bottom;
+}
+
+// Function to get the rectangle of the primary screen
+RECT GetScreenRect() {
+    if (g_StubWindowSystem) return g_SimulatedScreen;
+
+    HDC hdcScreen = GetDC(nullptr);
+    RECT screenRect;
+    screenRect.left = 0;
+    screenRect.top = 0;
+    screenRect.right = GetDeviceCaps(hdcScreen, HORZRES);
+    screenRect.bottom = GetDeviceCaps(hdcScreen, VERTRES);
+    ReleaseDC(nullptr, hdcScreen);
+    return screenRect;
+}
+
+// Function to get the rectangle of the monitor a window is on
+bool GetWindowMonitorRect(HWND hwnd, RECT* monitorRect) {
+    if (g_StubWindowSystem) {
+        *monitorRect = g_SimulatedScreen;
+        return true;
+    }
+
+    HMONITOR hMonitor = MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST);
+    MONITORINFO monitorInfo = { sizeof(monitorInfo) };
+    if (!GetMonitorInfo(hMonitor, &monitorInfo)) {
+        return false;
+    }
+    *monitorRect = monitorInfo.rcMonitor;
+    return true;
+}
+
+// Function to convert UTF-16 text from Win32 to UTF-8
+std::string WideToUtf8(const wchar_t* text, int length) {
+    if (length <= 0) return std::string();
+    int sizeNeeded = WideCharToMultiByte(CP_UTF8, 0, text, length, NULL, 0, NULL, NULL);
+    std::string result(sizeNeeded, 0);
+    WideCharToMultiByte(CP_UTF8, 0, text, length, &result[0], sizeNeeded, NULL, NULL);
+    return result;
+}
+
+// Function to read a window's title from the window itself. InternalGetWindowText reads the
+// text stored with the window instead of sending WM_GETTEXT, so a hung app cannot block it.
+std::string FetchWindowTitle(HWND hwnd) {
+    if (g_StubWindowSystem) {
+        auto lock = LockSimulatedWindows();
+        auto it = g_SimulatedWindows.find(hwnd);
+        return it != g_SimulatedWindows.end() ? it->second.title : std::string();
+    }
+
+    wchar_t titleW[512];
+    int lengthW = InternalGetWindowText(hwnd, titleW, sizeof(titleW) / sizeof(wchar_t));
+    return WideToUtf8(titleW, lengthW);
+}
+
+// Function to read a window's class and owning process from the system
+void FetchWindowIdentity(HWND hwnd, std::string& className, DWORD& processId, std::string& processName) {
+    if (g_StubWindowSystem) {
+        auto lock = LockSimulatedWindows();
+        auto it = g_SimulatedWindows.find(hwnd);
+        if (it == g_SimulatedWindows.end()) return;
+        className = it->second.className;
+        processId = it->second.processId;
+        processName = it->second.processName;
+        return;
+    }
+
+    wchar_t classW[256];
+    className = WideToUtf8(classW, GetClassNameW(hwnd, classW, sizeof(classW) / sizeof(wchar_t)));
+
+    processId = 0;
+    GetWindowThreadProcessId(hwnd, &processId);
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);
+    if (process) {
+        wchar_t pathW[MAX_PATH];
+        DWORD length = MAX_PATH;
+        if (QueryFullProcessImageNameW(process, 0, pathW, &length)) {
+            std::string path = WideToUtf8(pathW, static_cast<int>(length));
+            processName = path.substr(path.find_last_of("\\/") + 1);
+        }
+        CloseHandle(process);
+    }
+}
+
+// Function to get the interned copy of a string, taking one reference to it
+const std::string* InternString(const std::string& value) {
+    auto it = g_InternedStrings.emplace(value, 0).first;
+    ++it->second;
+    return &it->first;
+}
+
+// Function to drop one reference to an interned string
+void ReleaseInternedString(const std::string* value) {
+    if (!value) return;
+    auto it = g_InternedStrings.find(*value);
+    if (it != g_InternedStrings.end() && --it->second == 0) {
+        g_InternedStrings.erase(it);
+    }
+}
+
+// Function to replace an interned string field with a new value
+void AssignInternedString(const std::string*& field, const std::string& value) {
+    if (field && *field == value) return;
+    ReleaseInternedString(field);
+    field = InternString(value);
+}
+
+// Function to re-read some of a window's properties into the cache. This is the only place
+// that asks the window system for them.
+const WindowProperties& RefreshWindowProperties(HWND hwnd, unsigned fields = PROPERTY_ALL) {
+    auto inserted = g_WindowPropertyCache.emplace(hwnd, WindowProperties());
+    WindowProperties& properties = inserted.first->second;
+    if (inserted.second) fields = PROPERTY_ALL; // A new entry needs everything
+    ++g_WindowPropertyFetches;
+
+    if (fields & PROPERTY_TITLE) {
+        AssignInternedString(properties.title, FetchWindowTitle(hwnd));
+    }
+    if (fields & PROPERTY_STYLES) {
+        properties.style = WsGetWindowLong(hwnd, GWL_STYLE);
+        properties.exStyle = WsGetWindowLong(hwnd, GWL_EXSTYLE);
+    }
+    if (fields & PROPERTY_IDENTITY) {
+        std::string className;
+        std::string processName;
+        FetchWindowIdentity(hwnd, className, properties.processId, processName);
+        AssignInternedString(properties.className, className);
+        AssignInternedString(properties.processName, processName);
+    }
+    return properties;
+}
+
+// Function to get a window's cached properties, reading them only the first time
+const WindowProperties& GetWindowProperties(HWND hwnd) {
+    auto it = g_WindowPropertyCache.find(hwnd);
+    if (it != g_WindowPropertyCache.end()) return it->second;
+    return RefreshWindowProperties(hwnd);
+}
+
+// Function to drop a window from the property cache
+void ForgetWindowProperties(HWND hwnd) {
+    auto it = g_WindowPropertyCache.find(hwnd);
+    if (it == g_WindowPropertyCache.end()) return;
+    ReleaseInternedString(it->second.title);
+    ReleaseInternedString(it->second.className);
+    ReleaseInternedString(it->second.processName);
+    g_WindowPropertyCache.erase(it);
+}
+
+// Function to drop cached properties of windows that did not end up managed. No events keep
+// those entries fresh.
+void PruneWindowProperties() {
+    for (auto it = g_WindowPropertyCache.begin(); it != g_WindowPropertyCache.end();) {
+        HWND hwnd = (it++)->first;
+        if (!g_ManagedWindowSet.Contains(hwnd)) {
+            ForgetWindowProperties(hwnd);
+        }
+    }
+}
+
+// Helper function to retrieve window title, from the property cache. The reference stays
+// valid until the window's next title change is processed.
+const std::string& GetWindowTitle(HWND hwnd) {
+    return *GetWindowProperties(hwnd).title;
+}
+
+// Trace recording. A trace captures everything the window manager reacts to (WinEvents,
+// hotkeys, resize-mode keys) plus snapshots of the windows involved, so a session can be
+// replayed offline against the simulated window set.
+//
+// File layout: the 8-byte magic "LWMTRC01" followed by records. Each record is a one-byte
+// type, the microseconds elapsed since the previous record, and a type-specific payload.
+// Integers are LEB128 varints (signed values zigzag-encoded), so most records are a few bytes.
+const char TRACE_MAGIC[8] = { 'L', 'W', 'M', 'T', 'R', 'C', '0', '1' };
+
+enum class TraceRecordType : uint8_t {
+    SCREEN = 1,         // left, top, right, bottom
+    WINDOW = 2,         // hwnd, visible, style, exStyle, left, top, right, bottom, title
+    ENUM_WINDOW = 3,    // hwnd passed to EnumWindowsCallback at startup
+    INITIAL_LAYOUT = 4, // startup layout was built from the enumerated windows
+    WIN_EVENT = 5,      // event, hwnd, idObject, idChild
+    HOTKEY = 6,         // hotkey id, foreground hwnd
+    RESIZE_KEY = 7,     // virtual-key code, shift pressed
+    COMMAND = 8         // command text
+};
+
+std::ofstream g_TraceFile;
+bool g_TraceRecording = false;
+std::chrono::steady_clock::time_point g_TraceLastRecordTime;
+size_t g_TraceRecordCount = 0;
+
+// Function to append an unsigned LEB128 varint to the trace
+void TraceWriteVarint(uint64_t value) {
+    char bytes[10];
+    int count = 0;
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if (value) byte |= 0x80;
+        bytes[count++] = static_cast<char>(byte);
+    } while (value);
+    g_TraceFile.write(bytes, count);
+}
+
+// Function to append a zigzag-encoded signed varint to the trace
+void TraceWriteSigned(int64_t value) {
+    TraceWriteVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+void TraceWriteHwnd(HWND hwnd) {
+    TraceWriteVarint(reinterpret_cast<uintptr_t>(hwnd));
+}
+
+// Function to start a record: its type and the time since the previous record
+void TraceBeginRecord(TraceRecordType type) {
+    auto now = std::chrono::steady_clock::now();
+    auto deltaUs = std::chrono::duration_cast<std::chrono::microseconds>(now - g_TraceLastRecordTime).count();
+    g_TraceLastRecordTime = now;
+
+    g_TraceFile.put(static_cast<char>(type));
+    TraceWriteVarint(static_cast<uint64_t>(deltaUs));
+
+    // Flush periodically so a killed session still leaves a usable trace
+    if (++g_TraceRecordCount % 64 == 0) {
+        g_TraceFile.flush();
+    }
+}
+
+// Function to begin recording a trace to the given file
+bool StartTraceRecording(const std::string& path) {
+    g_TraceFile.open(path, std::ios::binary | std::ios::trunc);
+    if (!g_TraceFile) {
+        std::cerr << "StartTraceRecording: Failed to open \"" << path << "\" for writing.\n";
+        return false;
+    }
+    g_TraceFile.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    g_TraceLastRecordTime = std::chrono::steady_clock::now();
+    g_TraceRecordCount = 0;
+    g_TraceRecording = true;
+    std::cout << "StartTraceRecording: Recording trace to \"" << path << "\".\n";
+    return true;
+}
+
+void StopTraceRecording() {
+    if (!g_TraceRecording) return;
+    g_TraceRecording = false;
+    g_TraceFile.close();
+    std::cout << "StopTraceRecording: Wrote " << g_TraceRecordCount << " trace records.\n";
+}
+
+void TraceScreen(const RECT& screenRect) {
+    if (!g_TraceRecording) return;
+    TraceBeginRecord(TraceRecordType::SCREEN);
+    TraceWriteSigned(screenRect.left);
+    TraceWriteSigned(screenRect.top);
+    TraceWriteSigned(screenRect.right);
+    TraceWriteSigned(screenRect.bottom);
+}
+
+// Function to record the properties the window manager inspects for a window
+void TraceWindowSnapshot(HWND hwnd) {
+    if (!g_TraceRecording) return;
+
+    RECT rect = { 0, 0, 0, 0 };
+    WsGetWindowRect(hwnd, &rect);
+    std::string title = FetchWindowTitle(hwnd); // The cache may not have seen the change yet
+
+    TraceBeginRecord(TraceRecordType::WINDOW);
+    TraceWriteHwnd(hwnd);
+    TraceWriteVarint(WsIsWindowVisible(hwnd) ? 1 : 0);
+    TraceWriteVarint(static_cast<uint32_t>(WsGetWindowLong(hwnd, GWL_STYLE)));
+    TraceWriteVarint(static_cast<uint32_t>(WsGetWindowLong(hwnd, GWL_EXSTYLE)));
+    TraceWriteSigned(rect.left);
+    TraceWriteSigned(rect.top);
+    TraceWriteSigned(rect.right);
+    TraceWriteSigned(rect.bottom);
+    TraceWriteVarint(title.size());
+    g_TraceFile.write(title.data(), title.size());
+}
+
+void TraceEnumWindow(HWND hwnd) {
+    if (!g_TraceRecording) return;
+    TraceWindowSnapshot(hwnd);
+    TraceBeginRecord(TraceRecordType::ENUM_WINDOW);
+    TraceWriteHwnd(hwnd);
+}
+
+void TraceInitialLayout() {
+    if (!g_TraceRecording) return;
+    TraceBeginRecord(TraceRecordType::INITIAL_LAYOUT);
+}
+
+void TraceWinEvent(DWORD event, HWND hwnd, LONG idObject, LONG idChild) {
+    if (!g_TraceRecording) return;
+
+    // A shown or renamed window is inspected right away, so capture what it looks like now
+    if ((event == EVENT_OBJECT_SHOW || event == EVENT_OBJECT_NAMECHANGE) &&
+        idObject == OBJID_WINDOW && idChild == CHILDID_SELF) {
+        TraceWindowSnapshot(hwnd);
+    }
+
+    TraceBeginRecord(TraceRecordType::WIN_EVENT);
+    TraceWriteVarint(event);
+    TraceWriteHwnd(hwnd);
+    TraceWriteSigned(idObject);
+    TraceWriteSigned(idChild);
+}
+
+void TraceHotkey(WPARAM hotkeyId) {
+    if (!g_TraceRecording) return;
+    TraceBeginRecord(TraceRecordType::HOTKEY);
+    TraceWriteVarint(hotkeyId);
+    TraceWriteHwnd(WsGetForegroundWindow());
+}
+
+void TraceResizeKey(DWORD vkCode, bool isShiftPressed) {
+    if (!g_TraceRecording) return;
+    TraceBeginRecord(TraceRecordType::RESIZE_KEY);
+    TraceWriteVarint(vkCode);
+    TraceWriteVarint(isShiftPressed ? 1 : 0);
+}
+
+void TraceCommand(const std::string& command) {
+    if (!g_TraceRecording) return;
+    TraceBeginRecord(TraceRecordType::COMMAND);
+    TraceWriteVarint(command.size());
+    g_TraceFile.write(command.data(), command.size());
+}
+
+// Geometry commits. SetWindowPos, SetWindowLong and ShowWindow wait for the target window's
+// application to answer, so with the calls made on the layout thread one hung window froze
+// every retile and every hotkey. Once the pool is started, MoveWindowNormalized only decides
+// which calls a window needs and queues them; worker threads make the calls and hand the
+// results back through WM_LAYOUT_GEOMETRY. A window has at most one commit running, and a
+// newer commit for it replaces the one still waiting, so the latest geometry always wins.
+// A watchdog marks commits that run past g_GeometryTimeoutMs and adds a worker when all of
+// them are stuck, so the other windows keep committing. A window that times out
+// GEOMETRY_QUARANTINE_STRIKES times in a row is quarantined: it gets no more calls until it
+// answers a probe, and then its latest geometry is committed.
+const int GEOMETRY_WORKERS = 4;
+const int GEOMETRY_MAX_WORKERS = 16;
+const int GEOMETRY_QUARANTINE_STRIKES = 3;
+int g_GeometryTimeoutMs = 250;
+
+// Structure describing the calls one window needs
+struct GeometryCommit {
+    HWND hwnd = nullptr;
+    bool restore = false;
+    bool setStyle = false;
+    LONG style = 0;
+    bool move = false;
+    RECT rect = { 0, 0, 0, 0 };
+    UINT flags = 0;
+    bool raise = false;      // Bring the window to the top of the z-order, without activating it
+    bool foreground = false; // Make it the foreground window
+};
+
+// Structure describing how a commit went
+struct GeometryResult {
+    GeometryCommit commit;
+    bool styleFailed = false;
+    bool moveFailed = false;
+    bool hasActual = false;
+    RECT actual = { 0, 0, 0, 0 }; // Rectangle the window took, valid if hasActual is set
+};
+
+// Structure holding one window's place in the pool
+struct GeometrySlot {
+    GeometryCommit pending;
+    bool hasPending = false;
+    bool queued = false;
+    bool running = false;
+    bool timedOut = false;    // The running commit has passed the timeout
+    bool quarantined = false;
+    bool forgotten = false;   // The window went away while its commit was running
+    int strikes = 0;          // Timeouts in a row
+    std::chrono::steady_clock::time_point started;
+};
+
+// Everything below is guarded by g_GeometryMutex, which is never held across a window call
+std::mutex g_GeometryMutex;
+std::condition_variable g_GeometryWork;  // A window was queued, or the pool is stopping
+std::condition_variable g_GeometryWatch; // A thread exited, or the pool is stopping
+std::unordered_map<HWND, GeometrySlot> g_GeometrySlots;
+std::deque<HWND> g_GeometryQueue;
+std::vector<GeometryResult> g_GeometryResults;
+int g_GeometryWorkerCount = 0;
+int g_GeometryIdleWorkers = 0;
+int g_GeometryThreads = 0; // Workers and watchdog not yet exited
+bool g_GeometryStopping = false;
+size_t g_GeometryTimeouts = 0;
+
+// Function to make a commit's calls. Runs on a geometry worker, or on the layout thread when
+// the pool is not started, and touches nothing but the window.
+GeometryResult ExecuteGeometryCommit(const GeometryCommit& commit) {
+    GeometryResult result;
+    result.commit = commit;
+    HWND hwnd = commit.hwnd;
+
+    // Ensure window is restored (not minimized or maximized)
+    if (commit.restore) {
+        CountWindowSystemCall();
+        RawShowWindow(hwnd, SW_RESTORE);
+    }
+
+    if (commit.setStyle) {
+        CountWindowSystemCall();
+        if (!RawSetWindowLong(hwnd, GWL_STYLE, commit.style)) {
+            std::cerr << "MoveWindowNormalized: Failed to set window style for HWND=0x"
+                      << std::hex << hwnd << std::dec << ". Error: " << GetLastError() << "\n";
+            result.styleFailed = true;
+            result.moveFailed = commit.move;
+            return result;
+        }
+    }
+
+    if (commit.move) {
+        const RECT& rect = commit.rect;
+        CountWindowSystemCall();
+        if (!RawSetWindowPos(hwnd, HWND_TOP, rect.left, rect.top, rect.right - rect.left,
+                             rect.bottom - rect.top, commit.flags)) {
+            std::cerr << "MoveWindowNormalized: Failed to move HWND=0x"
+                      << std::hex << hwnd << std::dec << ". Error: " << GetLastError() << "\n";
+            result.moveFailed = true;
+        }
+        else {
+            // Read back the size the window took, so its limits can be learned
+            result.hasActual = WsGetWindowRect(hwnd, &result.actual);
+        }
+    }
+
+    if (commit.raise) {
+        CountWindowSystemCall();
+        RawSetWindowPos(hwnd, HWND_TOP, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE | SWP_SHOWWINDOW | SWP_NOACTIVATE);
+    }
+    if (commit.foreground) {
+        CountWindowSystemCall();
+        RawSetForegroundWindow(hwnd);
+    }
+    return result;
+}
+
+// Function to fold a newer commit for the same window into one still waiting
+void MergeGeometryCommit(GeometryCommit& pending, const GeometryCommit& newer) {
+    pending.restore |= newer.restore;
+    pending.raise |= newer.raise;
+    pending.foreground |= newer.foreground;
+    if (newer.setStyle) {
+        pending.setStyle = true;
+        pending.style = newer.style;
+    }
+    if (newer.move) {
+        UINT frameChanged = (pending.move ? pending.flags : 0) & SWP_FRAMECHANGED;
+        pending.move = true;
+        pending.rect = newer.rect;
+        pending.flags = newer.flags | frameChanged;
+    }
+}
+
+// Function to record the outcome of a commit. Runs on the layout thread.
+void ApplyGeometryResult(const GeometryResult& result) {
+    const GeometryCommit& commit = result.commit;
+    auto applied = g_AppliedWindowState.find(commit.hwnd);
+    if (applied == g_AppliedWindowState.end()) return; // Gone, or moved by the user meanwhile
+
+    if (result.styleFailed) applied->second.hasStyle = false;
+    if (!commit.move) return;
+    if (result.moveFailed) {
+        applied->second.placed = false;
+        return;
+    }
+
+    ++g_WindowMoveCount;
+    CountMetric(Metric::WINDOW_MOVES);
+
+    // Check whether the window took the size, and learn its limits if it did not
+    if (result.hasActual) {
+        LearnSizeConstraints(commit.hwnd, commit.rect.right - commit.rect.left,
+                             commit.rect.bottom - commit.rect.top, result.actual);
+    }
+}
+
+// Function to queue a window whose slot has a commit waiting. Called with the lock held.
+void QueueGeometrySlot(HWND hwnd, GeometrySlot& slot) {
+    if (!slot.hasPending || slot.queued || slot.running || slot.quarantined) return;
+    slot.queued = true;
+    g_GeometryQueue.push_back(hwnd);
+    g_GeometryWork.notify_one();
+}
+
+// Function run by each geometry worker
+void RunGeometryWorker() {
+    std::unique_lock<std::mutex> lock(g_GeometryMutex);
+    for (;;) {
+        ++g_GeometryIdleWorkers;
+        g_GeometryWork.wait(lock, []() { return g_GeometryStopping || !g_GeometryQueue.empty(); });
+        --g_GeometryIdleWorkers;
+        if (g_GeometryQueue.empty()) break;
+
+        HWND hwnd = g_GeometryQueue.front();
+        g_GeometryQueue.pop_front();
+        auto queued = g_GeometrySlots.find(hwnd);
+        GeometrySlot& slot = queued->second;
+        slot.queued = false;
+        if (slot.forgotten) {
+            g_GeometrySlots.erase(queued);
+            continue;
+        }
+        if (!slot.hasPending || slot.quarantined) {
+            if (!slot.hasPending && !slot.quarantined && slot.strikes == 0) g_GeometrySlots.erase(queued);
+            continue;
+        }
+
+        GeometryCommit commit = slot.pending;
+        slot.hasPending = false;
+        slot.running = true;
+        slot.timedOut = false;
+        slot.started = std::chrono::steady_clock::now();
+        lock.unlock();
+
+        GeometryResult result = ExecuteGeometryCommit(commit);
+
+        lock.lock();
+        auto it = g_GeometrySlots.find(hwnd);
+        it->second.running = false;
+        if (it->second.forgotten) {
+            g_GeometrySlots.erase(it);
+            continue;
+        }
+        if (!it->second.timedOut) it->second.strikes = 0;
+        QueueGeometrySlot(hwnd, it->second);
+        if (!it->second.queued && !it->second.quarantined && it->second.strikes == 0) {
+            g_GeometrySlots.erase(it); // Nothing left to remember about a healthy window
+        }
+
+        // The first result waiting wakes the layout thread; the simulated window system has
+        // no message loop, so there the caller drains the results itself
+        g_GeometryResults.push_back(result);
+        if (g_GeometryResults.size() == 1 && !g_StubWindowSystem) {
+            PostLayoutMessage(WM_LAYOUT_GEOMETRY, 0, 0);
+        }
+    }
+    --g_GeometryWorkerCount;
+    --g_GeometryThreads;
+    g_GeometryWatch.notify_all();
+}
+
+// Function to start one more geometry worker. Called with the lock held.
+void StartGeometryWorker() {
+    ++g_GeometryWorkerCount;
+    ++g_GeometryThreads;
+    std::thread(RunGeometryWorker).detach();
+}
+
+// Function run by the watchdog, which times out commits, quarantines windows that keep
+// timing out and probes quarantined windows until they answer
+void RunGeometryWatchdog() {
+    std::unique_lock<std::mutex> lock(g_GeometryMutex);
+    while (!g_GeometryStopping) {
+        g_GeometryWatch.wait_for(lock, std::chrono::milliseconds((std::max)(g_GeometryTimeoutMs / 4, 1)));
+        if (g_GeometryStopping) break;
+
+        auto now = std::chrono::steady_clock::now();
+        auto timeout = std::chrono::milliseconds(g_GeometryTimeoutMs);
+        std::vector<HWND> probes;
+        bool stuck = false;
+        int64_t quarantined = 0;
+        for (auto& entry : g_GeometrySlots) {
+            GeometrySlot& slot = entry.second;
+            if (slot.running && !slot.timedOut && now - slot.started >= timeout) {
+                slot.timedOut = true;
+                ++slot.strikes;
+                ++g_GeometryTimeouts;
+                CountMetric(Metric::GEOMETRY_TIMEOUTS);
+                std::cerr << "GeometryWatchdog: HWND=0x" << std::hex << entry.first << std::dec
+                          << " did not answer within " << g_GeometryTimeoutMs << " ms.\n";
+                if (slot.strikes >= GEOMETRY_QUARANTINE_STRIKES && !slot.quarantined) {
+                    slot.quarantined = true;
+                    std::cerr << "GeometryWatchdog: Quarantined HWND=0x" << std::hex << entry.first
+                              << std::dec << " after " << slot.strikes << " timeouts.\n";
+                }
+            }
+            if (slot.running && slot.timedOut) stuck = true;
+            if (slot.quarantined) {
+                ++quarantined;
+                if (!slot.running) probes.push_back(entry.first);
+            }
+        }
+        SetGauge(Gauge::QUARANTINED_WINDOWS, quarantined);
+
+        // Windows still waiting should not wait for a hung one to let its worker go
+        if (stuck && g_GeometryIdleWorkers == 0 && !g_GeometryQueue.empty() &&
+            g_GeometryWorkerCount < GEOMETRY_MAX_WORKERS) {
+            StartGeometryWorker();
+        }
+
+        if (probes.empty()) continue;
+        lock.unlock();
+        std::vector<HWND> answered;
+        for (HWND hwnd : probes) {
+            if (RawProbeWindow(hwnd, g_GeometryTimeoutMs)) answered.push_back(hwnd);
+        }
+        lock.lock();
+
+        for (HWND hwnd : answered) {
+            auto it = g_GeometrySlots.find(hwnd);
+            if (it == g_GeometrySlots.end() || !it->second.quarantined) continue;
+            it->second.quarantined = false;
+            it->second.strikes = 0;
+            std::cout << "GeometryWatchdog: HWND=0x" << std::hex << hwnd << std::dec
+                      << " answers again; released from quarantine.\n";
+            QueueGeometrySlot(hwnd, it->second);
+        }
+    }
+    --g_GeometryThreads;
+    g_GeometryWatch.notify_all();
+}
+
+// Function to start the geometry workers and the watchdog
+void StartGeometryPool() {
+    std::lock_guard<std::mutex> lock(g_GeometryMutex);
+    if (g_GeometryPoolRunning.load(std::memory_order_relaxed)) return;
+    g_GeometryStopping = false;
+    g_GeometryPoolRunning.store(true, std::memory_order_relaxed);
+    for (int i = 0; i < GEOMETRY_WORKERS; ++i) StartGeometryWorker();
+    ++g_GeometryThreads;
+    std::thread(RunGeometryWatchdog).detach();
+}
+
+// Function to stop the pool once the queued commits are done. Waits for every thread to
+// exit, including workers still blocked in a window call, so the main loop leaves the pool
+// running until the process ends.
+void StopGeometryPool() {
+    std::unique_lock<std::mutex> lock(g_GeometryMutex);
+    if (!g_GeometryPoolRunning.load(std::memory_order_relaxed)) return;
+    g_GeometryStopping = true;
+    g_GeometryWork.notify_all();
+    g_GeometryWatch.notify_all();
+    g_GeometryWatch.wait(lock, []() { return g_GeometryThreads == 0; });
+    g_GeometrySlots.clear();
+    g_GeometryPoolRunning.store(false, std::memory_order_relaxed);
+}
+
+// Function to hand a commit to the pool
+void SubmitGeometryCommit(const GeometryCommit& commit) {
+    std::lock_guard<std::mutex> lock(g_GeometryMutex);
+    GeometrySlot& slot = g_GeometrySlots[commit.hwnd];
+    slot.forgotten = false;
+    if (slot.hasPending) {
+        MergeGeometryCommit(slot.pending, commit);
+    }
+    else {
+        slot.pending = commit;
+        slot.hasPending = true;
+    }
+    QueueGeometrySlot(commit.hwnd, slot);
+}
+
+// Function to drop a window's waiting commit before the layout thread changes the window
+// itself, so the older geometry does not land on top of the change. What the dropped commit
+// would have applied is marked as not applied.
+void DropPendingGeometry(HWND hwnd) {
+    if (!g_GeometryPoolRunning.load(std::memory_order_relaxed)) return;
+    GeometryCommit dropped;
+    {
+        std::lock_guard<std::mutex> lock(g_GeometryMutex);
+        auto it = g_GeometrySlots.find(hwnd);
+        if (it == g_GeometrySlots.end() || !it->second.hasPending) return;
+        dropped = it->second.pending;
+        it->second.hasPending = false;
+    }
+
+    auto applied = g_AppliedWindowState.find(hwnd);
+    if (applied == g_AppliedWindowState.end()) return;
+    if (dropped.restore) applied->second.restored = false;
+    if (dropped.setStyle) applied->second.hasStyle = false;
+    if (dropped.move) applied->second.placed = false;
+}
+
+// Function to forget a destroyed window's slot
+void ForgetGeometryWindow(HWND hwnd) {
+    if (!g_GeometryPoolRunning.load(std::memory_order_relaxed)) return;
+    std::lock_guard<std::mutex> lock(g_GeometryMutex);
+    auto it = g_GeometrySlots.find(hwnd);
+    if (it == g_GeometrySlots.end()) return;
+    if (it->second.running || it->second.queued) {
+        // The worker that holds or pops it erases it
+        it->second.forgotten = true;
+        it->second.hasPending = false;
+    }
+    else {
+        g_GeometrySlots.erase(it);
+    }
+}
+
+// Function to check whether a window is quarantined
+bool IsGeometryQuarantined(HWND hwnd) {
+    std::lock_guard<std::mutex> lock(g_GeometryMutex);
+    auto it = g_GeometrySlots.find(hwnd);
+    return it != g_GeometrySlots.end() && it->second.quarantined;
+}
+
+// Function to check whether a commit for a window is still queued or being made
+bool HasGeometryInFlight(HWND hwnd) {
+    if (!g_GeometryPoolRunning.load(std::memory_order_relaxed)) return false;
+    std::lock_guard<std::mutex> lock(g_GeometryMutex);
+    auto it = g_GeometrySlots.find(hwnd);
+    return it != g_GeometrySlots.end() && (it->second.hasPending || it->second.queued || it->second.running);
+}
+
+// Function to drop what was last applied to a tiled window once something else has moved,
+// resized or restyled it: the application itself, Win+Up, or another program. Our own calls
+// report the same events, so the window is compared with what we applied, and is left alone
+// while a commit for it is still on its way. Reading the rectangle and style sends no message.
+void ReconcileAppliedWindowState(HWND hwnd) {
+    auto applied = g_AppliedWindowState.find(hwnd);
+    if (applied == g_AppliedWindowState.end() || HasGeometryInFlight(hwnd)) return;
+
+    const AppliedWindowState& state = applied->second;
+    RECT actual;
+    bool moved = state.placed && WsGetWindowRect(hwnd, &actual) && !EqualRects(actual, state.rect);
+    bool restyled = state.hasStyle && !state.frameStale &&
+        ((WsGetWindowLong(hwnd, GWL_STYLE) ^ state.style) & (WS_CAPTION | WS_THICKFRAME)) != 0;
+    if (moved || restyled) g_AppliedWindowState.erase(applied);
+}
+
+// Function to record the results the workers handed back, on the layout thread. A window
+// that refused its size gets the layout solved again, as ApplyLayout does for the calls it
+// makes itself.
+void DrainGeometryResults() {
+    std::vector<GeometryResult> results;
+    {
+        std::lock_guard<std::mutex> lock(g_GeometryMutex);
+        results.swap(g_GeometryResults);
+    }
+    for (const GeometryResult& result : results) ApplyGeometryResult(result);
+
+    if (g_SizeConstraintsChanged) {
+        g_SizeConstraintsChanged = false;
+        TileWindows(GetScreenRect());
+    }
+}
+
+// Function to normalize and move windows for more consistent tiling behavior. The caption
+// and sizing frame are stripped and the window restored once; after that only a changed
+// rectangle costs a call. With the geometry pool running the calls are queued and the
+// function returns at once; what was queued is recorded as applied.
+bool MoveWindowNormalized(HWND hwnd, int x, int y, int width, int height) {
+    if (!hwnd) return false;
+
+    auto inserted = g_AppliedWindowState.emplace(hwnd, AppliedWindowState());
+    AppliedWindowState& applied = inserted.first->second;
+
+    // Validate the window handle the first time; the entry is dropped when it is destroyed
+    if (inserted.second && !WsIsWindow(hwnd)) {
+        std::cerr << "MoveWindowNormalized: Invalid HWND.\n";
+        g_AppliedWindowState.erase(inserted.first);
+        return false;
+    }
+
+    GeometryCommit commit;
+    commit.hwnd = hwnd;
+    if (!applied.restored) {
+        commit.restore = true;
+        applied.restored = true;
+    }
+
+    // Remove WS_CAPTION and WS_THICKFRAME to make the window borderless, unless the style we
+    // last wrote has neither. Reading the style sends no message, so it is done here.
+    if (!applied.hasStyle || (applied.style & (WS_CAPTION | WS_THICKFRAME))) {
+        LONG originalStyle = WsGetWindowLong(hwnd, GWL_STYLE);
+        if (originalStyle == 0 && GetLastError() != 0) {
+            std::cerr << "MoveWindowNormalized: Failed to get window style for HWND=0x" 
+                      << std::hex << hwnd << std::dec << ". Error: " << GetLastError() << "\n";
+            return false;
+        }
+
+        LONG newStyle = originalStyle & ~(WS_CAPTION | WS_THICKFRAME);
+        if (newStyle != originalStyle) {
+            commit.setStyle = true;
+            commit.style = newStyle;
+            UpdateCachedStyle(hwnd, GWL_STYLE, newStyle);
+            applied.frameStale = true;
+        }
+        applied.style = newStyle;
+        applied.hasStyle = true;
+    }
+
+    // Move the window to the specified position and size. A pending style change is applied
+    // by the same call rather than a separate SWP_FRAMECHANGED one.
+    RECT requested = { x, y, x + width, y + height };
+    if (!applied.placed || applied.frameStale || !EqualRects(applied.rect, requested)) {
+        commit.move = true;
+        commit.rect = requested;
+        commit.flags = SWP_NOZORDER | SWP_SHOWWINDOW | (applied.frameStale ? SWP_FRAMECHANGED : 0);
+        applied.placed = true;
+        applied.rect = requested;
+        applied.frameStale = false;
+    }
+
+    if (!commit.restore && !commit.setStyle && !commit.move) return true;
+    if (g_GeometryPoolRunning.load(std::memory_order_relaxed)) {
+        SubmitGeometryCommit(commit);
+        return true;
+    }
+
+    GeometryResult result = ExecuteGeometryCommit(commit);
+    ApplyGeometryResult(result);
+    return !result.styleFailed && !result.moveFailed;
+}
+
+// Function to set a window's style the way MoveWindowNormalized does: with the geometry pool
+// running it is queued and recorded as applied, and the window's next move redraws the frame
+void SetWindowStyleQueued(HWND hwnd, LONG style) {
+    if (!g_GeometryPoolRunning.load(std::memory_order_relaxed)) {
+        WsSetWindowLong(hwnd, GWL_STYLE, style);
+        return;
+    }
+
+    UpdateCachedStyle(hwnd, GWL_STYLE, style);
+    auto applied = g_AppliedWindowState.find(hwnd);
+    if (applied != g_AppliedWindowState.end()) {
+        applied->second.style = style;
+        applied->second.hasStyle = true;
+        applied->second.frameStale = true;
+    }
+
+    GeometryCommit commit;
+    commit.hwnd = hwnd;
+    commit.setStyle = true;
+    commit.style = style;
+    SubmitGeometryCommit(commit);
+}
+
+// Function to restore, raise and activate a window. With the geometry pool running the calls
+// are queued like any other commit, so a hung application does not hold up the layout thread.
+void RaiseWindowQueued(HWND hwnd) {
+    if (!g_GeometryPoolRunning.load(std::memory_order_relaxed)) {
+        WsShowWindow(hwnd, SW_RESTORE);
+        WsSetWindowPos(hwnd, HWND_TOP, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE | SWP_SHOWWINDOW);
+        WsSetForegroundWindow(hwnd);
+        return;
+    }
+
+    auto applied = g_AppliedWindowState.find(hwnd);
+    if (applied != g_AppliedWindowState.end()) applied->second.restored = true;
+
+    GeometryCommit commit;
+    commit.hwnd = hwnd;
+    commit.restore = true;
+    commit.raise = true;
+    commit.foreground = true;
+    SubmitGeometryCommit(commit);
+}
+
+// Function to move a window that is not tiled to a rectangle of its own, on top of the z-order
+// and with its frame redrawn, without activating it. With the geometry pool running the call
+// is queued, behind anything still on its way to the window.
+void PlaceWindowQueued(HWND hwnd, const RECT& rect) {
+    const UINT flags = SWP_FRAMECHANGED | SWP_NOACTIVATE;
+    if (!g_GeometryPoolRunning.load(std::memory_order_relaxed)) {
+        WsSetWindowPos(hwnd, HWND_TOP, rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top, flags);
+        return;
+    }
+
+    GeometryCommit commit;
+    commit.hwnd = hwnd;
+    commit.move = true;
+    commit.rect = rect;
+    commit.flags = flags;
+    SubmitGeometryCommit(commit);
+}
+
+
+// Function to check whether a window is in the floating layer
+bool IsFloatingWindow(HWND hwnd) {
+    return std::any_of(g_FloatingWindows.begin(), g_FloatingWindows.end(),
+        [hwnd](const FloatingWindow& window) { return window.hwnd == hwnd; });
+}
+
+// Function to decide whether a new window floats: dialogs, owned windows (pickers, tool
+// palettes, properties sheets) and windows matching FLOATING_TITLE_RULES
+bool ShouldFloat(HWND hwnd, const std::string& title, LONG exStyle) {
+    if (exStyle & WS_EX_DLGMODALFRAME) return true;
+    if (WsGetWindowOwner(hwnd) != nullptr) return true;
+    for (const char* rule : FLOATING_TITLE_RULES) {
+        if (title.find(rule) != std::string::npos) return true;
+    }
+    return false;
+}
+
+// Function to put a window on top of the floating layer. Only its z-order is changed, through
+// the geometry pool when it is running.
+void AddFloatingWindow(HWND hwnd, const RECT& rect) {
+    g_FloatingWindows.push_back(FloatingWindow{ hwnd, rect });
+    if (!g_GeometryPoolRunning.load(std::memory_order_relaxed)) {
+        WsSetWindowPos(hwnd, HWND_TOP, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE | SWP_NOACTIVATE);
+        return;
+    }
+
+    GeometryCommit commit;
+    commit.hwnd = hwnd;
+    commit.raise = true;
+    SubmitGeometryCommit(commit);
+}
+
+// Function to take a window out of the floating layer. Returns false if it was not in it.
+bool RemoveFloatingWindow(HWND hwnd) {
+    auto it = std::find_if(g_FloatingWindows.begin(), g_FloatingWindows.end(),
+        [hwnd](const FloatingWindow& window) { return window.hwnd == hwnd; });
+    if (it == g_FloatingWindows.end()) return false;
+    g_FloatingWindows.erase(it);
+    return true;
+}
+
+// Secondary indexes over the managed windows, by class and by process name. They are kept in
+// step with g_ManagedWindowSet, so a criteria query reads one bucket instead of every window.
+std::unordered_map<std::string, std::vector<HWND>> g_WindowsByClass;
+std::unordered_map<std::string, std::vector<HWND>> g_WindowsByProcess;
+
+// i3-style marks. A mark names exactly one window; marking another window moves it.
+std::unordered_map<std::string, HWND> g_Marks;
+std::unordered_map<HWND, std::vector<std::string>> g_MarksByWindow;
+
+// Function to remove a window from an index bucket, dropping the bucket when it empties
+void EraseFromWindowIndex(std::unordered_map<std::string, std::vector<HWND>>& index, const std::string& key, HWND hwnd) {
+    auto bucket = index.find(key);
+    if (bucket == index.end()) return;
+    std::vector<HWND>& windows = bucket->second;
+    auto it = std::find(windows.begin(), windows.end(), hwnd);
+    if (it == windows.end()) return;
+    *it = windows.back(); // Order within a bucket does not matter
+    windows.pop_back();
+    if (windows.empty()) index.erase(bucket);
+}
+
+// Function to add a newly managed window to the secondary indexes
+void IndexManagedWindow(HWND hwnd) {
+    const WindowProperties& properties = GetWindowProperties(hwnd);
+    g_WindowsByClass[*properties.className].push_back(hwnd);
+    g_WindowsByProcess[*properties.processName].push_back(hwnd);
+}
+
+// Function to drop a window that is no longer managed from the indexes and its marks. Must run
+// before its cached properties are forgotten.
+void UnindexManagedWindow(HWND hwnd) {
+    const WindowProperties& properties = GetWindowProperties(hwnd);
+    EraseFromWindowIndex(g_WindowsByClass, *properties.className, hwnd);
+    EraseFromWindowIndex(g_WindowsByProcess, *properties.processName, hwnd);
+
+    auto marks = g_MarksByWindow.find(hwnd);
+    if (marks != g_MarksByWindow.end()) {
+        for (const std::string& mark : marks->second) g_Marks.erase(mark);
+        g_MarksByWindow.erase(marks);
+    }
+}
+
+// Function to forget every index entry and mark, for when the managed set is rebuilt
+void ClearWindowIndexes() {
+    g_WindowsByClass.clear();
+    g_WindowsByProcess.clear();
+    g_Marks.clear();
+    g_MarksByWindow.clear();
+}
+
+// Function to put a mark on a window, taking it from any window that had it
+void SetWindowMark(HWND hwnd, const std::string& mark) {
+    auto existing = g_Marks.find(mark);
+    if (existing != g_Marks.end()) {
+        if (existing->second == hwnd) return;
+        std::vector<std::string>& previous = g_MarksByWindow[existing->second];
+        previous.erase(std::find(previous.begin(), previous.end(), mark));
+        if (previous.empty()) g_MarksByWindow.erase(existing->second);
+    }
+    g_Marks[mark] = hwnd;
+    g_MarksByWindow[hwnd].push_back(mark);
+}
+
+// Function to remove one mark from a window, or all of its marks if the name is empty
+void RemoveWindowMark(HWND hwnd, const std::string& mark) {
+    auto marks = g_MarksByWindow.find(hwnd);
+    if (marks == g_MarksByWindow.end()) return;
+    std::vector<std::string>& names = marks->second;
+    for (size_t i = 0; i < names.size();) {
+        if (mark.empty() || names[i] == mark) {
+            g_Marks.erase(names[i]);
+            names.erase(names.begin() + i);
+        } else {
+            ++i;
+        }
+    }
+    if (names.empty()) g_MarksByWindow.erase(marks);
+}
+
+// Callback to collect visible windows that will be managed
+BOOL CALLBACK EnumWindowsCallback(HWND hwnd, LPARAM lParam) {
+    auto windows = reinterpret_cast<WindowRegistry*>(lParam);
+
+    TraceEnumWindow(hwnd);
+
+    if (!WsIsWindowVisible(hwnd)) return TRUE;                 // Skip invisible windows
+    const WindowProperties& properties = RefreshWindowProperties(hwnd);
+    if (properties.title->empty()) return TRUE;                // Skip untitled windows
+    LONG exStyle = properties.exStyle;
+
+    if (exStyle & WS_EX_TOOLWINDOW) return TRUE;               // Skip tool windows
+    LONG style = properties.style;
+    if ((style & WS_POPUP) || (style & WS_CHILD)) return TRUE; // Skip popups or child windows
+
+    RECT rect;
+    if (!WsGetWindowRect(hwnd, &rect)) {
+        std::cerr << "EnumWindowsCallback: Failed to retrieve RECT for HWND 0x" 
+                  << std::hex << hwnd << std::dec << ". Error: " << GetLastError() << "\n";
+        return TRUE;
+    }
+
+    if (rect.left == rect.right || rect.top == rect.bottom) return TRUE; // Skip windows with no area
+
+    // Retrieve window title
+    const std::string& title = *properties.title;
+
+    // Initialize WindowInfo and add to managedWindows
+    WindowInfo winInfo;
+    winInfo.hwnd = hwnd;
+    winInfo.savedRect = rect; // Initially set to current rect
+    winInfo.savedStyle = style;
+    windows->Insert(winInfo);
+    g_ManagedWindowSet.Insert(hwnd);
+    IndexManagedWindow(hwnd);
+
+    // Dialogs and other rule matches stay where they are, in the floating layer
+    if (ShouldFloat(hwnd, title, exStyle)) {
+        AddFloatingWindow(hwnd, rect);
+        std::cout << "EnumWindowsCallback: Floating window added: HWND=0x"
+                  << std::hex << hwnd << std::dec << ", Title=\"" << title << "\"\n";
+        return TRUE;
+    }
+
+    // Debug: Print added window with title
+    std::cout << "EnumWindowsCallback: Managed window added: HWND=0x" 
+              << std::hex << hwnd << std::dec << ", Title=\"" << title << "\"\n";
+
+    return TRUE;
+}
+
+// Function to initialize the layout with the first window
+void InitializeLayout(HWND firstWindow) {
+    g_FocusedLeaf = NodeHandle();
+    g_FullscreenLeaf = NodeHandle();
+    ClearPlaceholders();
+    root = std::make_unique<LayoutNode>(firstWindow);
+    MarkLayoutChanged(root.get());
+    ClearJournal();
+}
+
+// Function to build and apply the startup layout from the enumerated managed windows
+void BuildInitialLayout(const RECT& screenRect) {
+    TraceInitialLayout();
+    PruneWindowProperties();
+
+    // Initialize the layout with the first tiled window and add the remaining ones. Windows
+    // matching a placeholder of a loaded layout fill it instead.
+    for (const WindowInfo& window : managedWindows) {
+        if (IsFloatingWindow(window.hwnd)) continue;
+        if (SwallowIntoPlaceholder(window.hwnd)) continue;
+        if (!root) {
+            InitializeLayout(window.hwnd);
+        }
+        else {
+            AddWindowToLayout(window.hwnd);
+        }
+    }
+
+    // Apply the tiling layout and store window positions
+    TileWindows(screenRect);
+    PublishLayoutSnapshot();
+    PublishSharedState();
+    UpdateLayoutGauges();
+}
+
+// Function to check whether a node lies in the subtree rooted at another
+bool IsInSubtree(const LayoutNode* node, const LayoutNode* subtree) {
+    for (; node; node = node->parent) {
+        if (node == subtree) return true;
+    }
+    return false;
+}
+
+// Function to make a tiled leaf the focused one, recording it in the focus history of every
+// split above it
+void SetFocusedLeaf(LayoutNode* leaf) {
+    g_FocusedLeaf = leaf ? leaf->handle : NodeHandle();
+    for (LayoutNode* node = leaf; node && node->parent; node = node->parent) {
+        node->parent->focusSecond = (node->parent->secondChild.get() == node);
+    }
+}
+
+// Function to follow the focus history down from a node to the leaf that was focused last
+LayoutNode* DescendFocusHistory(LayoutNode* node) {
+    while (node && node->isSplit) {
+        node = node->focusSecond ? node->secondChild.get() : node->firstChild.get();
+    }
+    return node;
+}
+
+// Function to get the focused tiled leaf, or nullptr if the focused window is not tiled
+LayoutNode* GetFocusedLeaf() {
+    LayoutNode* leaf = ResolveNode(g_FocusedLeaf);
+    if (leaf && leaf->hwnd == g_FocusedWindow) return leaf;
+    return nullptr;
+}
+
+// Function to get the window of the last focused tiled leaf, where focus goes when the
+// focused window closes. Returns nullptr if there is no such leaf.
+HWND FocusedLeafWindow() {
+    LayoutNode* leaf = ResolveNode(g_FocusedLeaf);
+    return leaf ? leaf->hwnd : nullptr;
+}
+
+// Function to keep focus on the same window when two leaves exchange windows
+void SwapFocusedLeaf(LayoutNode* nodeA, LayoutNode* nodeB) {
+    if (g_FocusedLeaf == nodeA->handle) SetFocusedLeaf(nodeB);
+    else if (g_FocusedLeaf == nodeB->handle) SetFocusedLeaf(nodeA);
+}
+
+// Function to record that a managed window received focus. Only a window focused from
+// outside (mouse, Alt+Tab, a new window) costs a tree search; our own focus changes already
+// know their leaf.
+void TrackFocusedWindow(HWND hwnd) {
+    if (hwnd == g_FocusedWindow && (IsFloatingWindow(hwnd) || GetFocusedLeaf())) return;
+    g_FocusedWindow = hwnd;
+    if (IsFloatingWindow(hwnd)) return; // The last focused tiled leaf is kept for later
+    LayoutNode* leaf = FindLayoutNode(root.get(), hwnd);
+    if (leaf) SetFocusedLeaf(leaf);
+}
+
+// Function to compute what a node's counts should be from its children
+void ComputeNodeCounts(const LayoutNode* node, int& leafCount, int& windowLeafDepth) {
+    if (!node->isSplit) {
+        leafCount = 1;
+        windowLeafDepth = node->hwnd ? 0 : NO_WINDOW_LEAF;
+        return;
+    }
+    leafCount = node->firstChild->leafCount + node->secondChild->leafCount;
+    windowLeafDepth = (std::min)(NO_WINDOW_LEAF,
+        1 + (std::min)(node->firstChild->windowLeafDepth, node->secondChild->windowLeafDepth));
+}
+
+// Function to mark the counts of a node and its ancestors stale after a change below it.
+// Stops at the first node already marked, whose ancestors are marked as well, so windows
+// added one after another deep in a spiral cost nothing here after the first.
+void InvalidateNodeCounts(LayoutNode* node) {
+    for (; node && !node->countsStale; node = node->parent) node->countsStale = true;
+}
+
+// Function to recompute the stale counts of a node and of the nodes below it, children
+// before parents. Iterative, as spiral and dwindle trees are as deep as they are wide.
+void RefreshNodeCounts(const LayoutNode* node) {
+    if (!node->countsStale) return;
+    std::vector<const LayoutNode*> pending = { node };
+    std::vector<const LayoutNode*> order; // Every node after its parent
+    while (!pending.empty()) {
+        const LayoutNode* current = pending.back();
+        pending.pop_back();
+        order.push_back(current);
+        if (!current->isSplit) continue;
+        if (current->firstChild->countsStale) pending.push_back(current->firstChild.get());
+        if (current->secondChild->countsStale) pending.push_back(current->secondChild.get());
+    }
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        ComputeNodeCounts(*it, (*it)->leafCount, (*it)->windowLeafDepth);
+        (*it)->countsStale = false;
+    }
+}
+
+// Function to get the number of leaves below a node
+int GetLeafCount(const LayoutNode* node) {
+    RefreshNodeCounts(node);
+    return node->leafCount;
+}
+
+// Function to get how far below a node its shallowest leaf holding a window is
+int GetWindowLeafDepth(const LayoutNode* node) {
+    RefreshNodeCounts(node);
+    return node->windowLeafDepth;
+}
+
+// Function to recompute the counts of a whole subtree, for trees built by hand
+void RecountSubtree(LayoutNode* node) {
+    if (!node) return;
+    if (node->isSplit) {
+        RecountSubtree(node->firstChild.get());
+        RecountSubtree(node->secondChild.get());
+    }
+    ComputeNodeCounts(node, node->leafCount, node->windowLeafDepth);
+    node->countsStale = false;
+}
+
+// Function to get the owning pointer that holds a node: its parent's child slot, or root
+std::unique_ptr<LayoutNode>& GetOwningSlot(LayoutNode* node) {
+    LayoutNode* parent = node->parent;
+    if (!parent) return root;
+    return (parent->firstChild.get() == node) ? parent->firstChild : parent->secondChild;
+}
+
+// Function to put a node and a new window leaf side by side under a new split that takes
+// the node's place. The new split covers the area the node covered. Returns the split.
+LayoutNode* WrapInSplit(LayoutNode* node, HWND newWindow, SplitType splitType, int splitRatio, bool windowIsFirst) {
+    LayoutNode* parent = node->parent;
+    std::unique_ptr<LayoutNode>& slot = GetOwningSlot(node);
+    RECT area = node->windowRect;
+
+    std::unique_ptr<LayoutNode> existing = std::move(slot);
+    std::unique_ptr<LayoutNode> leaf = std::make_unique<LayoutNode>(newWindow);
+    if (windowIsFirst) {
+        slot = std::make_unique<LayoutNode>(splitType, splitRatio, std::move(leaf), std::move(existing));
+    }
+    else {
+        slot = std::make_unique<LayoutNode>(splitType, splitRatio, std::move(existing), std::move(leaf));
+    }
+
+    LayoutNode* split = slot.get();
+    split->parent = parent;
+    split->windowRect = area;
+    split->firstChild->parent = split;
+    split->secondChild->parent = split;
+    InvalidateNodeCounts(parent);
+    MarkLayoutChanged(split);
+    return split;
+}
+
+// Function to replace a split with one of its children, destroying the other child. The
+// kept child inherits the split's place in the tree and the area it covered. Returns the
+// kept child.
+LayoutNode* CollapseSplit(LayoutNode* split, bool keepFirst) {
+    LayoutNode* parent = split->parent;
+    std::unique_ptr<LayoutNode>& slot = GetOwningSlot(split);
+
+    // Focus inside the destroyed child moves to the kept child's last focused leaf; a
+    // fullscreen window inside it simply ends fullscreen, as its handle goes stale
+    const LayoutNode* removed = (keepFirst ? split->secondChild : split->firstChild).get();
+    bool focusRemoved = IsInSubtree(ResolveNode(g_FocusedLeaf), removed);
+    RECT area = split->windowRect;
+
+    std::unique_ptr<LayoutNode> kept = std::move(keepFirst ? split->firstChild : split->secondChild);
+    kept->parent = parent;
+    kept->windowRect = area;
+    slot = std::move(kept); // Destroys the split and the other child
+    InvalidateNodeCounts(parent);
+
+    if (focusRemoved) SetFocusedLeaf(DescendFocusHistory(slot.get()));
+    MarkLayoutChanged(slot.get());
+    return slot.get();
+}
+
+// Function to journal a split created by WrapInSplit
+void RecordSplitDelta(LayoutNode* split, bool windowIsFirst) {
+    if (!JournalNeedsDelta()) return;
+    JournalDelta delta;
+    delta.type = JournalDeltaType::SPLIT;
+    delta.splitType = split->splitType;
+    delta.ratio = split->splitRatio;
+    delta.windowIsFirst = windowIsFirst;
+    delta.hwnd = (windowIsFirst ? split->firstChild : split->secondChild)->hwnd;
+    delta.path = GetNodePath(split);
+    RecordJournalDelta(std::move(delta));
+}
+
+// Function to journal an exchange of the windows of two leaves
+void RecordSwapDelta(LayoutNode* nodeA, LayoutNode* nodeB) {
+    if (!JournalNeedsDelta()) return;
+    JournalDelta delta;
+    delta.type = JournalDeltaType::SWAP;
+    delta.path = GetNodePath(nodeA);
+    delta.otherPath = GetNodePath(nodeB);
+    RecordJournalDelta(std::move(delta));
+}
+
+// Function to journal a split's orientation before it changes
+void RecordOrientationDelta(LayoutNode* split) {
+    if (!JournalNeedsDelta()) return;
+    JournalDelta delta;
+    delta.type = JournalDeltaType::ORIENTATION;
+    delta.splitType = split->splitType;
+    delta.path = GetNodePath(split);
+    RecordJournalDelta(std::move(delta));
+}
+
+// Function to journal a split's ratio before it changes
+void RecordRatioDelta(LayoutNode* split) {
+    if (!JournalNeedsDelta()) return;
+    JournalDelta delta;
+    delta.type = JournalDeltaType::RATIO;
+    delta.ratio = split->splitRatio;
+    delta.path = GetNodePath(split);
+    RecordJournalDelta(std::move(delta));
+}
+
+// A run of connected splits with the same orientation acts as one i3 container: its
+// segments, the subtrees hanging off the run, sit side by side in order. How the run is
+// nested does not show on screen, so when closing and opening windows has made a run too deep
+// it is rebuilt as a balanced tree over the same segments, with ratios that give every
+// segment the space it had. No split of a run may have part of the run further below it than
+// twice the minimum depth for its leaves, plus this much.
+const int GROUP_DEPTH_SLACK = 2;
+
+// Structure describing the segments of a run of same-orientation splits, in screen order
+struct SplitGroup {
+    LayoutNode* top = nullptr;
+    std::vector<LayoutNode*> segments;
+    std::vector<long long> extents;          // Size of each segment along the split axis
+    int gap = 0;
+    size_t focusedSegment = 0;
+};
+
+// Structure holding one split of a balanced rebuild, in preorder: it covers segments
+// [first, last] and its first child ends with segment mid
+struct GroupSplitPlan {
+    size_t first, last, mid;
+    int ratio;
+};
+
+// Function to get the smallest depth that fits count leaves in a binary tree
+int CeilLog2(size_t count) {
+    int depth = 0;
+    while ((static_cast<size_t>(1) << depth) < count) ++depth;
+    return depth;
+}
+
+// Function to check whether a node belongs to a run of splits of the given orientation
+bool IsGroupSplit(const LayoutNode* node, SplitType splitType) {
+    return node->isSplit && node->splitType == splitType;
+}
+
+// Function to collect the segments below a split of a run in screen order, with the size
+// each one gets when the split is extent long, rounded as ApplyLayout rounds it
+void CollectGroupSegments(LayoutNode* node, SplitType splitType, long long extent, SplitGroup& group) {
+    if (!IsGroupSplit(node, splitType)) {
+        group.segments.push_back(node);
+        group.extents.push_back(extent);
+        return;
+    }
+    long long available = extent - (std::min)(static_cast<long long>(group.gap), extent);
+    long long firstExtent = (available * node->splitRatio + RATIO_HALF) / RATIO_SCALE;
+    CollectGroupSegments(node->firstChild.get(), splitType, firstExtent, group);
+    CollectGroupSegments(node->secondChild.get(), splitType, available - firstExtent, group);
+}
+
+// Function to plan a balanced rebuild of segments [first, last]. Each split divides its
+// segments near the middle, moving off it (within the middle half) only to keep its ratio
+// in the range resize mode allows. Records the new path of every segment.
+void PlanBalancedGroup(const std::vector<long long>& prefix, int gap, size_t first, size_t last,
+                       std::vector<bool>& steps, std::vector<GroupSplitPlan>& plan,
+                       std::vector<std::vector<bool>>& newSteps) {
+    if (first == last) {
+        newSteps[first] = steps;
+        return;
+    }
+    auto extentOf = [&](size_t from, size_t to) {
+        return prefix[to + 1] - prefix[from] + static_cast<long long>(gap) * static_cast<long long>(to - from);
+    };
+    auto ratioAt = [&](size_t mid) {
+        long long available = extentOf(first, last) - gap;
+        if (available <= 0) return RATIO_HALF;
+        int ratio = static_cast<int>((extentOf(first, mid) * RATIO_SCALE + available / 2) / available);
+        return (std::max)(1, (std::min)(RATIO_SCALE - 1, ratio));
+    };
+
+    size_t count = last - first + 1;
+    size_t middle = first + count / 2 - 1;
+    size_t reach = count / 4;
+    size_t mid = middle;
+    for (size_t offset = 0; offset <= reach; ++offset) {
+        int below = (middle >= first + offset) ? ratioAt(middle - offset) : 0;
+        int above = (middle + offset < last) ? ratioAt(middle + offset) : 0;
+        if (below >= RATIO_MIN && below <= RATIO_MAX) { mid = middle - offset; break; }
+        if (above >= RATIO_MIN && above <= RATIO_MAX) { mid = middle + offset; break; }
+    }
+
+    plan.push_back(GroupSplitPlan{ first, last, mid, ratioAt(mid) });
+    steps.push_back(false);
+    PlanBalancedGroup(prefix, gap, first, mid, steps, plan, newSteps);
+    steps.back() = true;
+    PlanBalancedGroup(prefix, gap, mid + 1, last, steps, plan, newSteps);
+    steps.pop_back();
+}
+
+// Function to rewrite a stored path that leads into a rebuilt run. Returns false if it
+// pointed at one of the run's own splits, which no longer exist.
+bool RemapGroupPath(NodePath& path, const NodePath& topPath, const SplitGroup& group,
+                    const std::unordered_map<LayoutNode*, size_t>& segmentIndex,
+                    const std::vector<std::vector<bool>>& newSteps) {
+    if (path.depth < topPath.depth) return true;
+    for (uint32_t level = 0; level < topPath.depth; ++level) {
+        if (path.Step(level) != topPath.Step(level)) return true; // Not inside the run
+    }
+
+    LayoutNode* node = group.top;
+    uint32_t level = topPath.depth;
+    SplitType splitType = group.top->splitType;
+    while (IsGroupSplit(node, splitType) && level < path.depth) {
+        node = path.Step(level++) ? node->secondChild.get() : node->firstChild.get();
+    }
+    auto found = segmentIndex.find(node);
+    if (found == segmentIndex.end()) return false;
+
+    NodePath remapped;
+    for (uint32_t i = 0; i < topPath.depth; ++i) remapped.Push(path.Step(i));
+    for (bool step : newSteps[found->second]) remapped.Push(step);
+    for (uint32_t i = level; i < path.depth; ++i) remapped.Push(path.Step(i));
+    path = std::move(remapped);
+    return true;
+}
+
+// Function to keep stored history valid across the rebuild of a run. Operations that refer
+// to the run's own splits are dropped together with everything older.
+void RemapJournalForGroup(std::deque<JournalOperation>& journal, const NodePath& topPath, const SplitGroup& group,
+                          const std::unordered_map<LayoutNode*, size_t>& segmentIndex,
+                          const std::vector<std::vector<bool>>& newSteps) {
+    for (size_t i = journal.size(); i-- > 0;) {
+        bool valid = true;
+        for (JournalDelta& delta : journal[i].deltas) {
+            valid &= RemapGroupPath(delta.path, topPath, group, segmentIndex, newSteps);
+            if (delta.type == JournalDeltaType::SWAP) {
+                valid &= RemapGroupPath(delta.otherPath, topPath, group, segmentIndex, newSteps);
+            }
+        }
+        if (!valid) {
+            journal.erase(journal.begin(), journal.begin() + i + 1);
+            return;
+        }
+    }
+}
+
+// Function to build the splits of a planned run over its detached segments
+std::unique_ptr<LayoutNode> BuildPlannedGroup(SplitType splitType, const std::vector<GroupSplitPlan>& plan, size_t& next,
+                                              std::vector<std::unique_ptr<LayoutNode>>& segments, size_t focusedSegment) {
+    const GroupSplitPlan& split = plan[next];
+    std::unique_ptr<LayoutNode> first = (split.mid == split.first)
+        ? std::move(segments[split.first]) : BuildPlannedGroup(splitType, plan, ++next, segments, focusedSegment);
+    std::unique_ptr<LayoutNode> second = (split.mid + 1 == split.last)
+        ? std::move(segments[split.last]) : BuildPlannedGroup(splitType, plan, ++next, segments, focusedSegment);
+
+    auto node = std::make_unique<LayoutNode>(splitType, split.ratio, std::move(first), std::move(second));
+    node->firstChild->parent = node.get();
+    node->secondChild->parent = node.get();
+    node->focusSecond = (focusedSegment > split.mid);
+    return node;
+}
+
+// Function to rebuild a run of same-orientation splits, from top down, as a balanced tree
+// over the same segments. Each segment keeps its place and, up to rounding, its size; focus history points
+// at the segment that was focused last. Returns the new top of the run.
+LayoutNode* RebalanceSplitGroup(LayoutNode* top) {
+    SplitType splitType = top->splitType;
+    bool vertical = (splitType == SplitType::VERTICAL);
+    long long extent = vertical ? top->windowRect.right - top->windowRect.left : top->windowRect.bottom - top->windowRect.top;
+
+    SplitGroup group;
+    group.top = top;
+    if (extent > 0) {
+        group.gap = g_InnerGap;
+    } else {
+        extent = 1LL << 40; // Not laid out yet: keep the proportions the ratios give
+    }
+    CollectGroupSegments(top, splitType, extent, group);
+    size_t count = group.segments.size();
+
+    std::unordered_map<LayoutNode*, size_t> segmentIndex;
+    for (size_t i = 0; i < count; ++i) segmentIndex[group.segments[i]] = i;
+    LayoutNode* focused = top;
+    while (IsGroupSplit(focused, splitType)) {
+        focused = focused->focusSecond ? focused->secondChild.get() : focused->firstChild.get();
+    }
+    group.focusedSegment = segmentIndex[focused];
+
+    std::vector<long long> prefix(count + 1, 0);
+    for (size_t i = 0; i < count; ++i) prefix[i + 1] = prefix[i] + group.extents[i];
+    std::vector<GroupSplitPlan> plan;
+    std::vector<std::vector<bool>> newSteps(count);
+    std::vector<bool> steps;
+    PlanBalancedGroup(prefix, group.gap, 0, count - 1, steps, plan, newSteps);
+
+    // History is remapped while the old splits can still be walked
+    NodePath topPath = GetNodePath(top);
+    RemapJournalForGroup(g_UndoJournal, topPath, group, segmentIndex, newSteps);
+    RemapJournalForGroup(g_RedoJournal, topPath, group, segmentIndex, newSteps);
+
+    // Take the segments out of the old splits, then put the new splits in the run's place.
+    // Replacing the top destroys the old splits, which by then hold nothing.
+    std::vector<std::unique_ptr<LayoutNode>> detached(count);
+    for (size_t i = 0; i < count; ++i) detached[i] = std::move(GetOwningSlot(group.segments[i]));
+    LayoutNode* parent = top->parent;
+    RECT area = top->windowRect;
+    std::unique_ptr<LayoutNode>& slot = GetOwningSlot(top);
+
+    size_t next = 0;
+    slot = BuildPlannedGroup(splitType, plan, next, detached, group.focusedSegment);
+    slot->parent = parent;
+    slot->windowRect = area;
+    InvalidateNodeCounts(parent);
+    MarkLayoutChanged(slot.get());
+    CountMetric(Metric::GROUPS_REBALANCED);
+    return slot.get();
+}
+
+// Function to rebalance the run of splits a changed node belongs to, where it has become
+// too deep. Like a scapegoat tree, only the lowest split above the node that is too deep
+// for its leaves is rebuilt, with the part of the run below it, so the work stays in
+// proportion to the churn that caused it. Only walks from the node towards the top of its
+// run. Left alone while a user operation is being journaled, whose recorded paths must stay
+// as they are.
+void NormalizeAround(LayoutNode* node) {
+    if (!node || (g_JournalRecording && g_PendingJournalOp.origin != JournalOrigin::LIFECYCLE)) return;
+    if (!node->isSplit) node = node->parent;
+    if (!node) return;
+
+    SplitType splitType = node->splitType;
+    for (int depth = 0; ; ++depth) {
+        if (depth > 2 * CeilLog2(static_cast<size_t>(GetLeafCount(node))) + GROUP_DEPTH_SLACK) {
+            RebalanceSplitGroup(node);
+            return;
+        }
+        if (!node->parent || node->parent->splitType != splitType) return;
+        node = node->parent;
+    }
+}
+
+// Function to give every segment of each run of same-orientation splits below a node an
+// equal share of the run, like i3's balance. Journals the ratios it changes and returns how
+// many segments the node's own run has.
+size_t BalanceSubtree(LayoutNode* node) {
+    if (!node->isSplit) return 1;
+    size_t first = BalanceSubtree(node->firstChild.get());
+    size_t second = BalanceSubtree(node->secondChild.get());
+    if (!IsGroupSplit(node->firstChild.get(), node->splitType)) first = 1;
+    if (!IsGroupSplit(node->secondChild.get(), node->splitType)) second = 1;
+
+    int ratio = static_cast<int>(static_cast<long long>(RATIO_SCALE) * first / (first + second));
+    if (ratio != node->splitRatio) {
+        RecordRatioDelta(node);
+        node->splitRatio = ratio;
+        MarkLayoutChanged(node);
+    }
+    return first + second;
+}
+
+// Function to take a leaf out of the tree, collapsing its parent split into the remaining
+// sibling. Returns the node that took the parent's place, or nullptr if removing the last
+// leaf emptied the tree.
+LayoutNode* DetachLeaf(LayoutNode* leaf) {
+    if (leaf->parent) {
+        LayoutNode* parent = leaf->parent;
+        bool removedIsFirst = (parent->firstChild.get() == leaf);
+
+        bool journaled = JournalNeedsDelta();
+        JournalDelta delta;
+        if (journaled) {
+            delta.type = JournalDeltaType::REMOVAL;
+            delta.splitType = parent->splitType;
+            delta.ratio = parent->splitRatio;
+            delta.windowIsFirst = removedIsFirst;
+            delta.hwnd = leaf->hwnd;
+            delta.path = GetNodePath(parent);
+        }
+
+        // Replace parent with the sibling
+        LayoutNode* kept = CollapseSplit(parent, !removedIsFirst);
+        if (journaled) RecordJournalDelta(std::move(delta));
+        NodeHandle keptHandle = kept->handle;
+        NormalizeAround(kept);
+        return ResolveNode(keptHandle); // A rebalance may have rebuilt the kept split
+    }
+
+    // If the node to remove is root
+    root.reset();
+    g_LayoutSnapshotDirty = true;
+    ClearJournal();
+    return nullptr;
+}
+
+// Function to set a split's orientation and ratio, as a layout policy shapes the tree
+void SetSplitShape(LayoutNode* split, SplitType splitType, int splitRatio) {
+    if (split->splitType == splitType && split->splitRatio == splitRatio) return;
+    split->splitType = splitType;
+    split->splitRatio = splitRatio;
+    MarkLayoutChanged(split);
+}
+
+// Function to get the ratio that gives each leaf below a split the same share of it
+int LeafShareRatio(const LayoutNode* split) {
+    return static_cast<int>(static_cast<long long>(RATIO_SCALE) * GetLeafCount(split->firstChild.get()) / GetLeafCount(split));
+}
+
+// Layout policies decide where a new window goes, what happens to the tree when a window
+// leaves and how splits divide their area. LatticeWM has a single workspace, whose policy is
+// g_LayoutPolicy. Each policy is a struct of static functions that the insertion, removal
+// and layout code take as a template argument, so every policy gets its own compiled copy of
+// those paths and nothing in them dispatches at run time; WithLayoutPolicy picks the copy
+// once per call.
+enum class LayoutPolicy {
+    I3,           // Shallowest leaf, orientation alternating with depth
+    SPIRAL,       // Each window halves the previous one, turning around the screen
+    DWINDLE,      // Each window halves the previous one towards the bottom right
+    MASTER_STACK, // One master on the left, the others stacked in equal rows on the right
+    GRID          // Equal tiles, each split across the longer side of its area
+};
+
+const char* const LAYOUT_POLICY_NAMES[] = { "i3", "spiral", "dwindle", "master-stack", "grid" };
+
+LayoutPolicy g_LayoutPolicy = LayoutPolicy::I3;
+
+// Structure describing where a policy puts a new window
+struct InsertionPoint {
+    LayoutNode* node = nullptr; // Wrapped in a new split with the window
+    SplitType splitType = SplitType::VERTICAL;
+    int splitRatio = RATIO_HALF;
+    bool windowIsFirst = false;
+};
+
+// Function to find the shallowest leaf holding a window, leftmost among equals, which is
+// where a breadth-first walk would stop. Follows windowLeafDepth, so it costs the depth of
+// the tree. Returns nullptr if no leaf holds a window.
+LayoutNode* FindShallowestWindowLeaf(int* depth) {
+    LayoutNode* node = root.get();
+    if (!node || GetWindowLeafDepth(node) == NO_WINDOW_LEAF) return nullptr;
+    *depth = 0;
+    while (node->isSplit) {
+        node = (GetWindowLeafDepth(node->firstChild.get()) <= GetWindowLeafDepth(node->secondChild.get()))
+            ? node->firstChild.get() : node->secondChild.get();
+        ++*depth;
+    }
+    return node;
+}
+
+// Function to find the shallowest placeholder, which takes a window only when no leaf holds
+// one. Rare enough to walk the tree breadth-first.
+InsertionPoint FindPlaceholderInsertion(int splitRatio) {
+    std::queue<QueueItem> nodeQueue;
+    if (root) nodeQueue.push(QueueItem{ root.get(), 0 });
+    while (!nodeQueue.empty()) {
+        QueueItem item = nodeQueue.front();
+        nodeQueue.pop();
+        if (!item.node->isSplit) {
+            SplitType splitType = (item.depth % 2 == 0) ? SplitType::HORIZONTAL : SplitType::VERTICAL;
+            return InsertionPoint{ item.node, splitType, splitRatio, false };
+        }
+        nodeQueue.push(QueueItem{ item.node->firstChild.get(), item.depth + 1 });
+        nodeQueue.push(QueueItem{ item.node->secondChild.get(), item.depth + 1 });
+    }
+    return InsertionPoint();
+}
+
+// i3-style default: a new window splits the shallowest leaf, across its area at even depths
+// and along it at odd ones, and comes second. Ratios are left as set.
+struct I3Layout {
+    static constexpr bool RESHAPES = false; // Whether Shape may change splits outside a subtree's own
+    static constexpr bool OWNS_SHAPE = false; // Whether a tree built by another policy has to be rebuilt
+
+    static InsertionPoint FindInsertion(int splitRatio) {
+        int depth = 0;
+        LayoutNode* leaf = FindShallowestWindowLeaf(&depth);
+        if (!leaf) return InsertionPoint();
+        SplitType splitType = (depth % 2 == 0) ? SplitType::HORIZONTAL : SplitType::VERTICAL;
+        return InsertionPoint{ leaf, splitType, splitRatio, false };
+    }
+
+    static void Inserted(LayoutNode*) {}
+
+    static void Remove(LayoutNode* leaf) { DetachLeaf(leaf); }
+
+    static bool Move(LayoutNode* leaf, Direction dir) { return MoveLeafInContainers(leaf, dir); }
+
+    static void Shape(LayoutNode*, const RECT&) {}
+};
+
+// Leaf the spiral continues from, normally the window added last
+NodeHandle g_SpiralTail;
+
+// Spiral and dwindle: a new window halves the window added before it, alternating the
+// orientation. Dwindle always puts the new window second (right, then below); spiral puts
+// it first every other turn, so the windows wind inwards around the screen.
+template <bool Rotate>
+struct SpiralLayout : I3Layout {
+    static constexpr bool OWNS_SHAPE = true;
+
+    // Function to find where the spiral ends when the last window added is gone: follow the
+    // larger side of every split
+    static LayoutNode* FindTail() {
+        LayoutNode* node = root.get();
+        while (node && node->isSplit) {
+            node = (GetLeafCount(node->firstChild.get()) > GetLeafCount(node->secondChild.get()))
+                ? node->firstChild.get() : node->secondChild.get();
+        }
+        return node;
+    }
+
+    static InsertionPoint FindInsertion(int splitRatio) {
+        LayoutNode* tail = ResolveNode(g_SpiralTail);
+        if (!tail || tail->isSplit) tail = FindTail();
+        if (!tail || !tail->hwnd) return I3Layout::FindInsertion(splitRatio);
+
+        // The turn is read off the split the tail sits in: the orientation alternates, and
+        // a spiral changes side after every horizontal split
+        LayoutNode* parent = tail->parent;
+        if (!parent) return InsertionPoint{ tail, SplitType::VERTICAL, splitRatio, false };
+        bool tailIsFirst = (parent->firstChild.get() == tail);
+        bool horizontal = (parent->splitType == SplitType::HORIZONTAL);
+        bool windowIsFirst = Rotate && (horizontal ? !tailIsFirst : tailIsFirst);
+        return InsertionPoint{ tail, horizontal ? SplitType::VERTICAL : SplitType::HORIZONTAL,
+                               splitRatio, windowIsFirst };
+    }
+
+    static void Inserted(LayoutNode* leaf) { g_SpiralTail = leaf->handle; }
+
+    // A window trades places with its neighbor, so the spiral keeps its turns
+    static bool Move(LayoutNode* leaf, Direction dir) { return SwapWithAdjacent(leaf, dir); }
+};
+
+// Master-stack, as in dwm: the root splits the master on the left from the stack on the
+// right, and every other window shares the stack in equal rows. New windows join the top of
+// the stack. When the master closes, the top of the stack takes its place. The master's
+// width is the root's ratio and can be resized; the stack's ratios follow its window count.
+struct MasterStackLayout : I3Layout {
+    static constexpr bool RESHAPES = true;
+    static constexpr bool OWNS_SHAPE = true;
+
+    static InsertionPoint FindInsertion(int splitRatio) {
+        if (!root->isSplit) return InsertionPoint{ root.get(), SplitType::VERTICAL, splitRatio, false };
+        return InsertionPoint{ root->secondChild.get(), SplitType::HORIZONTAL, splitRatio, true };
+    }
+
+    static void Remove(LayoutNode* leaf) {
+        bool wasMaster = root->isSplit && root->firstChild.get() == leaf;
+        int masterRatio = root->splitRatio;
+        DetachLeaf(leaf);
+        if (!wasMaster || !root || !root->isSplit) return;
+
+        LayoutNode* top = root.get();
+        while (top->isSplit) top = top->firstChild.get();
+        HWND promoted = top->hwnd;
+        if (!promoted) return;
+
+        bool wasFocused = (ResolveNode(g_FocusedLeaf) == top);
+        DetachLeaf(top);
+        LayoutNode* split = WrapInSplit(root.get(), promoted, SplitType::VERTICAL, masterRatio, true);
+        RecordSplitDelta(split, true);
+        if (wasFocused) SetFocusedLeaf(split->firstChild.get());
+    }
+
+    // Function to move a window as in dwm: the master trades places with the top of the
+    // stack when moved right, a stacked window trades places with the master when moved left
+    // and with its neighbor in the stack when moved up or down. Other moves are refused.
+    static bool Move(LayoutNode* leaf, Direction dir) {
+        if (root->isSplit && root->splitType == SplitType::VERTICAL) {
+            LayoutNode* master = root->firstChild.get();
+            LayoutNode* stack = root->secondChild.get();
+            if (leaf == master && dir == Direction::RIGHT) {
+                LayoutNode* top = stack;
+                while (top->isSplit) top = top->firstChild.get();
+                return SwapWindowHandles(leaf, top);
+            }
+            if (leaf != master && IsInSubtree(leaf, stack)) {
+                if (dir == Direction::LEFT && !master->isSplit) return SwapWindowHandles(leaf, master);
+                if (dir == Direction::UP || dir == Direction::DOWN) {
+                    LayoutNode* adjacent = FindAdjacent(leaf, dir);
+                    if (adjacent && IsInSubtree(adjacent, stack)) return SwapWithAdjacent(leaf, dir);
+                }
+            }
+        }
+        std::cout << "MoveWindowInDirection: Master-stack has no place to the "
+                  << GetDirectionName(dir) << " for this window.\n";
+        return false;
+    }
+
+    // Function to give every leaf of a stack subtree an equal share of it
+    static void ShareEqually(LayoutNode* node) {
+        if (!node->isSplit) return;
+        SetSplitShape(node, node->splitType, LeafShareRatio(node));
+        ShareEqually(node->firstChild.get());
+        ShareEqually(node->secondChild.get());
+    }
+
+    static void Shape(LayoutNode* node, const RECT&) {
+        if (!root || !root->isSplit) return;
+        LayoutNode* stack = root->secondChild.get();
+        if (node == root.get()) ShareEqually(stack);
+        else if (IsInSubtree(node, stack)) ShareEqually(node);
+    }
+};
+
+// Grid: windows fill the shallowest leaves as in the default policy, and every split gives
+// each leaf below it an equal share, across the longer side of its area, so the tiles come
+// out equal and close to square.
+struct GridLayout : I3Layout {
+    static constexpr bool RESHAPES = true;
+
+    static void Shape(LayoutNode* node, const RECT& area) {
+        if (!node->isSplit) return;
+        bool vertical = (area.right - area.left) >= (area.bottom - area.top);
+        int ratio = LeafShareRatio(node);
+        SetSplitShape(node, vertical ? SplitType::VERTICAL : SplitType::HORIZONTAL, ratio);
+
+        RECT first = area, second = area;
+        if (vertical) {
+            first.right = second.left = area.left + static_cast<int>(static_cast<long long>(area.right - area.left) * ratio / RATIO_SCALE);
+        } else {
+            first.bottom = second.top = area.top + static_cast<int>(static_cast<long long>(area.bottom - area.top) * ratio / RATIO_SCALE);
+        }
+        Shape(node->firstChild.get(), first);
+        Shape(node->secondChild.get(), second);
+    }
+
+    // A window trades places with its neighbor, so the tiles stay equal
+    static bool Move(LayoutNode* leaf, Direction dir) { return SwapWithAdjacent(leaf, dir); }
+};
+
+// Function to call a generic visitor with the policy type of the workspace
+template <typename Visitor>
+auto WithLayoutPolicy(Visitor&& visit) {
+    switch (g_LayoutPolicy) {
+        case LayoutPolicy::SPIRAL:       return visit(SpiralLayout<true>());
+        case LayoutPolicy::DWINDLE:      return visit(SpiralLayout<false>());
+        case LayoutPolicy::MASTER_STACK: return visit(MasterStackLayout());
+        case LayoutPolicy::GRID:         return visit(GridLayout());
+        default:                         return visit(I3Layout());
+    }
+}
+
+// Function to add a new window where a policy puts it. Placeholders keep the space reserved
+// for their window, unless there is nothing else.
+template <typename Policy>
+void InsertWindow(HWND newWindow, int splitRatio) {
+    if (!root) {
+        // If root is not initialized, initialize with the new window
+        root = std::make_unique<LayoutNode>(newWindow);
+        MarkLayoutChanged(root.get());
+        ClearJournal();
+        Policy::Inserted(root.get());
+        return;
+    }
+
+    InsertionPoint point = Policy::FindInsertion(splitRatio);
+    if (!point.node) point = FindPlaceholderInsertion(splitRatio);
+    if (!point.node) return;
+
+    LayoutNode* split = WrapInSplit(point.node, newWindow, point.splitType, point.splitRatio, point.windowIsFirst);
+    RecordSplitDelta(split, point.windowIsFirst);
+    LayoutNode* leaf = point.windowIsFirst ? split->firstChild.get() : split->secondChild.get();
+    NormalizeAround(split);
+    Policy::Inserted(leaf);
+}
+
+// Function to add a new window using the workspace's layout policy
+void AddWindowToLayout(HWND newWindow, int splitRatio) {
+    WithLayoutPolicy([&](auto policy) { InsertWindow<decltype(policy)>(newWindow, splitRatio); });
+}
+
+// Function to add a new window using breadth-first split strategy with depth tracking, the
+// placement of the default policy
+void AddWindowBreadthFirst(HWND newWindow, int splitRatio) {
+    InsertWindow<I3Layout>(newWindow, splitRatio);
+}
+
+// Function to check whether the workspace's policy may reshape splits outside the subtree
+// being laid out, in which case only a full relayout is exact
+bool LayoutPolicyReshapes() {
+    return WithLayoutPolicy([](auto policy) { return decltype(policy)::RESHAPES; });
+}
+
+// Function to rebuild the tree from its windows, in their current order, as a policy would
+// have built it. Placeholders and undo history refer to the old tree and are dropped.
+template <typename Policy>
+void RebuildLayoutWith() {
+    std::vector<LayoutNode*> leaves;
+    CollectLeafNodes(root.get(), leaves);
+    std::vector<HWND> windows;
+    for (LayoutNode* leaf : leaves) windows.push_back(leaf->hwnd);
+
+    HWND focused = g_FocusedWindow;
+    g_FocusedLeaf = NodeHandle();
+    g_SpiralTail = NodeHandle();
+    ClearPlaceholders();
+    root.reset();
+    g_LayoutSnapshotDirty = true;
+    for (HWND hwnd : windows) InsertWindow<Policy>(hwnd, RATIO_HALF);
+    ClearJournal();
+
+    if (LayoutNode* leaf = FindLayoutNode(root.get(), focused)) SetFocusedLeaf(leaf);
+}
+
+// Function to switch the workspace's layout policy. A policy that keeps a shape of its own
+// gets the open windows rebuilt into it rather than taking over a tree it did not build.
+// Refused while a window is fullscreen. Returns false if the switch was refused.
+bool SetLayoutPolicy(LayoutPolicy policy) {
+    LayoutPolicy previous = g_LayoutPolicy;
+    g_LayoutPolicy = policy;
+    if (policy == previous || !root || !root->isSplit) return true;
+    if (!WithLayoutPolicy([](auto policy) { return decltype(policy)::OWNS_SHAPE; })) return true;
+
+    if (ResolveNode(g_FullscreenLeaf)) {
+        g_LayoutPolicy = previous;
+        std::cerr << "SetLayoutPolicy: Leave fullscreen before switching to "
+                  << LAYOUT_POLICY_NAMES[static_cast<int>(policy)] << ".\n";
+        return false;
+    }
+    WithLayoutPolicy([](auto policy) { RebuildLayoutWith<decltype(policy)>(); });
+    std::cout << "SetLayoutPolicy: Rebuilt the layout for " << LAYOUT_POLICY_NAMES[static_cast<int>(policy)] << ".\n";
+    return true;
+}
+
+// Function to look up a policy by its name. Returns false for an unknown name.
+bool ParseLayoutPolicy(const std::string& name, LayoutPolicy& policy) {
+    for (size_t i = 0; i < sizeof(LAYOUT_POLICY_NAMES) / sizeof(LAYOUT_POLICY_NAMES[0]); ++i) {
+        if (name == LAYOUT_POLICY_NAMES[i]) {
+            policy = static_cast<LayoutPolicy>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Placeholders, as created by i3's append_layout: leaves without a window that are filled
+// ("swallowed") by the first new window matching their criteria. A layout file describes a
+// tree of splits and placeholders, indented two spaces per level:
+//
+//   split vertical 60
+//     window class=Chrome_WidgetWin_1 title="* - Mail"
+//     split horizontal
+//       window process=WindowsTerminal.exe
+//       window title="*.txt - Notepad"
+//
+// A split takes the percentage of its first child (default 50) and has exactly two children.
+// class and process match exactly, title is a pattern with '*' and '?'. Criteria left out
+// match anything.
+struct Placeholder {
+    NodeHandle leaf;
+    std::string className;
+    std::string processName;
+    std::string titlePattern;
+    std::string indexKey;     // Bucket in g_PlaceholderIndex, empty if unindexed
+};
+
+// Placeholders by id. Ids follow load order, which is also the order placeholders are filled
+// in when several match.
+std::unordered_map<uint64_t, Placeholder> g_Placeholders;
+uint64_t g_NextPlaceholderId = 1;
+
+// Placeholders keyed by their most selective exact-match field ("c:" class or "p:" process),
+// so a new window only checks the few placeholders that can match it. Placeholders with only
+// a title pattern (or no criteria) are kept apart and checked for every window.
+std::unordered_map<std::string, std::vector<uint64_t>> g_PlaceholderIndex;
+std::vector<uint64_t> g_UnindexedPlaceholders;
+size_t g_PlaceholderCandidatesChecked = 0;
+
+// Function to match a title against a pattern with '*' (any run) and '?' (any character)
+bool MatchTitlePattern(const std::string& pattern, const std::string& title) {
+    size_t p = 0, t = 0, starP = std::string::npos, starT = 0;
+    while (t < title.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == title[t])) {
+            ++p;
+            ++t;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            starP = p++;
+            starT = t;
+        } else if (starP != std::string::npos) {
+            p = starP + 1;
+            t = ++starT;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') ++p;
+    return p == pattern.size();
+}
+
+// Function to forget all placeholders, for when the tree holding them is replaced
+void ClearPlaceholders() {
+    g_Placeholders.clear();
+    g_PlaceholderIndex.clear();
+    g_UnindexedPlaceholders.clear();
+}
+
+// Function to register a placeholder leaf with its criteria
+void AddPlaceholder(Placeholder placeholder) {
+    uint64_t id = g_NextPlaceholderId++;
+    if (!placeholder.className.empty()) placeholder.indexKey = "c:" + placeholder.className;
+    else if (!placeholder.processName.empty()) placeholder.indexKey = "p:" + placeholder.processName;
+
+    if (placeholder.indexKey.empty()) g_UnindexedPlaceholders.push_back(id);
+    else g_PlaceholderIndex[placeholder.indexKey].push_back(id);
+    g_Placeholders.emplace(id, std::move(placeholder));
+}
+
+// Function to find the earliest-loaded placeholder a window matches. Returns 0 if none.
+uint64_t FindPlaceholderFor(HWND hwnd) {
+    if (g_Placeholders.empty()) return 0;
+
+    const WindowProperties& properties = GetWindowProperties(hwnd);
+    uint64_t best = 0;
+    auto consider = [&](const std::vector<uint64_t>& candidates) {
+        for (uint64_t id : candidates) {
+            if (best != 0 && id > best) break; // Buckets are in load order
+            ++g_PlaceholderCandidatesChecked;
+            const Placeholder& placeholder = g_Placeholders.at(id);
+            if (!placeholder.className.empty() && placeholder.className != *properties.className) continue;
+            if (!placeholder.processName.empty() && placeholder.processName != *properties.processName) continue;
+            if (!placeholder.titlePattern.empty() && !MatchTitlePattern(placeholder.titlePattern, *properties.title)) continue;
+            best = id;
+            break;
+        }
+    };
+
+    auto byClass = g_PlaceholderIndex.find("c:" + *properties.className);
+    if (byClass != g_PlaceholderIndex.end()) consider(byClass->second);
+    auto byProcess = g_PlaceholderIndex.find("p:" + *properties.processName);
+    if (byProcess != g_PlaceholderIndex.end()) consider(byProcess->second);
+    consider(g_UnindexedPlaceholders);
+    return best;
+}
+
+// Function to put a new window into the placeholder it matches, if any. The placeholder's tile
+// was laid out when the layout was loaded, so only the new window moves. Returns false if no
+// placeholder matches.
+bool SwallowIntoPlaceholder(HWND hwnd) {
+    uint64_t id = FindPlaceholderFor(hwnd);
+    if (id == 0) return false;
+
+    auto it = g_Placeholders.find(id);
+    LayoutNode* leaf = ResolveNode(it->second.leaf);
+    std::vector<uint64_t>& bucket = it->second.indexKey.empty()
+        ? g_UnindexedPlaceholders : g_PlaceholderIndex[it->second.indexKey];
+    bucket.erase(std::find(bucket.begin(), bucket.end(), id));
+    if (bucket.empty() && !it->second.indexKey.empty()) g_PlaceholderIndex.erase(it->second.indexKey);
+    g_Placeholders.erase(it);
+
+    // A placeholder whose leaf left the tree is dropped, and the next match is tried
+    if (!leaf) return SwallowIntoPlaceholder(hwnd);
+
+    leaf->hwnd = hwnd;
+    InvalidateNodeCounts(leaf);
+    MarkLayoutChanged(leaf);
+    std::cout << "SwallowIntoPlaceholder: HWND=0x" << std::hex << hwnd << std::dec << " filled a placeholder.\n";
+
+    if (ResolveNode(g_FullscreenLeaf)) {
+        TileWindows(GetScreenRect()); // Deferred until fullscreen ends
+    } else {
+        ApplyLayout(leaf, leaf->windowRect);
+    }
+    return true;
+}
+
+// Function to read one "key=value" or key="quoted value" field from a layout line
+bool ReadLayoutField(const std::string& line, size_t& pos, std::string& key, std::string& value) {
+    while (pos < line.size() && line[pos] == ' ') ++pos;
+    if (pos >= line.size()) return false;
+
+    size_t equals = line.find('=', pos);
+    if (equals == std::string::npos) return false;
+    key = line.substr(pos, equals - pos);
+    pos = equals + 1;
+
+    if (pos < line.size() && line[pos] == '"') {
+        size_t close = line.find('"', pos + 1);
+        if (close == std::string::npos) return false;
+        value = line.substr(pos + 1, close - pos - 1);
+        pos = close + 1;
+    } else {
+        size_t end = line.find(' ', pos);
+        if (end == std::string::npos) end = line.size();
+        value = line.substr(pos, end - pos);
+        pos = end;
+    }
+    return true;
+}
+
+// One non-empty line of a layout file
+struct LayoutLine {
+    int indent;
+    std::string text;
+    int number;
+};
+
+// Function to build the subtree starting at lines[index], registering its placeholders.
+// Returns nullptr on a malformed layout.
+std::unique_ptr<LayoutNode> ParseLayoutNode(const std::vector<LayoutLine>& lines, size_t& index,
+                                            std::vector<Placeholder>& placeholders) {
+    const LayoutLine& line = lines[index++];
+
+    if (line.text.compare(0, 6, "window") == 0) {
+        Placeholder placeholder{ NodeHandle(), "", "", "", "" };
+        size_t pos = 6;
+        std::string key, value;
+        while (ReadLayoutField(line.text, pos, key, value)) {
+            if (key == "class") placeholder.className = value;
+            else if (key == "process") placeholder.processName = value;
+            else if (key == "title") placeholder.titlePattern = value;
+            else {
+                std::cerr << "LoadLayout: Line " << line.number << ": Unknown criterion \"" << key << "\".\n";
+                return nullptr;
+            }
+        }
+        auto leaf = std::make_unique<LayoutNode>(static_cast<HWND>(nullptr));
+        placeholder.leaf = leaf->handle;
+        placeholders.push_back(std::move(placeholder));
+        return leaf;
+    }
+
+    if (line.text.compare(0, 5, "split") != 0) {
+        std::cerr << "LoadLayout: Line " << line.number << ": Expected \"split\" or \"window\".\n";
+        return nullptr;
+    }
+
+    SplitType splitType = (line.text.find("horizontal") != std::string::npos) ? SplitType::HORIZONTAL : SplitType::VERTICAL;
+    int percent = 50;
+    size_t digits = line.text.find_first_of("0123456789");
+    if (digits != std::string::npos) percent = std::atoi(line.text.c_str() + digits);
+    int ratio = (std::max)(RATIO_MIN, (std::min)(RATIO_MAX, percent * (RATIO_SCALE / 100)));
+
+    std::unique_ptr<LayoutNode> children[2];
+    for (auto& child : children) {
+        if (index >= lines.size() || lines[index].indent <= line.indent) {
+            std::cerr << "LoadLayout: Line " << line.number << ": A split needs two children.\n";
+            return nullptr;
+        }
+        child = ParseLayoutNode(lines, index, placeholders);
+        if (!child) return nullptr;
+    }
+    if (index < lines.size() && lines[index].indent > line.indent) {
+        std::cerr << "LoadLayout: Line " << lines[index].number << ": A split has only two children.\n";
+        return nullptr;
+    }
+
+    auto split = std::make_unique<LayoutNode>(splitType, ratio, std::move(children[0]), std::move(children[1]));
+    split->firstChild->parent = split.get();
+    split->secondChild->parent = split.get();
+    return split;
+}
+
+// Function to append a layout of placeholders to the tree and lay it out once. With an empty
+// tree the layout becomes the tree; otherwise it takes the right half of the screen.
+bool LoadLayout(const std::string& text) {
+    std::vector<LayoutLine> lines;
+    int number = 0;
+    for (size_t start = 0; start < text.size();) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) end = text.size();
+        std::string raw = text.substr(start, end - start);
+        start = end + 1;
+        ++number;
+
+        if (!raw.empty() && raw.back() == '\r') raw.pop_back();
+        size_t first = raw.find_first_not_of(' ');
+        if (first == std::string::npos || raw[first] == '#') continue;
+        lines.push_back(LayoutLine{ static_cast<int>(first), raw.substr(first), number });
+    }
+    if (lines.empty()) {
+        std::cerr << "LoadLayout: Layout is empty.\n";
+        return false;
+    }
+
+    size_t index = 0;
+    std::vector<Placeholder> placeholders;
+    std::unique_ptr<LayoutNode> loaded = ParseLayoutNode(lines, index, placeholders);
+    if (!loaded) return false;
+    if (index < lines.size()) {
+        std::cerr << "LoadLayout: Line " << lines[index].number << ": Only one top-level node is allowed.\n";
+        return false;
+    }
+
+    if (!root) {
+        root = std::move(loaded);
+    } else {
+        std::unique_ptr<LayoutNode> existing = std::move(root);
+        root = std::make_unique<LayoutNode>(SplitType::VERTICAL, RATIO_HALF, std::move(existing), std::move(loaded));
+        root->firstChild->parent = root.get();
+        root->secondChild->parent = root.get();
+    }
+    MarkLayoutChanged(root.get());
+    ClearJournal(); // Recorded paths do not survive the new root
+
+    for (Placeholder& placeholder : placeholders) {
+        AddPlaceholder(std::move(placeholder));
+    }
+    std::cout << "LoadLayout: Loaded " << placeholders.size() << " placeholders.\n";
+
+    TileWindows(GetScreenRect());
+    return true;
+}
+
+// Function to load a layout file
+bool LoadLayoutFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "LoadLayoutFile: Failed to open \"" << path << "\".\n";
+        return false;
+    }
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return LoadLayout(text);
+}
+
+
+// Function to determine the split type based on direction
+SplitType GetSplitTypeFromDirection(Direction dir) {
+    switch (dir) {
+        case Direction::LEFT:
+        case Direction::RIGHT:
+            return SplitType::VERTICAL;
+        case Direction::UP:
+        case Direction::DOWN:
+            return SplitType::HORIZONTAL;
+        default:
+            return SplitType::VERTICAL; // Default fallback
+    }
+}
+
+void CombineChildConstraints(LayoutNode* node);
+
+// Function to refresh the size limits of every node in a subtree from its windows'
+void UpdateSubtreeConstraints(LayoutNode* node) {
+    if (!node) return;
+
+    if (!node->isSplit) {
+        auto it = g_WindowSizeConstraints.find(node->hwnd);
+        node->subtreeConstraints = (it != g_WindowSizeConstraints.end()) ? it->second : SizeConstraints();
+        return;
+    }
+
+    UpdateSubtreeConstraints(node->firstChild.get());
+    UpdateSubtreeConstraints(node->secondChild.get());
+    CombineChildConstraints(node);
+}
+
+// Function to work out a split's size limits from its children's, which are up to date
+void CombineChildConstraints(LayoutNode* node) {
+    const SizeConstraints& first = node->firstChild->subtreeConstraints;
+    const SizeConstraints& second = node->secondChild->subtreeConstraints;
+    bool vertical = (node->splitType == SplitType::VERTICAL);
+    const AxisConstraint& firstAlong = vertical ? first.width : first.height;
+    const AxisConstraint& secondAlong = vertical ? second.width : second.height;
+    const AxisConstraint& firstAcross = vertical ? first.height : first.width;
+    const AxisConstraint& secondAcross = vertical ? second.height : second.width;
+
+    // Along the split the children's sizes add up; across it both must fit the same size
+    AxisConstraint along;
+    along.minSize = firstAlong.minSize + g_InnerGap + secondAlong.minSize;
+    along.maxSize = (std::min)(UNBOUNDED_SIZE, firstAlong.maxSize + g_InnerGap + secondAlong.maxSize);
+
+    AxisConstraint across;
+    across.minSize = (std::max)(firstAcross.minSize, secondAcross.minSize);
+    across.maxSize = (std::max)(across.minSize, (std::min)(firstAcross.maxSize, secondAcross.maxSize));
+
+    node->subtreeConstraints.width = vertical ? along : across;
+    node->subtreeConstraints.height = vertical ? across : along;
+}
+
+// Function to pick the size of a split's first child along the split axis. Honors both
+// children's limits when they can all be met; otherwise minimums win over the ratio, and
+// if even those do not fit, space is shared in proportion to them.
+int SolveSplitSize(int total, int ratio, const AxisConstraint& first, const AxisConstraint& second) {
+    // Exact integer share, rounded to the nearest pixel. Whatever the rounding leaves over
+    // goes to the second child, so the children always cover the split exactly.
+    int size = static_cast<int>((static_cast<long long>(total) * ratio + RATIO_HALF) / RATIO_SCALE);
+
+    int low = (std::max)(first.minSize, total - second.maxSize);
+    int high = (std::min)(first.maxSize, total - second.minSize);
+    if (low <= high) {
+        size = (std::max)(low, (std::min)(size, high));
+
+        // Land on a child's size grid if that stays within the limits, so it does not snap
+        // and leave a seam
+        if (first.increment > 1) {
+            int snapped = FitSizeToConstraint(size, first);
+            if (snapped >= low && snapped <= high) size = snapped;
+        }
+        else if (second.increment > 1) {
+            int snapped = total - FitSizeToConstraint(total - size, second);
+            if (snapped >= low && snapped <= high) size = snapped;
+        }
+        return size;
+    }
+
+    long long minimums = static_cast<long long>(first.minSize) + second.minSize;
+    if (minimums > total && minimums > 0) {
+        return static_cast<int>(static_cast<long long>(total) * first.minSize / minimums);
+    }
+
+    // Both maximums are too small to fill the area: each side gets its maximum and the rest
+    // stays empty
+    return (std::min)(first.maxSize, total);
+}
+
+// Function to divide a split's area between its children, whose subtree constraints are up
+// to date. The inner gap comes out of the space first, so both children are sized from what
+// is left and the gap always stays exactly g_InnerGap wide.
+void SolveSplitAreas(const LayoutNode* node, const RECT& area, RECT& firstArea, RECT& secondArea) {
+    const SizeConstraints& first = node->firstChild->subtreeConstraints;
+    const SizeConstraints& second = node->secondChild->subtreeConstraints;
+
+    if (node->splitType == SplitType::VERTICAL) {
+        int gap = (std::min)(g_InnerGap, static_cast<int>(area.right - area.left));
+        int splitPos = area.left + SolveSplitSize(area.right - area.left - gap, node->splitRatio, first.width, second.width);
+        firstArea = { area.left, area.top, splitPos, area.bottom };
+        secondArea = { splitPos + gap, area.top, area.right, area.bottom };
+    }
+    else { // SplitType::HORIZONTAL
+        int gap = (std::min)(g_InnerGap, static_cast<int>(area.bottom - area.top));
+        int splitPos = area.top + SolveSplitSize(area.bottom - area.top - gap, node->splitRatio, first.height, second.height);
+        firstArea = { area.left, area.top, area.right, splitPos };
+        secondArea = { area.left, splitPos + gap, area.right, area.bottom };
+    }
+}
+
+// Function to refresh the size limits of a changed subtree and of every split above it
+void UpdateConstraintsUpward(LayoutNode* node) {
+    UpdateSubtreeConstraints(node);
+    for (LayoutNode* split = node->parent; split; split = split->parent) CombineChildConstraints(split);
+}
+
+// Function to check whether the splits above a node, solved again with their current size
+// limits, still give the node the area it covers. If they do, the node can be laid out on
+// its own and the result matches laying out the whole tree.
+bool KeepsItsArea(const LayoutNode* node) {
+    for (; node->parent; node = node->parent) {
+        RECT firstArea, secondArea;
+        SolveSplitAreas(node->parent, node->parent->windowRect, firstArea, secondArea);
+        const RECT& expected = (node->parent->firstChild.get() == node) ? firstArea : secondArea;
+        if (!EqualRects(expected, node->windowRect)) return false;
+    }
+    return true;
+}
+
+// Function to apply the layout below a node whose subtree constraints are up to date
+void ApplyLayoutSolved(LayoutNode* node, RECT area) {
+    if (!node) return;
+
+    if (!node->isSplit) {
+        // This is a leaf node; move the window to the specified area, trimmed to what the
+        // window accepts so it has no reason to resize itself afterwards
+        if (node->hwnd != nullptr) {
+            const SizeConstraints& limits = node->subtreeConstraints;
+            RECT fitted = area;
+            fitted.right = area.left + FitSizeToConstraint(area.right - area.left, limits.width);
+            fitted.bottom = area.top + FitSizeToConstraint(area.bottom - area.top, limits.height);
+
+            if (MoveWindowNormalized(node->hwnd, fitted.left, fitted.top,
+                fitted.right - fitted.left, fitted.bottom - fitted.top)) {
+                // Store the tile rather than the trimmed window, so the leaf can be laid out
+                // again on its own
+                if (!EqualRects(node->windowRect, area)) {
+                    node->windowRect = area;
+                    MarkLayoutChanged(node);
+                }
+            }
+        }
+        else if (!EqualRects(node->windowRect, area)) {
+            // A placeholder keeps its tile for the window that will fill it
+            node->windowRect = area;
+            MarkLayoutChanged(node);
+        }
+        return;
+    }
+
+    // Remember the area of the split so its subtree can be laid out on its own
+    if (!EqualRects(node->windowRect, area)) {
+        node->windowRect = area;
+        MarkLayoutChanged(node);
+    }
+
+    RECT firstArea, secondArea;
+    SolveSplitAreas(node, area, firstArea, secondArea);
+    ApplyLayoutSolved(node->firstChild.get(), firstArea);
+    ApplyLayoutSolved(node->secondChild.get(), secondArea);
+}
+
+// Function to apply the layout by traversing the tree, after letting a policy shape it
+template <typename Policy>
+void ApplyLayoutWith(LayoutNode* node, RECT area) {
+    Policy::Shape(node, area);
+    UpdateSubtreeConstraints(node);
+    ApplyLayoutSolved(node, area);
+
+    // A window that refused its size has taught us its limits; one more solve places it
+    // and its neighbors accordingly. Only one extra solve is ever made, so a window that
+    // keeps changing its mind cannot start a resize loop.
+    if (g_SizeConstraintsChanged) {
+        g_SizeConstraintsChanged = false;
+        UpdateSubtreeConstraints(node);
+        ApplyLayoutSolved(node, area);
+        g_SizeConstraintsChanged = false;
+    }
+}
+
+// Function to apply the layout with the workspace's layout policy
+void ApplyLayout(LayoutNode* node, RECT area) {
+    if (!node) return;
+    WithLayoutPolicy([&](auto policy) { ApplyLayoutWith<decltype(policy)>(node, area); });
+}
+
+// Function to get the area available for tiling on a screen, inside the outer gap
+RECT GetTilingArea(const RECT& screenRect) {
+    RECT area = screenRect;
+    if (g_BarEnabled) area.top = (std::min)(area.bottom, area.top + BAR_HEIGHT);
+    int gap = (std::max)(0, (std::min)(g_OuterGap,
+        static_cast<int>((std::min)(area.right - area.left, area.bottom - area.top) / 2)));
+    return RECT{ area.left + gap, area.top + gap, area.right - gap, area.bottom - gap };
+}
+
+// Function to tile all windows based on the layout tree. While a window is fullscreen the
+// windows it covers are left alone and the layout is applied when fullscreen ends.
+void TileWindows(const RECT& screenRect) {
+    if (ResolveNode(g_FullscreenLeaf)) {
+        g_TilingDeferred = true;
+        ++g_DeferredRetileCount;
+        std::cout << "TileWindows: Deferred while a window is fullscreen.\n";
+        return;
+    }
+    if (root) {
+        g_TilingDeferred = false;
+        ++g_RetileCount;
+        CountMetric(Metric::RETILES);
+        ApplyLayout(root.get(), GetTilingArea(screenRect));
+        std::cout << "TileWindows: Windows tiled successfully.\n";
+    }
+    else {
+        std::cerr << "TileWindows: Layout root is null. No windows to tile.\n";
+    }
+}
+
+// Function to bring the overlay's visibility in line with the fullscreen slot: hidden while
+// a window is fullscreen, shown otherwise. Safe to call any number of times.
+void ReconcileOverlayWindow() {
+    if (g_StubWindowSystem) return; // No overlay exists for simulated windows
+    if (!g_hOverlay || !IsWindow(g_hOverlay)) return;
+
+    bool shouldShow = (ResolveNode(g_FullscreenLeaf) == nullptr);
+    if ((IsWindowVisible(g_hOverlay) != FALSE) == shouldShow) return;
+
+    ShowWindow(g_hOverlay, shouldShow ? SW_SHOWNOACTIVATE : SW_HIDE);
+    std::cout << (shouldShow ? "Overlay window shown.\n" : "Overlay window hidden.\n");
+}
+
+// Function to toggle fullscreen for a window
+void SetWindowFullscreen(LayoutNode* node, const RECT& monitorRect) {
+    if (!node || node->hwnd == nullptr) return;
+
+    HWND hwnd = node->hwnd;
+    WindowInfo* info = managedWindows.Get(hwnd);
+    if (!info) {
+        std::cerr << "SetWindowFullscreen: HWND=0x" << std::hex << hwnd << std::dec << " is not managed.\n";
+        return;
+    }
+    if (IsGeometryQuarantined(hwnd)) {
+        std::cerr << "SetWindowFullscreen: HWND=0x" << std::hex << hwnd << std::dec
+                  << " is not answering; left as it is.\n";
+        return;
+    }
+
+    bool enter = (node->handle != g_FullscreenLeaf);
+    if (enter) {
+        // Only one window is fullscreen at a time
+        LayoutNode* previous = ResolveNode(g_FullscreenLeaf);
+        if (previous) SetWindowFullscreen(previous, monitorRect);
+        if (ResolveNode(g_FullscreenLeaf)) return;
+
+        // Save current window state. Reading the style and rectangle sends no message.
+        info->fullscreenSavedStyle = WsGetWindowLong(hwnd, GWL_STYLE);
+        if (!WsGetWindowRect(hwnd, &info->fullscreenSavedRect)) {
+            std::cerr << "SetWindowFullscreen: Failed to get window rect for HWND=0x" 
+                      << std::hex << hwnd << std::dec 
+                      << ". Error: " << GetLastError() << "\n";
+            return;
+        }
+
+        // Remove borders, title bar, etc.
+        SetWindowStyleQueued(hwnd, info->fullscreenSavedStyle & ~(WS_CAPTION | WS_THICKFRAME | WS_MINIMIZE | WS_MAXIMIZE | WS_SYSMENU));
+
+        // Resize and reposition to cover the entire screen
+        MoveWindowNormalized(hwnd,
+            monitorRect.left,
+            monitorRect.top,
+            monitorRect.right - monitorRect.left,
+            monitorRect.bottom - monitorRect.top);
+    }
+    else {
+        // Restore original window style. The move below, or the pending relayout, redraws the
+        // frame and shows the window.
+        SetWindowStyleQueued(hwnd, info->fullscreenSavedStyle);
+
+        // Restore original window size and position, unless the layout changed underneath, in
+        // which case the pending relayout places it together with the windows it covered
+        if (!g_TilingDeferred) {
+            const RECT& saved = info->fullscreenSavedRect;
+            MoveWindowNormalized(hwnd,
+                saved.left,
+                saved.top,
+                saved.right - saved.left,
+                saved.bottom - saved.top);
+        }
+    }
+
+    g_FullscreenLeaf = enter ? node->handle : NodeHandle();
+    MarkLayoutChanged(node);
+    ReconcileOverlayWindow();
+
+    if (!enter && g_TilingDeferred) {
+        TileWindows(GetScreenRect());
+    }
+}
+
+// Function to find a LayoutNode given an HWND
+LayoutNode* FindLayoutNode(LayoutNode* node, HWND hwnd) {
+    if (!node) return nullptr;
+    if (!node->isSplit && node->hwnd == hwnd) return node;
+    if (node->isSplit) {
+        LayoutNode* found = FindLayoutNode(node->firstChild.get(), hwnd);
+        if (found) return found;
+        return FindLayoutNode(node->secondChild.get(), hwnd);
+    }
+    return nullptr;
+}
+
+// Function to remove a window's leaf from the layout tree, as the workspace's policy does.
+// Returns true if the window was part of the layout.
+bool RemoveWindowFromLayout(HWND hwnd) {
+    LayoutNode* nodeToRemove = FindLayoutNode(root.get(), hwnd);
+    if (!nodeToRemove) return false;
+
+    WithLayoutPolicy([&](auto policy) { decltype(policy)::Remove(nodeToRemove); });
+    return true;
+}
+
+// Structure naming a subtree to lay out again, with the area it covers
+struct RelayoutTarget {
+    NodePath path;
+    RECT area;
+};
+
+// Function to keep pending relayout targets pointing at the right nodes across a
+// structural change. Targets inside removed structure are dropped; the change adds its own
+// target covering them.
+void RemapRelayoutTargets(std::vector<RelayoutTarget>& targets, const NodePath& changeAt,
+                          JournalDeltaType change, bool windowIsFirst) {
+    targets.erase(std::remove_if(targets.begin(), targets.end(), [&](RelayoutTarget& target) {
+        return !RemapNodePath(target.path, changeAt, change, windowIsFirst);
+    }), targets.end());
+}
+
+// Function to apply one journal delta, turning it into its own inverse. The subtrees whose
+// geometry changed are added to targets. Returns false if the delta no longer matches the
+// tree, which leaves the tree untouched.
+bool ApplyJournalDelta(JournalDelta& delta, std::vector<RelayoutTarget>& targets) {
+    LayoutNode* node = ResolveNodePath(delta.path);
+    if (!node) return false;
+
+    switch (delta.type) {
+        case JournalDeltaType::SPLIT: {
+            LayoutNode* windowLeaf = delta.windowIsFirst ? node->firstChild.get() : node->secondChild.get();
+            if (!node->isSplit || windowLeaf->isSplit || windowLeaf->hwnd != delta.hwnd) return false;
+            delta.splitType = node->splitType;
+            delta.ratio = node->splitRatio;
+            RECT area = node->windowRect;
+            CollapseSplit(node, !delta.windowIsFirst);
+            RemapRelayoutTargets(targets, delta.path, JournalDeltaType::REMOVAL, delta.windowIsFirst);
+            targets.push_back(RelayoutTarget{ delta.path, area });
+            delta.type = JournalDeltaType::REMOVAL;
+            return true;
+        }
+        case JournalDeltaType::REMOVAL: {
+            if (!WsIsWindow(delta.hwnd) || FindLayoutNode(root.get(), delta.hwnd)) return false;
+            LayoutNode* split = WrapInSplit(node, delta.hwnd, delta.splitType, delta.ratio, delta.windowIsFirst);
+            if (delta.hwnd == g_FocusedWindow) {
+                // A window brought back by a move keeps focus
+                SetFocusedLeaf(delta.windowIsFirst ? split->firstChild.get() : split->secondChild.get());
+            }
+            RemapRelayoutTargets(targets, delta.path, JournalDeltaType::SPLIT, delta.windowIsFirst);
+            targets.push_back(RelayoutTarget{ delta.path, split->windowRect });
+            delta.type = JournalDeltaType::SPLIT;
+            return true;
+        }
+        case JournalDeltaType::SWAP: {
+            LayoutNode* other = ResolveNodePath(delta.otherPath);
+            if (!other || node->isSplit || other->isSplit) return false;
+            std::swap(node->hwnd, other->hwnd);
+            SwapFocusedLeaf(node, other);
+            MarkLayoutChanged(node);
+            MarkLayoutChanged(other);
+            targets.push_back(RelayoutTarget{ delta.path, node->windowRect });
+            targets.push_back(RelayoutTarget{ delta.otherPath, other->windowRect });
+            return true;
+        }
+        case JournalDeltaType::ORIENTATION:
+            if (!node->isSplit) return false;
+            std::swap(node->splitType, delta.splitType);
+            MarkLayoutChanged(node);
+            targets.push_back(RelayoutTarget{ delta.path, node->windowRect });
+            return true;
+        case JournalDeltaType::RATIO:
+            if (!node->isSplit) return false;
+            std::swap(node->splitRatio, delta.ratio);
+            MarkLayoutChanged(node);
+            targets.push_back(RelayoutTarget{ delta.path, node->windowRect });
+            return true;
+    }
+    return false;
+}
+
+// Function to apply a journaled operation (backwards for undo, forwards for redo) and lay out
+// only the subtrees it touched. Returns false, and drops all history, if the journal no
+// longer matches the tree.
+bool ApplyJournalOperation(JournalOperation& op, bool backwards) {
+    std::vector<RelayoutTarget> targets;
+    size_t count = op.deltas.size();
+    for (size_t i = 0; i < count; ++i) {
+        JournalDelta& delta = op.deltas[backwards ? count - 1 - i : i];
+        if (!ApplyJournalDelta(delta, targets)) {
+            std::cerr << "ApplyJournalOperation: Journal no longer matches the layout. History cleared.\n";
+            ClearJournal();
+            TileWindows(GetScreenRect());
+            return false;
+        }
+    }
+
+    // Lay out only the touched subtrees, each within the area it already covers. A policy
+    // that reshapes the tree may have to change splits above them, so it gets a full layout.
+    if (LayoutPolicyReshapes()) {
+        TileWindows(GetScreenRect());
+        return true;
+    }
+    // A target inside another one is covered by it, and its recorded area may be stale once
+    // the outer one has been laid out. If the windows' size limits move a split above the
+    // targets, the splits are no longer where they were recorded and everything is tiled.
+    std::unordered_map<LayoutNode*, const RECT*> outermost;
+    std::vector<LayoutNode*> laidOut;
+    for (const RelayoutTarget& target : targets) {
+        if (LayoutNode* node = ResolveNodePath(target.path)) outermost.emplace(node, &target.area);
+    }
+    for (const RelayoutTarget& target : targets) {
+        LayoutNode* node = ResolveNodePath(target.path);
+        auto found = node ? outermost.find(node) : outermost.end();
+        if (found == outermost.end() || found->second != &target.area) continue; // Already laid out
+        bool covered = false;
+        for (LayoutNode* ancestor = node->parent; ancestor && !covered; ancestor = ancestor->parent) {
+            covered = outermost.count(ancestor) != 0;
+        }
+        if (!covered) {
+            ApplyLayout(node, target.area);
+            laidOut.push_back(node);
+        }
+    }
+    for (LayoutNode* node : laidOut) {
+        for (LayoutNode* split = node->parent; split; split = split->parent) CombineChildConstraints(split);
+    }
+    for (LayoutNode* node : laidOut) {
+        if (!KeepsItsArea(node)) {
+            TileWindows(GetScreenRect());
+            break;
+        }
+    }
+    return true;
+}
+
+// Function to undo the most recent layout operation
+void UndoLayoutOperation() {
+    if (g_UndoJournal.empty()) {
+        std::cout << "UndoLayoutOperation: Nothing to undo.\n";
+        return;
+    }
+    JournalOperation op = std::move(g_UndoJournal.back());
+    g_UndoJournal.pop_back();
+    if (ApplyJournalOperation(op, true)) {
+        std::cout << "UndoLayoutOperation: Undid " << op.deltas.size() << " change(s).\n";
+        g_RedoJournal.push_back(std::move(op));
+    }
+}
+
+// Function to redo the most recently undone layout operation
+void RedoLayoutOperation() {
+    if (g_RedoJournal.empty()) {
+        std::cout << "RedoLayoutOperation: Nothing to redo.\n";
+        return;
+    }
+    JournalOperation op = std::move(g_RedoJournal.back());
+    g_RedoJournal.pop_back();
+    if (ApplyJournalOperation(op, false)) {
+        std::cout << "RedoLayoutOperation: Redid " << op.deltas.size() << " change(s).\n";
+        g_UndoJournal.push_back(std::move(op));
+    }
+}
+
+// Function to collect all leaf nodes
+void CollectLeafNodes(LayoutNode* node, std::vector<LayoutNode*>& leaves) {
+    if (!node) return;
+    if (!node->isSplit && node->hwnd != nullptr) {
+        leaves.push_back(node);
+        return;
+    }
+    if (node->isSplit) {
+        CollectLeafNodes(node->firstChild.get(), leaves);
+        CollectLeafNodes(node->secondChild.get(), leaves);
+    }
+}
+
+// Function to check if any window is in fullscreen mode
+bool IsAnyWindowFullscreen() {
+    return ResolveNode(g_FullscreenLeaf) != nullptr;
+}
+
+// Function to find the lowest node that has both nodes in its subtree
+LayoutNode* FindCommonAncestor(LayoutNode* nodeA, LayoutNode* nodeB) {
+    int depthA = 0, depthB = 0;
+    for (LayoutNode* node = nodeA; node->parent; node = node->parent) ++depthA;
+    for (LayoutNode* node = nodeB; node->parent; node = node->parent) ++depthB;
+    for (; depthA > depthB; --depthA) nodeA = nodeA->parent;
+    for (; depthB > depthA; --depthB) nodeB = nodeB->parent;
+    while (nodeA != nodeB) {
+        nodeA = nodeA->parent;
+        nodeB = nodeB->parent;
+    }
+    return nodeA;
+}
+
+// Function to check whether a change can be laid out within the subtree it touched. Not
+// while fullscreen holds back layout, and not under a policy that may reshape splits
+// elsewhere in the tree.
+bool CanRelayoutLocally() {
+    return !ResolveNode(g_FullscreenLeaf) && !g_TilingDeferred && !LayoutPolicyReshapes();
+}
+
+// Function to lay out the subtrees below nodes that changed, each in the area it already
+// covers. The size limits above them are refreshed first; if a changed subtree's limits move
+// a split above it, or the windows laid out learn limits that do, everything is tiled
+// instead. Also falls back to tiling everything for the root, whose area follows the screen.
+void RelayoutSubtrees(std::initializer_list<LayoutNode*> nodes) {
+    bool local = CanRelayoutLocally();
+    for (LayoutNode* node : nodes) {
+        if (!node || !node->parent) local = false;
+    }
+    if (local) {
+        for (LayoutNode* node : nodes) UpdateConstraintsUpward(node);
+        for (LayoutNode* node : nodes) local = local && KeepsItsArea(node);
+    }
+    if (local) {
+        for (LayoutNode* node : nodes) ApplyLayout(node, node->windowRect);
+        for (LayoutNode* node : nodes) {
+            for (LayoutNode* split = node->parent; split; split = split->parent) CombineChildConstraints(split);
+        }
+        for (LayoutNode* node : nodes) local = local && KeepsItsArea(node);
+        if (local) return;
+    }
+    TileWindows(GetScreenRect());
+}
+
+void RelayoutSubtree(LayoutNode* node) {
+    RelayoutSubtrees({ node });
+}
+
+// Function to swap two window handles
+bool SwapWindowHandles(LayoutNode* nodeA, LayoutNode* nodeB) {
+    if (!nodeA || !nodeB) return false;
+    if (nodeA->hwnd == nullptr || nodeB->hwnd == nullptr) return false;
+
+    std::swap(nodeA->hwnd, nodeB->hwnd);
+    SwapFocusedLeaf(nodeA, nodeB);
+    MarkLayoutChanged(nodeA);
+    MarkLayoutChanged(nodeB);
+    RecordSwapDelta(nodeA, nodeB);
+
+    std::cout << "SwapWindowHandles: Swapped window handles between HWND 0x" 
+              << std::hex << nodeA->hwnd << " and HWND 0x" 
+              << nodeB->hwnd << std::dec << ".\n";
+
+    // Only the two windows change place; each takes the other's tile unless their limits
+    // move a split above them
+    RelayoutSubtrees({ nodeA, nodeB });
+    return true;
+}
+
+void CreateOverlayWindow(HWND targetHwnd) {
+    if (g_hOverlay != NULL) return; // Overlay already exists
+
+    // Register window class
+    const char CLASS_NAME[] = "OverlayWindowClass"; // Use narrow string
+
+    WNDCLASSA wc = { }; // Use WNDCLASSA for ANSI
+    wc.lpfnWndProc   = OverlayWndProc;
+    wc.hInstance     = GetModuleHandle(NULL);
+    wc.lpszClassName = CLASS_NAME;
+    wc.hCursor       = LoadCursor(NULL, IDC_ARROW);
+
+    if (!RegisterClassA(&wc)) { // Use RegisterClassA
+        std::cerr << "Failed to register window class.\n";
+        return;
+    }
+
+    // Get target window position and size
+    RECT rect;
+    GetWindowRect(targetHwnd, &rect);
+
+    // Create the overlay window
+    g_hOverlay = CreateWindowExA( // Use CreateWindowExA
+        WS_EX_LAYERED | WS_EX_TRANSPARENT | WS_EX_TOPMOST,
+        CLASS_NAME,
+        NULL,
+        WS_POPUP,
+        rect.left, rect.top,
+        rect.right - rect.left, rect.bottom - rect.top,
+        NULL,
+        NULL,
+        GetModuleHandle(NULL),
+        NULL
+    );
+
+    if (!g_hOverlay) {
+        std::cerr << "Failed to create overlay window.\n";
+        return;
+    }
+
+    // Make the window transparent
+    // Make pure blue (RGB 0, 0, 255) transparent
+SetLayeredWindowAttributes(g_hOverlay, RGB(255, 255, 255), 0, LWA_COLORKEY);
+
+
+    ShowWindow(g_hOverlay, SW_SHOW);
+}
+
+void UpdateOverlayWindow(HWND targetHwnd) {
+    if (g_hOverlay == NULL) return;
+
+    // Get target window position and size
+    RECT rect;
+    GetWindowRect(targetHwnd, &rect);
+
+    // Move and resize the overlay window to match the target window
+    SetWindowPos(g_hOverlay, HWND_TOPMOST, rect.left, rect.top, 
+                 rect.right - rect.left, rect.bottom - rect.top, SWP_NOACTIVATE);
+}
+
+void DestroyOverlayWindow() {
+    if (g_hOverlay != NULL) {
+        DestroyWindow(g_hOverlay);
+        g_hOverlay = NULL;
+    }
+}
+
+LRESULT CALLBACK OverlayWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    switch (msg) {
+    case WM_PAINT: {
+        PAINTSTRUCT ps;
+        HDC hdc = BeginPaint(hwnd, &ps);
+
+        // Create a pen for the border
+        HPEN hPen = CreatePen(PS_SOLID, g_BorderThickness, g_BorderColor);
+        HPEN hOldPen = (HPEN)SelectObject(hdc, hPen);
+
+        // Get client area
+        RECT rect;
+        GetClientRect(hwnd, &rect);
+
+        // Draw the border
+        for (int i = 0; i < g_BorderThickness; ++i) {
+            Rectangle(hdc, rect.left + i, rect.top + i, rect.right - i, rect.bottom - i);
+        }
+
+        // Cleanup
+        SelectObject(hdc, hOldPen);
+        DeleteObject(hPen);
+        EndPaint(hwnd, &ps);
+        return 0;
+    }
+    case WM_DESTROY:
+        PostQuitMessage(0);
+        return 0;
+    }
+    return DefWindowProc(hwnd, msg, wParam, lParam);
+}
+
+// Built-in status bar, in the style of i3bar. The bar reserves BAR_HEIGHT pixels at the top of
+// the screen and shows, left to right, the binding mode and the focused window's title, then
+// the blocks of the status command's output right-aligned. Each piece is a segment; when
+// anything changes, only the segments whose text, color or position changed are invalidated.
+
+// One block of i3bar status output
+struct StatusBlock {
+    std::string fullText;
+    std::string color;    // "#rrggbb", empty for the default color
+    std::string name;
+    std::string instance;
+    bool urgent = false;
+};
+
+// Incremental parser for the i3bar protocol: a header object followed by an endless JSON
+// array of status lines, each an array of block objects. Bytes are fed as they arrive from
+// the pipe, in chunks of any size, and every completed status line is handed to onLine.
+// Output that does not start with '{' or '[' is taken as plain text, one line per status line.
+struct StatusStreamParser {
+    enum class Mode { UNKNOWN, PLAIN, JSON };
+
+    // One open JSON container
+    struct Frame {
+        char kind;          // '{' or '['
+        bool expectingKey;  // Objects only: the next string is a key
+    };
+
+    std::function<void(std::vector<StatusBlock>&&)> onLine;
+    Mode mode = Mode::UNKNOWN;
+    bool headerDone = false;
+    std::vector<Frame> stack;
+    bool inString = false;
+    bool escape = false;
+    int unicodeDigits = -1;       // Hex digits still expected after \u, or -1
+    uint32_t unicodeValue = 0;
+    uint32_t highSurrogate = 0;
+    std::string token;            // String or literal being read
+    std::string key;              // Last key read at block depth
+    std::vector<StatusBlock> line;
+    StatusBlock block;
+
+    // Depths in the stack of the status line arrays and of the blocks inside them
+    static const size_t LINE_DEPTH = 2;
+    static const size_t BLOCK_DEPTH = 3;
+
+    void Feed(const char* data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            char c = data[i];
+            if (mode == Mode::UNKNOWN) {
+                if (c == ' ' || c == '\t' || c == '\r' || c == '\n') continue;
+                mode = (c == '{' || c == '[') ? Mode::JSON : Mode::PLAIN;
+                headerDone = (c == '[');
+            }
+            if (mode == Mode::PLAIN) FeedPlain(c);
+            else FeedJson(c);
+        }
+    }
+
+    void FeedPlain(char c) {
+        if (c == '\r') return;
+        if (c != '\n') {
+            token.push_back(c);
+            return;
+        }
+        std::vector<StatusBlock> plainLine(1);
+        plainLine[0].fullText.swap(token);
+        onLine(std::move(plainLine));
+    }
+
+    // Function to append a code point to the string being read, as UTF-8
+    void AppendCodePoint(uint32_t cp) {
+        if (cp < 0x80) {
+            token.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            token.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            token.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            token.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            token.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            token.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            token.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            token.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            token.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            token.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    void FeedStringChar(char c) {
+        if (unicodeDigits > 0) {
+            int digit = (c >= '0' && c <= '9') ? c - '0'
+                      : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                      : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : 0;
+            unicodeValue = (unicodeValue << 4) | static_cast<uint32_t>(digit);
+            if (--unicodeDigits > 0) return;
+            unicodeDigits = -1;
+            if (unicodeValue >= 0xD800 && unicodeValue < 0xDC00) {
+                highSurrogate = unicodeValue;
+            } else if (unicodeValue >= 0xDC00 && unicodeValue < 0xE000 && highSurrogate) {
+                AppendCodePoint(0x10000 + ((highSurrogate - 0xD800) << 10) + (unicodeValue - 0xDC00));
+                highSurrogate = 0;
+            } else {
+                AppendCodePoint(unicodeValue);
+            }
+            return;
+        }
+        if (escape) {
+            escape = false;
+            switch (c) {
+                case 'n': token.push_back('\n'); break;
+                case 't': token.push_back('\t'); break;
+                case 'r': token.push_back('\r'); break;
+                case 'b': token.push_back('\b'); break;
+                case 'f': token.push_back('\f'); break;
+                case 'u': unicodeDigits = 4; unicodeValue = 0; break;
+                default: token.push_back(c); break; // \" \\ \/
+            }
+            return;
+        }
+        if (c == '\\') {
+            escape = true;
+        } else if (c == '"') {
+            inString = false;
+            EndValue(true);
+        } else {
+            token.push_back(c);
+        }
+    }
+
+    // Function to finish a string or literal. Only values directly inside a block are kept.
+    void EndValue(bool isString) {
+        if (stack.size() == BLOCK_DEPTH && stack.back().kind == '{') {
+            if (stack.back().expectingKey) {
+                if (isString) key.swap(token);
+            } else if (key == "full_text") {
+                block.fullText.swap(token);
+            } else if (key == "color") {
+                block.color.swap(token);
+            } else if (key == "name") {
+                block.name.swap(token);
+            } else if (key == "instance") {
+                block.instance.swap(token);
+            } else if (key == "urgent") {
+                block.urgent = (token == "true");
+            }
+        }
+        token.clear();
+    }
+
+    void FeedJson(char c) {
+        if (inString) {
+            FeedStringChar(c);
+            return;
+        }
+
+        // Literals (numbers, true, false, null) end at the next structural character
+        bool structural = c == '{' || c == '}' || c == '[' || c == ']' || c == ',' || c == ':' ||
+                          c == '"' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        if (!structural) {
+            token.push_back(c);
+            return;
+        }
+        if (!token.empty()) EndValue(false);
+
+        switch (c) {
+            case '"':
+                inString = true;
+                highSurrogate = 0;
+                break;
+            case '{':
+                stack.push_back(Frame{ '{', true });
+                if (stack.size() == BLOCK_DEPTH) block = StatusBlock();
+                break;
+            case '[':
+                stack.push_back(Frame{ '[', false });
+                if (stack.size() == LINE_DEPTH) line.clear();
+                break;
+            case '}':
+            case ']':
+                if (stack.empty()) break;
+                if (stack.size() == BLOCK_DEPTH && c == '}') {
+                    line.push_back(std::move(block));
+                } else if (stack.size() == LINE_DEPTH && c == ']' && headerDone) {
+                    onLine(std::move(line));
+                    line.clear();
+                }
+                stack.pop_back();
+                // The header is the first top-level value; the status lines array follows it
+                if (stack.empty()) headerDone = true;
+                break;
+            case ':':
+                if (!stack.empty()) stack.back().expectingKey = false;
+                break;
+            case ',':
+                if (!stack.empty() && stack.back().kind == '{') stack.back().expectingKey = true;
+                break;
+            default:
+                break; // Whitespace
+        }
+    }
+};
+
+// One independently redrawn piece of the status bar
+struct BarSegment {
+    std::string text;
+    COLORREF color;
+    COLORREF background;
+    RECT rect;            // Position within the bar window
+};
+
+const COLORREF BAR_BACKGROUND = RGB(0x22, 0x22, 0x22);
+const COLORREF BAR_FOREGROUND = RGB(0xDD, 0xDD, 0xDD);
+const COLORREF BAR_MODE_BACKGROUND = RGB(0x90, 0x00, 0x00);
+const COLORREF BAR_URGENT_BACKGROUND = RGB(0x90, 0x00, 0x00);
+const int BAR_SEGMENT_PADDING = 6;
+
+HWND g_hBar = NULL;
+RECT g_BarRect = { 0, 0, 0, 0 };        // Screen area of the bar
+HFONT g_BarFont = NULL;
+std::vector<BarSegment> g_BarSegments;  // As last laid out and invalidated
+std::string g_BarMode;
+std::string g_BarTitle;
+std::vector<StatusBlock> g_BarStatus;
+
+// Damage counters: status updates applied, and the segments and pixels they invalidated
+size_t g_BarUpdates = 0;
+size_t g_BarDamagedSegments = 0;
+long long g_BarDamagedPixels = 0;
+
+// Status command child process and the thread reading its output
+HANDLE g_BarProcess = NULL;
+HANDLE g_BarPipeRead = NULL;
+std::thread g_BarReaderThread;
+
+// Function to parse an i3bar "#rrggbb" color, falling back to the default foreground
+COLORREF ParseBarColor(const std::string& color) {
+    if (color.size() != 7 || color[0] != '#') return BAR_FOREGROUND;
+    unsigned long value = std::strtoul(color.c_str() + 1, nullptr, 16);
+    return RGB((value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF);
+}
+
+// Function to convert UTF-8 text for drawing
+std::wstring Utf8ToWide(const std::string& text) {
+    if (text.empty()) return std::wstring();
+    int length = MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), nullptr, 0);
+    std::wstring wide(static_cast<size_t>((std::max)(length, 0)), L'\0');
+    if (length > 0) {
+        MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), &wide[0], length);
+    }
+    return wide;
+}
+
+// Function to measure the width of a segment's text in pixels. Without a bar window (the
+// benchmark suite) every code point counts as 7 pixels.
+int MeasureBarText(const std::string& text) {
+    if (g_hBar == NULL) {
+        int codePoints = 0;
+        for (char c : text) {
+            if ((static_cast<unsigned char>(c) & 0xC0) != 0x80) ++codePoints;
+        }
+        return codePoints * 7;
+    }
+
+    std::wstring wide = Utf8ToWide(text);
+    SIZE size = { 0, 0 };
+    HDC hdc = GetDC(g_hBar);
+    HGDIOBJ oldFont = SelectObject(hdc, g_BarFont);
+    GetTextExtentPoint32W(hdc, wide.c_str(), static_cast<int>(wide.size()), &size);
+    SelectObject(hdc, oldFont);
+    ReleaseDC(g_hBar, hdc);
+    return size.cx;
+}
+
+bool SameBarSegment(const BarSegment& a, const BarSegment& b) {
+    return a.text == b.text && a.color == b.color && a.background == b.background &&
+           EqualRect(&a.rect, &b.rect);
+}
+
+// Function to mark part of the bar for redrawing
+void DamageBar(const RECT& rect) {
+    ++g_BarDamagedSegments;
+    g_BarDamagedPixels += static_cast<long long>(rect.right - rect.left) * (rect.bottom - rect.top);
+    if (g_hBar != NULL) InvalidateRect(g_hBar, &rect, FALSE);
+}
+
+// Function to lay out the bar from the current mode, title and status, and invalidate only
+// the segments that differ from what is on screen
+void RebuildBar() {
+    int width = g_BarRect.right - g_BarRect.left;
+    std::vector<BarSegment> segments;
+
+    // Left side: binding mode, then the focused window's title
+    int left = 0;
+    if (!g_BarMode.empty()) {
+        int w = MeasureBarText(g_BarMode) + 2 * BAR_SEGMENT_PADDING;
+        segments.push_back(BarSegment{ g_BarMode, BAR_FOREGROUND, BAR_MODE_BACKGROUND, RECT{ left, 0, left + w, BAR_HEIGHT } });
+        left += w;
+    }
+
+    // Right side: status blocks, right-aligned in order
+    std::vector<int> widths;
+    int statusWidth = 0;
+    for (const StatusBlock& block : g_BarStatus) {
+        widths.push_back(MeasureBarText(block.fullText) + 2 * BAR_SEGMENT_PADDING);
+        statusWidth += widths.back();
+    }
+    int right = (std::max)(left, width - statusWidth);
+
+    if (!g_BarTitle.empty() && right > left) {
+        segments.push_back(BarSegment{ g_BarTitle, BAR_FOREGROUND, BAR_BACKGROUND, RECT{ left, 0, right, BAR_HEIGHT } });
+    }
+
+    for (size_t i = 0; i < g_BarStatus.size(); ++i) {
+        const StatusBlock& block = g_BarStatus[i];
+        int end = (std::min)(width, right + widths[i]);
+        segments.push_back(BarSegment{ block.fullText, ParseBarColor(block.color),
+                                       block.urgent ? BAR_URGENT_BACKGROUND : BAR_BACKGROUND,
+                                       RECT{ right, 0, end, BAR_HEIGHT } });
+        right = end;
+    }
+
+    // Segments are compared by position in the list. A changed segment damages both where it
+    // was and where it is now, so a shrinking block leaves no stale pixels behind.
+    for (size_t i = 0; i < (std::max)(segments.size(), g_BarSegments.size()); ++i) {
+        if (i < segments.size() && i < g_BarSegments.size()) {
+            if (SameBarSegment(segments[i], g_BarSegments[i])) continue;
+            RECT damaged;
+            UnionRect(&damaged, &segments[i].rect, &g_BarSegments[i].rect);
+            DamageBar(damaged);
+        } else {
+            DamageBar(i < segments.size() ? segments[i].rect : g_BarSegments[i].rect);
+        }
+    }
+
+    g_BarSegments.swap(segments);
+}
+
+// Function to apply one status line from the status command
+void SetBarStatus(std::vector<StatusBlock>&& blocks) {
+    ++g_BarUpdates;
+    g_BarStatus = std::move(blocks);
+    RebuildBar();
+}
+
+// Function to bring the mode and title segments up to date after a layout message. Both come
+// from state the layout thread already tracks, so the bar never polls.
+void UpdateBarFromLayout() {
+    if (!g_BarEnabled) return;
+
+    std::string mode = isResizeMode ? "resize" : "";
+
+    // Only managed windows have cache entries kept fresh by name-change events
+    const std::string* title = nullptr;
+    if (g_ManagedWindowSet.Contains(g_FocusedWindow)) {
+        title = &GetWindowTitle(g_FocusedWindow);
+    }
+
+    if (mode == g_BarMode && (title ? *title : std::string()) == g_BarTitle) return;
+    g_BarMode = mode;
+    g_BarTitle = title ? *title : std::string();
+    RebuildBar();
+}
+
+LRESULT CALLBACK BarWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    switch (msg) {
+    case WM_PAINT: {
+        PAINTSTRUCT ps;
+        HDC hdc = BeginPaint(hwnd, &ps);
+        HGDIOBJ oldFont = SelectObject(hdc, g_BarFont);
+        SetBkMode(hdc, TRANSPARENT);
+
+        HBRUSH background = CreateSolidBrush(BAR_BACKGROUND);
+        FillRect(hdc, &ps.rcPaint, background);
+        DeleteObject(background);
+
+        // Only segments inside the damaged area are drawn
+        for (const BarSegment& segment : g_BarSegments) {
+            RECT visible;
+            if (!IntersectRect(&visible, &segment.rect, &ps.rcPaint)) continue;
+            if (segment.background != BAR_BACKGROUND) {
+                HBRUSH brush = CreateSolidBrush(segment.background);
+                FillRect(hdc, &visible, brush);
+                DeleteObject(brush);
+            }
+            RECT textRect = segment.rect;
+            textRect.left += BAR_SEGMENT_PADDING;
+            textRect.right -= BAR_SEGMENT_PADDING;
+            std::wstring wide = Utf8ToWide(segment.text);
+            SetTextColor(hdc, segment.color);
+            DrawTextW(hdc, wide.c_str(), static_cast<int>(wide.size()), &textRect,
+                      DT_SINGLELINE | DT_VCENTER | DT_NOPREFIX | DT_END_ELLIPSIS);
+        }
+
+        SelectObject(hdc, oldFont);
+        EndPaint(hwnd, &ps);
+        return 0;
+    }
+    }
+    return DefWindowProc(hwnd, msg, wParam, lParam);
+}
+
+// Function to create the bar window along the top of the screen
+bool CreateBarWindow(const RECT& screenRect) {
+    const char CLASS_NAME[] = "LatticeBarWindowClass";
+
+    WNDCLASSA wc = { };
+    wc.lpfnWndProc   = BarWndProc;
+    wc.hInstance     = GetModuleHandle(NULL);
+    wc.lpszClassName = CLASS_NAME;
+    wc.hCursor       = LoadCursor(NULL, IDC_ARROW);
+
+    if (!RegisterClassA(&wc)) {
+        std::cerr << "CreateBarWindow: Failed to register window class.\n";
+        return false;
+    }
+
+    g_BarRect = RECT{ screenRect.left, screenRect.top, screenRect.right, screenRect.top + BAR_HEIGHT };
+    g_BarFont = static_cast<HFONT>(GetStockObject(DEFAULT_GUI_FONT));
+    g_hBar = CreateWindowExA(
+        WS_EX_TOOLWINDOW | WS_EX_TOPMOST | WS_EX_NOACTIVATE,
+        CLASS_NAME,
+        "LatticeWM Bar",
+        WS_POPUP,
+        g_BarRect.left, g_BarRect.top,
+        g_BarRect.right - g_BarRect.left, BAR_HEIGHT,
+        NULL,
+        NULL,
+        GetModuleHandle(NULL),
+        NULL
+    );
+
+    if (!g_hBar) {
+        std::cerr << "CreateBarWindow: Failed to create bar window. Error: " << GetLastError() << "\n";
+        return false;
+    }
+
+    ShowWindow(g_hBar, SW_SHOWNOACTIVATE);
+    UpdateBarFromLayout();
+    return true;
+}
+
+// Function to start the status command with its standard output piped to a reader thread.
+// Each completed status line is posted to the layout thread, which owns the bar.
+bool StartStatusCommand(const std::string& command) {
+    SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+    HANDLE pipeWrite = NULL;
+    if (!CreatePipe(&g_BarPipeRead, &pipeWrite, &sa, 0)) {
+        std::cerr << "StartStatusCommand: Failed to create pipe. Error: " << GetLastError() << "\n";
+        return false;
+    }
+    SetHandleInformation(g_BarPipeRead, HANDLE_FLAG_INHERIT, 0);
+
+    STARTUPINFOA si = { };
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    si.hStdOutput = pipeWrite;
+    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+    PROCESS_INFORMATION pi = { };
+    std::vector<char> commandLine(command.begin(), command.end());
+    commandLine.push_back('\0');
+    BOOL started = CreateProcessA(nullptr, commandLine.data(), nullptr, nullptr, TRUE,
+                                  CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi);
+    CloseHandle(pipeWrite); // The child holds the only write end, so its exit ends the reads
+
+    if (!started) {
+        std::cerr << "StartStatusCommand: Failed to start \"" << command << "\". Error: " << GetLastError() << "\n";
+        CloseHandle(g_BarPipeRead);
+        g_BarPipeRead = NULL;
+        return false;
+    }
+    CloseHandle(pi.hThread);
+    g_BarProcess = pi.hProcess;
+
+    g_BarReaderThread = std::thread([]() {
+        StatusStreamParser parser;
+        parser.onLine = [](std::vector<StatusBlock>&& blocks) {
+            auto* message = new std::vector<StatusBlock>(std::move(blocks));
+            if (!PostLayoutMessage(WM_LAYOUT_STATUS, 0, reinterpret_cast<LPARAM>(message))) {
+                delete message;
+            }
+        };
+
+        char buffer[4096];
+        DWORD bytesRead = 0;
+        while (ReadFile(g_BarPipeRead, buffer, sizeof(buffer), &bytesRead, nullptr) && bytesRead > 0) {
+            parser.Feed(buffer, bytesRead);
+        }
+    });
+
+    std::cout << "StartStatusCommand: Status command \"" << command << "\" started.\n";
+    return true;
+}
+
+// Function to stop the status command and its reader thread
+void StopStatusCommand() {
+    if (g_BarProcess != NULL) {
+        TerminateProcess(g_BarProcess, 0);
+        WaitForSingleObject(g_BarProcess, INFINITE);
+        CloseHandle(g_BarProcess);
+        g_BarProcess = NULL;
+    }
+    if (g_BarReaderThread.joinable()) g_BarReaderThread.join();
+    if (g_BarPipeRead != NULL) {
+        CloseHandle(g_BarPipeRead);
+        g_BarPipeRead = NULL;
+    }
+}
+
+void FocusWindow(LayoutNode* node) {
+    if (!node || node->hwnd == nullptr) return;
+
+    HWND hwnd = node->hwnd;
+
+    // A quarantined window would not come forward, so focus stays where it is
+    if (IsGeometryQuarantined(hwnd)) {
+        std::cerr << "FocusWindow: HWND=0x" << std::hex << reinterpret_cast<uintptr_t>(hwnd) << std::dec
+                  << " is not answering; focus left where it is.\n";
+        return;
+    }
+
+    std::string title = GetWindowTitle(hwnd);
+    std::cout << "FocusWindow: Focusing window: " << title << " (HWND=0x" 
+              << std::hex << reinterpret_cast<uintptr_t>(hwnd) << std::dec << ")\n";
+
+    RaiseWindowQueued(hwnd);
+
+    // The foreground event that follows finds focus already here
+    g_FocusedWindow = hwnd;
+    SetFocusedLeaf(node);
+
+    if (g_StubWindowSystem) return; // No overlay for simulated windows
+
+    // Create and update the overlay window
+    CreateOverlayWindow(hwnd);
+    UpdateOverlayWindow(hwnd);
+
+    // Optionally, handle window move/resize events to update the overlay
+    // This requires additional implementation, such as setting up a hook or a timer
+}
+
+// Function to register hotkeys
+bool RegisterHotKeys() {
+    bool success = true;
+
+    // Lambda that attempts hotkey registration and reports failures
+    auto register_hotkey = [&](int id, UINT modifiers, UINT vk, const char* description) -> bool {
+        if (!RegisterHotKey(nullptr, id, modifiers, vk)) {
+            std::cerr << "RegisterHotKeys: Failed to register hotkey ID " << id 
+                      << " (" << description << "). Error: " << GetLastError() << "\n";
+            return false;
+        }
+        return true;
+    };
+
+    // Register navigation and focus hotkeys
+    success &= register_hotkey(1, MOD_KEY, VK_LEFT, "Focus Left");
+    success &= register_hotkey(2, MOD_KEY, VK_RIGHT, "Focus Right");
+    success &= register_hotkey(6, MOD_KEY, VK_UP, "Focus Up");
+    success &= register_hotkey(7, MOD_KEY, VK_DOWN, "Focus Down");
+
+    // Register move hotkeys
+    success &= register_hotkey(11, MOD_KEY | MOD_SHIFT, VK_UP, "Move Up");
+    success &= register_hotkey(12, MOD_KEY | MOD_SHIFT, VK_DOWN, "Move Down");
+    success &= register_hotkey(13, MOD_KEY | MOD_SHIFT, VK_LEFT, "Move Left");
+    success &= register_hotkey(14, MOD_KEY | MOD_SHIFT, VK_RIGHT, "Move Right");
+
+    // Register Close Current Window hotkey
+    success &= register_hotkey(15, MOD_KEY | MOD_SHIFT, 'Q', "Close Current Window");
+
+    // Register fullscreen toggle hotkey
+    success &= register_hotkey(3, MOD_KEY, 'F', "Toggle Fullscreen");
+
+    // Register resize mode toggle hotkey
+    success &= register_hotkey(10, MOD_KEY, 'R', "Toggle Resize Mode");
+
+    // **Register Split Orientation Toggle Hotkeys**
+    success &= register_hotkey(16, MOD_KEY, 'V', "Toggle to Vertical Split");
+    success &= register_hotkey(17, MOD_KEY, 'H', "Toggle to Horizontal Split");
+
+    // **Register hotkey to open new terminal
+    success &= register_hotkey(18, MOD_KEY, VK_RETURN, "Open New Terminal Window");
+
+    // Register undo and redo of layout changes
+    success &= register_hotkey(19, MOD_KEY, 'Z', "Undo Layout Change");
+    success &= register_hotkey(20, MOD_KEY | MOD_SHIFT, 'Z', "Redo Layout Change");
+
+    // Register floating toggle hotkey
+    success &= register_hotkey(21, MOD_KEY | MOD_SHIFT, VK_SPACE, "Toggle Floating");
+
+    // Register window switcher hotkey
+    success &= register_hotkey(22, MOD_KEY, 'D', "Open Window Switcher");
+
+    return success;
+}
+
+// Function to unregister all hotkeys
+void UnregisterHotKeys() {
+    for (int id = 1; id <= 22; ++id) {
+        UnregisterHotKey(nullptr, id);
+    }
+    std::cout << "UnregisterHotKeys: All hotkeys unregistered.\n";
 }
 
 // Function to find the adjacent LayoutNode in a given direction
 LayoutNode* FindAdjacent(LayoutNode* current, Direction dir) {
     if (!current) return nullptr;
 
-    LayoutNode* node = current;
-    LayoutNode* parent = node->parent;
+    LayoutNode* node = current;
+    LayoutNode* parent = node->parent;
+
+    // Determine the required split type based on direction
+    SplitType requiredSplit;
+    switch (dir) {
+        case Direction::LEFT:
+        case Direction::RIGHT:
+            requiredSplit = SplitType::VERTICAL;
+            break;
+        case Direction::UP:
+        case Direction::DOWN:
+            requiredSplit = SplitType::HORIZONTAL;
+            break;
+    }
+
+    // Traverse up to find the nearest ancestor split matching the required split
+    while (parent) {
+        if (parent->isSplit && parent->splitType == requiredSplit) {
+            // Determine if current node is firstChild or secondChild
+            bool isFirst = (parent->firstChild.get() == node);
+
+            // Determine the direction to navigate
+            bool navigateToSecond = false;
+            if ((dir == Direction::LEFT && !isFirst) ||
+                (dir == Direction::RIGHT && isFirst) ||
+                (dir == Direction::UP && !isFirst) ||
+                (dir == Direction::DOWN && isFirst)) {
+                navigateToSecond = true;
+            }
+
+            if (navigateToSecond) {
+                // Traverse the sibling subtree to find the target window
+                LayoutNode* sibling = isFirst ? parent->secondChild.get() : parent->firstChild.get();
+
+                // Descend to the window nearest the edge we enter from. Splits across the
+                // direction of travel return to their last focused child, as in i3.
+                bool enterSecond = (dir == Direction::LEFT || dir == Direction::UP);
+                LayoutNode* target = sibling;
+                while (target->isSplit) {
+                    bool second = (target->splitType == requiredSplit) ? enterSecond : target->focusSecond;
+                    target = second ? target->secondChild.get() : target->firstChild.get();
+                }
+                // Ensure that we are not selecting the same node
+                if (target->hwnd != current->hwnd) {
+                    return target;
+                }
+            }
+        }
+        node = parent;
+        parent = node->parent;
+    }
+
+    // No adjacent found
+    return nullptr;
+}
+
+// Function to navigate in a given direction
+void Navigate(Direction dir) {
+    LayoutNode* currentNode = GetFocusedLeaf();
+    if (currentNode) {
+        LayoutNode* adjacent = FindAdjacent(currentNode, dir);
+        if (adjacent && adjacent->hwnd != nullptr) {
+            FocusWindow(adjacent);
+        }
+        else {
+            std::cout << "Navigate: No window in the " <<
+                (dir == Direction::LEFT ? "LEFT" :
+                 dir == Direction::RIGHT ? "RIGHT" :
+                 dir == Direction::UP ? "UP" : "DOWN") << " direction.\n";
+        }
+    }
+    else {
+        std::cerr << "Navigate: Current window not managed.\n";
+    }
+}
+
+// Function to adjust splitRatio and reapply layout
+void AdjustSplitRatio(LayoutNode* node, int deltaRatio) {
+    if (!node || !node->isSplit) return;
+
+    // Adjust the split ratio
+    RecordRatioDelta(node);
+    node->splitRatio += deltaRatio;
+
+    // Clamp the split ratio to avoid extreme sizes
+    // NOTE: minwindef.h which is included indirectly, defines a min and max method. I've wrapped
+    // std::min and std::max here with parenthesis to fully qualify their names and prevent warnings
+    node->splitRatio = (std::max)(RATIO_MIN, (std::min)(RATIO_MAX, node->splitRatio));
+    MarkLayoutChanged(node);
+
+    // Re-apply the layout
+    RECT screenRect = GetScreenRect();
+
+    TileWindows(screenRect);
+}
+
+// Function to take a window leaf out of the tree and put the window beside another node,
+// under a new split of the given orientation, journaled as one removal and one split. The
+// window stays focused. Only the subtree holding both places is laid out again.
+bool MoveLeafBeside(LayoutNode* leaf, LayoutNode* target, SplitType splitType, bool windowIsFirst) {
+    HWND hwnd = leaf->hwnd;
+    NodeHandle oldParentHandle = leaf->parent ? leaf->parent->handle : NodeHandle();
+    NodeHandle targetHandle = target->handle;
+    bool wasFocused = (g_FocusedLeaf == leaf->handle);
+
+    // Detaching frees the old parent, so it is only compared by handle afterwards
+    LayoutNode* kept = DetachLeaf(leaf);
+    if (targetHandle == oldParentHandle) target = kept;
+    else target = ResolveNode(targetHandle); // A rebalance may have rebuilt it
+    if (!target) target = kept ? kept : root.get();
+
+    LayoutNode* split = WrapInSplit(target, hwnd, splitType, RATIO_HALF, windowIsFirst);
+    RecordSplitDelta(split, windowIsFirst);
+    LayoutNode* moved = windowIsFirst ? split->firstChild.get() : split->secondChild.get();
+    if (wasFocused) SetFocusedLeaf(moved);
+
+    std::cout << "MoveLeafBeside: Moved HWND=0x" << std::hex << hwnd << std::dec << ".\n";
+    RelayoutSubtree(kept ? FindCommonAncestor(kept, split) : split);
+    return true;
+}
+
+// Function to get the name of a direction, for logging
+const char* GetDirectionName(Direction dir) {
+    return dir == Direction::LEFT ? "LEFT" :
+           dir == Direction::RIGHT ? "RIGHT" :
+           dir == Direction::UP ? "UP" : "DOWN";
+}
+
+// Function to move the focused window in a given direction, as the workspace's layout policy
+// allows
+bool MoveWindowInDirection(Direction dir) {
+    LayoutNode* currentNode = GetFocusedLeaf();
+    if (!currentNode) {
+        std::cerr << "MoveWindowInDirection: Current window not managed.\n";
+        return false;
+    }
+    if (currentNode->handle == g_FullscreenLeaf) {
+        std::cout << "MoveWindowInDirection: A fullscreen window stays in place.\n";
+        return false;
+    }
+    return WithLayoutPolicy([&](auto policy) { return decltype(policy)::Move(currentNode, dir); });
+}
+
+// Function to move a window by trading places with the window next to it in a given
+// direction, which leaves the shape of the tree as it is
+bool SwapWithAdjacent(LayoutNode* currentNode, Direction dir) {
+    LayoutNode* adjacent = FindAdjacent(currentNode, dir);
+    if (!adjacent || adjacent->isSplit || adjacent->hwnd == nullptr) {
+        std::cout << "MoveWindowInDirection: No window to the " << GetDirectionName(dir) << ".\n";
+        return false;
+    }
+    if (!SwapWindowHandles(currentNode, adjacent)) return false;
+    std::cout << "MoveWindowInDirection: Swapped with HWND=0x" << std::hex
+              << currentNode->hwnd << std::dec << " to the " << GetDirectionName(dir) << ".\n";
+    return true;
+}
+
+// Function to move a window in a given direction, with i3's container semantics. A window
+// inside a container along the direction of travel trades places with its neighbor there,
+// or enters the neighbor if that is a container itself, next to the child focused there
+// last. A window at the edge of its container, or in a container across the direction,
+// leaves it and is put beside it in the nearest container along the direction, which is
+// made at the top of the tree if there is none. Containers left with one child collapse.
+// Only the subtree holding both the old and the new place is laid out again.
+bool MoveLeafInContainers(LayoutNode* currentNode, Direction dir) {
+    SplitType axis = GetSplitTypeFromDirection(dir);
+    bool towardsFirst = (dir == Direction::LEFT || dir == Direction::UP);
+    const char* dirName = GetDirectionName(dir);
+
+    // Walk up the window's own container while the window is at its edge in that direction
+    LayoutNode* branch = currentNode;
+    while (branch->parent && branch->parent->splitType == axis) {
+        LayoutNode* split = branch->parent;
+        if ((split->firstChild.get() == branch) != towardsFirst) {
+            // The neighbor is the segment of the container next to the window
+            LayoutNode* neighbor = towardsFirst ? split->firstChild.get() : split->secondChild.get();
+            while (neighbor->isSplit && neighbor->splitType == axis) {
+                neighbor = towardsFirst ? neighbor->secondChild.get() : neighbor->firstChild.get();
+            }
+            if (!neighbor->isSplit && neighbor->hwnd != nullptr) {
+                if (!SwapWindowHandles(currentNode, neighbor)) return false;
+                std::cout << "MoveWindowInDirection: Swapped with HWND=0x" << std::hex
+                          << currentNode->hwnd << std::dec << " to the " << dirName << ".\n";
+                return true;
+            }
+
+            // A container is entered beside the child that was focused there last; a
+            // placeholder is passed over, as it keeps its tile for the window it waits for
+            if (neighbor->isSplit) {
+                LayoutNode* child = neighbor;
+                while (child->isSplit && child->splitType == neighbor->splitType) {
+                    child = child->focusSecond ? child->secondChild.get() : child->firstChild.get();
+                }
+                return MoveLeafBeside(currentNode, child, neighbor->splitType, !towardsFirst);
+            }
+            return MoveLeafBeside(currentNode, neighbor, axis, towardsFirst);
+        }
+        branch = split;
+    }
+
+    if (!branch->parent) {
+        std::cout << "MoveWindowInDirection: Already at the " << dirName << " edge.\n";
+        return false;
+    }
+
+    // Leave the container across the direction for the nearest one along it
+    LayoutNode* outside = branch->parent;
+    while (outside->parent && outside->parent->splitType != axis) outside = outside->parent;
+    return MoveLeafBeside(currentNode, outside, axis, towardsFirst);
+}
+
+// Function to change the split orientation of the current container
+void ChangeSplitOrientation(SplitType newSplitType) {
+    LayoutNode* currentNode = GetFocusedLeaf();
+
+    if (!currentNode) {
+        std::cerr << "ChangeSplitOrientation: Current window not managed.\n";
+        return;
+    }
+
+    // Find the parent split node
+    LayoutNode* parent = currentNode->parent;
+    if (!parent) {
+        std::cerr << "ChangeSplitOrientation: Current window has no parent split node.\n";
+        return;
+    }
+
+    // Check if the parent split type is already the desired type
+    if (parent->splitType == newSplitType) {
+        std::cout << "ChangeSplitOrientation: Split type is already " 
+                  << (newSplitType == SplitType::VERTICAL ? "Vertical" : "Horizontal") << ".\n";
+        return;
+    }
+
+    // Change the split type
+    RecordOrientationDelta(parent);
+    parent->splitType = newSplitType;
+    MarkLayoutChanged(parent);
+    std::cout << "ChangeSplitOrientation: Split type changed to " 
+              << (newSplitType == SplitType::VERTICAL ? "Vertical" : "Horizontal") << ".\n";
+
+    // Re-apply the layout to reflect the change
+    RECT screenRect = GetScreenRect();
+
+    TileWindows(screenRect);
+}
+
+// Debugging Function to Print the Layout Tree
+void PrintLayout(LayoutNode* node, int depth) {
+    if (!node) return;
+    for (int i = 0; i < depth; ++i) std::cout << "  ";
+    if (node->isSplit) {
+        std::cout << "Split: " << (node->splitType == SplitType::VERTICAL ? "Vertical" : "Horizontal") 
+                  << ", Ratio: " << static_cast<double>(node->splitRatio) / RATIO_SCALE << "\n";
+        PrintLayout(node->firstChild.get(), depth + 1);
+        PrintLayout(node->secondChild.get(), depth + 1);
+    }
+    else {
+        std::string title = GetWindowTitle(node->hwnd);
+        std::cout << "Window: HWND=0x" << std::hex << node->hwnd << std::dec 
+                  << ", Title=\"" << title << "\"\n";
+    }
+}
+
+// Function to install the low-level keyboard hook used by resize mode
+bool InstallResizeKeyboardHook() {
+    if (g_StubWindowSystem) return true; // Resize keys are fed in directly when simulated
+
+    hKeyboardHook = SetWindowsHookEx(WH_KEYBOARD_LL, LowLevelKeyboardProc, nullptr, 0);
+    return hKeyboardHook != NULL;
+}
+
+// Function to remove the resize mode keyboard hook, if installed
+void RemoveResizeKeyboardHook() {
+    if (hKeyboardHook) {
+        UnhookWindowsHookEx(hKeyboardHook);
+        hKeyboardHook = NULL;
+    }
+}
+
+// Function to handle a key pressed while in resize mode
+void HandleResizeKey(DWORD vkCode, bool isShiftPressed) {
+    TraceResizeKey(vkCode, isShiftPressed);
+
+    if (vkCode == VK_ESCAPE) {
+        // Exit resize mode on ESC
+        isResizeMode = false;
+        RemoveResizeKeyboardHook();
+        std::cout << "HandleResizeKey: Exited resize mode.\n";
+        return;
+    }
+
+    LayoutNode* resizeNode = ResolveNode(activeNodeForResize);
+    if (!resizeNode || !resizeNode->parent) return;
+
+    // Determine delta ratio based on key and split type
+    int deltaRatio = 0;
+    LayoutNode* parentSplitNode = resizeNode->parent;
+    switch (vkCode) {
+        case VK_LEFT:
+            if (parentSplitNode->splitType == SplitType::VERTICAL) {
+                deltaRatio = isShiftPressed ? -RATIO_STEP : RATIO_STEP;
+            }
+            break;
+        case VK_RIGHT:
+            if (parentSplitNode->splitType == SplitType::VERTICAL) {
+                deltaRatio = isShiftPressed ? RATIO_STEP : -RATIO_STEP;
+            }
+            break;
+        case VK_UP:
+            if (parentSplitNode->splitType == SplitType::HORIZONTAL) {
+                deltaRatio = isShiftPressed ? -RATIO_STEP : RATIO_STEP;
+            }
+            break;
+        case VK_DOWN:
+            if (parentSplitNode->splitType == SplitType::HORIZONTAL) {
+                deltaRatio = isShiftPressed ? RATIO_STEP : -RATIO_STEP;
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (deltaRatio != 0) {
+        // Adjust the split ratio
+        AdjustSplitRatio(parentSplitNode, deltaRatio);
+    }
+}
+
+// Low-level keyboard hook callback
+LRESULT CALLBACK LowLevelKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam) {
+    if (nCode == HC_ACTION && isResizeMode && wParam == WM_KEYDOWN) {
+        KBDLLHOOKSTRUCT* p = (KBDLLHOOKSTRUCT*)lParam;
+
+        // Determine if Shift is pressed
+        bool isShiftPressed = (GetAsyncKeyState(VK_SHIFT) & 0x8000) != 0;
+
+        PostLayoutMessage(WM_LAYOUT_RESIZE_KEY, p->vkCode, isShiftPressed ? 1 : 0);
+        return 1; // Suppress the key
+    }
+    return CallNextHookEx(hKeyboardHook, nCode, wParam, lParam);
+}
+
+// WinEvent callback implementation
+// Function to decide whether a WinEvent can affect the layout. Runs for every hooked event
+// on the desktop, so it only looks at the event fields and the managed-window set.
+bool PrefilterWinEvent(DWORD event, HWND hwnd, LONG idObject, LONG idChild) {
+    // Only window-level events matter
+    if (hwnd == nullptr || idObject != OBJID_WINDOW || idChild != CHILDID_SELF) {
+        return false;
+    }
+
+    bool managed = g_ManagedWindowSet.Contains(hwnd);
+    switch (event) {
+    case EVENT_OBJECT_DESTROY:
+        return managed;  // Unmanaged windows have nothing to remove
+    case EVENT_OBJECT_NAMECHANGE:
+        return managed;  // Titles are only cached for managed windows
+    case EVENT_OBJECT_SHOW:
+        return !managed; // An already-managed window being re-shown must not be added twice
+    case EVENT_SYSTEM_FOREGROUND:
+        return true;     // Rare, and a window can become foreground just before it is managed
+    case EVENT_SYSTEM_MOVESIZEEND:
+    case EVENT_SYSTEM_MINIMIZESTART:
+    case EVENT_OBJECT_LOCATIONCHANGE:
+    case EVENT_OBJECT_STATECHANGE:
+        return managed;  // Only tiled windows have applied state to drop
+    default:
+        return true;
+    }
+}
+
+// Windows with a location or state event on its way to the layout thread. A drag, or one of
+// our own moves, reports these in bursts; one queued check per window covers the whole burst.
+std::mutex g_ReconcileMutex;
+std::unordered_set<HWND> g_ReconcilePending;
+
+// Function to mark a window as having a check queued. Returns false if one already is.
+bool MarkReconcilePending(HWND hwnd) {
+    std::lock_guard<std::mutex> lock(g_ReconcileMutex);
+    return g_ReconcilePending.insert(hwnd).second;
+}
+
+// Function to clear the mark, before the check reads the window, so a later event queues again
+void ClearReconcilePending(HWND hwnd) {
+    std::lock_guard<std::mutex> lock(g_ReconcileMutex);
+    g_ReconcilePending.erase(hwnd);
+}
+
+// Function to count pre-filter decisions
+void CountWinEvent(bool accepted) {
+    CountMetric(Metric::WINEVENTS_RECEIVED);
+    if (!accepted) CountMetric(Metric::WINEVENTS_FILTERED);
+
+    if (accepted) ++g_WinEventsAccepted;
+    else ++g_WinEventsRejected;
+}
+
+void CALLBACK WinEventProc(
+    HWINEVENTHOOK hWinEventHook,
+    DWORD event,
+    HWND hwnd,
+    LONG idObject,
+    LONG idChild,
+    DWORD dwEventThread,
+    DWORD dwmsEventTime
+) {
+    TraceWinEvent(event, hwnd, idObject, idChild);
+
+    // The hooks are global, so most events are for carets, menus, tooltips or windows we
+    // do not manage. Drop those before doing any logging or queuing.
+    bool accepted = PrefilterWinEvent(event, hwnd, idObject, idChild);
+    CountWinEvent(accepted);
+    if (!accepted) {
+        return;
+    }
+
+    // Location and state changes arrive in bursts, so they are neither logged nor queued
+    // twice for the same window
+    bool reconcile = (event == EVENT_OBJECT_LOCATIONCHANGE || event == EVENT_OBJECT_STATECHANGE);
+    if (reconcile) {
+        if (!MarkReconcilePending(hwnd)) return;
+    }
+    else {
+        // Log every other accepted event with HWND in hexadecimal
+        std::cout << "WinEventProc: Event " << event << " received for HWND=0x" 
+                  << std::hex << hwnd << std::dec << "\n";
+    }
+
+    // Hand the event to the layout thread
+    if (!PostLayoutMessage(WM_LAYOUT_WINEVENT, static_cast<WPARAM>(event), reinterpret_cast<LPARAM>(hwnd)) && reconcile) {
+        ClearReconcilePending(hwnd);
+    }
+}
+
+// Function to apply a window-level WinEvent to the layout. Runs on the layout thread.
+void HandleWindowEvent(DWORD event, HWND hwnd) {
+    // Function to process window addition
+    auto processWindow = [&](HWND hwnd) {
+        std::cout << "Processing window: HWND=0x" << std::hex << hwnd << std::dec << "\n";
+
+        if (!WsIsWindowVisible(hwnd)) {
+            std::cout << " - Skipped: Window is not visible.\n";
+            return;
+        }
+
+        // A newly shown window may have changed since it was last seen, so read it afresh
+        const WindowProperties& properties = RefreshWindowProperties(hwnd);
+        const std::string& title = *properties.title;
+        if (title.empty()) {
+            std::cout << " - Skipped: Window has no title.\n";
+            return;
+        }
+
+        LONG exStyle = properties.exStyle;
+        if (exStyle & WS_EX_TOOLWINDOW) {
+            std::cout << " - Skipped: Window is a tool window. Title=\"" << title << "\"\n";
+            return;
+        }
+
+        LONG style = properties.style;
+        if ((style & WS_POPUP) || (style & WS_CHILD)) {
+            std::cout << " - Skipped: Window is a popup or child window. Title=\"" << title << "\"\n";
+            return;
+        }
+
+        RECT rect;
+        if (!WsGetWindowRect(hwnd, &rect)) {
+            std::cerr << " - Error: Failed to get RECT for HWND=0x" << std::hex << hwnd 
+                      << ". Error: " << GetLastError() << "\n" << std::dec;
+            return;
+        }
+
+        if (rect.left == rect.right || rect.top == rect.bottom) {
+            std::cout << " - Skipped: Window has no area. Title=\"" << title << "\"\n";
+            return;
+        }
+
+        // Initialize WindowInfo
+        WindowInfo winInfo;
+        winInfo.hwnd = hwnd;
+        winInfo.savedRect = rect;
+        winInfo.savedStyle = style;
+        managedWindows.Insert(winInfo);
+        g_ManagedWindowSet.Insert(hwnd);
+        IndexManagedWindow(hwnd);
+
+        // Floating windows keep their geometry; the tiled layout is not touched
+        if (ShouldFloat(hwnd, title, exStyle)) {
+            AddFloatingWindow(hwnd, rect);
+            std::cout << " - Added: New floating window. Title=\"" << title << "\"\n";
+            return;
+        }
+        std::cout << " - Added: New window managed. Title=\"" << title << "\"\n";
+
+        // A window matching a placeholder takes its tile; nothing else moves
+        bool swallowed = SwallowIntoPlaceholder(hwnd);
+        if (!swallowed) {
+            // If no placeholder matches, add where the layout policy puts it
+            std::cout << " - No placeholder matches. Adding to the layout.\n";
+            AddWindowToLayout(hwnd);
+        }
+
+        // The foreground event may have come before the window was managed
+        if (hwnd == g_ForegroundWindow) {
+            TrackFocusedWindow(hwnd);
+        }
+
+        // Re-apply the tiling layout
+        if (!swallowed) {
+            RECT screenRect = GetScreenRect();
+
+            TileWindows(screenRect);
+        }
+    };
+
+    // Handle window show events
+    if (event == EVENT_OBJECT_SHOW) {
+        processWindow(hwnd);
+        if (!g_ManagedWindowSet.Contains(hwnd)) {
+            ForgetWindowProperties(hwnd); // Nothing keeps an unmanaged window's entry fresh
+        }
+    }
+    // Handle focus changes. Focus on an unmanaged window is remembered but does not move the
+    // managed focus.
+    else if (event == EVENT_SYSTEM_FOREGROUND) {
+        g_ForegroundWindow = hwnd;
+        if (g_ManagedWindowSet.Contains(hwnd)) {
+            TrackFocusedWindow(hwnd);
+        }
+    }
+    // Handle the user dragging or minimizing a window. Nothing is retiled, but what was last
+    // applied no longer describes the window, so the next layout pass puts it back in place.
+    else if (event == EVENT_SYSTEM_MOVESIZEEND || event == EVENT_SYSTEM_MINIMIZESTART) {
+        g_AppliedWindowState.erase(hwnd);
+    }
+    // Handle any other change of position, size or state, which may not have been ours
+    else if (event == EVENT_OBJECT_LOCATIONCHANGE || event == EVENT_OBJECT_STATECHANGE) {
+        ClearReconcilePending(hwnd);
+        ReconcileAppliedWindowState(hwnd);
+    }
+    // Handle title changes. Titles do not affect the layout; only the cache is updated.
+    else if (event == EVENT_OBJECT_NAMECHANGE) {
+        const std::string& title = *RefreshWindowProperties(hwnd, PROPERTY_TITLE).title;
+        std::cout << "WinEventProc: Title changed: HWND=0x" << std::hex << hwnd << std::dec
+                  << ", Title=\"" << title << "\"\n";
+    }
+    // Handle window destruction
+    else if (event == EVENT_OBJECT_DESTROY) {
+        // Remove the window from managedWindows and the layout tree
+        if (managedWindows.Erase(hwnd)) {
+            std::cout << "WinEventProc: Window removed: HWND=0x" << std::hex << hwnd << std::dec << "\n";
+            g_ManagedWindowSet.Erase(hwnd);
+            g_WindowSizeConstraints.erase(hwnd);
+            g_AppliedWindowState.erase(hwnd);
+            ForgetGeometryWindow(hwnd);
+            UnindexManagedWindow(hwnd);
+            ForgetWindowProperties(hwnd);
+
+            // Focus moves to the leaf the tree handed it to, until the next foreground event
+            bool wasFocused = (hwnd == g_FocusedWindow);
+
+            // A floating window was never in the tree, so there is nothing to retile
+            if (RemoveFloatingWindow(hwnd)) {
+                if (wasFocused) g_FocusedWindow = FocusedLeafWindow();
+                return;
+            }
+
+            // Remove the corresponding LayoutNode and re-apply the tiling layout
+            if (RemoveWindowFromLayout(hwnd)) {
+                if (wasFocused) g_FocusedWindow = FocusedLeafWindow();
+                ReconcileOverlayWindow(); // The closed window may have been the fullscreen one
+                RECT screenRect = GetScreenRect();
+
+                TileWindows(screenRect);
+            }
+        }
+    }
+}
+
+// Function to unregister all WinEvent hooks
+void UnregisterWinEventHooks(HWINEVENTHOOK hHookShow, HWINEVENTHOOK hHookDestroy, HWINEVENTHOOK hHookNameChange = nullptr,
+                             HWINEVENTHOOK hHookForeground = nullptr, HWINEVENTHOOK hHookMoveSize = nullptr,
+                             HWINEVENTHOOK hHookMinimize = nullptr, HWINEVENTHOOK hHookLocation = nullptr) {
+    if (hHookShow) {
+        UnhookWinEvent(hHookShow);
+    }
+    if (hHookDestroy) {
+        UnhookWinEvent(hHookDestroy);
+    }
+    if (hHookNameChange) {
+        UnhookWinEvent(hHookNameChange);
+    }
+    if (hHookForeground) {
+        UnhookWinEvent(hHookForeground);
+    }
+    if (hHookMoveSize) {
+        UnhookWinEvent(hHookMoveSize);
+    }
+    if (hHookMinimize) {
+        UnhookWinEvent(hHookMinimize);
+    }
+    if (hHookLocation) {
+        UnhookWinEvent(hHookLocation);
+    }
+    std::cout << "UnregisterWinEventHooks: All WinEvent hooks unregistered.\n";
+}
+
+// Function to close a focused window
+void CloseFocusedWindow(HWND currentWindow) {
+    if (g_StubWindowSystem) return; // A replayed trace carries the resulting destroy event
+
+    PostMessage(currentWindow, WM_CLOSE, 0, 0);
+}
+
+// Function to open the terminal
+void OpenTerminal() {
+    // Eventually we'll modify this function to allow users to specify their terminal from a config
+    // but this will be added at a later date
+    // - cmd.exe
+    // - powershell.exe
+    // - wt.exe (Windows Terminal, if installed)
+    // - bash.exe (Git Bash, if installed and in PATH)
+
+    if (g_StubWindowSystem) return; // A replayed trace carries the new window's events
+
+    // Example 1: Open Command Prompt
+    /*
+    ShellExecuteA(
+        NULL,                   // No parent window
+        "open",                 // Operation to perform
+        "cmd.exe",              // Application to start
+        NULL,                   // Command line arguments
+        NULL,                   // Default directory
+        SW_SHOWDEFAULT          // Show command
+    );
+    */
+
+    // Example 2: Open PowerShell
+    /*
+    ShellExecuteA(
+        NULL,
+        "open",
+        "powershell.exe",
+        NULL,
+        NULL,
+        SW_SHOWDEFAULT
+    );
+    */
+
+    // Example 3: Open Windows Terminal (requires Windows Terminal to be installed)
+    /*
+    ShellExecuteA(
+        NULL,
+        "open",
+        "wt.exe",
+        NULL,
+        NULL,
+        SW_SHOWDEFAULT
+    );
+    */
+
+    // Example 4: Open Git Bash (ensure it's installed and added to PATH)
+    /*
+    ShellExecuteA(
+        NULL,
+        "open",
+        "bash.exe",
+        NULL,
+        NULL,
+        SW_SHOWDEFAULT
+    );
+    */
+
+    if (ShellExecuteA(
+        NULL,
+        "open",
+        "bash.exe",
+        NULL,
+        NULL,
+        SW_SHOWDEFAULT
+    ) <= (HINSTANCE)32) { // Error checking
+        std::cerr << "OpenTerminal: Failed to open Terminal. Error code: " << GetLastError() << "\n";
+    } else {
+        std::cout << "OpenTerminal: Terminal opened successfully.\n";
+    }
+}
+
+// Function to toggle fullscreen on the focused window, if it is tiled
+void ToggleFocusedFullscreen() {
+    // While a window is fullscreen, MOD + F always ends it, wherever focus went meanwhile
+    LayoutNode* currentNode = ResolveNode(g_FullscreenLeaf);
+    if (!currentNode) currentNode = GetFocusedLeaf();
+    if (currentNode && currentNode->hwnd != nullptr) {
+        // Get monitor information for fullscreen
+        RECT monitorRect;
+        if (!GetWindowMonitorRect(currentNode->hwnd, &monitorRect)) {
+            std::cerr << "Hotkey 3: Failed to get monitor info. Error: " << GetLastError() << "\n";
+            return;
+        }
+
+        // Toggle fullscreen
+        SetWindowFullscreen(currentNode, monitorRect);
+    }
+    else {
+        std::cerr << "Hotkey 3: Current window not managed.\n";
+    }
+}
+
+// Function to move the focused window between the tiled tree and the floating layer. The
+// journal handles this like a window opening or closing, so callers record it with
+// JournalOrigin::LIFECYCLE rather than as an undoable step.
+void ToggleFocusedFloating() {
+    HWND current = g_FocusedWindow;
+    WindowInfo* managed = managedWindows.Get(current);
+    if (!managed) {
+        std::cerr << "ToggleFocusedFloating: Current window not managed.\n";
+        return;
+    }
+    if (IsGeometryQuarantined(current)) {
+        std::cerr << "ToggleFocusedFloating: HWND=0x" << std::hex << current << std::dec
+                  << " is not answering; left as it is.\n";
+        return;
+    }
+
+    RECT screenRect = GetScreenRect();
+    if (RemoveFloatingWindow(current)) {
+        std::cout << "ToggleFocusedFloating: Tiling HWND=0x" << std::hex << current << std::dec << "\n";
+        AddWindowToLayout(current);
+        SetFocusedLeaf(FindLayoutNode(root.get(), current));
+        TileWindows(screenRect);
+        return;
+    }
+
+    LayoutNode* node = FindLayoutNode(root.get(), current);
+    if (!node || node->handle == g_FullscreenLeaf) return;
+
+    std::cout << "ToggleFocusedFloating: Floating HWND=0x" << std::hex << current << std::dec << "\n";
+    RemoveWindowFromLayout(current);
+
+    // Give the window back its frame and the geometry it had before it was tiled. It is no
+    // longer placed by the layout, so nothing is kept as applied to it.
+    RECT rect = managed->savedRect;
+    if (rect.right <= rect.left || rect.bottom <= rect.top) {
+        WsGetWindowRect(current, &rect);
+    }
+    g_AppliedWindowState.erase(current);
+    SetWindowStyleQueued(current, managed->savedStyle);
+    PlaceWindowQueued(current, rect);
+    AddFloatingWindow(current, rect);
+
+    TileWindows(screenRect);
+}
+
+// i3-style criteria selecting the windows a command applies to, as in
+// [class="Notepad" title="*.txt"] focus. Class and process match exactly, the title is a
+// pattern as in layout files, con_mark names a mark and con_id is a window handle. Empty
+// fields match anything.
+struct WindowCriteria {
+    HWND conId = nullptr;
+    std::string className;
+    std::string processName;
+    std::string titlePattern;
+    std::string mark;
+};
+
+// Number of windows compared against criteria, for the benchmark
+size_t g_CriteriaWindowsChecked = 0;
+
+// Function to check one window against every field of the criteria
+bool MatchesCriteria(HWND hwnd, const WindowCriteria& criteria) {
+    ++g_CriteriaWindowsChecked;
+    if (criteria.conId && criteria.conId != hwnd) return false;
+    const WindowProperties& properties = GetWindowProperties(hwnd);
+    if (!criteria.className.empty() && criteria.className != *properties.className) return false;
+    if (!criteria.processName.empty() && criteria.processName != *properties.processName) return false;
+    if (!criteria.titlePattern.empty() && !MatchTitlePattern(criteria.titlePattern, *properties.title)) return false;
+    if (!criteria.mark.empty()) {
+        auto marked = g_Marks.find(criteria.mark);
+        if (marked == g_Marks.end() || marked->second != hwnd) return false;
+    }
+    return true;
+}
+
+// Function to find the managed windows matching the criteria, in no particular order. The
+// candidates come from the most selective field: the handle, else the mark, else the class
+// bucket, else the process bucket. Only criteria with nothing but a title pattern have to
+// check every window.
+std::vector<HWND> QueryWindows(const WindowCriteria& criteria) {
+    std::vector<HWND> matches;
+    auto consider = [&](const std::vector<HWND>& candidates) {
+        for (HWND hwnd : candidates) {
+            if (MatchesCriteria(hwnd, criteria)) matches.push_back(hwnd);
+        }
+    };
+
+    if (criteria.conId) {
+        if (g_ManagedWindowSet.Contains(criteria.conId)) consider({ criteria.conId });
+    } else if (!criteria.mark.empty()) {
+        auto marked = g_Marks.find(criteria.mark);
+        if (marked != g_Marks.end()) consider({ marked->second });
+    } else if (!criteria.className.empty()) {
+        auto bucket = g_WindowsByClass.find(criteria.className);
+        if (bucket != g_WindowsByClass.end()) consider(bucket->second);
+    } else if (!criteria.processName.empty()) {
+        auto bucket = g_WindowsByProcess.find(criteria.processName);
+        if (bucket != g_WindowsByProcess.end()) consider(bucket->second);
+    } else {
+        for (const WindowInfo& window : managedWindows) {
+            if (MatchesCriteria(window.hwnd, criteria)) matches.push_back(window.hwnd);
+        }
+    }
+    return matches;
+}
+
+// Function to read a leading [key=value ...] criteria block from a command. Sets pos past it
+// and returns false on a malformed block or an unknown key.
+bool ParseCriteria(const std::string& command, size_t& pos, WindowCriteria& criteria) {
+    // Find the closing bracket, skipping any inside quoted values
+    size_t close = pos + 1;
+    bool quoted = false;
+    while (close < command.size() && (quoted || command[close] != ']')) {
+        if (command[close] == '"') quoted = !quoted;
+        ++close;
+    }
+    if (close >= command.size()) {
+        std::cerr << "RunCommand: Unterminated criteria in \"" << command << "\".\n";
+        return false;
+    }
+
+    std::string block = command.substr(pos + 1, close - pos - 1);
+    size_t fieldPos = 0;
+    std::string key, value;
+    while (ReadLayoutField(block, fieldPos, key, value)) {
+        if (key == "class") criteria.className = value;
+        else if (key == "process") criteria.processName = value;
+        else if (key == "title") criteria.titlePattern = value;
+        else if (key == "con_mark") criteria.mark = value;
+        else if (key == "con_id") {
+            criteria.conId = reinterpret_cast<HWND>(static_cast<uintptr_t>(std::strtoull(value.c_str(), nullptr, 0)));
+            if (!criteria.conId) {
+                std::cerr << "RunCommand: Invalid con_id \"" << value << "\".\n";
+                return false;
+            }
+        }
+        else {
+            std::cerr << "RunCommand: Unknown criterion \"" << key << "\".\n";
+            return false;
+        }
+    }
+    if (block.find_first_not_of(' ', fieldPos) != std::string::npos) {
+        std::cerr << "RunCommand: Malformed criteria in \"" << command << "\".\n";
+        return false;
+    }
+    pos = close + 1;
+    return true;
+}
+
+// Function to run a text command: optional criteria, then one of
+//   focus | kill | mark <name> | unmark [<name>]
+// Without criteria the command applies to the focused window. `metrics` reports the runtime
+// metrics instead, into output if given and to the console otherwise, `layout <policy>`
+// switches the workspace's layout policy and `balance` gives the windows of every container
+// an equal share of it. Returns false if the command is malformed or matches no window.
+bool RunCommand(const std::string& command, std::string* output) {
+    TraceCommand(command);
+
+    size_t pos = command.find_first_not_of(' ');
+    if (pos == std::string::npos) return false;
+
+    std::vector<HWND> targets;
+    if (command[pos] == '[') {
+        WindowCriteria criteria;
+        if (!ParseCriteria(command, pos, criteria)) return false;
+        targets = QueryWindows(criteria);
+    } else if (g_FocusedWindow) {
+        targets.push_back(g_FocusedWindow);
+    }
+
+    std::istringstream words(command.substr(pos));
+    std::string verb, argument;
+    words >> verb >> argument;
+
+    // Commands that do not act on a window
+    if (verb == "metrics") {
+        if (output) *output = FormatMetrics();
+        else std::cout << FormatMetrics();
+        return true;
+    }
+    if (verb == "balance") {
+        if (root) {
+            BalanceSubtree(root.get());
+            TileWindows(GetScreenRect());
+        }
+        return true;
+    }
+    if (verb == "layout") {
+        LayoutPolicy policy;
+        if (!ParseLayoutPolicy(argument, policy)) {
+            std::cerr << "RunCommand: Unknown layout policy \"" << argument << "\".\n";
+            return false;
+        }
+        if (!SetLayoutPolicy(policy)) return false;
+        std::cout << "RunCommand: Layout policy is now " << LAYOUT_POLICY_NAMES[static_cast<int>(policy)] << ".\n";
+        TileWindows(GetScreenRect());
+        return true;
+    }
+
+    if (targets.empty()) {
+        std::cerr << "RunCommand: No window matches \"" << command << "\".\n";
+        return false;
+    }
+
+    if (verb == "focus") {
+        HWND target = targets.front();
+        LayoutNode* leaf = FindLayoutNode(root.get(), target);
+        if (leaf) {
+            FocusWindow(leaf);
+        } else if (IsGeometryQuarantined(target)) {
+            std::cerr << "RunCommand: HWND=0x" << std::hex << target << std::dec
+                      << " is not answering; focus left where it is.\n";
+        } else {
+            RaiseWindowQueued(target); // A floating window
+            g_FocusedWindow = target;
+        }
+    } else if (verb == "kill") {
+        for (HWND target : targets) CloseFocusedWindow(target);
+    } else if (verb == "mark" && !argument.empty()) {
+        for (HWND target : targets) SetWindowMark(target, argument);
+    } else if (verb == "unmark") {
+        for (HWND target : targets) RemoveWindowMark(target, argument);
+    } else {
+        std::cerr << "RunCommand: Unknown command \"" << command << "\".\n";
+        return false;
+    }
+
+    std::cout << "RunCommand: \"" << command << "\" applied to " << targets.size() << " window(s).\n";
+    return true;
+}
+
+// Name of the pipe commands are sent through, as with i3-msg
+const char COMMAND_PIPE_NAME[] = "\\\\.\\pipe\\LatticeWM";
+
+// How long --msg waits for a busy command pipe to free up, and how long a client waits for the
+// layout thread to run its command
+const DWORD COMMAND_PIPE_WAIT_MS = 2000;
+const DWORD COMMAND_REPLY_TIMEOUT_MS = 5000;
+
+// Security descriptor of the command pipe: only the user LatticeWM runs as may open it
+PSECURITY_DESCRIPTOR g_CommandPipeSecurity = nullptr;
+
+// Function to build a security descriptor that grants the current user, and no one else, full
+// access. Returns nullptr on failure; the result is freed with LocalFree.
+PSECURITY_DESCRIPTOR CreateCurrentUserSecurityDescriptor() {
+    HANDLE token = nullptr;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)) return nullptr;
+
+    DWORD size = 0;
+    GetTokenInformation(token, TokenUser, nullptr, 0, &size);
+    std::vector<BYTE> user(size);
+    bool haveUser = size > 0 && GetTokenInformation(token, TokenUser, user.data(), size, &size);
+    CloseHandle(token);
+    if (!haveUser) return nullptr;
+
+    char* sid = nullptr;
+    if (!ConvertSidToStringSidA(reinterpret_cast<TOKEN_USER*>(user.data())->User.Sid, &sid)) return nullptr;
+    std::string sddl = std::string("D:P(A;;GA;;;") + sid + ")";
+    LocalFree(sid);
+
+    PSECURITY_DESCRIPTOR descriptor = nullptr;
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorA(sddl.c_str(), SDDL_REVISION_1, &descriptor, nullptr)) {
+        return nullptr;
+    }
+    return descriptor;
+}
+
+// Function to create one instance of the command pipe. The first one claims the name, so
+// LatticeWM never listens on a pipe some other process created. Commands come in as a byte
+// stream; each reply goes back as one message.
+HANDLE CreateCommandPipeInstance(bool first) {
+    SECURITY_ATTRIBUTES attributes{ sizeof(attributes), g_CommandPipeSecurity, FALSE };
+    return CreateNamedPipeA(COMMAND_PIPE_NAME,
+                            PIPE_ACCESS_DUPLEX | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+                            PIPE_TYPE_MESSAGE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                            PIPE_UNLIMITED_INSTANCES, 65536, 4096, 0, &attributes);
+}
+
+// Function to run one command on the layout thread and write its reply to the client: "ok" or
+// "error" on the first line, then whatever the command printed (the metrics, for `metrics`)
+void RunPipeCommand(HANDLE pipe, std::string line) {
+    auto* message = new std::string(std::move(line));
+    auto* reply = new std::promise<std::string>;
+    std::future<std::string> result = reply->get_future();
+    std::string text;
+    if (!PostLayoutMessage(WM_LAYOUT_COMMAND, reinterpret_cast<WPARAM>(reply), reinterpret_cast<LPARAM>(message))) {
+        delete message;
+        delete reply;
+        text = "error\nLatticeWM is shutting down.\n";
+    } else if (result.wait_for(std::chrono::milliseconds(COMMAND_REPLY_TIMEOUT_MS)) != std::future_status::ready) {
+        text = "error\nThe command timed out.\n";
+    } else {
+        text = result.get();
+    }
+
+    DWORD written = 0;
+    if (!WriteFile(pipe, text.data(), static_cast<DWORD>(text.size()), &written, nullptr)) {
+        std::cerr << "ServeCommandClient: Failed to write a reply. Error: " << GetLastError() << "\n";
+    }
+}
+
+// Function to read commands from one connected client, one per line, and run each as soon as
+// its line is complete. Ends when the client closes its end.
+void ServeCommandClient(HANDLE pipe) {
+    std::string pending;
+    char buffer[4096];
+    for (bool open = true; open;) {
+        DWORD bytesRead = 0;
+        open = ReadFile(pipe, buffer, sizeof(buffer), &bytesRead, nullptr) && bytesRead > 0;
+        if (open) pending.append(buffer, bytesRead);
+        else pending.push_back('\n'); // The last command need not end its line
+
+        size_t start = 0;
+        for (size_t end; (end = pending.find('\n', start)) != std::string::npos; start = end + 1) {
+            std::string line = pending.substr(start, end - start);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.find_first_not_of(' ') == std::string::npos) continue;
+            RunPipeCommand(pipe, std::move(line));
+        }
+        pending.erase(0, start);
+    }
+    DisconnectNamedPipe(pipe);
+    CloseHandle(pipe);
+}
+
+// Function to accept commands on the command pipe and post them to the layout thread. Each
+// client gets its own pipe instance and thread, so one that keeps its end open holds up no
+// one else. The listener blocks in ConnectNamedPipe and simply ends with the process.
+bool StartCommandPipe() {
+    g_CommandPipeSecurity = CreateCurrentUserSecurityDescriptor();
+    if (!g_CommandPipeSecurity) {
+        std::cerr << "StartCommandPipe: Failed to build the pipe's security descriptor. Error: " << GetLastError() << "\n";
+        return false;
+    }
+
+    HANDLE pipe = CreateCommandPipeInstance(true);
+    if (pipe == INVALID_HANDLE_VALUE) {
+        std::cerr << "StartCommandPipe: Failed to create pipe (another process may own "
+                  << COMMAND_PIPE_NAME << "). Error: " << GetLastError() << "\n";
+        return false;
+    }
+
+    std::thread([pipe]() mutable {
+        for (;;) {
+            if (!ConnectNamedPipe(pipe, nullptr)) {
+                DWORD error = GetLastError();
+                if (error == ERROR_NO_DATA) { // The client left before it was accepted
+                    DisconnectNamedPipe(pipe);
+                    continue;
+                }
+                if (error != ERROR_PIPE_CONNECTED) break;
+            }
+
+            // Listen on a new instance before handing this one over, so a client arriving
+            // meanwhile finds the pipe busy (and waits) rather than gone
+            HANDLE next = CreateCommandPipeInstance(false);
+            std::thread(ServeCommandClient, pipe).detach();
+            pipe = next;
+            if (pipe == INVALID_HANDLE_VALUE) {
+                std::cerr << "StartCommandPipe: Failed to create pipe instance. Error: " << GetLastError() << "\n";
+                return;
+            }
+        }
+        CloseHandle(pipe);
+    }).detach();
+
+    std::cout << "StartCommandPipe: Listening for commands on " << COMMAND_PIPE_NAME << ".\n";
+    return true;
+}
+
+// Function to send a command to a running instance through the command pipe and print its
+// reply. Returns 0 if the command succeeded.
+int SendCommand(const std::string& command) {
+    HANDLE pipe = INVALID_HANDLE_VALUE;
+    for (;;) {
+        pipe = CreateFileA(COMMAND_PIPE_NAME, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (pipe != INVALID_HANDLE_VALUE) break;
+
+        // Every instance is serving another client; wait for the listener to open the next
+        DWORD error = GetLastError();
+        if (error == ERROR_PIPE_BUSY && WaitNamedPipeA(COMMAND_PIPE_NAME, COMMAND_PIPE_WAIT_MS)) continue;
+
+        if (error == ERROR_FILE_NOT_FOUND) {
+            std::cerr << "SendCommand: No running instance found.\n";
+        } else {
+            std::cerr << "SendCommand: Failed to open " << COMMAND_PIPE_NAME << ". Error: " << error << "\n";
+        }
+        return 1;
+    }
+
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    SetNamedPipeHandleState(pipe, &mode, nullptr, nullptr);
+
+    std::string line = command + "\n";
+    DWORD written = 0;
+    if (!WriteFile(pipe, line.data(), static_cast<DWORD>(line.size()), &written, nullptr) || written != line.size()) {
+        std::cerr << "SendCommand: Failed to send command. Error: " << GetLastError() << "\n";
+        CloseHandle(pipe);
+        return 1;
+    }
+
+    // The reply is one message, read in as many pieces as it takes
+    std::string reply;
+    char buffer[4096];
+    for (;;) {
+        DWORD bytesRead = 0;
+        BOOL complete = ReadFile(pipe, buffer, sizeof(buffer), &bytesRead, nullptr);
+        reply.append(buffer, bytesRead);
+        if (complete) break;
+        if (GetLastError() != ERROR_MORE_DATA) {
+            std::cerr << "SendCommand: Failed to read the reply. Error: " << GetLastError() << "\n";
+            CloseHandle(pipe);
+            return 1;
+        }
+    }
+    CloseHandle(pipe);
+
+    size_t statusEnd = reply.find('\n');
+    std::string status = reply.substr(0, statusEnd);
+    if (statusEnd != std::string::npos) std::cout << reply.substr(statusEnd + 1);
+    if (status != "ok") {
+        std::cerr << "SendCommand: \"" << command << "\" failed; see LatticeWM's log.\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Shared-memory copy of the layout state for bars and other tools, read with the library in
+// lattice_state.h. The layout thread is the only writer; it builds each version in a staging
+// copy and only writes to the region when something a reader can see has changed.
+HANDLE g_SharedStateMapping = nullptr;
+LatticeStateRegion* g_SharedState = nullptr;
+LatticeState g_SharedStateStaging;
+size_t g_SharedStatePublishes = 0;
+
+// Function to fill in the fixed header of a freshly created region
+void InitializeSharedStateRegion(LatticeStateRegion* region) {
+    std::memset(&region->state, 0, sizeof(region->state));
+    region->sequence.store(0, std::memory_order_relaxed);
+    region->magic = LATTICE_STATE_MAGIC;
+    region->version = LATTICE_STATE_VERSION;
+    region->size = sizeof(LatticeStateRegion);
+}
+
+// Function to create the named region. Readers simply find nothing if this fails. A region
+// that already exists belongs to another instance, or to a process squatting on the name, and
+// is never written to.
+bool StartSharedState() {
+    PSECURITY_DESCRIPTOR security = CreateCurrentUserSecurityDescriptor();
+    SECURITY_ATTRIBUTES attributes{ sizeof(attributes), security, FALSE };
+    g_SharedStateMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, security ? &attributes : nullptr,
+        PAGE_READWRITE, 0, sizeof(LatticeStateRegion), LATTICE_STATE_MAPPING_NAME);
+    DWORD error = GetLastError();
+    if (security) LocalFree(security);
+    if (!g_SharedStateMapping) {
+        std::cerr << "StartSharedState: Failed to create " << LATTICE_STATE_MAPPING_NAME
+                  << ". Error: " << error << "\n";
+        return false;
+    }
+    if (error == ERROR_ALREADY_EXISTS) {
+        std::cerr << "StartSharedState: " << LATTICE_STATE_MAPPING_NAME
+                  << " already exists; another process owns it, so the layout state is not published.\n";
+        CloseHandle(g_SharedStateMapping);
+        g_SharedStateMapping = nullptr;
+        return false;
+    }
+
+    void* view = MapViewOfFile(g_SharedStateMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(LatticeStateRegion));
+    if (!view) {
+        std::cerr << "StartSharedState: Failed to map " << LATTICE_STATE_MAPPING_NAME
+                  << ". Error: " << GetLastError() << "\n";
+        CloseHandle(g_SharedStateMapping);
+        g_SharedStateMapping = nullptr;
+        return false;
+    }
+
+    g_SharedState = new (view) LatticeStateRegion;
+    InitializeSharedStateRegion(g_SharedState);
+    std::cout << "StartSharedState: Publishing layout state in " << LATTICE_STATE_MAPPING_NAME << ".\n";
+    return true;
+}
+
+void StopSharedState() {
+    if (g_SharedState) UnmapViewOfFile(g_SharedState);
+    if (g_SharedStateMapping) CloseHandle(g_SharedStateMapping);
+    g_SharedState = nullptr;
+    g_SharedStateMapping = nullptr;
+}
+
+// Function to copy a title into a fixed-size field, cutting it at a UTF-8 character boundary
+void CopySharedStateTitle(char (&field)[LATTICE_STATE_TITLE_BYTES], const std::string& title) {
+    size_t length = (std::min)(title.size(), static_cast<size_t>(LATTICE_STATE_TITLE_BYTES - 1));
+    if (length < title.size()) {
+        while (length > 0 && (static_cast<unsigned char>(title[length]) & 0xC0) == 0x80) --length;
+    }
+    std::memcpy(field, title.data(), length);
+    std::memset(field + length, 0, LATTICE_STATE_TITLE_BYTES - length);
+}
+
+// Function to publish the current state to the shared region through its sequence lock.
+// Runs on the layout thread after each committed change.
+void PublishSharedState() {
+    if (!g_SharedState) return;
+
+    static std::vector<LayoutNode*> leaves;
+    leaves.clear();
+    CollectLeafNodes(root.get(), leaves);
+
+    LatticeState& staging = g_SharedStateStaging;
+    staging.workspace = 1;
+    staging.mode = isResizeMode ? LATTICE_MODE_RESIZE : LATTICE_MODE_DEFAULT;
+    staging.focusedHwnd = reinterpret_cast<uintptr_t>(g_FocusedWindow);
+    staging.totalLeaves = static_cast<uint32_t>(leaves.size());
+    staging.leafCount = (std::min)(staging.totalLeaves, LATTICE_STATE_MAX_LEAVES);
+    for (uint32_t i = 0; i < staging.leafCount; ++i) {
+        const LayoutNode* leaf = leaves[i];
+        LatticeStateLeaf& out = staging.leaves[i];
+        HWND hwnd = leaf->hwnd;
+        out.hwnd = reinterpret_cast<uintptr_t>(hwnd);
+        out.left = leaf->windowRect.left;
+        out.top = leaf->windowRect.top;
+        out.right = leaf->windowRect.right;
+        out.bottom = leaf->windowRect.bottom;
+        out.flags = (hwnd && hwnd == g_FocusedWindow ? LATTICE_LEAF_FOCUSED : 0) |
+                    (leaf->handle == g_FullscreenLeaf ? LATTICE_LEAF_FULLSCREEN : 0) |
+                    (hwnd ? 0 : LATTICE_LEAF_PLACEHOLDER);
+        out.reserved = 0;
+        CopySharedStateTitle(out.title, hwnd ? GetWindowTitle(hwnd) : std::string());
+    }
+
+    // Only this thread writes the region, so it can be compared without the lock
+    LatticeState& published = g_SharedState->state;
+    size_t headerBytes = offsetof(LatticeState, leaves) - offsetof(LatticeState, workspace);
+    if (published.generation != 0 &&
+        std::memcmp(&published.workspace, &staging.workspace, headerBytes) == 0 &&
+        std::memcmp(published.leaves, staging.leaves, staging.leafCount * sizeof(LatticeStateLeaf)) == 0) {
+        return;
+    }
+    staging.generation = published.generation + 1;
+
+    // An odd sequence tells readers an update is under way; the fence keeps the writes below
+    // from becoming visible before it
+    uint32_t sequence = g_SharedState->sequence.load(std::memory_order_relaxed);
+    g_SharedState->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&published, &staging, offsetof(LatticeState, leaves) + staging.leafCount * sizeof(LatticeStateLeaf));
+    g_SharedState->sequence.store(sequence + 2, std::memory_order_release);
+    ++g_SharedStatePublishes;
+}
+
+// Function to print the state a running instance publishes, using the reader library
+int PrintSharedState() {
+    LatticeStateReader reader;
+    if (!reader.Open()) {
+        std::cerr << "PrintSharedState: No running instance found.\n";
+        return 1;
+    }
+
+    std::unique_ptr<LatticeState> state(new LatticeState);
+    if (!reader.Read(*state)) {
+        std::cerr << "PrintSharedState: The state kept changing while it was read.\n";
+        return 1;
+    }
+
+    std::cout << "Generation " << state->generation << ", workspace " << state->workspace
+              << (state->mode == LATTICE_MODE_RESIZE ? ", resize mode" : "") << ", focused HWND=0x"
+              << std::hex << state->focusedHwnd << std::dec << "\n";
+    for (uint32_t i = 0; i < state->leafCount; ++i) {
+        const LatticeStateLeaf& leaf = state->leaves[i];
+        std::cout << ((leaf.flags & LATTICE_LEAF_FOCUSED) ? "* " : "  ")
+                  << "HWND=0x" << std::hex << leaf.hwnd << std::dec
+                  << ", Rect=(" << leaf.left << "," << leaf.top << "," << leaf.right << "," << leaf.bottom << ")"
+                  << ((leaf.flags & LATTICE_LEAF_FULLSCREEN) ? ", fullscreen" : "")
+                  << ((leaf.flags & LATTICE_LEAF_PLACEHOLDER) ? ", placeholder" : "")
+                  << ", Title=\"" << leaf.title << "\"\n";
+    }
+    if (state->totalLeaves > state->leafCount) {
+        std::cout << "  (" << state->totalLeaves - state->leafCount << " more leaves not published)\n";
+    }
+    return 0;
+}
+
+// Function to refresh the gauges after a committed change. Runs on the layout thread.
+void UpdateLayoutGauges() {
+    SetGauge(Gauge::MANAGED_WINDOWS, static_cast<int64_t>(managedWindows.size()));
+    SetGauge(Gauge::FLOATING_WINDOWS, static_cast<int64_t>(g_FloatingWindows.size()));
+    SetGauge(Gauge::UNDO_JOURNAL_OPS, static_cast<int64_t>(g_UndoJournal.size()));
+    SetGauge(Gauge::RETIRED_SNAPSHOTS, static_cast<int64_t>(g_RetiredSnapshots.size()));
+}
+
+// Function to write one metric in the Prometheus text exposition format
+void WriteMetric(std::ostream& out, const char* name, const char* help, const char* type, long long value) {
+    out << "# HELP " << name << " " << help << "\n"
+        << "# TYPE " << name << " " << type << "\n"
+        << name << " " << value << "\n";
+}
+
+// Function to render every metric in the Prometheus text format. Safe to call from any
+// thread: the tree shape is taken from the published layout snapshot.
+std::string FormatMetrics() {
+    std::ostringstream out;
+    for (int i = 0; i < static_cast<int>(Metric::COUNT); ++i) {
+        WriteMetric(out, METRIC_INFO[i].name, METRIC_INFO[i].help, "counter",
+                    static_cast<long long>(ReadMetric(static_cast<Metric>(i))));
+    }
+    for (int i = 0; i < static_cast<int>(Gauge::COUNT); ++i) {
+        WriteMetric(out, GAUGE_INFO[i].name, GAUGE_INFO[i].help, "gauge",
+                    g_MetricGauges[i].load(std::memory_order_relaxed));
+    }
+
+    // Read handled before posted, so a message posted in between cannot make this negative
+    uint64_t handled = ReadMetric(Metric::LAYOUT_MESSAGES_HANDLED);
+    uint64_t posted = ReadMetric(Metric::LAYOUT_MESSAGES_POSTED);
+    WriteMetric(out, "lattice_layout_queue_depth", "Messages waiting for the layout thread.", "gauge",
+                posted > handled ? static_cast<long long>(posted - handled) : 0);
+
+    long long tiled = 0;
+    long long depth = 0;
+    {
+        LayoutSnapshotGuard guard;
+        const LayoutSnapshot* snapshot = guard.Get();
+        if (snapshot && snapshot->root) {
+            tiled = snapshot->root->leafCount;
+            std::vector<std::pair<const SnapshotNode*, long long>> stack{ { snapshot->root.get(), 1 } };
+            while (!stack.empty()) {
+                auto [node, level] = stack.back();
+                stack.pop_back();
+                depth = (std::max)(depth, level);
+                if (node->isSplit) {
+                    if (node->firstChild) stack.emplace_back(node->firstChild.get(), level + 1);
+                    if (node->secondChild) stack.emplace_back(node->secondChild.get(), level + 1);
+                }
+            }
+        }
+    }
+    WriteMetric(out, "lattice_tiled_windows", "Windows in the layout tree.", "gauge", tiled);
+    WriteMetric(out, "lattice_tree_depth", "Levels in the layout tree.", "gauge", depth);
+    return out.str();
+}
+
+// Function to serve the metrics over HTTP on 127.0.0.1:<port> for Prometheus to scrape.
+// Every request gets the metrics, whatever its path. The listener simply ends with the process.
+bool StartMetricsEndpoint(int port) {
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        std::cerr << "StartMetricsEndpoint: Failed to start Winsock.\n";
+        return false;
+    }
+
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET) {
+        std::cerr << "StartMetricsEndpoint: Failed to create socket. Error: " << WSAGetLastError() << "\n";
+        return false;
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<u_short>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR ||
+        listen(listener, SOMAXCONN) == SOCKET_ERROR) {
+        std::cerr << "StartMetricsEndpoint: Failed to listen on 127.0.0.1:" << port
+                  << ". Error: " << WSAGetLastError() << "\n";
+        closesocket(listener);
+        return false;
+    }
+
+    std::thread([listener]() {
+        for (;;) {
+            SOCKET client = accept(listener, nullptr, nullptr);
+            if (client == INVALID_SOCKET) break;
+
+            // Read the request head; nothing in it changes the answer
+            std::string request;
+            char buffer[2048];
+            int received = 0;
+            while (request.find("\r\n\r\n") == std::string::npos && request.size() < 16384 &&
+                   (received = recv(client, buffer, sizeof(buffer), 0)) > 0) {
+                request.append(buffer, received);
+            }
+
+            std::string body = FormatMetrics();
+            std::string response = "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                "Connection: close\r\n\r\n" + body;
+            for (size_t sent = 0; sent < response.size();) {
+                int chunk = send(client, response.data() + sent, static_cast<int>(response.size() - sent), 0);
+                if (chunk <= 0) break;
+                sent += chunk;
+            }
+            shutdown(client, SD_SEND);
+            closesocket(client);
+        }
+        closesocket(listener);
+    }).detach();
+
+    std::cout << "StartMetricsEndpoint: Serving metrics on http://127.0.0.1:" << port << "/metrics.\n";
+    return true;
+}
+
+// Window switcher (MOD + D). What is typed is fuzzy-matched against the title, class and marks
+// of every managed window, and Enter focuses the chosen window directly.
+//
+// Opening the switcher packs each window's fields, lowered, into one corpus buffer and notes
+// which characters each entry contains. A keystroke first drops the entries missing one of
+// the query's characters, then matches the rest with an SSE2 byte search. A longer query can
+// only match a subset of what the shorter one matched, and matches each entry the same way up
+// to the old query's end, so typing narrows the previous candidates and only searches for the
+// characters just typed.
+struct SwitcherEntry {
+    HWND hwnd;
+    uint32_t offset;   // Start of "title\x1Fclass\x1Fmarks" in the corpus
+    uint32_t length;
+    uint64_t charMask; // SwitcherCharBit of every character in the entry
+};
+
+// How far an entry matched the query so far
+struct SwitcherMatch {
+    uint32_t entry;
+    uint32_t next;  // Where the search for the next query character starts
+    uint32_t last;  // Position of the last matched character, or UINT32_MAX before the first
+    int score;
+};
+
+const size_t SWITCHER_ROWS = 10;
+const int SWITCHER_WIDTH = 900;
+const int SWITCHER_ROW_HEIGHT = 24;
+const size_t SWITCHER_PADDING = 16; // Zero bytes after the corpus, so 16-byte loads never overrun
+const COLORREF SWITCHER_SELECTED_BACKGROUND = RGB(0x28, 0x55, 0x77);
+
+HWND g_hSwitcher = NULL;
+std::string g_SwitcherCorpus;
+std::vector<SwitcherEntry> g_SwitcherEntries;
+std::vector<SwitcherMatch> g_SwitcherCandidates; // Entries matching g_SwitcherQuery, in order
+std::vector<SwitcherMatch> g_SwitcherResults;    // Best candidates, best first
+std::string g_SwitcherInput;                   // As typed
+std::string g_SwitcherQuery;                   // Lowered, without spaces, as last matched
+size_t g_SwitcherSelection = 0;
+size_t g_SwitcherEntriesScanned = 0;           // Entries looked at by keystrokes, for the benchmark
+
+// Function to lower ASCII letters. Other bytes, including UTF-8 sequences, are left alone.
+char LowerSwitcherChar(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// Function to map a lowered character to its bit in an entry's character mask
+uint64_t SwitcherCharBit(char c) {
+    unsigned char byte = static_cast<unsigned char>(c);
+    if (byte >= 'a' && byte <= 'z') return 1ull << (byte - 'a');
+    if (byte >= '0' && byte <= '9') return 1ull << (26 + byte - '0');
+    return 1ull << (36 + byte % 28);
+}
+
+// Function to find the first occurrence of a byte in text[from, length). Returns length if
+// there is none. The text must be followed by SWITCHER_PADDING readable bytes.
+size_t FindSwitcherByte(const char* text, size_t from, size_t length, char c) {
+#ifdef LATTICE_SSE2
+    const __m128i needle = _mm_set1_epi8(c);
+    for (size_t i = from; i < length; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+        if (mask == 0) continue;
+#ifdef _MSC_VER
+        unsigned long bit;
+        _BitScanForward(&bit, mask);
+#else
+        unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+        return (std::min)(length, i + bit);
+    }
+    return length;
+#else
+    const void* found = std::memchr(text + from, c, length - (std::min)(from, length));
+    return found ? static_cast<size_t>(static_cast<const char*>(found) - text) : length;
+#endif
+}
+
+bool IsSwitcherWordBreak(char c) {
+    return c == ' ' || c == '-' || c == '_' || c == '.' || c == ':' || c == '/' || c == '\\' || c == '\x1F';
+}
+
+// Function to extend a match by more lowered query characters. Returns false if they do not
+// follow in the entry. Each character takes its first occurrence after the previous one;
+// matches that continue a run or start a word score extra.
+bool ExtendSwitcherMatch(SwitcherMatch& match, const char* characters, size_t count) {
+    const SwitcherEntry& entry = g_SwitcherEntries[match.entry];
+    const char* text = g_SwitcherCorpus.data() + entry.offset;
+    for (size_t i = 0; i < count; ++i) {
+        size_t found = FindSwitcherByte(text, match.next, entry.length, characters[i]);
+        if (found == entry.length) return false;
+        match.score += 1;
+        if (found == static_cast<size_t>(match.last) + 1) match.score += 4;
+        if (found == 0 || IsSwitcherWordBreak(text[found - 1])) match.score += 3;
+        match.last = static_cast<uint32_t>(found);
+        match.next = static_cast<uint32_t>(found + 1);
+    }
+    return true;
+}
+
+// Function to make every entry a candidate again, as matched by the empty query
+void ResetSwitcherCandidates() {
+    g_SwitcherCandidates.resize(g_SwitcherEntries.size());
+    for (size_t i = 0; i < g_SwitcherEntries.size(); ++i) {
+        g_SwitcherCandidates[i] = SwitcherMatch{ static_cast<uint32_t>(i), 0, UINT32_MAX, 0 };
+    }
+}
+
+// Function to pack the managed windows into a fresh corpus
+void BuildSwitcherCorpus() {
+    g_SwitcherCorpus.clear();
+    g_SwitcherEntries.clear();
+    g_SwitcherEntries.reserve(managedWindows.size());
+
+    for (const WindowInfo& window : managedWindows) {
+        const WindowProperties& properties = GetWindowProperties(window.hwnd);
+        SwitcherEntry entry{ window.hwnd, static_cast<uint32_t>(g_SwitcherCorpus.size()), 0, 0 };
+
+        g_SwitcherCorpus += *properties.title;
+        g_SwitcherCorpus += '\x1F';
+        g_SwitcherCorpus += *properties.className;
+        auto marks = g_MarksByWindow.find(window.hwnd);
+        if (marks != g_MarksByWindow.end()) {
+            for (const std::string& mark : marks->second) {
+                g_SwitcherCorpus += '\x1F';
+                g_SwitcherCorpus += mark;
+            }
+        }
+
+        entry.length = static_cast<uint32_t>(g_SwitcherCorpus.size() - entry.offset);
+        for (size_t i = entry.offset; i < g_SwitcherCorpus.size(); ++i) {
+            g_SwitcherCorpus[i] = LowerSwitcherChar(g_SwitcherCorpus[i]);
+            entry.charMask |= SwitcherCharBit(g_SwitcherCorpus[i]);
+        }
+        g_SwitcherEntries.push_back(entry);
+    }
+    g_SwitcherCorpus.append(SWITCHER_PADDING, '\0');
+
+    g_SwitcherQuery.clear();
+    ResetSwitcherCandidates();
+}
+
+// Function to rematch after the input changed and keep the best SWITCHER_ROWS results. Spaces
+// in the input are ignored.
+void UpdateSwitcherQuery(const std::string& input) {
+    std::string query;
+    uint64_t queryMask = 0;
+    for (char c : input) {
+        if (c == ' ') continue;
+        query += LowerSwitcherChar(c);
+        queryMask |= SwitcherCharBit(query.back());
+    }
+
+    bool narrowing = query.size() >= g_SwitcherQuery.size() &&
+                     query.compare(0, g_SwitcherQuery.size(), g_SwitcherQuery) == 0;
+    size_t matchedLength = narrowing ? g_SwitcherQuery.size() : 0;
+    if (!narrowing) ResetSwitcherCandidates();
+
+    // Only the best SWITCHER_ROWS results are kept, in order; candidates are visited in entry
+    // order, so ties go to the window managed first
+    g_SwitcherResults.clear();
+    size_t kept = 0;
+    for (SwitcherMatch match : g_SwitcherCandidates) {
+        ++g_SwitcherEntriesScanned;
+        const SwitcherEntry& entry = g_SwitcherEntries[match.entry];
+        if ((entry.charMask & queryMask) != queryMask) continue;
+        if (!ExtendSwitcherMatch(match, query.data() + matchedLength, query.size() - matchedLength)) continue;
+        g_SwitcherCandidates[kept++] = match;
+
+        if (g_SwitcherResults.size() == SWITCHER_ROWS && match.score <= g_SwitcherResults.back().score) continue;
+        int score = match.score;
+        auto position = std::find_if(g_SwitcherResults.begin(), g_SwitcherResults.end(),
+            [score](const SwitcherMatch& result) { return result.score < score; });
+        g_SwitcherResults.insert(position, match);
+        if (g_SwitcherResults.size() > SWITCHER_ROWS) g_SwitcherResults.pop_back();
+    }
+    g_SwitcherCandidates.resize(kept);
+
+    g_SwitcherQuery = query;
+    g_SwitcherSelection = 0;
+    if (g_hSwitcher != NULL) InvalidateRect(g_hSwitcher, nullptr, FALSE);
+}
+
+// Function to hide the switcher and free its corpus
+void CloseSwitcher() {
+    if (g_hSwitcher != NULL) ShowWindow(g_hSwitcher, SW_HIDE);
+    g_SwitcherCorpus.clear();
+    g_SwitcherEntries.clear();
+    g_SwitcherCandidates.clear();
+    g_SwitcherResults.clear();
+    g_SwitcherInput.clear();
+    g_SwitcherQuery.clear();
+}
+
+// Function to focus the selected result, through the same command path as --msg
+void ChooseSwitcherResult() {
+    if (g_SwitcherSelection < g_SwitcherResults.size()) {
+        HWND hwnd = g_SwitcherEntries[g_SwitcherResults[g_SwitcherSelection].entry].hwnd;
+        std::ostringstream command;
+        command << "[con_id=0x" << std::hex << reinterpret_cast<uintptr_t>(hwnd) << "] focus";
+        auto* message = new std::string(command.str());
+        if (!PostLayoutMessage(WM_LAYOUT_COMMAND, 0, reinterpret_cast<LPARAM>(message))) {
+            delete message;
+        }
+    }
+    CloseSwitcher();
+}
+
+LRESULT CALLBACK SwitcherWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    switch (msg) {
+    case WM_CHAR:
+        if (wParam == VK_BACK) {
+            if (!g_SwitcherInput.empty()) g_SwitcherInput.pop_back();
+            UpdateSwitcherQuery(g_SwitcherInput);
+        } else if (wParam >= 0x20 && wParam < 0x7F) {
+            g_SwitcherInput += static_cast<char>(wParam);
+            UpdateSwitcherQuery(g_SwitcherInput);
+        }
+        return 0;
+    case WM_KEYDOWN:
+        if (wParam == VK_ESCAPE) {
+            CloseSwitcher();
+        } else if (wParam == VK_RETURN) {
+            ChooseSwitcherResult();
+        } else if (wParam == VK_UP && g_SwitcherSelection > 0) {
+            --g_SwitcherSelection;
+            InvalidateRect(hwnd, nullptr, FALSE);
+        } else if (wParam == VK_DOWN && g_SwitcherSelection + 1 < g_SwitcherResults.size()) {
+            ++g_SwitcherSelection;
+            InvalidateRect(hwnd, nullptr, FALSE);
+        }
+        return 0;
+    case WM_ACTIVATE:
+        if (LOWORD(wParam) == WA_INACTIVE) CloseSwitcher(); // Clicking elsewhere dismisses it
+        return 0;
+    case WM_PAINT: {
+        PAINTSTRUCT ps;
+        HDC hdc = BeginPaint(hwnd, &ps);
+        HGDIOBJ oldFont = SelectObject(hdc, g_BarFont);
+        SetBkMode(hdc, TRANSPARENT);
+
+        RECT client;
+        GetClientRect(hwnd, &client);
+        HBRUSH background = CreateSolidBrush(BAR_BACKGROUND);
+        FillRect(hdc, &client, background);
+        DeleteObject(background);
+
+        // The input line, then one row per result
+        SetTextColor(hdc, BAR_FOREGROUND);
+        std::wstring input = Utf8ToWide("> " + g_SwitcherInput);
+        RECT row = { BAR_SEGMENT_PADDING, 0, client.right - BAR_SEGMENT_PADDING, SWITCHER_ROW_HEIGHT };
+        DrawTextW(hdc, input.c_str(), static_cast<int>(input.size()), &row, DT_SINGLELINE | DT_VCENTER | DT_NOPREFIX);
+
+        for (size_t i = 0; i < g_SwitcherResults.size(); ++i) {
+            row.top += SWITCHER_ROW_HEIGHT;
+            row.bottom += SWITCHER_ROW_HEIGHT;
+            if (i == g_SwitcherSelection) {
+                RECT highlight = { 0, row.top, client.right, row.bottom };
+                HBRUSH brush = CreateSolidBrush(SWITCHER_SELECTED_BACKGROUND);
+                FillRect(hdc, &highlight, brush);
+                DeleteObject(brush);
+            }
+            const WindowProperties& properties = GetWindowProperties(g_SwitcherEntries[g_SwitcherResults[i].entry].hwnd);
+            std::wstring text = Utf8ToWide(*properties.title + "  (" + *properties.className + ")");
+            DrawTextW(hdc, text.c_str(), static_cast<int>(text.size()), &row,
+                      DT_SINGLELINE | DT_VCENTER | DT_NOPREFIX | DT_END_ELLIPSIS);
+        }
+
+        SelectObject(hdc, oldFont);
+        EndPaint(hwnd, &ps);
+        return 0;
+    }
+    }
+    return DefWindowProc(hwnd, msg, wParam, lParam);
+}
+
+// Function to open the switcher over the top of the screen and give it the keyboard
+void OpenSwitcher() {
+    BuildSwitcherCorpus();
+    g_SwitcherInput.clear();
+    UpdateSwitcherQuery(g_SwitcherInput);
+
+    if (g_StubWindowSystem) return; // Nothing to draw for simulated windows
+
+    if (g_hSwitcher == NULL) {
+        const char CLASS_NAME[] = "LatticeSwitcherWindowClass";
+
+        WNDCLASSA wc = { };
+        wc.lpfnWndProc   = SwitcherWndProc;
+        wc.hInstance     = GetModuleHandle(NULL);
+        wc.lpszClassName = CLASS_NAME;
+        wc.hCursor       = LoadCursor(NULL, IDC_ARROW);
+
+        if (!RegisterClassA(&wc)) {
+            std::cerr << "OpenSwitcher: Failed to register window class.\n";
+            return;
+        }
+
+        RECT screenRect = GetScreenRect();
+        int height = static_cast<int>(SWITCHER_ROWS + 1) * SWITCHER_ROW_HEIGHT;
+        g_hSwitcher = CreateWindowExA(
+            WS_EX_TOOLWINDOW | WS_EX_TOPMOST,
+            CLASS_NAME,
+            "LatticeWM Switcher",
+            WS_POPUP,
+            (screenRect.left + screenRect.right - SWITCHER_WIDTH) / 2, screenRect.top + (screenRect.bottom - screenRect.top) / 4,
+            SWITCHER_WIDTH, height,
+            NULL,
+            NULL,
+            GetModuleHandle(NULL),
+            NULL
+        );
+
+        if (!g_hSwitcher) {
+            std::cerr << "OpenSwitcher: Failed to create switcher window. Error: " << GetLastError() << "\n";
+            return;
+        }
+    }
+    if (g_BarFont == NULL) g_BarFont = static_cast<HFONT>(GetStockObject(DEFAULT_GUI_FONT));
+
+    ShowWindow(g_hSwitcher, SW_SHOW);
+    SetForegroundWindow(g_hSwitcher);
+    InvalidateRect(g_hSwitcher, nullptr, FALSE);
+}
+
+// Function to dispatch a registered hotkey by its ID
+void HandleHotkey(WPARAM hotkeyId) {
+    TraceHotkey(hotkeyId);
+
+    // Check if any window is in fullscreen mode
+    if (IsAnyWindowFullscreen()) {
+        if (hotkeyId == 3) { // Hotkey ID 3 corresponds to MOD + F
+            std::cout << "Hotkey 3: MOD + F pressed. Toggling fullscreen.\n";
+            ToggleFocusedFullscreen();
+        }
+        else {
+            // All other hotkeys are ignored while in fullscreen
+            std::cout << "Hotkeys are disabled while a window is fullscreen. Only MOD + F is active.\n";
+        }
+        return;
+    }
+
+    // No window is in fullscreen; process hotkeys normally
+    switch (hotkeyId) {
+        case 1: { // MOD + LEFT
+            std::cout << "Hotkey 1: MOD + LEFT pressed. Focusing left window.\n";
+            Navigate(Direction::LEFT);
+            break;
+        }
+        case 2: { // MOD + RIGHT
+            std::cout << "Hotkey 2: MOD + RIGHT pressed. Focusing right window.\n";
+            Navigate(Direction::RIGHT);
+            break;
+        }
+        case 3: { // MOD + F (Toggle Fullscreen)
+            std::cout << "Hotkey 3: MOD + F pressed. Toggling fullscreen.\n";
+            ToggleFocusedFullscreen();
+            break;
+        }
+        case 6: { // MOD + UP
+            std::cout << "Hotkey 6: MOD + UP pressed. Focusing up window.\n";
+            Navigate(Direction::UP);
+            break;
+        }
+        case 7: { // MOD + DOWN
+            std::cout << "Hotkey 7: MOD + DOWN pressed. Focusing down window.\n";
+            Navigate(Direction::DOWN);
+            break;
+        }
+        case 10: { // MOD + R (Toggle Resize Mode)
+            std::cout << "Hotkey 10: MOD + R pressed. Toggling resize mode.\n";
+            isResizeMode = !isResizeMode;
+            if (isResizeMode) {
+                // Get the currently focused window
+                LayoutNode* focusedLeaf = GetFocusedLeaf();
+                activeNodeForResize = focusedLeaf ? focusedLeaf->handle : NodeHandle();
+                if (!focusedLeaf) {
+                    std::cerr << "Hotkey 10: Current window not managed.\n";
+                    isResizeMode = false;
+                    break;
+                }
+
+                // Install the keyboard hook
+                if (!InstallResizeKeyboardHook()) {
+                    std::cerr << "Hotkey 10: Failed to install keyboard hook. Error: " << GetLastError() << "\n";
+                    isResizeMode = false;
+                    break;
+                }
+
+                std::cout << "Hotkey 10: Entered resize mode. Use arrow keys to resize.\n";
+                std::cout << "  Press SHIFT + Arrow Key to shrink the window.\n";
+                std::cout << "  Press Arrow Key alone to grow the window.\n";
+                std::cout << "  Press ESC or MOD + R to exit resize mode.\n";
+            }
+            else {
+                // Uninstall the keyboard hook
+                RemoveResizeKeyboardHook();
+                std::cout << "Hotkey 10: Exited resize mode.\n";
+            }
+            break;
+        }
+        case 11: { // MOD + SHIFT + UP (Move Up)
+            std::cout << "Hotkey 11: MOD + SHIFT + UP pressed. Moving window up.\n";
+            if (MoveWindowInDirection(Direction::UP)) {
+                std::cout << "Hotkey 11: Moved window up successfully.\n";
+            }
+            break;
+        }
+        case 12: { // MOD + SHIFT + DOWN (Move Down)
+            std::cout << "Hotkey 12: MOD + SHIFT + DOWN pressed. Moving window down.\n";
+            if (MoveWindowInDirection(Direction::DOWN)) {
+                std::cout << "Hotkey 12: Moved window down successfully.\n";
+            }
+            break;
+        }
+        case 13: { // MOD + SHIFT + LEFT (Move Left)
+            std::cout << "Hotkey 13: MOD + SHIFT + LEFT pressed. Moving window left.\n";
+            if (MoveWindowInDirection(Direction::LEFT)) {
+                std::cout << "Hotkey 13: Moved window left successfully.\n";
+            }
+            break;
+        }
+        case 14: { // MOD + SHIFT + RIGHT (Move Right)
+            std::cout << "Hotkey 14: MOD + SHIFT + RIGHT pressed. Moving window right.\n";
+            if (MoveWindowInDirection(Direction::RIGHT)) {
+                std::cout << "Hotkey 14: Moved window right successfully.\n";
+            }
+            break;
+        }
+        case 15: { // MOD + SHIFT + Q (Close Focused Window)
+            std::cout << "Hotkey 15: MOD + SHIFT + Q pressed. Closing Focused Window.\n";
+            if (g_FocusedWindow) CloseFocusedWindow(g_FocusedWindow);
+            break;
+        }
+        case 16: { // MOD + V (Toggle to Vertical Split)
+            std::cout << "Hotkey 16: MOD + V pressed. Changing split to Vertical.\n";
+            ChangeSplitOrientation(SplitType::VERTICAL);
+            break;
+        }
+        case 17: { // MOD + H (Toggle to Horizontal Split)
+            std::cout << "Hotkey 17: MOD + H pressed. Changing split to Horizontal.\n";
+            ChangeSplitOrientation(SplitType::HORIZONTAL);
+            break;
+        }
+        case 18: { // MOD + Return (Open New Terminal Window)
+            std::cout << "Hotkey 18: MOD + Return pressed. Opening new terminal window.\n";
+            OpenTerminal();
+            break;
+        }
+        case 19: { // MOD + Z (Undo Layout Change)
+            std::cout << "Hotkey 19: MOD + Z pressed. Undoing last layout change.\n";
+            UndoLayoutOperation();
+            break;
+        }
+        case 20: { // MOD + SHIFT + Z (Redo Layout Change)
+            std::cout << "Hotkey 20: MOD + SHIFT + Z pressed. Redoing layout change.\n";
+            RedoLayoutOperation();
+            break;
+        }
+        case 21: { // MOD + SHIFT + Space (Toggle Floating)
+            std::cout << "Hotkey 21: MOD + SHIFT + Space pressed. Toggling floating.\n";
+            ToggleFocusedFloating();
+            break;
+        }
+        case 22: { // MOD + D (Window Switcher)
+            std::cout << "Hotkey 22: MOD + D pressed. Opening window switcher.\n";
+            OpenSwitcher();
+            break;
+        }
+        default:
+            std::cerr << "HandleHotkey: Unknown hotkey ID received: " << hotkeyId << "\n";
+            break;
+    }
+}
+
+// Function to check whether a message is one of ours rather than WM_HOTKEY or a window
+// message. Only these count towards the layout queue depth.
+bool IsLayoutMessage(UINT message) {
+    return message >= WM_LAYOUT_WINEVENT && message <= WM_LAYOUT_GEOMETRY;
+}
 
-    // Determine the required split type based on direction
-    SplitType requiredSplit;
-    switch (dir) {
-        case Direction::LEFT:
-        case Direction::RIGHT:
-            requiredSplit = SplitType::VERTICAL;
+// Function to post a message to the layout thread. Safe to call from any thread. With the
+// simulated window system there is no message loop, so the message is handled immediately.
+bool PostLayoutMessage(UINT message, WPARAM wParam, LPARAM lParam) {
+    bool counted = IsLayoutMessage(message);
+    if (counted) CountMetric(Metric::LAYOUT_MESSAGES_POSTED);
+    if (g_StubWindowSystem) {
+        MSG msg = { 0 };
+        msg.message = message;
+        msg.wParam = wParam;
+        msg.lParam = lParam;
+        DispatchLayoutMessage(msg);
+        return true;
+    }
+
+    if (!PostThreadMessage(g_LayoutThreadId, message, wParam, lParam)) {
+        std::cerr << "PostLayoutMessage: Failed to post message " << message
+                  << ". Error: " << GetLastError() << "\n";
+        if (counted) CountMetric(Metric::LAYOUT_MESSAGES_HANDLED); // Never queued, so never waiting
+        return false;
+    }
+    return true;
+}
+
+// Function to make a committed layout change visible: to snapshot and shared-state readers,
+// the gauges and the bar
+void PublishLayoutState() {
+    PublishLayoutSnapshot();
+    PublishSharedState();
+    UpdateLayoutGauges();
+    UpdateBarFromLayout();
+}
+
+// Function to pick the journal origin a hotkey is recorded with. Toggling floating moves a
+// window in or out of the tree, which is not an undoable step.
+JournalOrigin GetHotkeyJournalOrigin(WPARAM hotkeyId) {
+    return hotkeyId == 21 ? JournalOrigin::LIFECYCLE : JournalOrigin::USER;
+}
+
+// Function to handle a message on the layout thread. Returns false for messages that are
+// not layout messages, which the caller dispatches normally. Without publish the change is
+// committed but left for the caller to publish, together with the ones after it.
+bool DispatchLayoutMessage(const MSG& msg, bool publish) {
+    if (IsLayoutMessage(msg.message)) {
+        CountMetric(Metric::LAYOUT_MESSAGES_HANDLED);
+    }
+
+    switch (msg.message) {
+        case WM_HOTKEY:
+        case WM_LAYOUT_HOTKEY:
+            CountMetric(Metric::HOTKEYS);
+            BeginJournalOperation(GetHotkeyJournalOrigin(msg.wParam));
+            HandleHotkey(msg.wParam);
             break;
-        case Direction::UP:
-        case Direction::DOWN:
-            requiredSplit = SplitType::HORIZONTAL;
+        case WM_LAYOUT_WINEVENT:
+            BeginJournalOperation(JournalOrigin::LIFECYCLE);
+            HandleWindowEvent(static_cast<DWORD>(msg.wParam), reinterpret_cast<HWND>(msg.lParam));
+            break;
+        case WM_LAYOUT_RESIZE_KEY:
+            BeginJournalOperation(JournalOrigin::RESIZE);
+            // Keys queued before resize mode was left are dropped
+            if (isResizeMode) {
+                HandleResizeKey(static_cast<DWORD>(msg.wParam), msg.lParam != 0);
+            }
+            break;
+        case WM_LAYOUT_STATUS: {
+            // Status output only changes the bar, never the layout
+            std::unique_ptr<std::vector<StatusBlock>> blocks(reinterpret_cast<std::vector<StatusBlock>*>(msg.lParam));
+            SetBarStatus(std::move(*blocks));
+            return true;
+        }
+        case WM_LAYOUT_COMMAND: {
+            std::unique_ptr<std::string> command(reinterpret_cast<std::string*>(msg.lParam));
+            std::unique_ptr<std::promise<std::string>> reply(reinterpret_cast<std::promise<std::string>*>(msg.wParam));
+            CountMetric(Metric::COMMANDS);
+            BeginJournalOperation(JournalOrigin::USER);
+            std::string output;
+            bool succeeded = RunCommand(*command, reply ? &output : nullptr);
+            if (reply) reply->set_value((succeeded ? "ok\n" : "error\n") + output);
+            break;
+        }
+        case WM_LAYOUT_GEOMETRY:
+            BeginJournalOperation(JournalOrigin::LIFECYCLE);
+            DrainGeometryResults();
+            break;
+        default:
+            return false;
+    }
+
+    // Each layout message is one committed change, for the undo journal and for snapshot
+    // readers
+    CommitJournalOperation();
+    if (publish) PublishLayoutState();
+    return true;
+}
+
+// Function to put a message for the layout thread into its lane. Returns false for messages
+// that are not for the layout thread.
+bool QueueLayoutMessage(const MSG& msg) {
+    switch (msg.message) {
+        case WM_HOTKEY:
+        case WM_LAYOUT_HOTKEY:
+        case WM_LAYOUT_RESIZE_KEY:
+        case WM_LAYOUT_COMMAND:
+            g_LayoutLanes.input.push_back(msg);
+            return true;
+        case WM_LAYOUT_WINEVENT:
+            // A click or Alt+Tab must take effect before the keys that follow it
+            if (msg.wParam == EVENT_SYSTEM_FOREGROUND) g_LayoutLanes.input.push_back(msg);
+            else g_LayoutLanes.background.push_back(msg);
+            return true;
+        case WM_LAYOUT_STATUS:
+        case WM_LAYOUT_GEOMETRY:
+            g_LayoutLanes.background.push_back(msg);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Function to sort everything waiting in the layout thread's queue into the lanes. Other
+// messages are dispatched on the spot; taking messages from the queue is also what runs the
+// WinEvent and keyboard hooks. Returns false once WM_QUIT has been taken from the queue.
+bool DrainThreadQueue() {
+    MSG msg;
+    while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
+        if (msg.message == WM_QUIT) return false;
+        if (QueueLayoutMessage(msg)) continue;
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+    return true;
+}
+
+// Function to handle every waiting input message, then one slice of background messages.
+// poll refills the lanes between background messages, and input that turns up ends the
+// slice, so a keystroke waits for at most one background message. The slice's changes are
+// published together at its end. Returns whether any message was handled.
+bool RunLayoutLanes(const std::function<void()>& poll) {
+    using Clock = std::chrono::steady_clock;
+    bool handled = false;
+    while (!g_LayoutLanes.input.empty()) {
+        MSG msg = g_LayoutLanes.input.front();
+        g_LayoutLanes.input.pop_front();
+        DispatchLayoutMessage(msg);
+        handled = true;
+    }
+
+    auto start = Clock::now();
+    size_t count = 0;
+    while (!g_LayoutLanes.background.empty()) {
+        if (count == BACKGROUND_SLICE_MESSAGES ||
+            std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count() >= BACKGROUND_SLICE_US) {
+            break;
+        }
+        MSG msg = g_LayoutLanes.background.front();
+        g_LayoutLanes.background.pop_front();
+        DispatchLayoutMessage(msg, false);
+        ++count;
+
+        poll();
+        if (!g_LayoutLanes.input.empty()) {
+            if (!g_LayoutLanes.background.empty()) CountMetric(Metric::BACKGROUND_SLICES_CUT);
             break;
+        }
+    }
+    if (count > 0) {
+        PublishLayoutState();
+        handled = true;
+    }
+    return handled;
+}
+
+// Shapes of synthetic layout trees used by the benchmark suite
+enum class BenchShape {
+    BALANCED,   // Built with AddWindowBreadthFirst, depth grows with log2(n)
+    DEGENERATE  // Every new window splits the previous one, depth grows with n
+};
+
+// Structure to hold a single benchmark measurement
+struct BenchResult {
+    std::string name;
+    BenchShape shape;
+    size_t windows;
+    size_t operations;
+    long long totalNs;
+    std::string extraFields; // Additional ",\"key\":value" pairs for the JSON line
+};
+
+// Function to create a fake window handle for synthetic layout trees
+HWND MakeSyntheticHwnd(size_t id) {
+    return reinterpret_cast<HWND>(static_cast<uintptr_t>(id) << 4);
+}
+
+// Function to build a synthetic layout tree of the given shape in the global root
+void BuildSyntheticLayout(BenchShape shape, size_t windowCount) {
+    g_FocusedLeaf = NodeHandle();
+    g_FullscreenLeaf = NodeHandle();
+    ClearPlaceholders();
+    root.reset();
+    if (windowCount == 0) return;
+
+    if (shape == BenchShape::BALANCED) {
+        for (size_t i = 1; i <= windowCount; ++i) {
+            AddWindowBreadthFirst(MakeSyntheticHwnd(i));
+        }
+        return;
+    }
+
+    // Degenerate shape: keep splitting the most recently added leaf
+    root = std::make_unique<LayoutNode>(MakeSyntheticHwnd(1));
+    LayoutNode* tail = root.get();
+    for (size_t i = 2; i <= windowCount; ++i) {
+        tail->isSplit = true;
+        tail->splitType = (i % 2 == 0) ? SplitType::VERTICAL : SplitType::HORIZONTAL;
+        tail->splitRatio = RATIO_HALF;
+        tail->firstChild = std::make_unique<LayoutNode>(tail->hwnd);
+        tail->firstChild->parent = tail;
+        tail->secondChild = std::make_unique<LayoutNode>(MakeSyntheticHwnd(i));
+        tail->secondChild->parent = tail;
+        tail->hwnd = nullptr;
+        tail = tail->secondChild.get();
+    }
+    RecountSubtree(root.get());
+}
+
+// Function to time a benchmark body. The optional setup runs untimed before every pass, and
+// the body returns how many operations it performed. Passes repeat until enough time has
+// accumulated for a stable per-operation figure.
+BenchResult RunBenchmark(const std::string& name, BenchShape shape, size_t windows,
+                         const std::function<void()>& setup, const std::function<size_t()>& body) {
+    using Clock = std::chrono::steady_clock;
+    const long long minTotalNs = 50 * 1000 * 1000; // 50 ms
+
+    BenchResult result{ name, shape, windows, 0, 0, std::string() };
+    do {
+        if (setup) setup();
+        auto start = Clock::now();
+        result.operations += body();
+        result.totalNs += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    } while (result.totalNs < minTotalNs);
+
+    return result;
+}
+
+// Function to write a benchmark result as one JSON object per line
+void PrintBenchResult(std::ostream& out, const BenchResult& result) {
+    double nsPerOp = result.operations ? static_cast<double>(result.totalNs) / result.operations : 0.0;
+    out << "{\"benchmark\":\"" << result.name << "\""
+        << ",\"shape\":\"" << (result.shape == BenchShape::BALANCED ? "balanced" : "degenerate") << "\""
+        << ",\"windows\":" << result.windows
+        << ",\"operations\":" << result.operations
+        << ",\"total_ns\":" << result.totalNs
+        << ",\"ns_per_op\":" << nsPerOp << result.extraFields << "}\n";
+    out.flush();
+}
+
+// Function to check that the tiles below a split, plus one inner gap per split, cover the
+// split's area exactly: no overlaps, no seams and nothing outside it
+bool VerifyTiling(const LayoutNode* node, const RECT& area) {
+    if (!EqualRects(node->windowRect, area)) return false;
+    if (!node->isSplit) return true;
+
+    const RECT& first = node->firstChild->windowRect;
+    const RECT& second = node->secondChild->windowRect;
+    if (node->splitType == SplitType::VERTICAL) {
+        int gap = (std::min)(g_InnerGap, static_cast<int>(area.right - area.left));
+        if (first.left != area.left || second.right != area.right || first.right + gap != second.left ||
+            first.right < first.left || second.right < second.left ||
+            first.top != area.top || first.bottom != area.bottom ||
+            second.top != area.top || second.bottom != area.bottom) return false;
+    }
+    else {
+        int gap = (std::min)(g_InnerGap, static_cast<int>(area.bottom - area.top));
+        if (first.top != area.top || second.bottom != area.bottom || first.bottom + gap != second.top ||
+            first.bottom < first.top || second.bottom < second.top ||
+            first.left != area.left || first.right != area.right ||
+            second.left != area.left || second.right != area.right) return false;
+    }
+    return VerifyTiling(node->firstChild.get(), first) && VerifyTiling(node->secondChild.get(), second);
+}
+
+// Function to describe the shape of a tree, its splits and their orientations, without the
+// windows in it
+void AppendTreeShape(const LayoutNode* node, std::string& shape) {
+    if (!node->isSplit) {
+        shape += 'w';
+        return;
+    }
+    shape += (node->splitType == SplitType::VERTICAL) ? "v(" : "h(";
+    AppendTreeShape(node->firstChild.get(), shape);
+    AppendTreeShape(node->secondChild.get(), shape);
+    shape += ')';
+}
+
+// Function to count nodes whose leaf count or window-leaf depth, once brought up to date,
+// disagrees with their children
+size_t CountNodeCountErrors(const LayoutNode* node) {
+    if (!node) return 0;
+    RefreshNodeCounts(node);
+    size_t errors = 0;
+    if (node->isSplit) {
+        errors += CountNodeCountErrors(node->firstChild.get()) + CountNodeCountErrors(node->secondChild.get());
+    }
+    int leafCount, windowLeafDepth;
+    ComputeNodeCounts(node, leafCount, windowLeafDepth);
+    if (leafCount != node->leafCount || windowLeafDepth != node->windowLeafDepth) ++errors;
+    return errors;
+}
+
+// Function to measure the number of levels in a layout tree
+int MeasureTreeDepth(const LayoutNode* node) {
+    if (!node) return 0;
+    if (!node->isSplit) return 1;
+    return 1 + (std::max)(MeasureTreeDepth(node->firstChild.get()), MeasureTreeDepth(node->secondChild.get()));
+}
+
+// Function to build a chain of side-by-side windows in the global root, each split keeping
+// one window and nesting the rest, with ratios that give every window the same width
+void BuildSplitRun(size_t windowCount) {
+    BuildSyntheticLayout(BenchShape::BALANCED, 0);
+    std::unique_ptr<LayoutNode> rest = std::make_unique<LayoutNode>(MakeSyntheticHwnd(windowCount));
+    for (size_t i = windowCount - 1; i >= 1; --i) {
+        int ratio = static_cast<int>(RATIO_SCALE / (windowCount - i + 1));
+        auto split = std::make_unique<LayoutNode>(SplitType::VERTICAL, ratio,
+            std::make_unique<LayoutNode>(MakeSyntheticHwnd(i)), std::move(rest));
+        split->firstChild->parent = split.get();
+        split->secondChild->parent = split.get();
+        rest = std::move(split);
+    }
+    root = std::move(rest);
+}
+
+// Function to measure snapshot reader throughput while the layout thread keeps mutating,
+// relaying out and publishing. Readers walk the whole published tree on every read.
+void RunSnapshotStressBenchmark(std::ostream& out, size_t windowCount, int readerCount) {
+    using Clock = std::chrono::steady_clock;
+
+    BuildSyntheticLayout(BenchShape::BALANCED, windowCount);
+    ApplyLayout(root.get(), g_SimulatedScreen);
+    PublishLayoutSnapshot();
+
+    std::atomic<bool> running{ true };
+    std::vector<size_t> readCounts(readerCount, 0);
+    std::vector<size_t> leafTotals(readerCount, 0);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < readerCount; ++r) {
+        readers.emplace_back([&, r]() {
+            std::vector<const SnapshotNode*> stack;
+            size_t reads = 0;
+            size_t leaves = 0;
+            while (running.load(std::memory_order_relaxed)) {
+                LayoutSnapshotGuard guard;
+                const LayoutSnapshot* snapshot = guard.Get();
+                if (!snapshot) continue;
+
+                stack.clear();
+                if (snapshot->root) stack.push_back(snapshot->root.get());
+                while (!stack.empty()) {
+                    const SnapshotNode* node = stack.back();
+                    stack.pop_back();
+                    if (node->isSplit) {
+                        if (node->firstChild) stack.push_back(node->firstChild.get());
+                        if (node->secondChild) stack.push_back(node->secondChild.get());
+                    }
+                    else {
+                        ++leaves;
+                    }
+                }
+                ++reads;
+            }
+            readCounts[r] = reads;
+            leafTotals[r] = leaves;
+        });
+    }
+
+    // Writer: alternate ratio nudges with remove/re-add churn, committing each change
+    std::mt19937 rng(static_cast<unsigned>(windowCount + readerCount));
+    const size_t nodesBuiltBefore = g_SnapshotNodesBuilt;
+    size_t publishes = 0;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::milliseconds(500);
+    while (Clock::now() < deadline) {
+        HWND target = MakeSyntheticHwnd(1 + rng() % windowCount);
+        if (publishes % 2 == 0) {
+            LayoutNode* leaf = FindLayoutNode(root.get(), target);
+            if (leaf && leaf->parent) {
+                LayoutNode* split = leaf->parent;
+                split->splitRatio = (split->splitRatio >= RATIO_HALF) ? RATIO_HALF - RATIO_STEP : RATIO_HALF + RATIO_STEP;
+                MarkLayoutChanged(split);
+            }
+        }
+        else if (RemoveWindowFromLayout(target)) {
+            AddWindowBreadthFirst(target);
+        }
+        ApplyLayout(root.get(), g_SimulatedScreen);
+        PublishLayoutSnapshot();
+        ++publishes;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    running.store(false);
+    for (std::thread& reader : readers) reader.join();
+
+    size_t totalReads = 0;
+    for (size_t reads : readCounts) totalReads += reads;
+
+    out << "{\"benchmark\":\"SnapshotReadersUnderChurn\""
+        << ",\"shape\":\"balanced\""
+        << ",\"windows\":" << windowCount
+        << ",\"readers\":" << readerCount
+        << ",\"reads_per_sec\":" << totalReads / seconds
+        << ",\"publishes_per_sec\":" << publishes / seconds
+        << ",\"nodes_built_per_publish\":"
+        << (publishes ? static_cast<double>(g_SnapshotNodesBuilt - nodesBuiltBefore) / publishes : 0.0)
+        << ",\"tree_nodes\":" << (2 * windowCount - 1) << "}\n";
+    out.flush();
+
+    ClearLayoutSnapshots();
+    root.reset();
+}
+
+// Function to measure shared-state readers while the layout thread keeps mutating, relaying
+// out and publishing. Every read that succeeds is checked: its leaves must tile the screen
+// exactly and each must carry the title its window had when that version was published, so
+// a torn read that slipped past the sequence lock shows up in torn_reads.
+void RunSharedStateStressBenchmark(std::ostream& out, size_t windowCount, int readerCount) {
+    using Clock = std::chrono::steady_clock;
+
+    std::unique_ptr<LatticeStateRegion> region(new LatticeStateRegion);
+    InitializeSharedStateRegion(region.get());
+    g_SharedState = region.get();
+
+    // Titles are "<parity of the version> <window id>", rewritten before every publish
+    auto renameWindows = [&]() {
+        char parity = (region->state.generation % 2) ? 'e' : 'o';
+        for (size_t i = 1; i <= windowCount; ++i) {
+            HWND hwnd = MakeSyntheticHwnd(i);
+            g_SimulatedWindows[hwnd].title = std::string(1, parity) + " " + std::to_string(reinterpret_cast<uintptr_t>(hwnd));
+            RefreshWindowProperties(hwnd, PROPERTY_TITLE);
+        }
+    };
+
+    BuildSyntheticLayout(BenchShape::BALANCED, windowCount);
+    ApplyLayout(root.get(), g_SimulatedScreen);
+    renameWindows();
+    PublishSharedState();
+
+    const long long screenArea = static_cast<long long>(g_SimulatedScreen.right - g_SimulatedScreen.left) *
+                                 (g_SimulatedScreen.bottom - g_SimulatedScreen.top);
+    std::atomic<bool> running{ true };
+    std::vector<size_t> readCounts(readerCount, 0);
+    std::vector<size_t> retryCounts(readerCount, 0);
+    std::vector<size_t> failedCounts(readerCount, 0);
+    std::vector<size_t> tornCounts(readerCount, 0);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < readerCount; ++r) {
+        readers.emplace_back([&, r]() {
+            std::unique_ptr<LatticeState> state(new LatticeState);
+            while (running.load(std::memory_order_relaxed)) {
+                if (!LatticeReadState(region.get(), *state, 64, &retryCounts[r])) {
+                    ++failedCounts[r];
+                    continue;
+                }
+
+                char parity = (state->generation % 2) ? 'o' : 'e';
+                long long area = 0;
+                bool consistent = (state->leafCount == windowCount);
+                for (uint32_t i = 0; i < state->leafCount && consistent; ++i) {
+                    const LatticeStateLeaf& leaf = state->leaves[i];
+                    area += static_cast<long long>(leaf.right - leaf.left) * (leaf.bottom - leaf.top);
+                    consistent = (leaf.title[0] == parity) &&
+                        std::strtoull(leaf.title + 2, nullptr, 10) == leaf.hwnd;
+                }
+                if (!consistent || area != screenArea) ++tornCounts[r];
+                ++readCounts[r];
+            }
+        });
+    }
+
+    // Writer: alternate ratio nudges with remove/re-add churn, renaming every window so each
+    // version differs from the last in every leaf
+    std::mt19937 rng(static_cast<unsigned>(windowCount + readerCount));
+    size_t publishesBefore = g_SharedStatePublishes;
+    size_t steps = 0;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::milliseconds(500);
+    while (Clock::now() < deadline) {
+        HWND target = MakeSyntheticHwnd(1 + rng() % windowCount);
+        if (steps % 2 == 0) {
+            LayoutNode* leaf = FindLayoutNode(root.get(), target);
+            if (leaf && leaf->parent) {
+                LayoutNode* split = leaf->parent;
+                split->splitRatio = (split->splitRatio >= RATIO_HALF) ? RATIO_HALF - RATIO_STEP : RATIO_HALF + RATIO_STEP;
+                MarkLayoutChanged(split);
+            }
+        }
+        else if (RemoveWindowFromLayout(target)) {
+            AddWindowBreadthFirst(target);
+        }
+        ApplyLayout(root.get(), g_SimulatedScreen);
+        renameWindows();
+        PublishSharedState();
+        ++steps;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    running.store(false);
+    for (std::thread& reader : readers) reader.join();
+
+    size_t totalReads = 0, totalRetries = 0, totalFailed = 0, totalTorn = 0;
+    for (int r = 0; r < readerCount; ++r) {
+        totalReads += readCounts[r];
+        totalRetries += retryCounts[r];
+        totalFailed += failedCounts[r];
+        totalTorn += tornCounts[r];
+    }
+
+    out << "{\"benchmark\":\"SharedStateReadersUnderChurn\""
+        << ",\"shape\":\"balanced\""
+        << ",\"windows\":" << windowCount
+        << ",\"readers\":" << readerCount
+        << ",\"reads_per_sec\":" << totalReads / seconds
+        << ",\"publishes_per_sec\":" << (g_SharedStatePublishes - publishesBefore) / seconds
+        << ",\"retries_per_read\":" << (totalReads ? static_cast<double>(totalRetries) / totalReads : 0.0)
+        << ",\"failed_reads\":" << totalFailed
+        << ",\"torn_reads\":" << totalTorn << "}\n";
+    out.flush();
+
+    g_SharedState = nullptr;
+    root.reset();
+    while (!g_WindowPropertyCache.empty()) ForgetWindowProperties(g_WindowPropertyCache.begin()->first);
+}
+
+// Function to measure counter updates from several threads at once, as the hooks, the
+// pipe listener and the layout thread do. lost_counts is how far the total read back falls
+// short of the updates made; it should stay at 0.
+void RunMetricCountBenchmark(std::ostream& out, int threadCount) {
+    using Clock = std::chrono::steady_clock;
+    const uint64_t perThread = 4 * 1000 * 1000;
+
+    uint64_t before = ReadMetric(Metric::OS_CALLS);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([perThread]() {
+            for (uint64_t i = 0; i < perThread; ++i) CountMetric(Metric::OS_CALLS);
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    long long totalNs = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+    uint64_t expected = perThread * threadCount;
+    uint64_t counted = ReadMetric(Metric::OS_CALLS) - before;
+    out << "{\"benchmark\":\"MetricCount\""
+        << ",\"threads\":" << threadCount
+        << ",\"operations\":" << expected
+        << ",\"total_ns\":" << totalNs
+        << ",\"ns_per_op\":" << static_cast<double>(totalNs) / expected
+        << ",\"lost_counts\":" << (expected > counted ? expected - counted : 0) << "}\n";
+    out.flush();
+}
+
+// Function to measure retiles while a few windows stall every call they are sent, as hung
+// applications do. sync_retile_ms is one retile made on the layout thread for comparison.
+// late_healthy_commits counts rounds in which the other windows were not all in place within
+// a second, missed_quarantines stalled windows that were not quarantined, healthy_quarantined
+// other windows that were, and unrecovered windows not in place once the stalled ones answer
+// again; all four should stay at 0. max_focus_us is the longest focus or fullscreen toggle on
+// a stalled window; blocked_calls counts those that waited for it, and focused_quarantined
+// quarantined windows that still took focus or went fullscreen; both should stay at 0.
+void RunGeometryStallBenchmark(std::ostream& out, size_t windowCount, size_t stalledCount) {
+    using Clock = std::chrono::steady_clock;
+    const int stallMs = 200;
+    const int rounds = 6;
+    int savedTimeoutMs = g_GeometryTimeoutMs;
+    g_GeometryTimeoutMs = 50;
+
+    BuildSyntheticLayout(BenchShape::BALANCED, windowCount);
+    ApplyLayout(root.get(), g_SimulatedScreen);
+
+    std::vector<HWND> stalled;
+    for (size_t i = 0; i < stalledCount; ++i) {
+        stalled.push_back(MakeSyntheticHwnd(1 + i * windowCount / stalledCount));
+        g_SimulatedWindows[stalled.back()].stallMs = stallMs;
+    }
+    auto isStalled = [&](HWND hwnd) { return std::find(stalled.begin(), stalled.end(), hwnd) != stalled.end(); };
+
+    // Counts the windows, stalled ones included or not, that are not where the layout put them
+    auto countMisplaced = [&](bool includeStalled) {
+        auto lock = LockSimulatedWindows();
+        size_t misplaced = 0;
+        for (const auto& entry : g_AppliedWindowState) {
+            if (!includeStalled && isStalled(entry.first)) continue;
+            if (!EqualRects(g_SimulatedWindows[entry.first].rect, entry.second.rect)) ++misplaced;
+        }
+        return misplaced;
+    };
+    // Waits for the misplaced windows to reach their place, handling results as they come
+    auto waitPlaced = [&](bool includeStalled, std::chrono::milliseconds limit) {
+        auto deadline = Clock::now() + limit;
+        for (;;) {
+            DrainGeometryResults();
+            if (countMisplaced(includeStalled) == 0) return true;
+            if (Clock::now() >= deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+    auto nudge = [&](int round) {
+        root->splitRatio = (round % 2) ? RATIO_HALF - RATIO_STEP : RATIO_HALF + RATIO_STEP;
+        MarkLayoutChanged(root.get());
+    };
+
+    auto start = Clock::now();
+    nudge(1);
+    ApplyLayout(root.get(), g_SimulatedScreen);
+    double syncRetileMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    StartGeometryPool();
+    size_t timeoutsBefore = g_GeometryTimeouts;
+
+    // Focus and fullscreen on a stalled window queue their calls rather than wait for them
+    LayoutNode* stalledLeaf = FindLayoutNode(root.get(), stalled.front());
+    LayoutNode* healthyLeaf = FindLayoutNode(root.get(), MakeSyntheticHwnd(windowCount));
+    WindowInfo stalledInfo{ stalled.front(), RECT{}, 0 };
+    managedWindows.Insert(stalledInfo);
+    double maxFocusUs = 0;
+    size_t blockedCalls = 0;
+    auto timeCall = [&](auto call) {
+        auto callStart = Clock::now();
+        call();
+        double us = std::chrono::duration<double, std::micro>(Clock::now() - callStart).count();
+        maxFocusUs = (std::max)(maxFocusUs, us);
+        if (us >= stallMs * 1000.0 / 2) ++blockedCalls;
+    };
+    timeCall([&]() { FocusWindow(stalledLeaf); });
+    timeCall([&]() { SetWindowFullscreen(stalledLeaf, g_SimulatedScreen); });
+    timeCall([&]() { SetWindowFullscreen(stalledLeaf, g_SimulatedScreen); });
+
+    // So do floating it, focusing it by command while it floats, and tiling it again
+    bool wasListed = g_ManagedWindowSet.Contains(stalled.front());
+    g_ManagedWindowSet.Insert(stalled.front());
+    std::ostringstream focusStalled;
+    focusStalled << "[con_id=0x" << std::hex << reinterpret_cast<uintptr_t>(stalled.front()) << "] focus";
+    timeCall([&]() { ToggleFocusedFloating(); });
+    g_FocusedWindow = MakeSyntheticHwnd(windowCount);
+    timeCall([&]() { RunCommand(focusStalled.str(), nullptr); });
+    timeCall([&]() { ToggleFocusedFloating(); });
+    stalledLeaf = FindLayoutNode(root.get(), stalled.front());
+    healthyLeaf = FindLayoutNode(root.get(), MakeSyntheticHwnd(windowCount));
+    FocusWindow(healthyLeaf);
+
+    double maxRetileUs = 0, maxHealthyCommitMs = 0;
+    size_t lateHealthyCommits = 0;
+    for (int round = 0; round < rounds; ++round) {
+        nudge(round);
+        start = Clock::now();
+        ApplyLayout(root.get(), g_SimulatedScreen);
+        maxRetileUs = (std::max)(maxRetileUs, std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+
+        if (!waitPlaced(false, std::chrono::milliseconds(1000))) ++lateHealthyCommits;
+        maxHealthyCommitMs = (std::max)(maxHealthyCommitMs, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+
+        // Let the stalled windows finish, so each round gives them a separate commit to time out
+        std::this_thread::sleep_for(std::chrono::milliseconds(stallMs + g_GeometryTimeoutMs));
+    }
+
+    size_t missedQuarantines = 0, healthyQuarantined = 0;
+    for (size_t i = 1; i <= windowCount; ++i) {
+        HWND hwnd = MakeSyntheticHwnd(i);
+        bool quarantined = IsGeometryQuarantined(hwnd);
+        if (isStalled(hwnd) && !quarantined) ++missedQuarantines;
+        if (!isStalled(hwnd) && quarantined) ++healthyQuarantined;
+    }
+
+    // Once quarantined, the stalled window is left alone: focus stays on the healthy one
+    size_t focusedQuarantined = 0;
+    timeCall([&]() { FocusWindow(stalledLeaf); });
+    if (g_FocusedWindow == stalled.front()) ++focusedQuarantined;
+    timeCall([&]() { SetWindowFullscreen(stalledLeaf, g_SimulatedScreen); });
+    if (ResolveNode(g_FullscreenLeaf) != nullptr) ++focusedQuarantined;
+    g_FocusedWindow = stalled.front();
+    timeCall([&]() { ToggleFocusedFloating(); });
+    if (IsFloatingWindow(stalled.front())) ++focusedQuarantined;
+
+    // Nor does it take focus by command once it floats
+    RemoveWindowFromLayout(stalled.front());
+    AddFloatingWindow(stalled.front(), RECT{ 0, 0, 0, 0 });
+    g_FocusedWindow = MakeSyntheticHwnd(windowCount);
+    timeCall([&]() { RunCommand(focusStalled.str(), nullptr); });
+    if (g_FocusedWindow == stalled.front()) ++focusedQuarantined;
+    RemoveFloatingWindow(stalled.front());
+    if (!wasListed) g_ManagedWindowSet.Erase(stalled.front());
+    managedWindows.Erase(stalledInfo.hwnd);
+
+    // The stalled windows answer again and should get their latest geometry
+    {
+        auto lock = LockSimulatedWindows();
+        for (HWND hwnd : stalled) g_SimulatedWindows[hwnd].stallMs = 0;
+    }
+    waitPlaced(true, std::chrono::milliseconds(2000));
+    size_t unrecovered = countMisplaced(true);
+    size_t timeouts = g_GeometryTimeouts - timeoutsBefore;
+
+    StopGeometryPool();
+    DrainGeometryResults();
+
+    out << "{\"benchmark\":\"GeometryCommitStalls\""
+        << ",\"shape\":\"balanced\""
+        << ",\"windows\":" << windowCount
+        << ",\"stalled_windows\":" << stalledCount
+        << ",\"stall_ms\":" << stallMs
+        << ",\"timeout_ms\":" << g_GeometryTimeoutMs
+        << ",\"sync_retile_ms\":" << syncRetileMs
+        << ",\"max_retile_us\":" << maxRetileUs
+        << ",\"max_healthy_commit_ms\":" << maxHealthyCommitMs
+        << ",\"timeouts\":" << timeouts
+        << ",\"late_healthy_commits\":" << lateHealthyCommits
+        << ",\"missed_quarantines\":" << missedQuarantines
+        << ",\"healthy_quarantined\":" << healthyQuarantined
+        << ",\"unrecovered\":" << unrecovered
+        << ",\"max_focus_us\":" << maxFocusUs
+        << ",\"blocked_calls\":" << blockedCalls
+        << ",\"focused_quarantined\":" << focusedQuarantined << "}\n";
+    out.flush();
+    g_GeometryTimeoutMs = savedTimeoutMs;
+    root.reset();
+}
+
+// Function to measure keystroke latency while a storm of windows appear and close. The
+// storm's WinEvents are queued at once and a focus key arrives every keyIntervalUs until the
+// storm is over, through the same lanes and slices as the message loop. Latency is from a
+// key's arrival to the start of its handling. The fifo_ figures are the same storm handled
+// in arrival order from a single queue, as the message loop did before it had lanes.
+// unhandled_messages counts messages still waiting once the storm is over, and must stay
+// at 0.
+void RunInputStormBenchmark(std::ostream& out, size_t baseWindows, size_t stormWindows) {
+    using Clock = std::chrono::steady_clock;
+    const long long keyIntervalUs = 1000;
+    const WPARAM navigateHotkeys[] = { 1, 2, 6, 7 };
+
+    // One pass of the storm; returns the latency of every key in microseconds
+    auto runStorm = [&](bool lanes, long long& stormNs) {
+        BuildSyntheticLayout(BenchShape::BALANCED, baseWindows);
+        ApplyLayout(root.get(), g_SimulatedScreen);
+        g_ManagedWindowSet.Clear();
+        for (size_t i = 1; i <= baseWindows; ++i) g_ManagedWindowSet.Insert(MakeSyntheticHwnd(i));
+        LayoutNode* first = DescendFocusHistory(root.get());
+        g_FocusedWindow = first->hwnd;
+        SetFocusedLeaf(first);
+
+        std::deque<MSG> fifo;
+        std::deque<MSG>& background = lanes ? g_LayoutLanes.background : fifo;
+        for (DWORD event : { static_cast<DWORD>(EVENT_OBJECT_SHOW), static_cast<DWORD>(EVENT_OBJECT_DESTROY) }) {
+            for (size_t i = 1; i <= stormWindows; ++i) {
+                MSG msg = { 0 };
+                msg.message = WM_LAYOUT_WINEVENT;
+                msg.wParam = event;
+                msg.lParam = reinterpret_cast<LPARAM>(MakeSyntheticHwnd(baseWindows + i));
+                background.push_back(msg);
+            }
+        }
+
+        // Keys are queued when their time has come and the thread next looks at its queue
+        std::vector<double> latencies;
+        std::deque<Clock::time_point> arrivals;
+        auto start = Clock::now();
+        size_t keysQueued = 0;
+        auto poll = [&]() {
+            for (;;) {
+                Clock::time_point due = start + std::chrono::microseconds(keyIntervalUs * static_cast<long long>(keysQueued + 1));
+                if (Clock::now() < due) return;
+                MSG msg = { 0 };
+                msg.message = WM_LAYOUT_HOTKEY;
+                msg.wParam = navigateHotkeys[keysQueued % 4];
+                (lanes ? g_LayoutLanes.input : fifo).push_back(msg);
+                arrivals.push_back(due);
+                ++keysQueued;
+            }
+        };
+        auto handleKey = [&](const MSG& msg) {
+            latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - arrivals.front()).count());
+            arrivals.pop_front();
+            DispatchLayoutMessage(msg);
+        };
+
+        bool stormOver = false;
+        while (!stormOver) {
+            poll();
+            if (lanes) {
+                // Keys waiting now are handled first thing in the slice
+                Clock::time_point now = Clock::now();
+                for (size_t i = 0; i < g_LayoutLanes.input.size(); ++i) {
+                    latencies.push_back(std::chrono::duration<double, std::micro>(now - arrivals.front()).count());
+                    arrivals.pop_front();
+                }
+                RunLayoutLanes(poll);
+                stormOver = g_LayoutLanes.background.empty();
+            }
+            else {
+                MSG msg = fifo.front();
+                fifo.pop_front();
+                if (msg.message == WM_LAYOUT_HOTKEY) handleKey(msg);
+                else DispatchLayoutMessage(msg);
+                stormOver = std::none_of(fifo.begin(), fifo.end(), [](const MSG& m) { return m.message == WM_LAYOUT_WINEVENT; });
+            }
+        }
+        stormNs = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+        // Keys that came in with the last background message
+        while (lanes && !g_LayoutLanes.input.empty()) {
+            MSG msg = g_LayoutLanes.input.front();
+            g_LayoutLanes.input.pop_front();
+            handleKey(msg);
+        }
+        while (!lanes && !fifo.empty()) {
+            MSG msg = fifo.front();
+            fifo.pop_front();
+            handleKey(msg);
+        }
+        return latencies;
+    };
+    auto percentile = [](std::vector<double> values, double fraction) {
+        if (values.empty()) return 0.0;
+        std::sort(values.begin(), values.end());
+        return values[static_cast<size_t>(fraction * (values.size() - 1))];
+    };
+
+    uint64_t cutBefore = ReadMetric(Metric::BACKGROUND_SLICES_CUT);
+    long long fifoNs = 0, stormNs = 0;
+    std::vector<double> fifoLatencies = runStorm(false, fifoNs);
+    std::vector<double> latencies = runStorm(true, stormNs);
+    uint64_t slicesCut = ReadMetric(Metric::BACKGROUND_SLICES_CUT) - cutBefore;
+    size_t unhandled = g_LayoutLanes.input.size() + g_LayoutLanes.background.size();
+    if (root) unhandled += static_cast<size_t>(GetLeafCount(root.get())) - baseWindows; // Storm windows never closed
+
+    out << "{\"benchmark\":\"InputLatencyUnderStorm\""
+        << ",\"shape\":\"balanced\""
+        << ",\"windows\":" << baseWindows
+        << ",\"storm_events\":" << 2 * stormWindows
+        << ",\"keystrokes\":" << latencies.size()
+        << ",\"storm_ms\":" << stormNs / 1e6
+        << ",\"p50_keystroke_us\":" << percentile(latencies, 0.5)
+        << ",\"max_keystroke_us\":" << percentile(latencies, 1.0)
+        << ",\"fifo_storm_ms\":" << fifoNs / 1e6
+        << ",\"fifo_p50_keystroke_us\":" << percentile(fifoLatencies, 0.5)
+        << ",\"fifo_max_keystroke_us\":" << percentile(fifoLatencies, 1.0)
+        << ",\"slices_cut\":" << slicesCut
+        << ",\"unhandled_messages\":" << unhandled << "}\n";
+    out.flush();
+
+    g_LayoutLanes = LayoutLanes();
+    g_ManagedWindowSet.Clear();
+    g_FocusedLeaf = NodeHandle();
+    g_FocusedWindow = nullptr;
+    root.reset();
+}
+
+// Function to run the layout benchmark suite against synthetic window trees.
+// Usage: tile_windows.exe --bench [--out <file>] [--filter <benchmark name substring>]
+int RunBenchmarks(int argc, char* argv[]) {
+    std::string outPath;
+    std::string filter;
+    for (int i = 2; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else {
+            std::cerr << "RunBenchmarks: Unknown argument \"" << argv[i] << "\".\n";
+            return 1;
+        }
+    }
+
+    std::ofstream outFile;
+    if (!outPath.empty()) {
+        outFile.open(outPath);
+        if (!outFile) {
+            std::cerr << "RunBenchmarks: Failed to open \"" << outPath << "\" for writing.\n";
+            return 1;
+        }
     }
+    // Results share stdout's buffer while std::cout itself is silenced, so log lines from
+    // the layout code cannot interleave with the JSON output
+    std::ostream out(outPath.empty() ? std::cout.rdbuf() : outFile.rdbuf());
+    std::streambuf* coutBuffer = std::cout.rdbuf(nullptr);
+
+    // No real windows are touched while benchmarking
+    g_StubWindowSystem = true;
+
+    const RECT screenRect = { 0, 0, 3840, 2160 };
+    const size_t windowCounts[] = { 10, 100, 1000, 10000 };
+    const BenchShape shapes[] = { BenchShape::BALANCED, BenchShape::DEGENERATE };
+
+    // Keeps lookups observable so the optimizer cannot drop them
+    volatile uintptr_t sink = 0;
+
+    auto enabled = [&](const char* name) {
+        return filter.empty() || std::string(name).find(filter) != std::string::npos;
+    };
+
+    for (BenchShape shape : shapes) {
+        for (size_t windowCount : windowCounts) {
+            std::mt19937 rng(static_cast<unsigned>(windowCount));
+
+            // Window ids in a fixed pseudo-random order
+            std::vector<size_t> shuffledIds(windowCount);
+            for (size_t i = 0; i < windowCount; ++i) shuffledIds[i] = i + 1;
+            std::shuffle(shuffledIds.begin(), shuffledIds.end(), rng);
+
+            // Every synthetic window, including the ones added by the insertion benchmark,
+            // must exist in the simulated window set for moves to succeed
+            g_SimulatedWindows.clear();
+            g_AppliedWindowState.clear();
+            for (size_t i = 1; i <= windowCount + 256; ++i) {
+                g_SimulatedWindows[MakeSyntheticHwnd(i)].title = "Window";
+            }
+
+            // Per-pass sample size for operations that are linear in the tree size
+            const size_t sampleCount = (std::min)(windowCount, static_cast<size_t>(1000));
+
+            // Operation: insert one window into a tree that already holds windowCount windows
+            if (enabled("AddWindowBreadthFirst")) {
+                const size_t batch = (std::min)(windowCount, static_cast<size_t>(256));
+                PrintBenchResult(out, RunBenchmark("AddWindowBreadthFirst", shape, windowCount,
+                    [&]() { BuildSyntheticLayout(shape, windowCount); },
+                    [&]() -> size_t {
+                        for (size_t i = 1; i <= batch; ++i) {
+                            AddWindowBreadthFirst(MakeSyntheticHwnd(windowCount + i));
+                        }
+                        return batch;
+                    }));
+            }
+
+            // Operation: remove one window and collapse its parent, until the tree is empty
+            if (enabled("RemoveWindowFromLayout")) {
+                PrintBenchResult(out, RunBenchmark("RemoveWindowFromLayout", shape, windowCount,
+                    [&]() { BuildSyntheticLayout(shape, windowCount); },
+                    [&]() -> size_t {
+                        for (size_t id : shuffledIds) {
+                            sink = sink + RemoveWindowFromLayout(MakeSyntheticHwnd(id));
+                        }
+                        return windowCount;
+                    }));
+            }
+
+            BuildSyntheticLayout(shape, windowCount);
+
+            // Operation: locate the leaf of one window
+            if (enabled("FindLayoutNode")) {
+                PrintBenchResult(out, RunBenchmark("FindLayoutNode", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        for (size_t i = 0; i < sampleCount; ++i) {
+                            LayoutNode* node = FindLayoutNode(root.get(), MakeSyntheticHwnd(shuffledIds[i]));
+                            sink = sink + reinterpret_cast<uintptr_t>(node);
+                        }
+                        return sampleCount;
+                    }));
+            }
+
+            // Operation: find the neighbor of one window in one direction
+            if (enabled("FindAdjacent")) {
+                std::vector<LayoutNode*> leaves;
+                CollectLeafNodes(root.get(), leaves);
+                std::shuffle(leaves.begin(), leaves.end(), rng);
+                leaves.resize(sampleCount);
+
+                const Direction directions[] = { Direction::LEFT, Direction::RIGHT, Direction::UP, Direction::DOWN };
+                PrintBenchResult(out, RunBenchmark("FindAdjacent", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        for (LayoutNode* leaf : leaves) {
+                            for (Direction dir : directions) {
+                                sink = sink + reinterpret_cast<uintptr_t>(FindAdjacent(leaf, dir));
+                            }
+                        }
+                        return leaves.size() * 4;
+                    }));
+            }
+
+            // Operation: one directional focus hotkey through the layout thread, starting from
+            // the tracked focus. Every eighth step first hands the foreground to an unmanaged
+            // window, which must not lose the managed focus. focus_errors counts steps after
+            // which the focused leaf, its window and the focus history disagreed.
+            if (enabled("FocusNavigate")) {
+                for (size_t i = 1; i <= windowCount; ++i) {
+                    g_ManagedWindowSet.Insert(MakeSyntheticHwnd(i));
+                }
+                const WPARAM navigateHotkeys[] = { 1, 2, 6, 7 };
+                std::vector<WPARAM> steps(sampleCount);
+                for (WPARAM& step : steps) step = navigateHotkeys[rng() % 4];
+                HWND unmanaged = MakeSyntheticHwnd(windowCount + 1);
+
+                auto runSteps = [&](bool verify) {
+                    size_t errors = 0;
+                    for (size_t i = 0; i < steps.size(); ++i) {
+                        if (i % 8 == 0) {
+                            WinEventProc(nullptr, EVENT_SYSTEM_FOREGROUND, unmanaged, OBJID_WINDOW, CHILDID_SELF, 0, 0);
+                        }
+                        PostLayoutMessage(WM_HOTKEY, steps[i], 0);
+                        if (verify) {
+                            LayoutNode* leaf = GetFocusedLeaf();
+                            if (!leaf || FindLayoutNode(root.get(), g_FocusedWindow) != leaf ||
+                                DescendFocusHistory(root.get()) != leaf) {
+                                ++errors;
+                            }
+                        }
+                    }
+                    return errors;
+                };
+
+                LayoutNode* first = DescendFocusHistory(root.get());
+                g_FocusedWindow = first->hwnd;
+                SetFocusedLeaf(first);
+                size_t focusErrors = runSteps(true);
+
+                BenchResult result = RunBenchmark("FocusNavigate", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        runSteps(false);
+                        return steps.size();
+                    });
+                result.extraFields = ",\"focus_errors\":" + std::to_string(focusErrors);
+                PrintBenchResult(out, result);
+
+                g_FocusedLeaf = NodeHandle();
+                g_FocusedWindow = nullptr;
+                g_ForegroundWindow = nullptr;
+                g_ManagedWindowSet.Clear();
+            }
+
+            // Operation: lay out the whole tree once
+            if (enabled("ApplyLayout")) {
+                PrintBenchResult(out, RunBenchmark("ApplyLayout", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        ApplyLayout(root.get(), screenRect);
+                        return 1;
+                    }));
+            }
+
+            // Operation: one fullscreen check, as done for every WM_HOTKEY
+            if (enabled("IsAnyWindowFullscreen")) {
+                PrintBenchResult(out, RunBenchmark("IsAnyWindowFullscreen", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        for (int i = 0; i < 16; ++i) {
+                            sink = sink + IsAnyWindowFullscreen();
+                        }
+                        return 16;
+                    }));
+            }
+
+            // Operation: lay out the whole tree once with inner and outer gaps. Also checks
+            // two properties of the fixed-point layout on random ratios: the tiles and gaps
+            // cover the screen minus the outer gap exactly (tiling_failures), and a run of
+            // resize steps followed by the opposite steps restores every ratio and tile
+            // (reversibility_failures).
+            if (enabled("ApplyLayoutGaps")) {
+                const int gapSettings[][2] = { { 0, 0 }, { 3, 7 }, { 10, 20 } };
+                size_t tilingFailures = 0;
+                size_t reversibilityFailures = 0;
+
+                std::vector<LayoutNode*> leaves;
+                CollectLeafNodes(root.get(), leaves);
+                for (const auto& gaps : gapSettings) {
+                    g_InnerGap = gaps[0];
+                    g_OuterGap = gaps[1];
+                    for (int trial = 0; trial < 4; ++trial) {
+                        for (LayoutNode* leaf : leaves) {
+                            if (leaf->parent) {
+                                leaf->parent->splitRatio = RATIO_MIN + RATIO_STEP * static_cast<int>(rng() % ((RATIO_MAX - RATIO_MIN) / RATIO_STEP + 1));
+                            }
+                        }
+                        RECT tilingArea = GetTilingArea(screenRect);
+                        ApplyLayout(root.get(), tilingArea);
+                        if (!VerifyTiling(root.get(), tilingArea)) ++tilingFailures;
+
+                        // Step one split back and forth, starting far enough from the limits
+                        // that no step is clamped
+                        LayoutNode* split = leaves[rng() % leaves.size()]->parent;
+                        if (!split) continue;
+                        split->splitRatio = RATIO_HALF;
+                        TileWindows(screenRect);
+                        std::vector<RECT> before;
+                        for (LayoutNode* leaf : leaves) before.push_back(leaf->windowRect);
+
+                        int steps = 1 + static_cast<int>(rng() % 10);
+                        int direction = (rng() % 2) ? RATIO_STEP : -RATIO_STEP;
+                        for (int i = 0; i < steps; ++i) AdjustSplitRatio(split, direction);
+                        for (int i = 0; i < steps; ++i) AdjustSplitRatio(split, -direction);
+
+                        bool restored = (split->splitRatio == RATIO_HALF);
+                        for (size_t i = 0; i < leaves.size() && restored; ++i) {
+                            restored = EqualRects(before[i], leaves[i]->windowRect);
+                        }
+                        if (!restored) ++reversibilityFailures;
+                    }
+                }
+
+                g_InnerGap = 10;
+                g_OuterGap = 20;
+                RECT tilingArea = GetTilingArea(screenRect);
+                BenchResult result = RunBenchmark("ApplyLayoutGaps", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        ApplyLayout(root.get(), tilingArea);
+                        return 1;
+                    });
+                result.extraFields = ",\"tiling_failures\":" + std::to_string(tilingFailures) +
+                    ",\"reversibility_failures\":" + std::to_string(reversibilityFailures);
+                PrintBenchResult(out, result);
+
+                g_InnerGap = 0;
+                g_OuterGap = 0;
+                BuildSyntheticLayout(shape, windowCount);
+                ApplyLayout(root.get(), screenRect);
+            }
+
+            // Operation: lay out the whole tree once when a quarter of the windows have size
+            // limits (minimums, maximums, cell-size increments) the solver has already learned.
+            // refused_moves counts moves the windows still refused afterwards; anything but
+            // zero means the layout would keep resizing them.
+            if (enabled("ApplyLayoutConstrained")) {
+                for (size_t i = 1; i <= windowCount; i += 4) {
+                    SizeConstraints& limits = g_SimulatedWindows[MakeSyntheticHwnd(i)].limits;
+                    switch ((i / 4) % 3) {
+                    case 0: limits.width.minSize = 800; limits.height.minSize = 600; break;
+                    case 1: limits.width.maxSize = 300; limits.height.maxSize = 200; break;
+                    default:
+                        limits.width.increment = 9;
+                        limits.height.increment = 17;
+                        limits.width.base = 4;
+                        break;
+                    }
+                }
+                for (int pass = 0; pass < 4; ++pass) {
+                    ApplyLayout(root.get(), screenRect);
+                }
+
+                size_t refusedBefore = g_RefusedMoveCount;
+                BenchResult result = RunBenchmark("ApplyLayoutConstrained", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        ApplyLayout(root.get(), screenRect);
+                        return 1;
+                    });
+                result.extraFields = ",\"learned_windows\":" + std::to_string(g_WindowSizeConstraints.size()) +
+                    ",\"refused_moves\":" + std::to_string(g_RefusedMoveCount - refusedBefore);
+                PrintBenchResult(out, result);
+
+                for (auto& entry : g_SimulatedWindows) entry.second.limits = SizeConstraints();
+                g_WindowSizeConstraints.clear();
+                ApplyLayout(root.get(), screenRect);
+            }
+
+            // Operation: retile after nudging the ratio of a random leaf's split, as a resize
+            // key does. os_calls_per_retile counts window-system calls; for comparison,
+            // cold_calls_per_retile is a retile of windows seen for the first time and
+            // unchanged_calls_per_retile one where nothing moved. own_event_calls_per_retile is
+            // a retile after every window reported the location change our own move caused,
+            // and not_put_back counts windows still out of place after some moved or restyled
+            // themselves and the next retile ran; both should stay at 0.
+            if (enabled("RetileOsCalls")) {
+                std::vector<LayoutNode*> leaves;
+                CollectLeafNodes(root.get(), leaves);
+
+                g_AppliedWindowState.clear();
+                size_t callsBefore = g_WindowSystemCalls;
+                TileWindows(screenRect);
+                size_t coldCalls = g_WindowSystemCalls - callsBefore;
+                callsBefore = g_WindowSystemCalls;
+                TileWindows(screenRect);
+                size_t unchangedCalls = g_WindowSystemCalls - callsBefore;
+
+                callsBefore = g_WindowSystemCalls;
+                BenchResult result = RunBenchmark("RetileOsCalls", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        LayoutNode* split = leaves[rng() % leaves.size()]->parent;
+                        if (split) {
+                            split->splitRatio = (split->splitRatio == RATIO_HALF) ? RATIO_HALF + RATIO_STEP : RATIO_HALF;
+                            MarkLayoutChanged(split);
+                        }
+                        TileWindows(screenRect);
+                        return 1;
+                    });
+                double callsPerRetile = static_cast<double>(g_WindowSystemCalls - callsBefore) / result.operations;
+
+                // Location and state events for our own moves must not cost a call on the next
+                // retile, while windows moved or restyled from outside must be put back by it
+                for (LayoutNode* leaf : leaves) g_ManagedWindowSet.Insert(leaf->hwnd);
+                TileWindows(screenRect);
+                for (LayoutNode* leaf : leaves) {
+                    WinEventProc(nullptr, EVENT_OBJECT_LOCATIONCHANGE, leaf->hwnd, OBJID_WINDOW, CHILDID_SELF, 0, 0);
+                }
+                callsBefore = g_WindowSystemCalls;
+                TileWindows(screenRect);
+                size_t ownEventCalls = g_WindowSystemCalls - callsBefore;
+
+                const size_t changedCount = (std::min)(leaves.size(), static_cast<size_t>(16));
+                for (size_t i = 0; i < changedCount; ++i) {
+                    HWND hwnd = leaves[i * leaves.size() / changedCount]->hwnd;
+                    SimulatedWindow& window = g_SimulatedWindows[hwnd];
+                    if (i % 2 == 0) {
+                        window.rect = RECT{ 10, 10, 410, 310 }; // Moved and resized itself
+                        WinEventProc(nullptr, EVENT_OBJECT_LOCATIONCHANGE, hwnd, OBJID_WINDOW, CHILDID_SELF, 0, 0);
+                    }
+                    else {
+                        window.style |= WS_CAPTION; // Put its caption back
+                        WinEventProc(nullptr, EVENT_OBJECT_STATECHANGE, hwnd, OBJID_WINDOW, CHILDID_SELF, 0, 0);
+                    }
+                }
+                TileWindows(screenRect);
+                size_t notPutBack = 0;
+                for (LayoutNode* leaf : leaves) {
+                    HWND hwnd = leaf->hwnd;
+                    const SimulatedWindow& window = g_SimulatedWindows[hwnd];
+                    auto applied = g_AppliedWindowState.find(hwnd);
+                    if (applied == g_AppliedWindowState.end() || !EqualRects(window.rect, applied->second.rect) ||
+                        (window.style & WS_CAPTION)) {
+                        ++notPutBack;
+                    }
+                }
+                g_ManagedWindowSet.Clear();
 
-    // Traverse up to find the nearest ancestor split matching the required split
-    while (parent) {
-        if (parent->isSplit && parent->splitType == requiredSplit) {
-            // Determine if current node is firstChild or secondChild
-            bool isFirst = (parent->firstChild.get() == node);
+                result.extraFields = ",\"os_calls_per_retile\":" + std::to_string(callsPerRetile) +
+                    ",\"cold_calls_per_retile\":" + std::to_string(coldCalls) +
+                    ",\"unchanged_calls_per_retile\":" + std::to_string(unchangedCalls) +
+                    ",\"own_event_calls_per_retile\":" + std::to_string(ownEventCalls) +
+                    ",\"not_put_back\":" + std::to_string(notPutBack);
+                PrintBenchResult(out, result);
 
-            // Determine the direction to navigate
-            bool navigateToSecond = false;
-            if ((dir == Direction::LEFT && !isFirst) ||
-                (dir == Direction::RIGHT && isFirst) ||
-                (dir == Direction::UP && !isFirst) ||
-                (dir == Direction::DOWN && isFirst)) {
-                navigateToSecond = true;
+                BuildSyntheticLayout(shape, windowCount);
+                ApplyLayout(root.get(), screenRect);
             }
 
-            if (navigateToSecond) {
-                // Traverse the sibling subtree to find the target window
-                LayoutNode* sibling = isFirst ? parent->secondChild.get() : parent->firstChild.get();
-
-                // Depending on the direction, traverse to the appropriate window
-                std::function<LayoutNode*(LayoutNode*)> findTarget;
-                if (dir == Direction::LEFT || dir == Direction::UP) {
-                    // For LEFT and UP, find the rightmost or bottommost window
-                    findTarget = [&](LayoutNode* n) -> LayoutNode* {
-                        if (!n->isSplit) return n;
-                        // For LEFT and UP, go to the second child
-                        return findTarget(n->secondChild.get());
-                    };
+            // Operation: one directional move hotkey of the focused window, with a random
+            // window focused every eighth move. Every eighth window has size limits the solver
+            // already knows, so some moves change a split above the windows that moved.
+            // os_calls_per_move counts window-system calls per move that changed the layout.
+            // A verification pass checks every move against
+            // a full layout: partial_mismatches counts tiles the local relayout left different,
+            // tiling_failures layouts with a seam or overlap, and undo_failures moves whose
+            // undo did not put every window back where it was. All three should stay at 0.
+            if (enabled("MoveWindow")) {
+                const Direction directions[] = { Direction::LEFT, Direction::RIGHT, Direction::UP, Direction::DOWN };
+                const size_t verifySteps = (std::min)(windowCount, static_cast<size_t>(200));
+                RECT area = GetTilingArea(GetScreenRect());
+                for (size_t i = 1; i <= windowCount; i += 8) {
+                    SizeConstraints& limits = g_SimulatedWindows[MakeSyntheticHwnd(i)].limits;
+                    switch ((i / 8) % 3) {
+                    case 0: limits.width.minSize = 400; limits.height.minSize = 300; break;
+                    case 1: limits.width.maxSize = 300; limits.height.maxSize = 200; break;
+                    default: limits.width.increment = 9; limits.height.increment = 17; break;
+                    }
+                    g_WindowSizeConstraints[MakeSyntheticHwnd(i)] = limits;
                 }
-                else { // RIGHT and DOWN
-                    // For RIGHT and DOWN, find the leftmost or topmost window
-                    findTarget = [&](LayoutNode* n) -> LayoutNode* {
-                        if (!n->isSplit) return n;
-                        // For RIGHT and DOWN, go to the first child
-                        return findTarget(n->firstChild.get());
-                    };
+                TileWindows(GetScreenRect());
+
+                auto focusRandom = [&]() {
+                    LayoutNode* leaf = FindLayoutNode(root.get(), MakeSyntheticHwnd(1 + rng() % windowCount));
+                    g_FocusedWindow = leaf->hwnd;
+                    SetFocusedLeaf(leaf);
+                };
+                auto move = [&](Direction dir) {
+                    BeginJournalOperation(JournalOrigin::USER);
+                    bool moved = MoveWindowInDirection(dir);
+                    CommitJournalOperation();
+                    return moved;
+                };
+                auto tileMap = [&]() {
+                    std::vector<LayoutNode*> leaves;
+                    CollectLeafNodes(root.get(), leaves);
+                    std::unordered_map<HWND, RECT> tiles;
+                    for (LayoutNode* leaf : leaves) tiles[leaf->hwnd] = leaf->windowRect;
+                    return tiles;
+                };
+                auto countChanged = [&](const std::unordered_map<HWND, RECT>& tiles) {
+                    size_t changed = 0;
+                    for (const auto& entry : tileMap()) {
+                        auto was = tiles.find(entry.first);
+                        if (was == tiles.end() || !EqualRects(was->second, entry.second)) ++changed;
+                    }
+                    return changed;
+                };
+
+                size_t partialMismatches = 0, tilingFailures = 0, undoFailures = 0;
+                for (size_t i = 0; i < verifySteps; ++i) {
+                    if (i % 8 == 0) focusRandom();
+                    std::unordered_map<HWND, RECT> before = tileMap();
+                    if (!move(directions[rng() % 4])) continue;
+
+                    std::unordered_map<HWND, RECT> local = tileMap();
+                    TileWindows(GetScreenRect());
+                    partialMismatches += countChanged(local);
+                    if (!VerifyTiling(root.get(), area)) ++tilingFailures;
+
+                    UndoLayoutOperation();
+                    if (countChanged(before) != 0) ++undoFailures;
+                    RedoLayoutOperation();
                 }
 
-                LayoutNode* target = findTarget(sibling);
-                // Ensure that we are not selecting the same node
-                if (target->windowInfo.hwnd != current->windowInfo.hwnd) {
-                    return target;
-                }
+                size_t callsBefore = g_WindowSystemCalls;
+                size_t moves = 0;
+                BenchResult result = RunBenchmark("MoveWindow", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        for (size_t i = 0; i < sampleCount; ++i) {
+                            if (i % 8 == 0) focusRandom();
+                            moves += move(directions[rng() % 4]);
+                        }
+                        return sampleCount;
+                    });
+                result.extraFields = ",\"os_calls_per_move\":" +
+                    std::to_string(static_cast<double>(g_WindowSystemCalls - callsBefore) / (std::max)(moves, static_cast<size_t>(1))) +
+                    ",\"partial_mismatches\":" + std::to_string(partialMismatches) +
+                    ",\"tiling_failures\":" + std::to_string(tilingFailures) +
+                    ",\"undo_failures\":" + std::to_string(undoFailures);
+                PrintBenchResult(out, result);
+
+                ClearJournal();
+                g_FocusedLeaf = NodeHandle();
+                g_FocusedWindow = nullptr;
+                for (auto& entry : g_SimulatedWindows) entry.second.limits = SizeConstraints();
+                g_WindowSizeConstraints.clear();
+                BuildSyntheticLayout(shape, windowCount);
+                ApplyLayout(root.get(), screenRect);
             }
-        }
-        node = parent;
-        parent = node->parent;
-    }
 
-    // No adjacent found
-    return nullptr;
-}
+            // Operation: a floating dialog appears and closes again, through the full WinEvent
+            // path. retiles counts tiled relayouts this caused; it must stay at 0.
+            if (enabled("FloatingShowDestroy")) {
+                const size_t dialogCount = 64;
+                for (size_t i = 1; i <= dialogCount; ++i) {
+                    SimulatedWindow& dialog = g_SimulatedWindows[MakeSyntheticHwnd(windowCount + i)];
+                    dialog.exStyle = WS_EX_DLGMODALFRAME;
+                    dialog.rect = RECT{ 100, 100, 700, 500 };
+                }
 
-// Function to navigate in a given direction
-void Navigate(Direction dir) {
-    HWND current = GetForegroundWindow();
-    LayoutNode* currentNode = FindLayoutNode(root.get(), current);
-    if (currentNode) {
-        LayoutNode* adjacent = FindAdjacent(currentNode, dir);
-        if (adjacent && adjacent->windowInfo.hwnd != nullptr) {
-            FocusWindow(adjacent);
-        }
-        else {
-            std::cout << "Navigate: No window in the " <<
-                (dir == Direction::LEFT ? "LEFT" :
-                 dir == Direction::RIGHT ? "RIGHT" :
-                 dir == Direction::UP ? "UP" : "DOWN") << " direction.\n";
-        }
-    }
-    else {
-        std::cerr << "Navigate: Current window not managed.\n";
-    }
-}
+                size_t retilesBefore = g_RetileCount;
+                BenchResult result = RunBenchmark("FloatingShowDestroy", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        for (size_t i = 1; i <= dialogCount; ++i) {
+                            HWND dialog = MakeSyntheticHwnd(windowCount + i);
+                            WinEventProc(nullptr, EVENT_OBJECT_SHOW, dialog, OBJID_WINDOW, CHILDID_SELF, 0, 0);
+                            WinEventProc(nullptr, EVENT_OBJECT_DESTROY, dialog, OBJID_WINDOW, CHILDID_SELF, 0, 0);
+                        }
+                        return dialogCount;
+                    });
+                result.extraFields = ",\"retiles\":" + std::to_string(g_RetileCount - retilesBefore);
+                PrintBenchResult(out, result);
+
+                for (size_t i = 1; i <= dialogCount; ++i) {
+                    SimulatedWindow& dialog = g_SimulatedWindows[MakeSyntheticHwnd(windowCount + i)];
+                    dialog.exStyle = 0;
+                    dialog.rect = RECT{ 0, 0, 0, 0 };
+                }
+            }
 
-// Function to adjust splitRatio and reapply layout
-void AdjustSplitRatio(LayoutNode* node, float deltaRatio) {
-    if (!node || !node->isSplit) return;
+            // Operation: a tiled window appears and closes again while another window is
+            // fullscreen. retiles and covered_moves count relayouts and moves of covered windows
+            // this caused; both must stay at 0. exit_retiles is the relayout made when
+            // fullscreen ends, which must be exactly 1.
+            if (enabled("FullscreenShowDestroy")) {
+                const size_t newWindowCount = 64;
+                for (size_t i = 1; i <= newWindowCount; ++i) {
+                    g_SimulatedWindows[MakeSyntheticHwnd(windowCount + i)].rect = RECT{ 100, 100, 700, 500 };
+                }
 
-    // Adjust the split ratio
-    node->splitRatio += deltaRatio;
+                LayoutNode* fullscreen = DescendFocusHistory(root.get());
+                WindowInfo fullscreenInfo{ fullscreen->hwnd, RECT{}, 0 };
+                managedWindows.Insert(fullscreenInfo);
+                SetWindowFullscreen(fullscreen, screenRect);
+                size_t retilesBefore = g_RetileCount;
+                size_t movesBefore = g_WindowMoveCount;
+                BenchResult result = RunBenchmark("FullscreenShowDestroy", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        for (size_t i = 1; i <= newWindowCount; ++i) {
+                            HWND window = MakeSyntheticHwnd(windowCount + i);
+                            WinEventProc(nullptr, EVENT_OBJECT_SHOW, window, OBJID_WINDOW, CHILDID_SELF, 0, 0);
+                            WinEventProc(nullptr, EVENT_OBJECT_DESTROY, window, OBJID_WINDOW, CHILDID_SELF, 0, 0);
+                        }
+                        return newWindowCount;
+                    });
+                size_t retiles = g_RetileCount - retilesBefore;
+                size_t coveredMoves = g_WindowMoveCount - movesBefore;
+
+                SetWindowFullscreen(fullscreen, screenRect);
+                result.extraFields = ",\"retiles\":" + std::to_string(retiles) +
+                    ",\"covered_moves\":" + std::to_string(coveredMoves) +
+                    ",\"exit_retiles\":" + std::to_string(g_RetileCount - retilesBefore - retiles);
+                PrintBenchResult(out, result);
+
+                managedWindows.Erase(fullscreenInfo.hwnd);
+                for (size_t i = 1; i <= newWindowCount; ++i) {
+                    g_SimulatedWindows[MakeSyntheticHwnd(windowCount + i)].rect = RECT{ 0, 0, 0, 0 };
+                }
+            }
 
-    // Clamp the split ratio to avoid extreme sizes
-    // NOTE: minwindef.h which is included indirectly, defines a min and max method. I've wrapped
-    // std::min and std::max here with parenthesis to fully qualify their names and prevent warnings
-    node->splitRatio = (std::max)(0.2f, (std::min)(0.8f, node->splitRatio));
+            // Operation: pre-filter one hooked WinEvent from a mix dominated by non-window
+            // objects and unmanaged handles, as seen from a global hook
+            if (enabled("WinEventPrefilter")) {
+                g_ManagedWindowSet.Clear();
+                for (size_t i = 1; i <= windowCount; ++i) {
+                    g_ManagedWindowSet.Insert(MakeSyntheticHwnd(i));
+                }
 
-    // Re-apply the layout
-    HDC hdcScreen = GetDC(nullptr);
-    RECT screenRect;
-    screenRect.left = 0;
-    screenRect.top = 0;
-    screenRect.right = GetDeviceCaps(hdcScreen, HORZRES);
-    screenRect.bottom = GetDeviceCaps(hdcScreen, VERTRES);
-    ReleaseDC(nullptr, hdcScreen);
+                struct HookedEvent { DWORD event; HWND hwnd; LONG idObject; };
+                std::vector<HookedEvent> events(1024);
+                for (HookedEvent& e : events) {
+                    unsigned kind = rng() % 10;
+                    e.event = (rng() % 2) ? EVENT_OBJECT_SHOW : EVENT_OBJECT_DESTROY;
+                    e.idObject = (kind < 7) ? OBJID_CARET : OBJID_WINDOW;
+                    e.hwnd = MakeSyntheticHwnd((kind < 9) ? windowCount + 1 + rng() % 100000 : 1 + rng() % windowCount);
+                }
 
-    TileWindows(screenRect);
-}
+                PrintBenchResult(out, RunBenchmark("WinEventPrefilter", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        for (const HookedEvent& e : events) {
+                            sink = sink + PrefilterWinEvent(e.event, e.hwnd, e.idObject, CHILDID_SELF);
+                        }
+                        return events.size();
+                    }));
+                g_ManagedWindowSet.Clear();
+            }
 
-// Function to move a window in a given direction
-bool MoveWindowInDirection(Direction dir) {
-    std::lock_guard<std::mutex> lock(layoutMutex); // Ensure thread safety
+            // Operation: undo or redo one journaled hotkey operation, including the relayout
+            // of the subtree it touched
+            if (enabled("JournalUndoRedo")) {
+                ApplyLayout(root.get(), screenRect);
+                ClearJournal();
+
+                std::vector<LayoutNode*> leaves;
+                CollectLeafNodes(root.get(), leaves);
+                const size_t journaledOps = (std::min)(MAX_JOURNAL_OPERATIONS, leaves.size());
+                for (size_t i = 0; i < journaledOps; ++i) {
+                    LayoutNode* leaf = leaves[rng() % leaves.size()];
+                    LayoutNode* split = leaf->parent;
+                    BeginJournalOperation(JournalOrigin::USER);
+                    if (i % 3 == 0 && split) {
+                        RecordRatioDelta(split);
+                        split->splitRatio = (split->splitRatio >= RATIO_HALF) ? RATIO_HALF - 5 * RATIO_STEP : RATIO_HALF + 5 * RATIO_STEP;
+                        MarkLayoutChanged(split);
+                    }
+                    else if (i % 3 == 1 && split) {
+                        RecordOrientationDelta(split);
+                        split->splitType = (split->splitType == SplitType::VERTICAL) ? SplitType::HORIZONTAL : SplitType::VERTICAL;
+                        MarkLayoutChanged(split);
+                    }
+                    else {
+                        LayoutNode* other = leaves[rng() % leaves.size()];
+                        if (other != leaf) {
+                            std::swap(leaf->hwnd, other->hwnd);
+                            MarkLayoutChanged(leaf);
+                            MarkLayoutChanged(other);
+                            RecordSwapDelta(leaf, other);
+                        }
+                    }
+                    CommitJournalOperation();
+                }
 
-    HWND current = GetForegroundWindow();
-    LayoutNode* currentNode = FindLayoutNode(root.get(), current);
-    if (!currentNode) {
-        std::cerr << "MoveWindowInDirection: Current window not managed.\n";
-        return false;
+                size_t journalBytes = 0;
+                for (const JournalOperation& op : g_UndoJournal) journalBytes += op.MemoryBytes();
+                const size_t storedOps = g_UndoJournal.size();
+
+                BenchResult result = RunBenchmark("JournalUndoRedo", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        while (!g_UndoJournal.empty()) UndoLayoutOperation();
+                        while (!g_RedoJournal.empty()) RedoLayoutOperation();
+                        return 2 * storedOps;
+                    });
+                result.extraFields = ",\"journal_ops\":" + std::to_string(storedOps) +
+                    ",\"bytes_per_op\":" + std::to_string(storedOps ? journalBytes / storedOps : 0);
+                PrintBenchResult(out, result);
+                ClearJournal();
+            }
+        }
     }
 
-    // Debug: Print layout before moving
-    std::cout << "MoveWindowInDirection: Layout before moving:\n";
-    PrintLayout(root.get());
-
-    LayoutNode* adjacentNode = FindAdjacent(currentNode, dir);
-    if (!adjacentNode) {
-        std::cout << "MoveWindowInDirection: No window in the " <<
-            (dir == Direction::LEFT ? "LEFT" :
-             dir == Direction::RIGHT ? "RIGHT" :
-             dir == Direction::UP ? "UP" : "DOWN") << " direction to move.\n";
-
-        // **Prevent Split Creation Without Window Assignment**
-        // Check if there's a pending split available
-        if (!pendingSplits.empty()) {
-            std::cout << "MoveWindowInDirection: Pending splits exist. Waiting for window assignment.\n";
-            return false; // Do not create a new split
-        }
-
-        // Determine if split orientation needs to change
-        SplitType desiredSplit = GetSplitTypeFromDirection(dir);
-        if (currentNode->parent && currentNode->parent->splitType != desiredSplit) {
-            // Change split type of the parent
-            currentNode->parent->splitType = desiredSplit;
-            std::cout << "MoveWindowInDirection: Changed split type to " <<
-                (desiredSplit == SplitType::VERTICAL ? "VERTICAL" : "HORIZONTAL") << ".\n";
-
-            // Reapply layout to adjust window positions
-            HDC hdcScreen = GetDC(nullptr);
-            RECT screenRect;
-            screenRect.left = 0;
-            screenRect.top = 0;
-            screenRect.right = GetDeviceCaps(hdcScreen, HORZRES);
-            screenRect.bottom = GetDeviceCaps(hdcScreen, VERTRES);
-            ReleaseDC(nullptr, hdcScreen);
+    // Operation: one full walk of the published snapshot from a reader thread
+    if (enabled("SnapshotReadersUnderChurn")) {
+        const size_t windowCount = 1000;
+        g_SimulatedWindows.clear();
+        g_AppliedWindowState.clear();
+        for (size_t i = 1; i <= windowCount; ++i) {
+            g_SimulatedWindows[MakeSyntheticHwnd(i)].title = "Window";
+        }
+        for (int readerCount : { 1, 2, 4 }) {
+            RunSnapshotStressBenchmark(out, windowCount, readerCount);
+        }
+    }
 
-            TileWindows(screenRect);
-            return true;
+    // Operation: one consistent copy of the shared-memory state from a reader thread
+    if (enabled("SharedStateReadersUnderChurn")) {
+        const size_t windowCount = LATTICE_STATE_MAX_LEAVES;
+        g_SimulatedWindows.clear();
+        g_AppliedWindowState.clear();
+        for (size_t i = 1; i <= windowCount; ++i) {
+            g_SimulatedWindows[MakeSyntheticHwnd(i)].title = "Window";
         }
+        for (int readerCount : { 1, 2, 4 }) {
+            RunSharedStateStressBenchmark(out, windowCount, readerCount);
+        }
+    }
 
-        // If split orientation does not need to change, do not alter layout
-        std::cout << "MoveWindowInDirection: Split orientation does not need to change.\n";
-        return false; // Exit without altering the layout
+    // Operation: one counter update on a thread's own metric shard
+    if (enabled("MetricCount")) {
+        for (int threadCount : { 1, 2, 4 }) {
+            RunMetricCountBenchmark(out, threadCount);
+        }
     }
 
-    // Debug: Print adjacent window
-    std::cout << "MoveWindowInDirection: Adjacent window HWND=0x" 
-              << std::hex << adjacentNode->windowInfo.hwnd << std::dec << "\n";
+    // Operation: one retile while a few windows stall every call, with the geometry pool
+    if (enabled("GeometryCommitStalls")) {
+        const size_t windowCount = 100;
+        g_SimulatedWindows.clear();
+        g_AppliedWindowState.clear();
+        for (size_t i = 1; i <= windowCount; ++i) {
+            g_SimulatedWindows[MakeSyntheticHwnd(i)].title = "Window";
+        }
+        RunGeometryStallBenchmark(out, windowCount, 3);
+    }
 
-    // Swap the window handles
-    if (SwapWindowHandles(currentNode, adjacentNode)) {
-        std::cout << "MoveWindowInDirection: Swapped windows successfully.\n";
-        // Debug: Print layout after moving
-        std::cout << "MoveWindowInDirection: Layout after moving:\n";
-        PrintLayout(root.get());
-        return true;
+    // Operation: focus keys while windows appear and close in the background
+    if (enabled("InputLatencyUnderStorm")) {
+        const size_t baseWindows = 64;
+        const size_t stormWindows = 1000;
+        g_SimulatedWindows.clear();
+        g_AppliedWindowState.clear();
+        for (size_t i = 1; i <= baseWindows + stormWindows; ++i) {
+            SimulatedWindow& window = g_SimulatedWindows[MakeSyntheticHwnd(i)];
+            window.title = "Window";
+            window.rect = RECT{ 100, 100, 700, 500 };
+        }
+        RunInputStormBenchmark(out, baseWindows, stormWindows);
     }
 
-    return false;
-}
+    // Operations of each layout policy: insert one window (LayoutPolicyInsert), remove every
+    // window in random order (LayoutPolicyRemove) and lay out the whole tree
+    // (LayoutPolicyApply). Spiral, dwindle and master-stack trees are as deep as they are
+    // wide, so they are reported as degenerate. After removing a random half of the windows
+    // and adding them back, tiling_failures counts layouts that do not cover the screen
+    // exactly and count_errors nodes whose cached counts are wrong; both should stay at 0.
+    // Every policy but i3 keeps the shape of its tree, so for those reshaped_moves counts
+    // random window moves that changed it, and switch_mismatches is 1 if switching to the
+    // policy from an i3 tree gave another shape than building the tree under it; both
+    // should stay at 0.
+    for (int policyIndex = 0; policyIndex < 5; ++policyIndex) {
+        if (!enabled("LayoutPolicy")) break;
+        g_LayoutPolicy = static_cast<LayoutPolicy>(policyIndex);
+        const std::string policyField = std::string(",\"policy\":\"") + LAYOUT_POLICY_NAMES[policyIndex] + "\"";
+        const BenchShape shape = (g_LayoutPolicy == LayoutPolicy::I3 || g_LayoutPolicy == LayoutPolicy::GRID)
+            ? BenchShape::BALANCED : BenchShape::DEGENERATE;
+
+        for (size_t windowCount : windowCounts) {
+            std::mt19937 rng(static_cast<unsigned>(windowCount));
+            std::vector<size_t> shuffledIds(windowCount);
+            for (size_t i = 0; i < windowCount; ++i) shuffledIds[i] = i + 1;
+            std::shuffle(shuffledIds.begin(), shuffledIds.end(), rng);
+
+            g_SimulatedWindows.clear();
+            g_AppliedWindowState.clear();
+            for (size_t i = 1; i <= windowCount + 256; ++i) {
+                g_SimulatedWindows[MakeSyntheticHwnd(i)].title = "Window";
+            }
 
-// Function to change the split orientation of the current container
-void ChangeSplitOrientation(SplitType newSplitType) {
-    std::lock_guard<std::mutex> lock(layoutMutex);
+            auto buildLayout = [&]() {
+                g_FocusedLeaf = NodeHandle();
+                g_SpiralTail = NodeHandle();
+                root.reset();
+                for (size_t i = 1; i <= windowCount; ++i) AddWindowToLayout(MakeSyntheticHwnd(i));
+            };
+
+            if (enabled("LayoutPolicyInsert")) {
+                const size_t batch = (std::min)(windowCount, static_cast<size_t>(256));
+                BenchResult result = RunBenchmark("LayoutPolicyInsert", shape, windowCount, buildLayout,
+                    [&]() -> size_t {
+                        for (size_t i = 1; i <= batch; ++i) AddWindowToLayout(MakeSyntheticHwnd(windowCount + i));
+                        return batch;
+                    });
+                result.extraFields = policyField;
+                PrintBenchResult(out, result);
+            }
 
-    HWND current = GetForegroundWindow();
-    LayoutNode* currentNode = FindLayoutNode(root.get(), current);
+            if (enabled("LayoutPolicyRemove")) {
+                BenchResult result = RunBenchmark("LayoutPolicyRemove", shape, windowCount, buildLayout,
+                    [&]() -> size_t {
+                        for (size_t id : shuffledIds) sink = sink + RemoveWindowFromLayout(MakeSyntheticHwnd(id));
+                        return windowCount;
+                    });
+                result.extraFields = policyField;
+                PrintBenchResult(out, result);
+            }
 
-    if (!currentNode) {
-        std::cerr << "ChangeSplitOrientation: Current window not managed.\n";
-        return;
+            if (enabled("LayoutPolicyApply")) {
+                buildLayout();
+                for (size_t i = 0; i < windowCount / 2; ++i) RemoveWindowFromLayout(MakeSyntheticHwnd(shuffledIds[i]));
+                for (size_t i = 0; i < windowCount / 2; ++i) AddWindowToLayout(MakeSyntheticHwnd(shuffledIds[i]));
+                ApplyLayout(root.get(), screenRect);
+                size_t tilingFailures = VerifyTiling(root.get(), screenRect) ? 0 : 1;
+                size_t countErrors = CountNodeCountErrors(root.get());
+
+                BenchResult result = RunBenchmark("LayoutPolicyApply", shape, windowCount, nullptr,
+                    [&]() -> size_t {
+                        ApplyLayout(root.get(), screenRect);
+                        return 1;
+                    });
+                result.extraFields = policyField + ",\"tiling_failures\":" + std::to_string(tilingFailures) +
+                    ",\"count_errors\":" + std::to_string(countErrors);
+
+                if (g_LayoutPolicy != LayoutPolicy::I3) {
+                    const Direction directions[] = { Direction::LEFT, Direction::RIGHT, Direction::UP, Direction::DOWN };
+                    const size_t moveCount = (std::min)(windowCount, static_cast<size_t>(200));
+                    size_t reshapedMoves = 0;
+                    for (size_t i = 0; i < moveCount; ++i) {
+                        LayoutNode* leaf = FindLayoutNode(root.get(), MakeSyntheticHwnd(1 + rng() % windowCount));
+                        g_FocusedWindow = leaf->hwnd;
+                        SetFocusedLeaf(leaf);
+                        std::string before, after;
+                        AppendTreeShape(root.get(), before);
+                        MoveWindowInDirection(directions[rng() % 4]);
+                        AppendTreeShape(root.get(), after);
+                        if (before != after) ++reshapedMoves;
+                    }
+                    g_FocusedWindow = nullptr;
+                    ClearJournal();
+
+                    std::string switched, built;
+                    LayoutPolicy policy = g_LayoutPolicy;
+                    g_LayoutPolicy = LayoutPolicy::I3;
+                    buildLayout();
+                    SetLayoutPolicy(policy);
+                    AppendTreeShape(root.get(), switched);
+                    buildLayout();
+                    AppendTreeShape(root.get(), built);
+                    result.extraFields += ",\"reshaped_moves\":" + std::to_string(reshapedMoves) +
+                        ",\"switch_mismatches\":" + std::to_string(switched == built ? 0 : 1);
+                }
+                PrintBenchResult(out, result);
+            }
+        }
     }
-
-    // Find the parent split node
-    LayoutNode* parent = currentNode->parent;
-    if (!parent) {
-        std::cerr << "ChangeSplitOrientation: Current window has no parent split node.\n";
-        return;
+    g_LayoutPolicy = LayoutPolicy::I3;
+    g_SpiralTail = NodeHandle();
+    g_FocusedLeaf = NodeHandle();
+    root.reset();
+
+    // Operation: rebuild a chain of side-by-side windows, as deep as it is wide, as a balanced
+    // tree (TreeRebalance). The chain is laid out with gaps and two of its windows swapped as
+    // an undoable step first; after the rebuild the swap is undone. max_shift_px is how far
+    // any window ended up from where it was before the swap, which should stay within a pixel
+    // or two of rounding, undo_failures whether the undo was lost (it should stay at 0) and
+    // depth_after the depth of the rebuilt tree.
+    for (size_t windowCount : windowCounts) {
+        if (!enabled("TreeRebalance")) break;
+        g_SimulatedWindows.clear();
+        g_AppliedWindowState.clear();
+        for (size_t i = 1; i <= windowCount; ++i) {
+            g_SimulatedWindows[MakeSyntheticHwnd(i)].title = "Window";
+        }
+        // Gaps only while the windows are wide enough to keep them
+        g_InnerGap = (windowCount <= 100) ? 4 : 0;
+        RECT area = GetTilingArea(screenRect);
+
+        BuildSplitRun(windowCount);
+        ApplyLayout(root.get(), area);
+        std::unordered_map<HWND, RECT> before;
+        std::vector<LayoutNode*> leaves;
+        CollectLeafNodes(root.get(), leaves);
+        for (LayoutNode* leaf : leaves) before[leaf->hwnd] = leaf->windowRect;
+        int depthBefore = MeasureTreeDepth(root.get());
+
+        BeginJournalOperation(JournalOrigin::USER);
+        SwapWindowHandles(leaves[windowCount / 3], leaves[windowCount - 1]);
+        CommitJournalOperation();
+        RebalanceSplitGroup(root.get());
+        int depthAfter = MeasureTreeDepth(root.get());
+        size_t countErrors = CountNodeCountErrors(root.get());
+        ApplyLayout(root.get(), area);
+        size_t undoFailures = 0;
+        if (g_UndoJournal.empty()) ++undoFailures;
+        UndoLayoutOperation();
+        if (g_RedoJournal.empty()) ++undoFailures;
+
+        long long maxShift = 0;
+        leaves.clear();
+        CollectLeafNodes(root.get(), leaves);
+        for (LayoutNode* leaf : leaves) {
+            const RECT& was = before[leaf->hwnd];
+            const RECT& now = leaf->windowRect;
+            maxShift = (std::max)({ maxShift, std::llabs(was.left - now.left), std::llabs(was.right - now.right),
+                                    std::llabs(was.top - now.top), std::llabs(was.bottom - now.bottom) });
+        }
+        ClearJournal();
+        g_InnerGap = 0;
+
+        BenchResult result = RunBenchmark("TreeRebalance", BenchShape::DEGENERATE, windowCount,
+            [&]() { BuildSplitRun(windowCount); },
+            [&]() -> size_t {
+                RebalanceSplitGroup(root.get());
+                return 1;
+            });
+        result.extraFields = ",\"depth_before\":" + std::to_string(depthBefore) +
+            ",\"depth_after\":" + std::to_string(depthAfter) +
+            ",\"max_shift_px\":" + std::to_string(maxShift) +
+            ",\"undo_failures\":" + std::to_string(undoFailures) +
+            ",\"count_errors\":" + std::to_string(countErrors);
+        PrintBenchResult(out, result);
     }
 
-    // Check if the parent split type is already the desired type
-    if (parent->splitType == newSplitType) {
-        std::cout << "ChangeSplitOrientation: Split type is already " 
-                  << (newSplitType == SplitType::VERTICAL ? "Vertical" : "Horizontal") << ".\n";
-        return;
+    // Operation: close a random window and open it again next to the focused window, in the
+    // focused window's container, as i3 opens windows. Each new window takes focus, so the
+    // windows pile up in long runs of same-orientation splits. max_depth is the deepest the
+    // tree got and rebalanced_groups how many runs were rebuilt on the way.
+    for (size_t windowCount : windowCounts) {
+        if (!enabled("TreeChurn")) break;
+        std::mt19937 rng(static_cast<unsigned>(windowCount));
+        g_SimulatedWindows.clear();
+        g_AppliedWindowState.clear();
+        for (size_t i = 1; i <= windowCount; ++i) {
+            g_SimulatedWindows[MakeSyntheticHwnd(i)].title = "Window";
+        }
+        BuildSyntheticLayout(BenchShape::BALANCED, windowCount);
+        SetFocusedLeaf(DescendFocusHistory(root.get()));
+
+        auto churn = [&]() {
+            HWND hwnd = MakeSyntheticHwnd(1 + rng() % windowCount);
+            if (!RemoveWindowFromLayout(hwnd) || !root) return;
+            LayoutNode* focused = ResolveNode(g_FocusedLeaf);
+            if (!focused) focused = DescendFocusHistory(root.get());
+            SplitType splitType = focused->parent ? focused->parent->splitType : SplitType::VERTICAL;
+            LayoutNode* split = WrapInSplit(focused, hwnd, splitType, RATIO_HALF, false);
+            RecordSplitDelta(split, false);
+            LayoutNode* leaf = split->secondChild.get();
+            NormalizeAround(split);
+            SetFocusedLeaf(leaf);
+        };
+
+        // The depth walk visits the whole tree, so it is sampled on large trees
+        const size_t steps = 4 * windowCount;
+        const size_t sampleEvery = (std::max)(static_cast<size_t>(1), windowCount / 256);
+        int maxDepth = 0;
+        uint64_t rebalancedBefore = ReadMetric(Metric::GROUPS_REBALANCED);
+        for (size_t i = 0; i < steps; ++i) {
+            churn();
+            if (i % sampleEvery == 0) maxDepth = (std::max)(maxDepth, MeasureTreeDepth(root.get()));
+        }
+        uint64_t rebalanced = ReadMetric(Metric::GROUPS_REBALANCED) - rebalancedBefore;
+
+        BenchResult result = RunBenchmark("TreeChurn", BenchShape::BALANCED, windowCount, nullptr,
+            [&]() -> size_t {
+                for (int i = 0; i < 64; ++i) churn();
+                return 64;
+            });
+        result.extraFields = ",\"max_depth\":" + std::to_string(maxDepth) +
+            ",\"rebalanced_groups\":" + std::to_string(rebalanced) +
+            ",\"count_errors\":" + std::to_string(CountNodeCountErrors(root.get()));
+        PrintBenchResult(out, result);
     }
+    root.reset();
+
+    // Operation: restore a saved layout of dozens of applications, one window appearing at a
+    // time in random order through the full WinEvent path. candidates_per_window is how many
+    // placeholders were checked per new window; retiles counts full relayouts while the
+    // windows appeared and must stay at 0, and misplaced counts windows that did not end up
+    // in the placeholder meant for them, which must also stay at 0.
+    if (enabled("PlaceholderRestore")) {
+        const size_t appCount = 64;
+        std::mt19937 rng(static_cast<unsigned>(appCount));
+
+        // A balanced tree of placeholders, mixing every kind of criteria
+        std::string layoutText;
+        std::function<void(size_t, size_t, int)> writeLayout = [&](size_t first, size_t count, int depth) {
+            std::string indent(static_cast<size_t>(depth) * 2, ' ');
+            if (count == 1) {
+                std::string id = std::to_string(first);
+                switch (first % 4) {
+                    case 0: layoutText += indent + "window process=app" + id + ".exe\n"; break;
+                    case 1: layoutText += indent + "window class=AppClass" + id + " title=\"Doc " + id + " - *\"\n"; break;
+                    case 2: layoutText += indent + "window title=\"Doc " + id + " - *\"\n"; break;
+                    default: layoutText += indent + "window class=AppClass" + id + "\n"; break;
+                }
+                return;
+            }
+            layoutText += indent + (depth % 2 ? "split horizontal\n" : "split vertical\n");
+            writeLayout(first, count / 2, depth + 1);
+            writeLayout(first + count / 2, count - count / 2, depth + 1);
+        };
+        writeLayout(0, appCount, 0);
+
+        g_SimulatedWindows.clear();
+        g_AppliedWindowState.clear();
+        std::vector<HWND> windows(appCount);
+        for (size_t i = 0; i < appCount; ++i) {
+            windows[i] = MakeSyntheticHwnd(i + 1);
+            SimulatedWindow& window = g_SimulatedWindows[windows[i]];
+            window.title = "Doc " + std::to_string(i) + " - Editor";
+            window.className = "AppClass" + std::to_string(i);
+            window.processName = "app" + std::to_string(i) + ".exe";
+            window.rect = RECT{ 100, 100, 700, 500 };
+        }
+        std::vector<HWND> appearOrder = windows;
+
+        std::vector<LayoutNode*> placeholderLeaves;
+        auto setup = [&]() {
+            managedWindows.Clear();
+            g_ManagedWindowSet.Clear();
+            ClearWindowIndexes();
+            while (!g_WindowPropertyCache.empty()) ForgetWindowProperties(g_WindowPropertyCache.begin()->first);
+            BuildSyntheticLayout(BenchShape::BALANCED, 0);
+            LoadLayout(layoutText);
+            // Placeholder ids follow the order of the layout text
+            std::vector<std::pair<uint64_t, LayoutNode*>> byId;
+            for (const auto& entry : g_Placeholders) byId.emplace_back(entry.first, ResolveNode(entry.second.leaf));
+            std::sort(byId.begin(), byId.end());
+            placeholderLeaves.clear();
+            for (const auto& entry : byId) placeholderLeaves.push_back(entry.second);
+            std::shuffle(appearOrder.begin(), appearOrder.end(), rng);
+        };
+
+        size_t retiles = 0;
+        auto body = [&]() -> size_t {
+            size_t retilesBefore = g_RetileCount;
+            for (HWND window : appearOrder) {
+                WinEventProc(nullptr, EVENT_OBJECT_SHOW, window, OBJID_WINDOW, CHILDID_SELF, 0, 0);
+            }
+            retiles += g_RetileCount - retilesBefore;
+            return appCount;
+        };
+
+        setup();
+        body();
+        size_t misplaced = 0;
+        for (size_t i = 0; i < appCount; ++i) {
+            if (placeholderLeaves[i]->hwnd != windows[i]) ++misplaced;
+        }
 
-    // Change the split type
-    parent->splitType = newSplitType;
-    std::cout << "ChangeSplitOrientation: Split type changed to " 
-              << (newSplitType == SplitType::VERTICAL ? "Vertical" : "Horizontal") << ".\n";
+        g_PlaceholderCandidatesChecked = 0;
+        BenchResult result = RunBenchmark("PlaceholderRestore", BenchShape::BALANCED, appCount, setup, body);
+        result.extraFields = ",\"candidates_per_window\":" +
+            std::to_string(static_cast<double>(g_PlaceholderCandidatesChecked) / result.operations) +
+            ",\"retiles\":" + std::to_string(retiles) +
+            ",\"misplaced\":" + std::to_string(misplaced);
+        PrintBenchResult(out, result);
+
+        managedWindows.Clear();
+        g_ManagedWindowSet.Clear();
+        ClearWindowIndexes();
+        while (!g_WindowPropertyCache.empty()) ForgetWindowProperties(g_WindowPropertyCache.begin()->first);
+        BuildSyntheticLayout(BenchShape::BALANCED, 0);
+        g_SimulatedWindows.clear();
+        g_AppliedWindowState.clear();
+    }
 
-    // Re-apply the layout to reflect the change
-    HDC hdcScreen = GetDC(nullptr);
-    RECT screenRect;
-    screenRect.left = 0;
-    screenRect.top = 0;
-    screenRect.right = GetDeviceCaps(hdcScreen, HORZRES);
-    screenRect.bottom = GetDeviceCaps(hdcScreen, VERTRES);
-    ReleaseDC(nullptr, hdcScreen);
+    // Operation: parse one i3bar status line, fed in pipe-sized chunks of random length, and
+    // apply it to the bar. damaged_segments counts the segments invalidated over all updates;
+    // apart from the first, full draw of each pass, only the clock changes on most lines, so
+    // it should stay close to one per update.
+    // parse_failures counts lines that did not parse back to the blocks that were written.
+    if (enabled("StatusBarUpdate")) {
+        const size_t lineCount = 1000;
+        std::mt19937 rng(static_cast<unsigned>(lineCount));
+
+        std::string stream = "{\"version\":1,\"click_events\":false}\n[\n";
+        std::vector<std::vector<StatusBlock>> expected(lineCount);
+        auto twoDigits = [](size_t value) {
+            return std::string(value < 10 ? "0" : "") + std::to_string(value);
+        };
+        for (size_t i = 0; i < lineCount; ++i) {
+            std::string clock = "12:" + twoDigits(i / 60 % 60) + ":" + twoDigits(i % 60);
+            std::string load = "load 0." + std::to_string(i / 7 % 10);
+            bool urgent = (i % 50 == 0);
+
+            stream += (i == 0 ? "" : ",");
+            stream += "[{\"name\":\"load\",\"full_text\":\"" + load + "\"},";
+            stream += "{\"name\":\"temp\",\"instance\":\"cpu\",\"full_text\":\"42\\u00b0C \\\"hot\\\"\",\"urgent\":";
+            stream += urgent ? "true" : "false";
+            stream += "},{\"name\":\"time\",\"full_text\":\"" + clock + "\",\"color\":\"#ffffff\"}]\n";
+
+            expected[i].resize(3);
+            expected[i][0].fullText = load;
+            expected[i][1].fullText = "42\xC2\xB0" "C \"hot\"";
+            expected[i][1].urgent = urgent;
+            expected[i][2].fullText = clock;
+            expected[i][2].color = "#ffffff";
+        }
 
-    TileWindows(screenRect);
-}
+        std::vector<size_t> chunkSizes;
+        for (size_t offset = 0; offset < stream.size();) {
+            size_t chunk = (std::min)(stream.size() - offset, static_cast<size_t>(1 + rng() % 64));
+            chunkSizes.push_back(chunk);
+            offset += chunk;
+        }
 
-// Debugging Function to Print the Layout Tree
-void PrintLayout(LayoutNode* node, int depth) {
-    if (!node) return;
-    for (int i = 0; i < depth; ++i) std::cout << "  ";
-    if (node->isSplit) {
-        std::cout << "Split: " << (node->splitType == SplitType::VERTICAL ? "Vertical" : "Horizontal") 
-                  << ", Ratio: " << node->splitRatio << "\n";
-        PrintLayout(node->firstChild.get(), depth + 1);
-        PrintLayout(node->secondChild.get(), depth + 1);
-    }
-    else {
-        std::string title = GetWindowTitle(node->windowInfo.hwnd);
-        std::cout << "Window: HWND=0x" << std::hex << node->windowInfo.hwnd << std::dec 
-                  << ", Title=\"" << title << "\"\n";
+        size_t parseFailures = 0;
+        g_BarRect = RECT{ 0, 0, screenRect.right, BAR_HEIGHT };
+        g_BarTitle = "Focused window";
+        g_BarUpdates = 0;
+        g_BarDamagedSegments = 0;
+        g_BarDamagedPixels = 0;
+
+        BenchResult result = RunBenchmark("StatusBarUpdate", BenchShape::BALANCED, 0,
+            []() {
+                g_BarSegments.clear();
+                g_BarStatus.clear();
+            },
+            [&]() -> size_t {
+                size_t lineIndex = 0;
+                StatusStreamParser parser;
+                parser.onLine = [&](std::vector<StatusBlock>&& blocks) {
+                    const std::vector<StatusBlock>& want = expected[(std::min)(lineIndex++, lineCount - 1)];
+                    bool same = blocks.size() == want.size();
+                    for (size_t b = 0; same && b < blocks.size(); ++b) {
+                        same = blocks[b].fullText == want[b].fullText && blocks[b].color == want[b].color &&
+                               blocks[b].urgent == want[b].urgent;
+                    }
+                    if (!same) ++parseFailures;
+                    SetBarStatus(std::move(blocks));
+                };
+
+                size_t offset = 0;
+                for (size_t chunk : chunkSizes) {
+                    parser.Feed(stream.data() + offset, chunk);
+                    offset += chunk;
+                }
+                if (lineIndex != lineCount) ++parseFailures;
+                return lineIndex;
+            });
+
+        result.extraFields = ",\"updates\":" + std::to_string(g_BarUpdates) +
+            ",\"damaged_segments\":" + std::to_string(g_BarDamagedSegments) +
+            ",\"damaged_pixels_per_update\":" + std::to_string(g_BarUpdates ? g_BarDamagedPixels / static_cast<long long>(g_BarUpdates) : 0) +
+            ",\"bytes_per_update\":" + std::to_string(stream.size() / lineCount) +
+            ",\"parse_failures\":" + std::to_string(parseFailures);
+        PrintBenchResult(out, result);
+
+        g_BarSegments.clear();
+        g_BarStatus.clear();
+        g_BarTitle.clear();
     }
-}
-
-// Low-level keyboard hook callback
-LRESULT CALLBACK LowLevelKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam) {
-    if (nCode == HC_ACTION && isResizeMode && wParam == WM_KEYDOWN) {
-        KBDLLHOOKSTRUCT* p = (KBDLLHOOKSTRUCT*)lParam;
 
-        // Determine if Shift is pressed
-        bool isShiftPressed = (GetAsyncKeyState(VK_SHIFT) & 0x8000) != 0;
+    // Operation: answer one criteria query (by class, by mark, by class and title, by process
+    // and title) over thousands of managed windows. windows_checked_per_query counts the
+    // windows compared against the criteria; it should stay near matches_per_query rather
+    // than grow with the number of windows. wrong_results counts queries whose answer differs
+    // from a scan of every window.
+    for (size_t windowCount : { static_cast<size_t>(1000), static_cast<size_t>(10000) }) {
+        if (!enabled("CriteriaQuery")) break;
+        const size_t classCount = 50, processCount = 20;
+
+        g_SimulatedWindows.clear();
+        g_AppliedWindowState.clear();
+        managedWindows.Clear();
+        for (size_t i = 0; i < windowCount; ++i) {
+            HWND hwnd = MakeSyntheticHwnd(i + 1);
+            SimulatedWindow& window = g_SimulatedWindows[hwnd];
+            window.title = "Doc " + std::to_string(i) + " - Editor";
+            window.className = "AppClass" + std::to_string(i % classCount);
+            window.processName = "app" + std::to_string(i % processCount) + ".exe";
+
+            WindowInfo info;
+            info.hwnd = hwnd;
+            managedWindows.Insert(info);
+            g_ManagedWindowSet.Insert(hwnd);
+            IndexManagedWindow(hwnd);
+            if (i % 10 == 0) SetWindowMark(hwnd, "m" + std::to_string(i));
+        }
 
-        // Determine delta ratio based on key and split type
-        float deltaRatio = 0.0f;
-        if (activeNodeForResize && activeNodeForResize->parent) {
-            LayoutNode* parentSplitNode = activeNodeForResize->parent;
-            switch (p->vkCode) {
-                case VK_LEFT:
-                    if (parentSplitNode->splitType == SplitType::VERTICAL) {
-                        deltaRatio = isShiftPressed ? -0.02f : 0.02f;
-                    }
-                    break;
-                case VK_RIGHT:
-                    if (parentSplitNode->splitType == SplitType::VERTICAL) {
-                        deltaRatio = isShiftPressed ? 0.02f : -0.02f;
-                    }
-                    break;
-                case VK_UP:
-                    if (parentSplitNode->splitType == SplitType::HORIZONTAL) {
-                        deltaRatio = isShiftPressed ? -0.02f : 0.02f;
-                    }
-                    break;
-                case VK_DOWN:
-                    if (parentSplitNode->splitType == SplitType::HORIZONTAL) {
-                        deltaRatio = isShiftPressed ? 0.02f : -0.02f;
-                    }
+        std::mt19937 rng(static_cast<unsigned>(windowCount));
+        std::vector<WindowCriteria> queries(1000);
+        for (size_t q = 0; q < queries.size(); ++q) {
+            size_t i = rng() % windowCount;
+            WindowCriteria& criteria = queries[q];
+            switch (q % 4) {
+                case 0: criteria.className = "AppClass" + std::to_string(i % classCount); break;
+                case 1: criteria.mark = "m" + std::to_string(i - i % 10); break;
+                case 2:
+                    criteria.className = "AppClass" + std::to_string(i % classCount);
+                    criteria.titlePattern = "Doc " + std::to_string(i % 100) + "* - Editor";
                     break;
-                case VK_ESCAPE:
-                    // Exit resize mode on ESC
-                    isResizeMode = false;
-                    if (hKeyboardHook) {
-                        UnhookWindowsHookEx(hKeyboardHook);
-                        hKeyboardHook = NULL;
-                    }
-                    std::cout << "LowLevelKeyboardProc: Exited resize mode.\n";
-                    return 1; // Suppress the key
                 default:
+                    criteria.processName = "app" + std::to_string(i % processCount) + ".exe";
+                    criteria.titlePattern = "Doc *" + std::to_string(i % 10) + " - *";
                     break;
             }
+        }
 
-            if (deltaRatio != 0.0f) {
-                // Adjust the split ratio
-                AdjustSplitRatio(parentSplitNode, deltaRatio);
+        size_t wrongResults = 0, matches = 0;
+        for (const WindowCriteria& criteria : queries) {
+            std::vector<HWND> found = QueryWindows(criteria);
+            std::vector<HWND> expected;
+            for (const WindowInfo& window : managedWindows) {
+                if (MatchesCriteria(window.hwnd, criteria)) expected.push_back(window.hwnd);
             }
+            std::sort(found.begin(), found.end());
+            std::sort(expected.begin(), expected.end());
+            if (found != expected) ++wrongResults;
+            matches += found.size();
         }
 
-        return 1; // Suppress the key
-    }
-    return CallNextHookEx(hKeyboardHook, nCode, wParam, lParam);
-}
-
-// WinEvent callback implementation
-void CALLBACK WinEventProc(
-    HWINEVENTHOOK hWinEventHook,
-    DWORD event,
-    HWND hwnd,
-    LONG idObject,
-    LONG idChild,
-    DWORD dwEventThread,
-    DWORD dwmsEventTime
-) {
-    // Log every event received with HWND in hexadecimal
-    std::cout << "WinEventProc: Event " << event << " received for HWND=0x" 
-              << std::hex << hwnd << std::dec << "\n";
-
-    // Only process window-level events
-    if (idObject != OBJID_WINDOW || idChild != CHILDID_SELF) {
-        return;
+        g_CriteriaWindowsChecked = 0;
+        BenchResult result = RunBenchmark("CriteriaQuery", BenchShape::BALANCED, windowCount, nullptr,
+            [&]() -> size_t {
+                for (const WindowCriteria& criteria : queries) {
+                    sink = sink + QueryWindows(criteria).size();
+                }
+                return queries.size();
+            });
+        result.extraFields = ",\"windows_checked_per_query\":" +
+            std::to_string(static_cast<double>(g_CriteriaWindowsChecked) / result.operations) +
+            ",\"matches_per_query\":" + std::to_string(static_cast<double>(matches) / queries.size()) +
+            ",\"wrong_results\":" + std::to_string(wrongResults);
+        PrintBenchResult(out, result);
+
+        managedWindows.Clear();
+        g_ManagedWindowSet.Clear();
+        ClearWindowIndexes();
+        while (!g_WindowPropertyCache.empty()) ForgetWindowProperties(g_WindowPropertyCache.begin()->first);
+        g_SimulatedWindows.clear();
+        g_AppliedWindowState.clear();
     }
 
-    std::lock_guard<std::mutex> lock(layoutMutex); // Lock the mutex
-
-    // Function to process window addition
-    auto processWindow = [&](HWND hwnd) {
-        std::cout << "Processing window: HWND=0x" << std::hex << hwnd << std::dec << "\n";
+    // Operation: one keystroke in the window switcher, from typing abbreviations of window
+    // titles with the occasional backspace. entries_scanned_per_keystroke shows how far
+    // narrowing cuts the work; max_keystroke_ns is the slowest single keystroke. wrong_results
+    // counts keystrokes whose candidates differ from a plain subsequence check of every title.
+    for (size_t windowCount : { static_cast<size_t>(1000), static_cast<size_t>(10000) }) {
+        if (!enabled("SwitcherFilter")) break;
+        const char* words[] = { "budget", "report", "inbox", "release", "notes", "meeting", "draft", "invoice",
+                                "design", "review", "sprint", "backlog", "roadmap", "profile", "settings", "kernel" };
+        const char* apps[] = { "Notepad", "Mail", "Chrome", "Terminal", "Explorer", "Word", "Excel", "Code" };
+        std::mt19937 rng(static_cast<unsigned>(windowCount));
+
+        g_SimulatedWindows.clear();
+        g_AppliedWindowState.clear();
+        managedWindows.Clear();
+        std::vector<std::string> titles(windowCount);
+        for (size_t i = 0; i < windowCount; ++i) {
+            HWND hwnd = MakeSyntheticHwnd(i + 1);
+            titles[i] = std::string(words[rng() % 16]) + " " + words[rng() % 16] + " " + std::to_string(i) +
+                        " - " + apps[i % 8];
+            SimulatedWindow& window = g_SimulatedWindows[hwnd];
+            window.title = titles[i];
+            window.className = std::string(apps[i % 8]) + "Window";
+
+            WindowInfo info;
+            info.hwnd = hwnd;
+            managedWindows.Insert(info);
+            g_ManagedWindowSet.Insert(hwnd);
+            IndexManagedWindow(hwnd);
+            if (i % 100 == 0) SetWindowMark(hwnd, "pin" + std::to_string(i));
+        }
 
-        if (!IsWindowVisible(hwnd)) {
-            std::cout << " - Skipped: Window is not visible.\n";
-            return;
+        // Each session types an abbreviation such as "bud re 4217" one keystroke at a time
+        std::vector<std::vector<std::string>> sessions(200);
+        size_t keystrokes = 0;
+        for (size_t s = 0; s < sessions.size(); ++s) {
+            const std::string& title = titles[rng() % windowCount];
+            size_t second = title.find(' ') + 1, third = title.find(' ', second) + 1;
+            std::string typed = title.substr(0, 3) + " " + title.substr(second, 2) + " " +
+                                title.substr(third, title.find(' ', third) - third);
+            std::string input;
+            for (size_t c = 0; c < typed.size(); ++c) {
+                input += typed[c];
+                sessions[s].push_back(input);
+                if (s % 4 == 0 && c == 4) {
+                    input.pop_back(); // A typo, taken back
+                    sessions[s].push_back(input);
+                }
+            }
+            keystrokes += sessions[s].size();
         }
 
-        int titleLength = GetWindowTextLengthA(hwnd);
-        if (titleLength == 0) {
-            std::cout << " - Skipped: Window has no title.\n";
-            return;
+        BuildSwitcherCorpus();
+        size_t wrongResults = 0;
+        long long maxKeystrokeNs = 0;
+        for (const std::vector<std::string>& session : sessions) {
+            g_SwitcherQuery.clear();
+            ResetSwitcherCandidates();
+            for (const std::string& input : session) {
+                auto start = std::chrono::steady_clock::now();
+                UpdateSwitcherQuery(input);
+                maxKeystrokeNs = (std::max)(maxKeystrokeNs, static_cast<long long>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+
+                std::string query;
+                for (char c : input) {
+                    if (c != ' ') query += LowerSwitcherChar(c);
+                }
+                std::vector<uint32_t> expected;
+                for (size_t e = 0; e < g_SwitcherEntries.size(); ++e) {
+                    const char* text = g_SwitcherCorpus.data() + g_SwitcherEntries[e].offset;
+                    size_t q = 0;
+                    for (size_t t = 0; t < g_SwitcherEntries[e].length && q < query.size(); ++t) {
+                        if (text[t] == query[q]) ++q;
+                    }
+                    if (q == query.size()) expected.push_back(static_cast<uint32_t>(e));
+                }
+                std::vector<uint32_t> found;
+                for (const SwitcherMatch& match : g_SwitcherCandidates) found.push_back(match.entry);
+                if (found != expected) ++wrongResults;
+            }
         }
 
-        // Retrieve window title
-        std::string title = GetWindowTitle(hwnd); // Using helper function
+        g_SwitcherEntriesScanned = 0;
+        BenchResult result = RunBenchmark("SwitcherFilter", BenchShape::BALANCED, windowCount, nullptr,
+            [&]() -> size_t {
+                for (const std::vector<std::string>& session : sessions) {
+                    g_SwitcherQuery.clear();
+                    ResetSwitcherCandidates();
+                    for (const std::string& input : session) {
+                        UpdateSwitcherQuery(input);
+                        sink = sink + g_SwitcherResults.size();
+                    }
+                }
+                return keystrokes;
+            });
+        result.extraFields = ",\"entries_scanned_per_keystroke\":" +
+            std::to_string(static_cast<double>(g_SwitcherEntriesScanned) / result.operations) +
+            ",\"max_keystroke_ns\":" + std::to_string(maxKeystrokeNs) +
+            ",\"wrong_results\":" + std::to_string(wrongResults);
+        PrintBenchResult(out, result);
+
+        CloseSwitcher();
+        managedWindows.Clear();
+        g_ManagedWindowSet.Clear();
+        ClearWindowIndexes();
+        while (!g_WindowPropertyCache.empty()) ForgetWindowProperties(g_WindowPropertyCache.begin()->first);
+        g_SimulatedWindows.clear();
+        g_AppliedWindowState.clear();
+    }
 
-        LONG exStyle = GetWindowLong(hwnd, GWL_EXSTYLE);
-        if (exStyle & WS_EX_TOOLWINDOW) {
-            std::cout << " - Skipped: Window is a tool window. Title=\"" << title << "\"\n";
-            return;
+    // Operations: find a managed window's record by HWND, and close and reopen a window, in
+    // the window registry and, for comparison, in a plain vector searched with find_if.
+    for (size_t windowCount : windowCounts) {
+        if (!enabled("WindowRegistry")) break;
+        std::mt19937 rng(static_cast<unsigned>(windowCount));
+
+        std::vector<WindowInfo> vectorWindows;
+        WindowRegistry registry;
+        for (size_t i = 0; i < windowCount; ++i) {
+            WindowInfo info{ MakeSyntheticHwnd(i + 1), RECT{}, 0 };
+            vectorWindows.push_back(info);
+            registry.Insert(info);
         }
+        std::vector<HWND> lookups(1000);
+        for (HWND& hwnd : lookups) hwnd = MakeSyntheticHwnd(1 + rng() % windowCount);
+
+        PrintBenchResult(out, RunBenchmark("WindowRegistryLookupVector", BenchShape::BALANCED, windowCount, nullptr,
+            [&]() -> size_t {
+                for (HWND hwnd : lookups) {
+                    auto it = std::find_if(vectorWindows.begin(), vectorWindows.end(),
+                        [hwnd](const WindowInfo& window) { return window.hwnd == hwnd; });
+                    sink = sink + it->savedStyle;
+                }
+                return lookups.size();
+            }));
+        PrintBenchResult(out, RunBenchmark("WindowRegistryLookup", BenchShape::BALANCED, windowCount, nullptr,
+            [&]() -> size_t {
+                for (HWND hwnd : lookups) sink = sink + registry.Get(hwnd)->savedStyle;
+                return lookups.size();
+            }));
+
+        PrintBenchResult(out, RunBenchmark("WindowRegistryCloseOpenVector", BenchShape::BALANCED, windowCount, nullptr,
+            [&]() -> size_t {
+                for (HWND hwnd : lookups) {
+                    auto it = std::find_if(vectorWindows.begin(), vectorWindows.end(),
+                        [hwnd](const WindowInfo& window) { return window.hwnd == hwnd; });
+                    WindowInfo info = *it;
+                    vectorWindows.erase(it);
+                    vectorWindows.push_back(info);
+                }
+                return lookups.size();
+            }));
+        PrintBenchResult(out, RunBenchmark("WindowRegistryCloseOpen", BenchShape::BALANCED, windowCount, nullptr,
+            [&]() -> size_t {
+                for (HWND hwnd : lookups) {
+                    WindowInfo info = *registry.Get(hwnd);
+                    registry.Erase(hwnd);
+                    registry.Insert(info);
+                }
+                return lookups.size();
+            }));
+    }
 
-        LONG style = GetWindowLong(hwnd, GWL_STYLE);
-        if ((style & WS_POPUP) || (style & WS_CHILD)) {
-            std::cout << " - Skipped: Window is a popup or child window. Title=\"" << title << "\"\n";
-            return;
+    // Operation: resolve a node handle, with half of the nodes destroyed and their slots reused
+    // by new nodes since the handles were taken. stale_resolved counts handles to destroyed
+    // nodes that still resolved, and live_unresolved live handles that did not; both should
+    // stay at 0.
+    for (size_t windowCount : windowCounts) {
+        if (!enabled("NodeHandleResolve")) break;
+        std::mt19937 rng(static_cast<unsigned>(windowCount));
+
+        std::vector<std::unique_ptr<LayoutNode>> nodes;
+        std::vector<NodeHandle> handles;
+        for (size_t i = 0; i < windowCount; ++i) {
+            nodes.push_back(std::make_unique<LayoutNode>(MakeSyntheticHwnd(i + 1)));
+            handles.push_back(nodes.back()->handle);
         }
-
-        RECT rect;
-        if (!GetWindowRect(hwnd, &rect)) {
-            std::cerr << " - Error: Failed to get RECT for HWND=0x" << std::hex << hwnd 
-                      << ". Error: " << GetLastError() << "\n" << std::dec;
-            return;
+        std::vector<bool> destroyed(windowCount, false);
+        for (size_t i = 0; i < windowCount; i += 2) {
+            nodes[i] = std::make_unique<LayoutNode>(MakeSyntheticHwnd(windowCount + i + 1));
+            destroyed[i] = true;
         }
 
-        if (rect.left == rect.right || rect.top == rect.bottom) {
-            std::cout << " - Skipped: Window has no area. Title=\"" << title << "\"\n";
-            return;
+        size_t staleResolved = 0, liveUnresolved = 0;
+        for (size_t i = 0; i < windowCount; ++i) {
+            LayoutNode* node = ResolveNode(handles[i]);
+            if (destroyed[i] && node) ++staleResolved;
+            if (!destroyed[i] && node != nodes[i].get()) ++liveUnresolved;
         }
 
-        // Initialize WindowInfo
-        WindowInfo winInfo;
-        winInfo.hwnd = hwnd;
-        winInfo.savedRect = rect;
-        winInfo.savedStyle = style;
-        managedWindows.push_back(winInfo);
-        std::cout << " - Added: New window managed. Title=\"" << title << "\"\n";
+        std::vector<NodeHandle> lookups(1000);
+        for (NodeHandle& handle : lookups) handle = handles[rng() % windowCount];
+        BenchResult result = RunBenchmark("NodeHandleResolve", BenchShape::BALANCED, windowCount, nullptr,
+            [&]() -> size_t {
+                for (NodeHandle handle : lookups) sink = sink + reinterpret_cast<uintptr_t>(ResolveNode(handle));
+                return lookups.size();
+            });
+        result.extraFields = ",\"stale_resolved\":" + std::to_string(staleResolved) +
+            ",\"live_unresolved\":" + std::to_string(liveUnresolved);
+        PrintBenchResult(out, result);
+    }
+
+    root.reset();
+    ClearLayoutSnapshots();
+    ClearJournal();
+    g_SimulatedWindows.clear();
+    g_AppliedWindowState.clear();
+    g_StubWindowSystem = false;
+    std::cout.rdbuf(coutBuffer);
+    return 0;
+}
 
-        // Assign the new window to the first available pending split
-        bool assigned = false;
-        while (!pendingSplits.empty()) {
-            LayoutNode* pendingNode = pendingSplits.front();
-            pendingSplits.pop();
+// Structure to read records back from a trace buffer
+struct TraceReader {
+    std::vector<uint8_t> data;
+    size_t pos = 0;
+    bool failed = false;
 
-            if (pendingNode && !pendingNode->isSplit && pendingNode->windowInfo.hwnd == nullptr) {
-                pendingNode->windowInfo.hwnd = hwnd;
-                std::cout << " - Assigned new window to pending split.\n";
-                assigned = true;
-                break;
+    bool AtEnd() const { return pos >= data.size(); }
+
+    uint64_t ReadVarint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= data.size()) {
+                failed = true;
+                return 0;
             }
+            uint8_t byte = data[pos++];
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return value;
         }
+        failed = true;
+        return 0;
+    }
+
+    int64_t ReadSigned() {
+        uint64_t raw = ReadVarint();
+        return static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+    }
+
+    HWND ReadHwnd() {
+        return reinterpret_cast<HWND>(static_cast<uintptr_t>(ReadVarint()));
+    }
+
+    RECT ReadRect() {
+        RECT rect;
+        rect.left = static_cast<LONG>(ReadSigned());
+        rect.top = static_cast<LONG>(ReadSigned());
+        rect.right = static_cast<LONG>(ReadSigned());
+        rect.bottom = static_cast<LONG>(ReadSigned());
+        return rect;
+    }
 
-        if (!assigned) {
-            // If no pending split found, add breadth-first
-            std::cout << " - No pending split found. Adding breadth-first.\n";
-            AddWindowBreadthFirst(hwnd);
+    std::string ReadString() {
+        uint64_t length = ReadVarint();
+        if (failed || length > data.size() - pos) {
+            failed = true;
+            return std::string();
         }
+        std::string value(reinterpret_cast<const char*>(&data[pos]), static_cast<size_t>(length));
+        pos += static_cast<size_t>(length);
+        return value;
+    }
+};
 
-        // Re-apply the tiling layout
-        HDC hdcScreen = GetDC(nullptr);
-        RECT screenRect;
-        screenRect.left = 0;
-        screenRect.top = 0;
-        screenRect.right = GetDeviceCaps(hdcScreen, HORZRES);
-        screenRect.bottom = GetDeviceCaps(hdcScreen, VERTRES);
-        ReleaseDC(nullptr, hdcScreen);
+// Function to replay a recorded trace through the normal event and hotkey handlers, against
+// the simulated window set. Records are fed back to back, so replay runs as fast as the
+// layout code allows rather than at the recorded pace.
+// Usage: tile_windows.exe --replay <trace file> [--verbose]
+int RunTraceReplay(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "RunTraceReplay: Usage: --replay <trace file> [--verbose]\n";
+        return 1;
+    }
+    const std::string tracePath = argv[2];
+    bool verbose = (argc > 3 && std::strcmp(argv[3], "--verbose") == 0);
 
-        TileWindows(screenRect);
-    };
+    std::ifstream traceFile(tracePath, std::ios::binary);
+    if (!traceFile) {
+        std::cerr << "RunTraceReplay: Failed to open \"" << tracePath << "\".\n";
+        return 1;
+    }
+    TraceReader reader;
+    reader.data.assign(std::istreambuf_iterator<char>(traceFile), std::istreambuf_iterator<char>());
 
-    // Handle window show events
-    if (event == EVENT_OBJECT_SHOW) {
-        processWindow(hwnd);
+    if (reader.data.size() < sizeof(TRACE_MAGIC) ||
+        std::memcmp(reader.data.data(), TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        std::cerr << "RunTraceReplay: \"" << tracePath << "\" is not a trace file.\n";
+        return 1;
+    }
+    reader.pos = sizeof(TRACE_MAGIC);
+
+    // Silence the per-event logging unless asked for; it would dominate the timing
+    std::streambuf* coutBuffer = std::cout.rdbuf();
+    std::streambuf* cerrBuffer = std::cerr.rdbuf();
+    if (!verbose) {
+        std::cout.rdbuf(nullptr);
+        std::cerr.rdbuf(nullptr);
     }
-    // Handle window destruction
-    else if (event == EVENT_OBJECT_DESTROY) {
-        // Find and remove the window from managedWindows and the layout tree
-        auto it = std::find_if(managedWindows.begin(), managedWindows.end(),
-            [hwnd](const WindowInfo& win) { return win.hwnd == hwnd; });
-        if (it != managedWindows.end()) {
-            std::cout << "WinEventProc: Window removed: HWND=0x" << std::hex << hwnd << std::dec << "\n";
-            managedWindows.erase(it);
-
-            // Find the corresponding LayoutNode
-            LayoutNode* nodeToRemove = FindLayoutNode(root.get(), hwnd);
-            if (nodeToRemove) {
-                // Remove the node from the layout tree
-                if (nodeToRemove->parent) {
-                    LayoutNode* parent = nodeToRemove->parent;
-                    std::unique_ptr<LayoutNode> sibling;
-                    if (parent->firstChild.get() == nodeToRemove) {
-                        sibling = std::move(parent->secondChild);
-                    } else {
-                        sibling = std::move(parent->firstChild);
-                    }
 
-                    // Replace parent with sibling
-                    if (parent->parent) {
-                        if (parent->parent->firstChild.get() == parent) {
-                            parent->parent->firstChild = std::move(sibling);
-                            parent->parent->firstChild->parent = parent->parent;
-                        } else {
-                            parent->parent->secondChild = std::move(sibling);
-                            parent->parent->secondChild->parent = parent->parent;
-                        }
-                    }
-                    else {
-                        // If parent is root
-                        root = std::move(sibling);
-                        if (root) {
-                            root->parent = nullptr;
-                        }
-                    }
-                }
-                else {
-                    // If the node to remove is root
-                    root.reset();
-                }
+    g_StubWindowSystem = true;
+    g_RetileCount = 0;
+    g_WindowMoveCount = 0;
+    g_WindowSystemCalls = 0;
 
-                // Re-apply the tiling layout
-                HDC hdcScreen = GetDC(nullptr);
-                RECT screenRect;
-                screenRect.left = 0;
-                screenRect.top = 0;
-                screenRect.right = GetDeviceCaps(hdcScreen, HORZRES);
-                screenRect.bottom = GetDeviceCaps(hdcScreen, VERTRES);
-                ReleaseDC(nullptr, hdcScreen);
+    size_t records = 0, winEvents = 0, hotkeys = 0, resizeKeys = 0, commands = 0;
+    uint64_t traceSpanUs = 0;
 
-                TileWindows(screenRect);
+    auto start = std::chrono::steady_clock::now();
+    while (!reader.AtEnd() && !reader.failed) {
+        auto type = static_cast<TraceRecordType>(reader.data[reader.pos++]);
+        traceSpanUs += reader.ReadVarint();
+        ++records;
+
+        switch (type) {
+            case TraceRecordType::SCREEN:
+                g_SimulatedScreen = reader.ReadRect();
+                break;
+            case TraceRecordType::WINDOW: {
+                HWND hwnd = reader.ReadHwnd();
+                SimulatedWindow& window = g_SimulatedWindows[hwnd];
+                window.visible = reader.ReadVarint() != 0;
+                window.style = static_cast<LONG>(reader.ReadVarint());
+                window.exStyle = static_cast<LONG>(reader.ReadVarint());
+                window.rect = reader.ReadRect();
+                window.title = reader.ReadString();
+                break;
+            }
+            case TraceRecordType::ENUM_WINDOW:
+                EnumWindowsCallback(reader.ReadHwnd(), reinterpret_cast<LPARAM>(&managedWindows));
+                break;
+            case TraceRecordType::INITIAL_LAYOUT:
+                if (!managedWindows.empty()) {
+                    BuildInitialLayout(GetScreenRect());
+                }
+                break;
+            case TraceRecordType::WIN_EVENT: {
+                DWORD event = static_cast<DWORD>(reader.ReadVarint());
+                HWND hwnd = reader.ReadHwnd();
+                LONG idObject = static_cast<LONG>(reader.ReadSigned());
+                LONG idChild = static_cast<LONG>(reader.ReadSigned());
+                WinEventProc(nullptr, event, hwnd, idObject, idChild, 0, 0);
+                if (event == EVENT_OBJECT_DESTROY && idObject == OBJID_WINDOW) {
+                    g_SimulatedWindows.erase(hwnd);
+                }
+                ++winEvents;
+                break;
+            }
+            case TraceRecordType::HOTKEY: {
+                WPARAM hotkeyId = static_cast<WPARAM>(reader.ReadVarint());
+                g_SimulatedForeground = reader.ReadHwnd();
+                // Traces recorded without foreground events still carry the foreground window
+                // of every hotkey
+                if (g_SimulatedForeground != g_ForegroundWindow) {
+                    WinEventProc(nullptr, EVENT_SYSTEM_FOREGROUND, g_SimulatedForeground, OBJID_WINDOW, CHILDID_SELF, 0, 0);
+                }
+                PostLayoutMessage(WM_HOTKEY, hotkeyId, 0);
+                ++hotkeys;
+                break;
+            }
+            case TraceRecordType::RESIZE_KEY: {
+                DWORD vkCode = static_cast<DWORD>(reader.ReadVarint());
+                bool isShiftPressed = reader.ReadVarint() != 0;
+                PostLayoutMessage(WM_LAYOUT_RESIZE_KEY, vkCode, isShiftPressed ? 1 : 0);
+                ++resizeKeys;
+                break;
             }
+            case TraceRecordType::COMMAND:
+                PostLayoutMessage(WM_LAYOUT_COMMAND, 0, reinterpret_cast<LPARAM>(new std::string(reader.ReadString())));
+                ++commands;
+                break;
+            default:
+                reader.failed = true;
+                break;
         }
     }
-}
+    long long wallUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
 
-// Function to unregister all WinEvent hooks
-void UnregisterWinEventHooks(HWINEVENTHOOK hHookShow, HWINEVENTHOOK hHookDestroy, HWINEVENTHOOK hHookNameChange = nullptr) {
-    if (hHookShow) {
-        UnhookWinEvent(hHookShow);
-    }
-    if (hHookDestroy) {
-        UnhookWinEvent(hHookDestroy);
-    }
-    if (hHookNameChange) {
-        UnhookWinEvent(hHookNameChange);
+    std::cout.rdbuf(coutBuffer);
+    std::cerr.rdbuf(cerrBuffer);
+
+    if (reader.failed) {
+        std::cerr << "RunTraceReplay: Trace is truncated or corrupt after " << records << " records.\n";
     }
-    std::cout << "UnregisterWinEventHooks: All WinEvent hooks unregistered.\n";
-}
 
-// Function to close a focused window
-void CloseFocusedWindow(HWND currentWindow) {
-    PostMessage(currentWindow, WM_CLOSE, 0, 0);
+    double speedup = wallUs > 0 ? static_cast<double>(traceSpanUs) / wallUs : 0.0;
+    std::cout << "{\"trace\":\"" << tracePath << "\""
+              << ",\"records\":" << records
+              << ",\"win_events\":" << winEvents
+              << ",\"hotkeys\":" << hotkeys
+              << ",\"resize_keys\":" << resizeKeys
+              << ",\"commands\":" << commands
+              << ",\"trace_span_us\":" << traceSpanUs
+              << ",\"wall_us\":" << wallUs
+              << ",\"speedup\":" << speedup
+              << ",\"retiles\":" << g_RetileCount
+              << ",\"window_moves\":" << g_WindowMoveCount
+              << ",\"refused_moves\":" << g_RefusedMoveCount
+              << ",\"os_calls\":" << g_WindowSystemCalls
+              << ",\"os_calls_per_retile\":"
+              << (g_RetileCount ? static_cast<double>(g_WindowSystemCalls) / g_RetileCount : 0.0)
+              << ",\"property_fetches\":" << g_WindowPropertyFetches
+              << ",\"events_accepted\":" << g_WinEventsAccepted
+              << ",\"events_rejected\":" << g_WinEventsRejected
+              << ",\"managed_windows\":" << managedWindows.size()
+              << ",\"floating_windows\":" << g_FloatingWindows.size() << "}\n";
+
+    g_FocusedLeaf = NodeHandle();
+    g_FocusedWindow = nullptr;
+    g_ForegroundWindow = nullptr;
+    g_FullscreenLeaf = NodeHandle();
+    ClearPlaceholders();
+    root.reset();
+    g_ManagedWindowSet.Clear();
+    ClearWindowIndexes();
+    g_WindowSizeConstraints.clear();
+    g_FloatingWindows.clear();
+    while (!g_WindowPropertyCache.empty()) ForgetWindowProperties(g_WindowPropertyCache.begin()->first);
+    g_SimulatedWindows.clear();
+    g_AppliedWindowState.clear();
+    g_StubWindowSystem = false;
+    return reader.failed ? 1 : 0;
 }
 
-// Function to open the terminal
-void OpenTerminal() {
-    // Eventually we'll modify this function to allow users to specify their terminal from a config
-    // but this will be added at a later date
-    // - cmd.exe
-    // - powershell.exe
-    // - wt.exe (Windows Terminal, if installed)
-    // - bash.exe (Git Bash, if installed and in PATH)
+int main(int argc, char* argv[]) {
+    // This thread owns the layout tree; input sources post their work to it
+    g_LayoutThreadId = GetCurrentThreadId();
 
-    // Example 1: Open Command Prompt
-    /*
-    ShellExecuteA(
-        NULL,                   // No parent window
-        "open",                 // Operation to perform
-        "cmd.exe",              // Application to start
-        NULL,                   // Command line arguments
-        NULL,                   // Default directory
-        SW_SHOWDEFAULT          // Show command
-    );
-    */
+    // Run the layout benchmark suite instead of managing windows
+    if (argc > 1 && std::strcmp(argv[1], "--bench") == 0) {
+        return RunBenchmarks(argc, argv);
+    }
 
-    // Example 2: Open PowerShell
-    /*
-    ShellExecuteA(
-        NULL,
-        "open",
-        "powershell.exe",
-        NULL,
-        NULL,
-        SW_SHOWDEFAULT
-    );
-    */
+    // Replay a recorded trace against the simulated window set
+    if (argc > 1 && std::strcmp(argv[1], "--replay") == 0) {
+        return RunTraceReplay(argc, argv);
+    }
 
-    // Example 3: Open Windows Terminal (requires Windows Terminal to be installed)
-    /*
-    ShellExecuteA(
-        NULL,
-        "open",
-        "wt.exe",
-        NULL,
-        NULL,
-        SW_SHOWDEFAULT
-    );
-    */
+    // Send a command to the running instance, like i3-msg
+    if (argc > 2 && std::strcmp(argv[1], "--msg") == 0) {
+        return SendCommand(argv[2]);
+    }
 
-    // Example 4: Open Git Bash (ensure it's installed and added to PATH)
-    /*
-    ShellExecuteA(
-        NULL,
-        "open",
-        "bash.exe",
-        NULL,
-        NULL,
-        SW_SHOWDEFAULT
-    );
-    */
+    // Print the layout state the running instance publishes in shared memory
+    if (argc > 1 && std::strcmp(argv[1], "--state") == 0) {
+        return PrintSharedState();
+    }
 
-    if (ShellExecuteA(
-        NULL,
-        "open",
-        "bash.exe",
-        NULL,
-        NULL,
-        SW_SHOWDEFAULT
-    ) <= (HINSTANCE)32) { // Error checking
-        std::cerr << "OpenTerminal: Failed to open Terminal. Error code: " << GetLastError() << "\n";
-    } else {
-        std::cout << "OpenTerminal: Terminal opened successfully.\n";
+    // Record everything the window manager reacts to, for later replay
+    if (argc > 2 && std::strcmp(argv[1], "--record") == 0) {
+        if (!StartTraceRecording(argv[2])) {
+            return 1;
+        }
+    }
+
+    // Gaps between and around tiled windows
+    for (int i = 1; i + 2 < argc; ++i) {
+        if (std::strcmp(argv[i], "--gaps") == 0) {
+            g_InnerGap = (std::max)(0, std::atoi(argv[i + 1]));
+            g_OuterGap = (std::max)(0, std::atoi(argv[i + 2]));
+            std::cout << "Main: Using inner gap " << g_InnerGap << ", outer gap " << g_OuterGap << ".\n";
+        }
+    }
+
+    // Where new windows go and how the tree divides the screen
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "--layout-policy") == 0) {
+            if (!ParseLayoutPolicy(argv[i + 1], g_LayoutPolicy)) {
+                std::cerr << "Main: Unknown layout policy \"" << argv[i + 1] << "\".\n";
+                StopTraceRecording();
+                return 1;
+            }
+            std::cout << "Main: Using layout policy " << argv[i + 1] << ".\n";
+        }
+    }
+
+    // Built-in status bar fed by a status command speaking the i3bar protocol
+    const char* barCommand = nullptr;
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "--bar") == 0) {
+            barCommand = argv[i + 1];
+            g_BarEnabled = true;
+        }
     }
-}
 
-int main() {
     // Ensure the program is DPI Aware using SetProcessDPIAware
     BOOL dpiResult = SetProcessDPIAware();
     if (!dpiResult) {
@@ -1248,37 +9343,57 @@ int main() {
         std::cout << "DPI awareness set successfully.\n";
     }
 
+    TraceScreen(GetScreenRect());
+
     // Enumerate all visible windows
     std::cout << "Main: Enumerating windows...\n";
     EnumWindows(EnumWindowsCallback, reinterpret_cast<LPARAM>(&managedWindows));
 
     if (managedWindows.empty()) {
         std::cerr << "Main: No windows to manage.\n";
+        StopTraceRecording();
         return 1;
     }
 
     // Get screen dimensions
-    HDC hdcScreen = GetDC(nullptr);
-    RECT screenRect;
-    screenRect.left = 0;
-    screenRect.top = 0;
-    screenRect.right = GetDeviceCaps(hdcScreen, HORZRES);
-    screenRect.bottom = GetDeviceCaps(hdcScreen, VERTRES);
-    ReleaseDC(nullptr, hdcScreen);
+    RECT screenRect = GetScreenRect();
 
     std::cout << "Main: Screen dimensions: Width=" << screenRect.right
               << ", Height=" << screenRect.bottom << "\n";
 
-    // Initialize the layout with the first window
-    InitializeLayout(managedWindows[0].hwnd);
+    // A saved layout's placeholders are filled by the enumerated windows that match them,
+    // then by new windows as they appear
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "--layout") == 0) {
+            LoadLayoutFile(argv[i + 1]);
+        }
+    }
 
-    // Add remaining windows to the layout
-    for (size_t i = 1; i < managedWindows.size(); ++i) {
-        AddWindowBreadthFirst(managedWindows[i].hwnd);
+    // The bar is created after enumeration so it is never managed itself, and before the
+    // first layout so its space is reserved from the start
+    if (g_BarEnabled) {
+        if (CreateBarWindow(screenRect)) {
+            StartStatusCommand(barCommand);
+        } else {
+            g_BarEnabled = false;
+        }
     }
 
-    // Apply the tiling layout and store window positions
-    TileWindows(screenRect);
+    // Readers of the shared state see the initial layout as soon as it is built
+    StartSharedState();
+
+    // Prometheus endpoint for the runtime metrics
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "--metrics") == 0) {
+            StartMetricsEndpoint(std::atoi(argv[i + 1]));
+        }
+    }
+
+    // Calls that a hung window could block are made off the layout thread from the first
+    // layout on
+    StartGeometryPool();
+
+    BuildInitialLayout(screenRect);
 
     // Register hotkeys for switching, moving, and other functionalities
     if (!RegisterHotKeys()) {
@@ -1301,6 +9416,9 @@ int main() {
     std::cout << "      Press Arrow Key alone to grow the window.\n";
     std::cout << "    Press ESC or MOD + R to exit resize mode.\n";
     std::cout << "  MOD + SHIFT + Q: Close the focused window.\n";
+    std::cout << "  MOD + Z / MOD + SHIFT + Z: Undo / redo the last layout change.\n";
+    std::cout << "  MOD + SHIFT + Space: Toggle floating for the focused window.\n";
+    std::cout << "  MOD + D: Switch to a window by typing part of its title, class or mark.\n";
 
     // Register WinEvent hooks for window show and destruction
     HWINEVENTHOOK hEventHookShow = SetWinEventHook(
@@ -1323,193 +9441,107 @@ int main() {
         WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS
     );
 
-    if (!hEventHookShow || !hEventHookDestroy) {
+    // Keeps cached window titles up to date
+    HWINEVENTHOOK hEventHookNameChange = SetWinEventHook(
+        EVENT_OBJECT_NAMECHANGE,
+        EVENT_OBJECT_NAMECHANGE,
+        nullptr,
+        WinEventProc,
+        0,
+        0,
+        WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS
+    );
+
+    // Drives the focus model
+    HWINEVENTHOOK hEventHookForeground = SetWinEventHook(
+        EVENT_SYSTEM_FOREGROUND,
+        EVENT_SYSTEM_FOREGROUND,
+        nullptr,
+        WinEventProc,
+        0,
+        0,
+        WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS
+    );
+
+    // Tell the applied-state cache about tiled windows the user dragged or minimized
+    HWINEVENTHOOK hEventHookMoveSize = SetWinEventHook(
+        EVENT_SYSTEM_MOVESIZEEND,
+        EVENT_SYSTEM_MOVESIZEEND,
+        nullptr,
+        WinEventProc,
+        0,
+        0,
+        WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS
+    );
+
+    HWINEVENTHOOK hEventHookMinimize = SetWinEventHook(
+        EVENT_SYSTEM_MINIMIZESTART,
+        EVENT_SYSTEM_MINIMIZESTART,
+        nullptr,
+        WinEventProc,
+        0,
+        0,
+        WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS
+    );
+
+    // Notice tiled windows moved, resized, maximized or restyled by anything else
+    HWINEVENTHOOK hEventHookLocation = SetWinEventHook(
+        EVENT_OBJECT_STATECHANGE,
+        EVENT_OBJECT_LOCATIONCHANGE,
+        nullptr,
+        WinEventProc,
+        0,
+        0,
+        WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS
+    );
+
+    if (!hEventHookShow || !hEventHookDestroy || !hEventHookNameChange || !hEventHookForeground ||
+        !hEventHookMoveSize || !hEventHookMinimize || !hEventHookLocation) {
         std::cerr << "Main: Failed to set WinEvent hooks. Error: " << GetLastError() << "\n";
     } else {
-        std::cout << "Main: WinEvent hooks for show and destruction set successfully.\n";
+        std::cout << "Main: WinEvent hooks for show, destruction, name change, foreground, move/size, minimize and location set successfully.\n";
     }
 
-    // Message loop to handle hotkey and window events
-    MSG msg = { 0 };
-    while (GetMessage(&msg, nullptr, 0, 0)) {
-        if (msg.message == WM_HOTKEY) {
-            // Check if any window is in fullscreen mode
-            if (IsAnyWindowFullscreen()) {
-                if (msg.wParam == 3) { // Hotkey ID 3 corresponds to MOD + F
-                    std::cout << "Hotkey 3: MOD + F pressed. Toggling fullscreen.\n";
-                    HWND current = GetForegroundWindow();
-                    LayoutNode* currentNode = FindLayoutNode(root.get(), current);
-                    if (currentNode && currentNode->windowInfo.hwnd != nullptr) {
-                        // Get monitor information for fullscreen
-                        HMONITOR hMonitor = MonitorFromWindow(currentNode->windowInfo.hwnd, MONITOR_DEFAULTTONEAREST);
-                        MONITORINFO monitorInfo = { sizeof(monitorInfo) };
-                        if (!GetMonitorInfo(hMonitor, &monitorInfo)) {
-                            std::cerr << "Hotkey 3: Failed to get monitor info. Error: " << GetLastError() << "\n";
-                            break;
-                        }
-
-                        // Toggle fullscreen
-                        SetWindowFullscreen(currentNode, monitorInfo.rcMonitor);
-                    }
-                    else {
-                        std::cerr << "Hotkey 3: Current window not managed.\n";
-                    }
-                }
-                else {
-                    // All other hotkeys are ignored while in fullscreen
-                    std::cout << "Hotkeys are disabled while a window is fullscreen. Only MOD + F is active.\n";
-                }
-            }
-            else {
-                // No window is in fullscreen; process hotkeys normally
-                switch (msg.wParam) {
-                    case 1: { // MOD + LEFT
-                        std::cout << "Hotkey 1: MOD + LEFT pressed. Focusing left window.\n";
-                        Navigate(Direction::LEFT);
-                        break;
-                    }
-                    case 2: { // MOD + RIGHT
-                        std::cout << "Hotkey 2: MOD + RIGHT pressed. Focusing right window.\n";
-                        Navigate(Direction::RIGHT);
-                        break;
-                    }
-                    case 3: { // MOD + F (Toggle Fullscreen)
-                        std::cout << "Hotkey 3: MOD + F pressed. Toggling fullscreen.\n";
-                        HWND current = GetForegroundWindow();
-                        LayoutNode* currentNode = FindLayoutNode(root.get(), current);
-                        if (currentNode && currentNode->windowInfo.hwnd != nullptr) {
-                            // Get monitor information for fullscreen
-                            HMONITOR hMonitor = MonitorFromWindow(currentNode->windowInfo.hwnd, MONITOR_DEFAULTTONEAREST);
-                            MONITORINFO monitorInfo = { sizeof(monitorInfo) };
-                            if (!GetMonitorInfo(hMonitor, &monitorInfo)) {
-                                std::cerr << "Hotkey 3: Failed to get monitor info. Error: " << GetLastError() << "\n";
-                                break;
-                            }
-
-                            // Toggle fullscreen
-                            SetWindowFullscreen(currentNode, monitorInfo.rcMonitor);
-                        }
-                        else {
-                            std::cerr << "Hotkey 3: Current window not managed.\n";
-                        }
-                        break;
-                    }
-                    case 6: { // MOD + UP
-                        std::cout << "Hotkey 6: MOD + UP pressed. Focusing up window.\n";
-                        Navigate(Direction::UP);
-                        break;
-                    }
-                    case 7: { // MOD + DOWN
-                        std::cout << "Hotkey 7: MOD + DOWN pressed. Focusing down window.\n";
-                        Navigate(Direction::DOWN);
-                        break;
-                    }
-                    case 10: { // MOD + R (Toggle Resize Mode)
-                        std::cout << "Hotkey 10: MOD + R pressed. Toggling resize mode.\n";
-                        isResizeMode = !isResizeMode;
-                        if (isResizeMode) {
-                            // Get the currently focused window
-                            HWND current = GetForegroundWindow();
-                            activeNodeForResize = FindLayoutNode(root.get(), current);
-                            if (!activeNodeForResize) {
-                                std::cerr << "Hotkey 10: Current window not managed.\n";
-                                isResizeMode = false;
-                                break;
-                            }
+    // Commands from --msg and other clients
+    StartCommandPipe();
 
-                            // Install the keyboard hook
-                            hKeyboardHook = SetWindowsHookEx(WH_KEYBOARD_LL, LowLevelKeyboardProc, nullptr, 0);
-                            if (!hKeyboardHook) {
-                                std::cerr << "Hotkey 10: Failed to install keyboard hook. Error: " << GetLastError() << "\n";
-                                isResizeMode = false;
-                                break;
-                            }
+    // Start with focus on the current foreground window
+    PostLayoutMessage(WM_LAYOUT_WINEVENT, EVENT_SYSTEM_FOREGROUND, reinterpret_cast<LPARAM>(GetForegroundWindow()));
 
-                            std::cout << "Hotkey 10: Entered resize mode. Use arrow keys to resize.\n";
-                            std::cout << "  Press SHIFT + Arrow Key to shrink the window.\n";
-                            std::cout << "  Press Arrow Key alone to grow the window.\n";
-                            std::cout << "  Press ESC or MOD + R to exit resize mode.\n";
-                        }
-                        else {
-                            // Uninstall the keyboard hook
-                            if (hKeyboardHook) {
-                                UnhookWindowsHookEx(hKeyboardHook);
-                                hKeyboardHook = NULL;
-                            }
-                            std::cout << "Hotkey 10: Exited resize mode.\n";
-                        }
-                        break;
-                    }
-                    case 11: { // MOD + SHIFT + UP (Move Up)
-                        std::cout << "Hotkey 11: MOD + SHIFT + UP pressed. Moving window up.\n";
-                        if (MoveWindowInDirection(Direction::UP)) {
-                            std::cout << "Hotkey 11: Moved window up successfully.\n";
-                        }
-                        break;
-                    }
-                    case 12: { // MOD + SHIFT + DOWN (Move Down)
-                        std::cout << "Hotkey 12: MOD + SHIFT + DOWN pressed. Moving window down.\n";
-                        if (MoveWindowInDirection(Direction::DOWN)) {
-                            std::cout << "Hotkey 12: Moved window down successfully.\n";
-                        }
-                        break;
-                    }
-                    case 13: { // MOD + SHIFT + LEFT (Move Left)
-                        std::cout << "Hotkey 13: MOD + SHIFT + LEFT pressed. Moving window left.\n";
-                        if (MoveWindowInDirection(Direction::LEFT)) {
-                            std::cout << "Hotkey 13: Moved window left successfully.\n";
-                        }
-                        break;
-                    }
-                    case 14: { // MOD + SHIFT + RIGHT (Move Right)
-                        std::cout << "Hotkey 14: MOD + SHIFT + RIGHT pressed. Moving window right.\n";
-                        if (MoveWindowInDirection(Direction::RIGHT)) {
-                            std::cout << "Hotkey 14: Moved window right successfully.\n";
-                        }
-                        break;
-                    }
-                    case 15: { // MOD + SHIFT + Q (Close Focused Window)
-                        std::cout << "Hotkey 15: MOD + SHIFT + Q pressed. Closing Focused Window.\n";
-                        HWND current = GetForegroundWindow();
-                        CloseFocusedWindow(current);
-                        break;
-                    }
-                    case 16: { // MOD + V (Toggle to Vertical Split)
-                        std::cout << "Hotkey 16: MOD + V pressed. Changing split to Vertical.\n";
-                        ChangeSplitOrientation(SplitType::VERTICAL);
-                        break;
-                    }
-                    case 17: { // MOD + H (Toggle to Horizontal Split)
-                        std::cout << "Hotkey 17: MOD + H pressed. Changing split to Horizontal.\n";
-                        ChangeSplitOrientation(SplitType::HORIZONTAL);
-                        break;
-                    }
-                    case 18: { // MOD + Return (Open New Terminal Window)
-                        std::cout << "Hotkey 18: MOD + Return pressed. Opening new terminal window.\n";
-                        OpenTerminal();
-                        break;
-                    }
-                    default:
-                        std::cerr << "Main: Unknown hotkey ID received: " << msg.wParam << "\n";
-                        break;
-                }
+    // Message loop to handle hotkey and window events. Waits only while both lanes are empty;
+    // after WM_QUIT, what is already in the lanes is still handled.
+    bool quitting = false;
+    auto poll = [&]() { if (!quitting) quitting = !DrainThreadQueue(); };
+    MSG msg = { 0 };
+    while (!quitting || !g_LayoutLanes.input.empty() || !g_LayoutLanes.background.empty()) {
+        if (!quitting && g_LayoutLanes.input.empty() && g_LayoutLanes.background.empty()) {
+            if (GetMessage(&msg, nullptr, 0, 0) <= 0) {
+                quitting = true;
+                continue;
+            }
+            if (!QueueLayoutMessage(msg)) {
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
             }
         }
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
+        poll();
+        RunLayoutLanes(poll);
     }
 
     // Ensure the keyboard hook is removed before exiting
-    if (hKeyboardHook) {
-        UnhookWindowsHookEx(hKeyboardHook);
-        hKeyboardHook = NULL;
-    }
+    RemoveResizeKeyboardHook();
+
+    StopStatusCommand();
 
     // Unregister all hotkeys before exiting
     UnregisterHotKeys();
 
     // Unhook WinEvent hooks
-    UnregisterWinEventHooks(hEventHookShow, hEventHookDestroy, nullptr);
+    UnregisterWinEventHooks(hEventHookShow, hEventHookDestroy, hEventHookNameChange, hEventHookForeground,
+                            hEventHookMoveSize, hEventHookMinimize, hEventHookLocation);
+
+    StopTraceRecording();
+    StopSharedState();
 
     std::cout << "Main: Application exiting.\n";
     return 0;